@@ -27,6 +27,31 @@ MSS=256
 MIP=512
 MTU=500
 
+# fifos that carry their data through shared memory rings instead,
+# e.g. "ether2mux mux2ip ip2ipmux ipmux2tcp tcp2ipmux ipmux2ip ip2mux mux2ether"
+# or "all".  Leave empty to use plain fifos everywhere.
+RINGS=""
+
+# 1 to have TCP and UDP compute their checksums once per segment, when it
+# leaves the module, instead of on every header field change
+DEFER_CHECKSUMS=0
+
+# TCP congestion control for new connections: reno, newreno or cubic
+TCP_CC=newreno
+
+# milliseconds an ACK for in-order data may wait for more data or a reply
+# to ride on, 0 to ACK every segment at once
+DELAYED_ACK=40
+
+# 1 to have ip_module_routing forward packets for other hosts
+IP_FORWARD=0
+
+# directory where each module keeps its ring of recent trace records,
+# as <module>.trace (sort -n puts it in order).  Empty keeps it in
+# memory.  Which records are made is set when Minet is compiled; see
+# src/libminet/log.h.
+LOG_DIR="."
+
 
 DEBUG_LEVEL=10
 DISPLAY=xterm
@@ -90,6 +115,12 @@ write_cfg MINET_MONITORTYPE=\"${MONITOR_TYPE}\"
 write_cfg MINET_MSS=${MSS}
 write_cfg MINET_MIP=${MIP}
 write_cfg MINET_MTU=${MTU}
+write_cfg MINET_RINGS=\"${RINGS}\"
+write_cfg MINET_DEFER_CHECKSUMS=${DEFER_CHECKSUMS}
+write_cfg MINET_CC=\"${TCP_CC}\"
+write_cfg MINET_DELAYED_ACK=${DELAYED_ACK}
+write_cfg MINET_IP_FORWARD=${IP_FORWARD}
+write_cfg MINET_LOG_DIR=\"${LOG_DIR}\"
 
 
 echo "Configuration Written to \"${CFG_FILE}\":"
@@ -22,10 +22,33 @@ void usage()
   cerr<<"arp_module myipadx myethernetadx\n";
 }
 
+// A request for target, sent straight to the address we have for it
+// if we have one, the way a neighbor's reachability is checked, and
+// broadcast otherwise
+void SendRequest(const MinetHandle &mux, const ARPCache &cache, const IPAddress &ipaddr,
+		 const EthernetAddr &ethernetaddr, const IPAddress &target)
+{
+  const EthernetAddr *known=cache.Find(target);
+  ARPPacket request(ARPPacket::Request,
+		    ethernetaddr,
+		    ipaddr,
+		    ETHERNET_BLANK_ADDR,
+		    target);
+  EthernetHeader h;
+  h.SetSrcAddr(ethernetaddr);
+  h.SetDestAddr(known ? *known : ETHERNET_BROADCAST_ADDR);
+  h.SetProtocolType(PROTO_ARP);
+  request.PushHeader(h);
+
+  RawEthernetPacket rawout(request);
+  MinetSend(mux,rawout);
+}
+
 
 int main(int argc, char *argv[])
 {
   ARPCache cache;
+  bool subscribed=false;
 
   IPAddress ipaddr(MyIPAddr);
   EthernetAddr ethernetaddr(MyEthernetAddr);
@@ -46,7 +69,8 @@ int main(int argc, char *argv[])
   }
 
 
-  cache.Update(ARPRequestResponse(ipaddr,ethernetaddr,ARPRequestResponse::RESPONSE_OK));
+  cache.Update(ARPRequestResponse(ipaddr,ethernetaddr,ARPRequestResponse::RESPONSE_OK),
+	       (double)Time(),true);
 
 
 
@@ -57,32 +81,38 @@ int main(int argc, char *argv[])
 
   MinetEvent event;
 
-  while (MinetGetNextEvent(event)==0) {
-    if (event.eventtype!=MinetEvent::Dataflow
+  while (MinetGetNextEvent(event,cache.TimeUntilNext((double)Time()))==0) {
+    if (event.eventtype==MinetEvent::Timeout) {
+      // a request is due for a retry or an entry is aging
+    } else if (event.eventtype!=MinetEvent::Dataflow
 	|| event.direction!=MinetEvent::IN) {
       MinetSendToMonitor(MinetMonitoringEvent("Unknown event ignored."));
     } else {
       if (event.handle==ip) {
 	ARPRequestResponse r;
 	MinetReceive(ip,r);
-	cerr << "Local Request:  "<<r<<"\n";
-	cache.Lookup(r);
-	cerr << "Local Response: "<<r<<"\n";
-	MinetSend(ip,r);
-	if (r.flag==ARPRequestResponse::RESPONSE_UNKNOWN) {
-	  ARPPacket request(ARPPacket::Request,
-			    ethernetaddr,
-			    ipaddr,
-			    ETHERNET_BLANK_ADDR,
-			    r.ipaddr);
-	  EthernetHeader h;
-	  h.SetSrcAddr(ethernetaddr);
-	  h.SetDestAddr(ETHERNET_BROADCAST_ADDR);
-	  h.SetProtocolType(PROTO_ARP);
-	  request.PushHeader(h);
-
-	  RawEthernetPacket rawout(request);
-	  MinetSend(mux,rawout);
+	if (r.flag==ARPRequestResponse::SUBSCRIBE) {
+	  // from now on ip_module hears about everything we learn, starting
+	  // with what we already know.  It resolves from its copy, so we
+	  // never see an entry used and have to check before dropping one.
+	  MINET_LOG(ARP, INFO, "Local Subscribe");
+	  subscribed=true;
+	  cache.SetProbeStale(true);
+	  for (ARPCache::const_iterator i=cache.begin(); i!=cache.end(); ++i) {
+	    if ((*i).second.IsUsable()) {
+	      MinetSend(ip,(*i).second.mapping);
+	    }
+	  }
+	} else {
+	  MINET_LOG(ARP, DEBUG, "Local Request:  "<<r);
+	  // only asks the network if nothing is being asked for this
+	  // address already and it has not just failed to answer
+	  bool ask=cache.Resolve(r,(double)Time());
+	  MINET_LOG(ARP, DEBUG, "Local Response: "<<r);
+	  MinetSend(ip,r);
+	  if (ask) {
+	    SendRequest(mux,cache,ipaddr,ethernetaddr,r.ipaddr);
+	  }
 	}
       }
       if (event.handle==mux) {
@@ -98,7 +128,12 @@ int main(int argc, char *argv[])
 	  arp.GetSenderEthernetAddr(sourcehw);
 
 	  ARPRequestResponse r(sourceip,sourcehw,ARPRequestResponse::RESPONSE_OK);
-	  cache.Update(r);
+	  const EthernetAddr *known=cache.Find(sourceip);
+	  bool changed = known==0 || *known!=sourcehw;
+	  cache.Update(r,(double)Time());
+	  if (subscribed && changed) {
+	    MinetSend(ip,r);
+	  }
 
 	  //cerr << cache << "\n";
 
@@ -122,13 +157,25 @@ int main(int argc, char *argv[])
 
 	      RawEthernetPacket rawout(repl);
 	      MinetSend(mux,rawout);
-	      cerr << "Remote Request:  " << arp <<"\n";
-	      cerr << "Remote Response: " << repl <<"\n";
+	      MINET_LOG(ARP, DEBUG, "Remote Request:  " << arp);
+	      MINET_LOG(ARP, DEBUG, "Remote Response: " << repl);
 	    }
 	  }
 	}
       }
     }
+
+    std::vector<IPAddress> retry, gone;
+    cache.Expire((double)Time(),retry,gone);
+    for (unsigned i=0;i<retry.size();i++) {
+      SendRequest(mux,cache,ipaddr,ethernetaddr,retry[i]);
+    }
+    if (subscribed) {
+      // let ip_module forget addresses we no longer vouch for
+      for (unsigned i=0;i<gone.size();i++) {
+	MinetSend(ip,ARPRequestResponse(gone[i],ETHERNET_BLANK_ADDR,ARPRequestResponse::RESPONSE_UNKNOWN));
+      }
+    }
   }
 }
 
@@ -14,10 +14,6 @@
 
 #include "Minet.h"
 
-#define DEBUG_SEND 0
-#define DEBUG_RECV 0
-#define DEBUG_ARP  0
-
 using std::cerr;
 using std::endl;
 
@@ -86,30 +82,24 @@ int main(int argc, char * argv[])
       if (event.handle==arp) {
 	RawEthernetPacket p;
 	MinetReceive(arp,p);
-#if DEBUG_ARP
-	cerr << "Writing out ARP Packet: " << p << endl;
-#endif
+	MINET_LOG(ETHERMUX, DEBUG, "Writing out ARP Packet: " << p);
 	MinetSend(dd,p);
       }
       if (event.handle==ip) {
 	RawEthernetPacket p;
 	MinetReceive(ip,p);
 
-#if DEBUG_SEND
-	cerr << "ABOUT TO SEND OUT: " << endl;
-	Packet check(p);
-	check.ExtractHeaderFromPayload<EthernetHeader>(ETHERNET_HEADER_LEN);
-	check.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(check));
-	check.ExtractHeaderFromPayload<ICMPHeader>(ICMP_HEADER_LENGTH);
-	EthernetHeader eh = check.FindHeader(Headers::EthernetHeader);
-	IPHeader iph = check.FindHeader(Headers::IPHeader);
-	ICMPHeader icmph = check.FindHeader(Headers::ICMPHeader);
-
-	eh.Print(cerr);  cerr << endl;
-	iph.Print(cerr); cerr << endl;
-	icmph.Print(cerr);  cerr << endl;
-	cerr << "END OF PACKET" << endl << endl;
-#endif
+	if (MINET_LOG_ENABLED(ETHERMUX, TRACE)) {
+	  Packet check(p);
+	  check.ExtractHeaderFromPayload<EthernetHeader>(ETHERNET_HEADER_LEN);
+	  check.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(check));
+	  check.ExtractHeaderFromPayload<ICMPHeader>(ICMP_HEADER_LENGTH);
+	  EthernetHeader eh = check.FindHeader(Headers::EthernetHeader);
+	  IPHeader iph = check.FindHeader(Headers::IPHeader);
+	  ICMPHeader icmph = check.FindHeader(Headers::ICMPHeader);
+
+	  MINET_LOG(ETHERMUX, TRACE, "ABOUT TO SEND OUT: " << eh << " " << iph << " " << icmph);
+	}
 
 	MinetSend(dd,p);
       }
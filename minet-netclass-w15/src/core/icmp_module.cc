@@ -15,9 +15,6 @@
 
 #include "Minet.h"
 
-#define DEBUG_SEND 0
-#define DEBUG_RECV 0
-
 using std::cout;
 using std::cerr;
 using std::endl;
@@ -73,10 +70,7 @@ int main(int argc, char *argv[])
 	p.ExtractHeaderFromPayload<ICMPHeader>(ICMP_HEADER_LENGTH);
 
 	// received packet information
-#if DEBUG_RECV
-	cerr << "Received ICMP/Packet: " << endl;
-	DebugDump(p);
-#endif
+	MINET_LOG(ICMP, TRACE, "Received ICMP/Packet: " << p);
 
 	// respond to packet
 	ICMPPacket response;
@@ -84,10 +78,7 @@ int main(int argc, char *argv[])
 
 	if (response.requires_reply())
 	  {
-#if DEBUG_RECV
-	    cerr << "Sent Packet: " << endl;
-	    DebugDump(response);  cerr << endl;
-#endif
+	    MINET_LOG(ICMP, TRACE, "Sent Packet: " << response);
 	    MinetSend(ipmux, response);
 	  }
 	else
@@ -114,9 +105,7 @@ int main(int argc, char *argv[])
 				      data.GetSize(),
 				      EOK);
 
-#if DEBUG_RECV
-	    cerr << "Forwarding ICMP Packet to Sock" << endl;
-#endif
+	    MINET_LOG(ICMP, DEBUG, "Forwarding ICMP Packet to Sock");
 	    // not sure why this is happening -PAD
 	    MinetSend(sock,write);
 	  }
@@ -135,6 +124,7 @@ int main(int argc, char *argv[])
 	    SockRequestResponse repl;
 	    // repl.type=SockRequestResponse::STATUS;
 	    repl.type=STATUS;
+	    repl.id=req.id;
 	    repl.connection=req.connection;
 	    // buffer is zero bytes
 	    repl.bytes=0;
@@ -176,6 +166,7 @@ int main(int argc, char *argv[])
 	      SockRequestResponse repl;
 	      // repl.type=SockRequestResponse::STATUS;
 	      repl.type=STATUS;
+	      repl.id=req.id;
 	      repl.connection=req.connection;
 	      repl.bytes=bytes;
 	      repl.error=EOK;
@@ -185,7 +176,7 @@ int main(int argc, char *argv[])
 	  break;
 	case FORWARD:
 	  {
-	    cout << "forward" << endl;
+	    MINET_LOG(ICMP, DEBUG, "forward");
 	    ConnectionToStateMapping<ICMPState> m;
 	    m.connection=req.connection;
 	    // remove any old forward that might be there.
@@ -196,6 +187,7 @@ int main(int argc, char *argv[])
 	    clist.push_back(m);
 	    SockRequestResponse repl;
 	    repl.type=STATUS;
+	    repl.id=req.id;
 	    repl.connection=req.connection;
 	    repl.error=EOK;
 	    repl.bytes=0;
@@ -204,11 +196,12 @@ int main(int argc, char *argv[])
 	  break;
 	case CLOSE:
 	  {
-	    cout << "close" << endl;
+	    MINET_LOG(ICMP, DEBUG, "close");
 	    ConnectionList<ICMPState>::iterator cs = clist.FindMatching(req.connection);
 	    SockRequestResponse repl;
 	    repl.connection=req.connection;
 	    repl.type=STATUS;
+	    repl.id=req.id;
 	    if (cs==clist.end()) {
 	      repl.error=ENOMATCH;
 	    } else {
@@ -220,9 +213,10 @@ int main(int argc, char *argv[])
 	  break;
 	default:
 	  {
-	    cout << "default" << endl;
+	    MINET_LOG(ICMP, DEBUG, "default");
 	    SockRequestResponse repl;
 	    repl.type=STATUS;
+	    repl.id=req.id;
 	    repl.error=EWHAT;
 	    MinetSend(sock,repl);
 	  }
@@ -15,13 +15,45 @@
 
 #include "Minet.h"
 
-#define DEBUG_SEND 1
-#define DEBUG_RECV 1
-
 using std::cout;
 using std::cerr;
 using std::endl;
 
+// Our copy of arp_module's cache, kept current by the updates it pushes
+// once we subscribe, so resolving a next hop costs no IPC.  Packets to
+// addresses that are not in it yet wait in pending until the answer
+// arrives.
+ARPCache neighbors;
+ARPPendingQueues pending;
+// Datagrams that have come in fragments, until they are whole
+IPReassembler fragments;
+
+void Transmit(MinetHandle &ethermux, Packet &p, const EthernetAddr &dest)
+{
+  // set src and dest addrs in header
+  // set protocol ip
+
+  EthernetHeader h;
+  h.SetSrcAddr(MyEthernetAddr);
+  h.SetDestAddr(dest);
+  h.SetProtocolType(PROTO_IP);
+  p.PushHeader(h);
+
+  RawEthernetPacket e(p);
+
+  MINET_LOG(IP, TRACE, "ABOUT TO SEND OUT: " << h << " " << IPHeader(p.FindHeader(Headers::IPHeader)));
+
+  MinetSend(ethermux,e);
+}
+
+void RequestAddress(MinetHandle &arp, const IPAddress &ipaddr)
+{
+  ARPRequestResponse req(ipaddr,
+			 EthernetAddr(ETHERNET_BLANK_ADDR),
+			 ARPRequestResponse::REQUEST);
+  MinetSend(arp,req);
+}
+
 int SendPacket(MinetHandle &ethermux, MinetHandle &arp, Packet &p)
 {
 
@@ -31,53 +63,110 @@ int SendPacket(MinetHandle &ethermux, MinetHandle &arp, Packet &p)
 
   iph.GetDestIP(ipaddr);
 
-  ARPRequestResponse req(ipaddr,
-			 EthernetAddr(ETHERNET_BLANK_ADDR),
-			 ARPRequestResponse::REQUEST);
+  if (ipaddr == "255.255.255.255") {
+    Transmit(ethermux,p,ETHERNET_BROADCAST_ADDR);
+    return 0;
+  }
+
+  const EthernetAddr *hw=neighbors.Find(ipaddr);
+
+  if (hw!=0) {
+    Transmit(ethermux,p,*hw);
+    return 0;
+  }
+
+  // only the first packet to an address asks for it; the rest wait with it
+  if (pending.Enqueue(ipaddr,p,(double)Time())) {
+    RequestAddress(arp,ipaddr);
+  }
+  return 1;
+}
+
+// An answer or an update from arp_module
+void HandleARP(MinetHandle &ethermux, MinetHandle &arp)
+{
   ARPRequestResponse resp;
 
-  MinetSend(arp,req);
   MinetReceive(arp,resp);
 
   if (resp.ethernetaddr!=ETHERNET_BLANK_ADDR) {
     resp.flag=ARPRequestResponse::RESPONSE_OK;
   }
 
-  if ((resp.flag==ARPRequestResponse::RESPONSE_OK) ||
-      (ipaddr == "255.255.255.255")) {
-    // set src and dest addrs in header
-    // set protocol ip
-
-    EthernetHeader h;
-    h.SetSrcAddr(MyEthernetAddr);
-    h.SetDestAddr(resp.ethernetaddr);
-    h.SetProtocolType(PROTO_IP);
-    p.PushHeader(h);
-
-    RawEthernetPacket e(p);
-
-#if DEBUG_SEND
-    cout << "ABOUT TO SEND OUT: " << endl;
-    Packet check(e);
-    check.ExtractHeaderFromPayload<EthernetHeader>(ETHERNET_HEADER_LEN);
-    check.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(check));
-    EthernetHeader eh = check.FindHeader(Headers::EthernetHeader);
-    IPHeader iph = check.FindHeader(Headers::IPHeader);
-
-    eh.Print(cerr);  cerr << endl;
-    iph.Print(cerr); cerr << endl;
-    cout << "END OF PACKET" << endl << endl;
-#endif
-
-    MinetSend(ethermux,e);
-    return 0;
+  // RESPONSE_UNKNOWN means arp_module has gone off to ask (the answer
+  // will come as an update) or has given up on an address; either way
+  // it is not one we can use
+  if (resp.flag!=ARPRequestResponse::RESPONSE_OK) {
+    neighbors.Delete(resp.ipaddr);
   } else {
-    MinetSendToMonitor(MinetMonitoringEvent("Discarding packet because there is no arp entry"));
-    cerr << "Discarded IP packet because there is no arp entry\n";
-    return -1;
+    neighbors.Update(resp);
+
+    std::deque<Packet> waiting;
+    if (pending.Take(resp.ipaddr,waiting)) {
+      for (unsigned i=0;i<waiting.size();i++) {
+	Transmit(ethermux,waiting[i],resp.ethernetaddr);
+      }
+    }
+  }
+}
+
+void ExpirePending(MinetHandle &arp)
+{
+  std::vector<IPAddress> retry, failed;
+
+  pending.Expire((double)Time(),retry,failed);
+
+  for (unsigned i=0;i<retry.size();i++) {
+    RequestAddress(arp,retry[i]);
+  }
+  for (unsigned i=0;i<failed.size();i++) {
+    MinetSendToMonitor(MinetMonitoringEvent("Discarding packets because there is no arp entry"));
+    MINET_LOG(IP, WARNING, "Discarded IP packets to " << failed[i] << " because there is no arp entry");
   }
 }
 
+// Reassembly that timed out is reported to the sender, as RFC 792 asks
+void ExpireFragments(MinetHandle &ethermux, MinetHandle &arp)
+{
+  std::vector<Packet> timedout;
+
+  fragments.Expire((double)Time(),timedout);
+
+  for (unsigned i=0;i<timedout.size();i++) {
+    MinetSendToMonitor(MinetMonitoringEvent("Discarding fragments because reassembly timed out"));
+    IPHeader iph=timedout[i].FindHeader(Headers::IPHeader);
+    IPAddress src;  iph.GetSourceIP(src);
+    ICMPPacket error(src, TIME_EXCEEDED, TTL_EQUALS_ZERO_DURING_REASSEMBLY, timedout[i]);
+    SendPacket(ethermux,arp,error);
+  }
+}
+
+// A packet from the stack is too big for the link and may not be
+// fragmented, so the stack is told as a router would tell it, with the
+// MTU it has to fit (RFC 1191)
+void FragmentationNeeded(MinetHandle &ipmux, const Packet &p, const unsigned short mtu)
+{
+  MinetSendToMonitor(MinetMonitoringEvent("Discarding packet because it is too big and DF is set"));
+
+  Packet sent=FlattenIPPacket(p);
+  IPHeader iph=sent.FindHeader(Headers::IPHeader);
+  IPAddress src;  iph.GetSourceIP(src);
+  ICMPPacket error(src, DESTINATION_UNREACHABLE, FRAGMENTATION_NEEDED, 0, htons(mtu), sent);
+
+  // as it would arrive, with the ICMP header in the payload
+  MinetSend(ipmux,FlattenIPPacket(error));
+}
+
+// Seconds until an ARP request or a reassembly is due, -1 if neither is
+double TimeUntilNext()
+{
+  double now=(double)Time();
+  double arp=pending.TimeUntilNext(now);
+  double frag=fragments.TimeUntilNext(now);
+
+  return arp<0 ? frag : frag<0 ? arp : MIN_MACRO(arp,frag);
+}
+
 int main(int argc, char *argv[])
 {
   MinetHandle ethermux, ipmux, arp;
@@ -104,15 +193,27 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  if (arp!=MINET_NOHANDLE) {
+    ARPRequestResponse sub;
+    sub.flag=ARPRequestResponse::SUBSCRIBE;
+    MinetSend(arp,sub);
+  }
+
   MinetSendToMonitor(MinetMonitoringEvent("ip_module handling IP traffic........"));
 
   MinetEvent event;
 
-  while (MinetGetNextEvent(event)==0) {
-    if (event.eventtype!=MinetEvent::Dataflow
+  while (MinetGetNextEvent(event,TimeUntilNext())==0) {
+    if (event.eventtype==MinetEvent::Timeout) {
+      // an ARP request is due for a retry or has gone unanswered, or a
+      // reassembly has timed out
+    } else if (event.eventtype!=MinetEvent::Dataflow
 	|| event.direction!=MinetEvent::IN) {
       MinetSendToMonitor(MinetMonitoringEvent("Unknown event ignored."));
     } else {
+      if (event.handle==arp) {
+	HandleARP(ethermux,arp);
+      }
       if (event.handle==ethermux) {
 	RawEthernetPacket raw;
 	MinetReceive(ethermux,raw);
@@ -123,10 +224,7 @@ int main(int argc, char *argv[])
 	IPHeader iph;
 	iph=p.FindHeader(Headers::IPHeader);
 
-#if DEBUG_RECV
-	cerr << "Received Packet: " << endl;
-	iph.Print(cerr);  cerr << endl;  p.Print(cerr);  cerr << endl;
-#endif
+	MINET_LOG(IP, TRACE, "Received Packet: " << iph << " " << p);
 
 	IPAddress toip;
 	iph.GetDestIP(toip);
@@ -136,7 +234,7 @@ int main(int argc, char *argv[])
 	    // discard the packet
 	    MinetSendToMonitor(MinetMonitoringEvent				\
 			("Discarding packet because header checksum is wrong."));
-	    cerr << "Discarding following packet because header checksum is wrong: "<<p<<"\n";
+	    MINET_LOG(IP, WARNING, "Discarding following packet because header checksum is wrong: "<<p);
 
 	    IPAddress src;  iph.GetSourceIP(src);
 	    // "2" specifies the octet that is wrong (in this case, the checksum)
@@ -155,7 +253,7 @@ int main(int argc, char *argv[])
 	    // discard the packet
 	    MinetSendToMonitor(MinetMonitoringEvent				\
 			("Discarding packet because TTL is zero."));
-	    cerr << "Discarding following packet because TTL is zero: "<<p<<"\n";
+	    MINET_LOG(IP, WARNING, "Discarding following packet because TTL is zero: "<<p);
 
 	    IPAddress src;  iph.GetSourceIP(src);
 	    ICMPPacket error(src, TIME_EXCEEDED,TTL_EQUALS_ZERO_DURING_TRANSIT, p);
@@ -171,24 +269,16 @@ int main(int argc, char *argv[])
 	  iph.GetFlags(flags);
 	  iph.GetFragOffset(fragoff);
 	  if ((flags&IP_HEADER_FLAG_MOREFRAG) || (fragoff!=0)) {
-	    MinetSendToMonitor(MinetMonitoringEvent				\
-			("Discarding packet because it is a fragment"));
-	    cerr << "Discarding following packet because it is a fragment: "<<p<<"\n";
-
-	    IPAddress src;  iph.GetSourceIP(src);
-	    ICMPPacket error(src, DESTINATION_UNREACHABLE ,FRAGMENTATION_NEEDED, p);
-
-	    MinetSendToMonitor(MinetMonitoringEvent("ICMP error message has been sent to host"));
-
-	    SendPacket(ethermux,arp,error);
-
-	    continue;
+	    // held until the rest of the datagram arrives
+	    Packet whole;
+	    if (!fragments.Add(p,(double)Time(),whole)) {
+	      continue;
+	    }
+	    p=whole;
 	  }
 
 	  // route here - would send icmp dest unreachable if fails
 
-	  // unfragment here
-
 	  MinetSend(ipmux,p);
 	} else {
 	  ; // discarded due to different target address
@@ -201,12 +291,23 @@ int main(int argc, char *argv[])
 
 	// Route Packet Here - would send icmp dest unreachable if fails
 
-	// Fragment Packet Here
-
-	SendPacket(ethermux,arp,p);
+	// a TCP super-segment is cut into MSS-sized frames here, once,
+	// rather than each crossing every module on its own, and anything
+	// else too big for the link is fragmented
+	std::vector<Packet> frames;
+	if (p.GetSegmentSize()) {
+	  SplitTCPSuperSegment(p,frames);
+	} else if (FragmentIPPacket(p,ETHERNET_DATA_MAX,frames)==0) {
+	  FragmentationNeeded(ipmux,p,ETHERNET_DATA_MAX);
+	}
+	for (unsigned i=0;i<frames.size();i++) {
+	  SendPacket(ethermux,arp,frames[i]);
+	}
 
       }
     }
+    ExpirePending(arp);
+    ExpireFragments(ethermux,arp);
   }
   MinetDeinit();
   return 0;
@@ -80,8 +80,7 @@ int main(int argc, char *argv[])
 	IPHeader iph;
 	iph=p.FindHeader(Headers::IPHeader);
 
-	cerr << "Received Packet: " << endl;
-	iph.Print(cerr);  cerr << endl;  p.Print(cerr);  cerr << endl;
+	MINET_LOG(IP, TRACE, "Received Packet: " << iph << " " << p);
 
 #if DIFFUSION_HACK
 	cerr << "IP Diffusion Enabled.  Recovered bits follow..." << endl;
@@ -137,7 +136,7 @@ int main(int argc, char *argv[])
 	    // discard the packet
 	    MinetSendToMonitor(MinetMonitoringEvent				\
 			("Discarding packet because header checksum is wrong."));
-	    cerr << "Discarding following packet because header checksum is wrong: "<<p<<"\n";
+	    MINET_LOG(IP, WARNING, "Discarding following packet because header checksum is wrong: "<<p);
 
 	    IPAddress src;  iph.GetSourceIP(src);
 	    // "2" specifies the octet that is wrong (in this case, the checksum)
@@ -173,8 +172,8 @@ int main(int argc, char *argv[])
 	  if ((flags&IP_HEADER_FLAG_MOREFRAG) || (fragoff!=0)) {
 	    MinetSendToMonitor(MinetMonitoringEvent				\
 			("Discarding packet because it is a fragment"));
-	    cerr << "Discarding following packet because it is a fragment: "<<p<<"\n";
-	    cerr << "NOTE: NO ICMP PACKET WAS SENT BACK\n";
+	    MINET_LOG(IP, WARNING, "Discarding following packet because it is a fragment: "<<p
+		      <<" (no ICMP packet was sent back)");
 
 	    continue;
 	  }
@@ -209,8 +208,7 @@ int main(int argc, char *argv[])
 
 	if (response.requires_reply())
 	{
-	  cerr << "Sent Packet: " << endl;
-	  DebugDump(response);  cerr << endl;
+	  MINET_LOG(IP, TRACE, "Sent Packet: " << response);
 	  RawEthernetPacket e(response);
 
 	  MinetSend(ethermux, e);
@@ -244,8 +242,7 @@ int main(int argc, char *argv[])
 
 	if (response.requires_reply())
 	{
-	  cerr << "Sent Packet: " << endl;
-	  DebugDump(response);  cerr << endl;
+	  MINET_LOG(IP, TRACE, "Sent Packet: " << response);
 	  RawEthernetPacket e(response);
 
 	  MinetSend(ethermux, e);
@@ -411,25 +408,13 @@ int main(int argc, char *argv[])
 
 	  RawEthernetPacket e(p);
 
-	  cout << "ABOUT TO SEND OUT: " << endl;
-	  Packet check(e);
-	  check.ExtractHeaderFromPayload<EthernetHeader>(ETHERNET_HEADER_LEN);
-	  check.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(check));
-	  // check.ExtractHeaderFromPayload<ICMPHeader>(ICMP_HEADER_LENGTH);
-	  EthernetHeader eh = check.FindHeader(Headers::EthernetHeader);
-	  IPHeader iph = check.FindHeader(Headers::IPHeader);
-	  // ICMPHeader icmph = check.FindHeader(Headers::ICMPHeader);
-
-	  eh.Print(cerr);  cerr << endl;
-	  iph.Print(cerr); cerr << endl;
-	  // icmph.Print(cerr);  cerr << endl;
-	  cout << "END OF PACKET" << endl << endl;
+	  MINET_LOG(IP, TRACE, "ABOUT TO SEND OUT: " << h << " " << IPHeader(p.FindHeader(Headers::IPHeader)));
 
 
 	  MinetSend(ethermux,e);
 	} else {
 	  MinetSendToMonitor(MinetMonitoringEvent("Discarding packet because there is no arp entry"));
-	  cerr << "Discarded IP packet because there is no arp entry\n";
+	  MINET_LOG(IP, WARNING, "Discarded IP packet because there is no arp entry");
 	}
       }
     }
@@ -19,6 +19,102 @@ using std::cout;
 using std::cerr;
 using std::endl;
 
+// Packets waiting for their next hop to resolve.  What has resolved is
+// in the forwarding table, kept current by the updates arp_module
+// pushes once we subscribe.
+ARPPendingQueues pending;
+// Datagrams that have come in fragments, until they are whole
+IPReassembler fragments;
+
+void Transmit(MinetHandle &ethermux, Packet &p, const EthernetHeader &h)
+{
+  p.PushHeader(h);
+  RawEthernetPacket e(p);
+
+  MINET_LOG(IP, TRACE, "Outgoing RawEthernetPackets from IPMux: EthernetHeader: " << h
+	    << " IPHeader: " << IPHeader(p.FindHeader(Headers::IPHeader)) << " Data: " << p.GetPayload());
+  MinetSend(ethermux,e);
+}
+
+void RequestAddress(MinetHandle &arp, const IPAddress &nexthop)
+{
+  MINET_LOG(IP, DEBUG, "arp request for " << nexthop);
+  ARPRequestResponse req(nexthop,
+			 EthernetAddr(ETHERNET_BLANK_ADDR),
+			 ARPRequestResponse::REQUEST);
+  MinetSend(arp,req);
+}
+
+// Sends p through the adjacency the forwarding table gave for it, or
+// parks it until its next hop resolves
+void Send(MinetHandle &ethermux, MinetHandle &arp, Packet &p, const ForwardResult r,
+	  const Adjacency *adj, const IPAddress &nexthop)
+{
+  if (r==FORWARD_OK) {
+    Transmit(ethermux,p,adj->ethheader);
+  } else if (pending.Enqueue(nexthop,p,(double)Time())) {
+    // only the first packet to a next hop asks for it; the rest wait
+    // with it
+    RequestAddress(arp,nexthop);
+  }
+}
+
+// The IP destination of a frame, read from it where it lies
+IPAddress FrameDestIP(const RawEthernetPacket &raw)
+{
+  unsigned dest;
+
+  memcpy(&dest,raw.data+ETHERNET_HEADER_LEN+16,4);
+  return IPAddress(ntohl(dest));
+}
+
+// A frame passing through goes on as it came, unless its next hop has
+// yet to resolve, in which case it waits as a packet
+void ForwardFrame(MinetHandle &ethermux, MinetHandle &arp, const ForwardingTable &fib,
+		  RawEthernetPacket &raw)
+{
+  IPAddress nexthop;
+
+  switch (fib.Forward(raw,nexthop)) {
+  case FORWARD_OK:
+    MinetSend(ethermux,raw);
+    break;
+  case FORWARD_UNRESOLVED:
+    {
+      Packet p(raw);
+      p.ExtractHeaderFromPayload<EthernetHeader>(ETHERNET_HEADER_LEN);
+      p.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(p));
+      p.PopFrontHeader();
+      IPHeader iph = p.FindHeader(Headers::IPHeader);
+      unsigned char ttl;
+      iph.GetTTL(ttl);
+      iph.SetTTL(ttl-1);
+      p.SetHeader(iph);
+      Send(ethermux,arp,p,FORWARD_UNRESOLVED,0,nexthop);
+    }
+    break;
+  case FORWARD_TTL_EXCEEDED:
+    MinetSendToMonitor(MinetMonitoringEvent("Discarding packet because TTL is zero."));
+    break;
+  case FORWARD_NO_ROUTE:
+    MinetSendToMonitor(MinetMonitoringEvent("Discarding packet because there is no route"));
+    break;
+  default:
+    // malformed, not sent to us, or to a loopback address
+    break;
+  }
+}
+
+// Seconds until an ARP request or a reassembly is due, -1 if neither is
+double TimeUntilNext()
+{
+  double now=(double)Time();
+  double arp=pending.TimeUntilNext(now);
+  double frag=fragments.TimeUntilNext(now);
+
+  return arp<0 ? frag : frag<0 ? arp : MIN_MACRO(arp,frag);
+}
+
 int main(int argc, char *argv[])
 {
   MinetHandle ethermux, ipmux, arp;
@@ -52,11 +148,18 @@ int main(int argc, char *argv[])
   MinetSendToMonitor(MinetMonitoringEvent("ip_module handling IP traffic........"));
   cout << "ip_module handling IP traffic......" << endl;
 
-  // Initializing route table
-  route_table_t *table = (route_table_t *)malloc(sizeof(route_table_t));
-  table = make_route_table();
-  load_routes(table, "route_table.txt");
-  print_route(table);
+  // Initializing forwarding table
+  ForwardingTable fib(MyEthernetAddr);
+  if (fib.Load("route_table.txt")<0) {
+    cout << "route_table.txt cannot be opened" << endl;
+  }
+  cout << fib.GetRoutes() << endl;
+
+  // Frames for other hosts are forwarded only if MINET_IP_FORWARD is
+  // set, as a host must not forward by default (RFC 1122)
+  const char *env=getenv("MINET_IP_FORWARD");
+  // minet.cfg values may arrive with their quotes
+  bool forwarding = env!=0 && atoi(env+strspn(env,"\""))!=0;
 
   // Initializing interface list
   if_list_t *if_list = (if_list_t *)malloc(sizeof(if_list));
@@ -67,29 +170,72 @@ int main(int argc, char *argv[])
   print_if_list(if_list);
 
 
+  if (arp!=MINET_NOHANDLE) {
+    ARPRequestResponse sub;
+    sub.flag=ARPRequestResponse::SUBSCRIBE;
+    MinetSend(arp,sub);
+  }
+
+
   MinetEvent event;
 
-  while (MinetGetNextEvent(event)==0) {
-    if (event.eventtype!=MinetEvent::Dataflow
+  while (MinetGetNextEvent(event,TimeUntilNext())==0) {
+    if (event.eventtype==MinetEvent::Timeout) {
+      // an ARP request is due for a retry or has gone unanswered, or a
+      // reassembly has timed out
+    } else if (event.eventtype!=MinetEvent::Dataflow
 	|| event.direction!=MinetEvent::IN) {
       MinetSendToMonitor(MinetMonitoringEvent("Unknown event ignored."));
     } else {
+      if (event.handle==arp) {
+	ARPRequestResponse resp;
+	MinetReceive(arp,resp);
+
+	if (resp.ethernetaddr!=ETHERNET_BLANK_ADDR) {
+	  resp.flag=ARPRequestResponse::RESPONSE_OK;
+	}
+
+	// RESPONSE_UNKNOWN means arp_module has gone off to ask (the answer
+	// will come as an update) or has given up on an address; either
+	// way it is not one we can use
+	if (resp.flag!=ARPRequestResponse::RESPONSE_OK) {
+	  fib.ClearNeighbor(resp.ipaddr);
+	} else {
+	  fib.SetNeighbor(resp.ipaddr,resp.ethernetaddr);
+
+	  std::deque<Packet> waiting;
+	  if (pending.Take(resp.ipaddr,waiting)) {
+	    EthernetHeader h;
+	    h.SetSrcAddr(MyEthernetAddr);
+	    h.SetDestAddr(resp.ethernetaddr);
+	    h.SetProtocolType(PROTO_IP);
+	    for (unsigned i=0;i<waiting.size();i++) {
+	      Transmit(ethermux,waiting[i],h);
+	    }
+	  }
+	}
+      }
       if (event.handle==ethermux) {
 	RawEthernetPacket raw;
 	MinetReceive(ethermux,raw);
-	Packet p(raw);
-	p.ExtractHeaderFromPayload<EthernetHeader>(ETHERNET_HEADER_LEN);
-	p.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(p));
-	IPHeader iph;
-	iph=p.FindHeader(Headers::IPHeader);
-
-	IPAddress toip;
-	iph.GetDestIP(toip);
-	if (toip==MyIPAddr || toip==IPAddress(IP_ADDRESS_BROADCAST)) {
+
+	IPAddress toip=FrameDestIP(raw);
+	if (toip!=MyIPAddr && toip!=IPAddress(IP_ADDRESS_BROADCAST)) {
+	  if (forwarding) {
+	    ForwardFrame(ethermux,arp,fib,raw);
+	  }
+	  // otherwise discarded due to different target address
+	} else {
+	  Packet p(raw);
+	  p.ExtractHeaderFromPayload<EthernetHeader>(ETHERNET_HEADER_LEN);
+	  p.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(p));
+	  IPHeader iph;
+	  iph=p.FindHeader(Headers::IPHeader);
+
 	  if (!(iph.IsChecksumCorrect())) {
 	    MinetSendToMonitor(MinetMonitoringEvent				\
 			("Discarding packet because header checksum is wrong."));
-	    cerr << "Discarding following packet because header checksum is wrong: "<<p<<"\n";
+	    MINET_LOG(IP, WARNING, "Discarding following packet because header checksum is wrong: "<<p);
 	    continue;
 	  }
 	  unsigned short fragoff;
@@ -97,27 +243,17 @@ int main(int argc, char *argv[])
 	  iph.GetFlags(flags);
 	  iph.GetFragOffset(fragoff);
 	  if ((flags&IP_HEADER_FLAG_MOREFRAG) || (fragoff!=0)) {
-	    MinetSendToMonitor(MinetMonitoringEvent				\
-			("Discarding packet because it is a fragment"));
-	    cerr << "Discarding following packet because it is a fragment: "<<p<<"\n";
-	    cerr << "NOTE: NO ICMP PACKET WAS SENT BACK\n";
-	    continue;
+	    // held until the rest of the datagram arrives
+	    Packet whole;
+	    if (!fragments.Add(p,(double)Time(),whole)) {
+	      continue;
+	    }
+	    p=whole;
+	    iph=p.FindHeader(Headers::IPHeader);
 	  }
-
-          // Printing incoming RawEthernetPackets from Ethermux
-	  Buffer payload = p.GetPayload();
-	  cout << "=============================================================\n";
-          cout << "Incoming RawEthernetPackets from EtherMux: \n";
-          cout << "EthernetHeader: \n";
-          cout << raw << "\n";
-          cout << "IPHeader: \n";
-          cout << iph << "\n";
-          cout << "Data: \n";
-          cout << payload << endl;
-          cout << "=============================================================\n";
+	  MINET_LOG(IP, TRACE, "Incoming RawEthernetPackets from EtherMux: EthernetHeader: " << raw
+		    << " IPHeader: " << iph << " Data: " << p.GetPayload());
 	  MinetSend(ipmux,p);
-	} else {
-	  // discarded due to different target address
 	}
       }
       if (event.handle==ipmux) {
@@ -126,63 +262,58 @@ int main(int argc, char *argv[])
 	IPHeader iph = p.FindHeader(Headers::IPHeader);
 
 	// ROUTE
-	IPAddress ipaddr;
-	route_t   *matched;
+	IPAddress ipaddr, nexthop;
+	const Adjacency *adj=0;
 
 	iph.GetDestIP(ipaddr);
 
-	matched = match_route(table, ipToString(ipaddr));
-	cout << "From routing table. net: " << matched->net << endl;
+	ForwardResult r = ipaddr==MyIPAddr ? FORWARD_LOCAL : fib.Lookup(ipaddr,adj,nexthop);
 
-	if(IPAddress(matched->net) == IP_ADDRESS_LO || ipaddr == MyIPAddr) {
-	  cout << "Packet is bound for local address" << endl;
+	if (r==FORWARD_NO_ROUTE) {
+	  MinetSendToMonitor(MinetMonitoringEvent				\
+			     ("Discarding packet because there is no route"));
+	  MINET_LOG(IP, WARNING, "Discarded IP packet because there is no route to " << ipaddr);
+	}
+	else if (r==FORWARD_LOCAL) {
+	  MINET_LOG(IP, TRACE, "Packet is bound for local address");
 	  MinetSend(ipmux, p);
 	}
 	else {
-	  cout << "arp request for " << ipaddr << endl;
-	  ARPRequestResponse req(ipaddr,
-				 EthernetAddr(ETHERNET_BLANK_ADDR),
-				 ARPRequestResponse::REQUEST);
-	  ARPRequestResponse resp;
-
-	  MinetSend(arp,req);
-	  MinetReceive(arp,resp);
-
-	  if (resp.ethernetaddr!=ETHERNET_BLANK_ADDR) {
-	    resp.flag=ARPRequestResponse::RESPONSE_OK;
+	  // super-segments are split and anything else too big for the
+	  // link is fragmented, as in ip_module
+	  std::vector<Packet> frames;
+	  if (p.GetSegmentSize()) {
+	    SplitTCPSuperSegment(p,frames);
+	  } else if (FragmentIPPacket(p,ETHERNET_DATA_MAX,frames)==0) {
+	    MinetSendToMonitor(MinetMonitoringEvent				\
+			       ("Discarding packet because it is too big and DF is set"));
+	    MINET_LOG(IP, WARNING, "Discarded IP packet to " << ipaddr << " because it is too big and DF is set"
+		      << " (no ICMP packet was sent back)");
 	  }
-
-	  if (resp.flag==ARPRequestResponse::RESPONSE_OK) {
-	    // set src and dest addrs in header
-	    // set protocol ip
-
-	    EthernetHeader h;
-	    h.SetSrcAddr(MyEthernetAddr);
-	    h.SetDestAddr(resp.ethernetaddr);
-	    h.SetProtocolType(PROTO_IP);
-	    p.PushHeader(h);
-	    RawEthernetPacket e(p);
-
-	    // Printing outgoing RawEthernetPackets from IPmux
-	    Buffer payload = p.GetPayload();
-	    cout << "=============================================================\n";
-	    cout << "Outgoing RawEthernetPackets from IPMux: \n";
-	    cout << "EthernetHeader: \n";
-	    cout << h << "\n";
-	    cout << "IPHeader: \n";
-	    cout << iph << "\n";
-	    cout << "Data: \n";
-	    cout << payload << endl;
-	    cout << "=============================================================\n";
-	    MinetSend(ethermux,e);
-	  } else {
-	    MinetSendToMonitor(MinetMonitoringEvent 				\
-			       ("Discarding packet because there is no arp entry"));
-	    cerr << "Discarded IP packet because there is no arp entry\n";
+	  for (unsigned i=0;i<frames.size();i++) {
+	    Send(ethermux,arp,frames[i],r,adj,nexthop);
 	  }
 	}
       }
     }
+
+    std::vector<IPAddress> retry, failed;
+    pending.Expire((double)Time(),retry,failed);
+    for (unsigned i=0;i<retry.size();i++) {
+      RequestAddress(arp,retry[i]);
+    }
+    for (unsigned i=0;i<failed.size();i++) {
+      MinetSendToMonitor(MinetMonitoringEvent 				\
+			 ("Discarding packets because there is no arp entry"));
+      MINET_LOG(IP, WARNING, "Discarded IP packets to " << failed[i] << " because there is no arp entry");
+    }
+    std::vector<Packet> timedout;
+    fragments.Expire((double)Time(),timedout);
+    if (!timedout.empty()) {
+      MinetSendToMonitor(MinetMonitoringEvent 				\
+			 ("Discarding fragments because reassembly timed out"));
+      MINET_LOG(IP, WARNING, "Discarded fragments because reassembly timed out (no ICMP packet was sent back)");
+    }
   }
   MinetDeinit();
   return 0;
@@ -13,9 +13,6 @@
 
 #include "Minet.h"
 
-
-#define DEBUG_ICMP 0
-
 using std::cout;
 using std::cerr;
 using std::endl;
@@ -115,18 +112,15 @@ int main(int argc, char * argv[])
       Packet p;
       MinetReceive(icmp,p);
 
-#if DEBUG_ICMP
-      cout << "ABOUT TO SEND OUT: " << endl;
-      Packet check(p);
-      check.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(check));
-      check.ExtractHeaderFromPayload<ICMPHeader>(ICMP_HEADER_LENGTH);
-      IPHeader iph = check.FindHeader(Headers::IPHeader);
-      ICMPHeader icmph = check.FindHeader(Headers::ICMPHeader);
-
-      iph.Print(cerr); cerr << endl;
-      icmph.Print(cerr);  cerr << endl;
-      cout << "END OF PACKET" << endl << endl;
-#endif
+      if (MINET_LOG_ENABLED(IPMUX, TRACE)) {
+	Packet check(p);
+	check.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(check));
+	check.ExtractHeaderFromPayload<ICMPHeader>(ICMP_HEADER_LENGTH);
+	IPHeader iph = check.FindHeader(Headers::IPHeader);
+	ICMPHeader icmph = check.FindHeader(Headers::ICMPHeader);
+
+	MINET_LOG(IPMUX, TRACE, "ABOUT TO SEND OUT: " << iph << " " << icmph);
+      }
 
       MinetSend(ip,p);
     }
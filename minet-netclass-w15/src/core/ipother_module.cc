@@ -70,6 +70,7 @@ int main(int argc, char *argv[])
 	    SockRequestResponse repl;
 	    // repl.type=SockRequestResponse::STATUS;
 	    repl.type=STATUS;
+	    repl.id=req.id;
 	    repl.error=EWHAT;
 	    MinetSend(sock,repl);
 	  }
@@ -45,7 +45,7 @@ int main(int argc, char *argv[])
       if (event.handle==mux) {
 	RawEthernetPacket raw;
 	MinetReceive(mux,raw);
-	cerr << raw << endl;
+	MINET_LOG(OTHER, INFO, raw);
       }
     }
   }
@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -10,6 +11,7 @@
 #include <iostream>
 
 #include "Minet.h"
+#include "tcpstate.h"
 
 #define DEBUG_APP 0
 #define DEBUG_UDP 0
@@ -24,28 +26,47 @@ SockStatus socks;
 PortStatus ports;
 
 MinetHandle tcp;
-Queue tcpq;
+RequestQueue tcpq;
 
 MinetHandle udp;
-Queue udpq;
+RequestQueue udpq;
 
 MinetHandle icmp;
-Queue icmpq;
+RequestQueue icmpq;
 
 MinetHandle ipother;
 
 MinetHandle app;
 
 
-void SendTCPRequest (SockRequestResponse * s, int sock) {
-    MinetSend(tcp, *s);
+// Closes sock and frees its local port, if it holds one.  A socket made
+// by accept shares the listener's port and does not hold it.
+static void CloseSock(int sock) {
+    if (socks.GetStatus(sock) != FREE) {
+	const Connection *c = socks.GetConnection(sock);
+	ports.ReleasePort(c->src, c->srcport, sock);
+    }
+    socks.CloseSocket(sock);
+}
 
-    if (s->type != STATUS) {
-	RequestRecord * elt = new RequestRecord(s, sock);
-	tcpq.Insert((void *)elt);
-    } else {
-	delete s;
+
+void SendTCPRequest (SockRequestResponse & s, int sock) {
+    if (s.type != STATUS) {
+	s.id = tcpq.Insert(s.type, sock);
     }
+
+    MinetSend(tcp, s);
+}
+
+// The options set on sock, one SockOption after another, for its
+// CONNECT or ACCEPT
+static Buffer OptionData(int sock) {
+    const std::vector<SockOption> &options = *socks.GetOptions(sock);
+    Buffer data;
+    for (unsigned i = 0; i < options.size(); i++) {
+	data.AddBack(Buffer((const char *)&options[i], sizeof(SockOption)));
+    }
+    return data;
 }
 
 static void SendAppMessage(SockRequestResponse * s, int sock) {
@@ -61,7 +82,7 @@ static void SendAppMessage(SockRequestResponse * s, int sock) {
 
 static void HandleTCPWrite(SockRequestResponse * s, int & respond) {
 
-    Connection * c = NULL;
+    Connection c;
     int sock;
     int newsock;
 
@@ -90,20 +111,30 @@ static void HandleTCPWrite(SockRequestResponse * s, int & respond) {
 	    s->data = Buffer();
 
 	    break;
-	case READ_PENDING: 
-	    // This assumes that the App can read all the data
-	    //    we are sending!
+	case READ_PENDING: {
+	    // The app gets what its read asked for, and the rest waits
+	    //    in bin for the next read
+	    Buffer rest = s->data;
+	    s->data = rest.ExtractFront(MIN(rest.GetSize(),
+					    (size_t)socks.GetReadLength(sock)));
+	    size_t taken = s->data.GetSize();
+
 	    if (app != MINET_NOHANDLE) {
 		SendAppMessage(s, sock);
 	    }
 
 	    socks.SetStatus(sock, CONNECTED);
 
+	    rest = rest.ExtractFront(MIN(rest.GetSize(),
+					 BIN_SIZE - socks.GetBin(sock)->GetSize()));
+	    socks.GetBin(sock)->AddBack(rest);
+
 	    s->error = EOK;
-	    s->bytes = s->data.GetSize();
+	    s->bytes = taken + rest.GetSize();
 	    s->data  = Buffer();
 
 	    break;
+	}
 	case ACCEPT_PENDING:   
 	    // must remember to deal with port assignment
 
@@ -127,15 +158,9 @@ static void HandleTCPWrite(SockRequestResponse * s, int & respond) {
 	    newsock = socks.FindFreeSock();
 
 	    if (newsock > 0) {
-		c = socks.GetConnection(newsock);
-
-		c->src      = s->connection.src;
-		c->dest     = s->connection.dest;
-		c->srcport  = s->connection.srcport;
-		c->destport = s->connection.destport;
-		c->protocol = s->connection.protocol;
-
+		socks.SetConnection(newsock, s->connection);
 		socks.SetStatus(newsock, CONNECTED);
+		*socks.GetOptions(newsock) = *socks.GetOptions(sock);
 
 		if (app != MINET_NOHANDLE) {
 		    socks.SetFifoToApp(newsock, app);
@@ -160,17 +185,14 @@ static void HandleTCPWrite(SockRequestResponse * s, int & respond) {
 		}
 
 		s->error = EOK;
-		socks.CloseSocket(sock);
+		CloseSock(sock);
 
 		break;
 	    }
 
-	    c = socks.GetConnection(sock);
-
-	    c->src      = s->connection.src;
-	    c->dest     = s->connection.dest;
-	    c->srcport  = s->connection.srcport;
-	    c->destport = s->connection.destport;
+	    c = s->connection;
+	    c.protocol = socks.GetConnection(sock)->protocol;
+	    socks.SetConnection(sock, c);
 
 	    socks.SetStatus(sock, CONNECTED);
 
@@ -192,16 +214,16 @@ static void HandleTCPWrite(SockRequestResponse * s, int & respond) {
 
 
 void HandleTCPStatus(SockRequestResponse * s, int & respond) {
-    RequestRecord          * elt     = NULL;
-    SockRequestResponse    * request = NULL;
+    RequestRecord elt;
     int sock;
 
 
-    elt = (RequestRecord *)tcpq.Remove();
-    request = elt->srr;
-    sock = elt->sock;
+    if (!tcpq.Remove(s->id, elt)) {
+	return;
+    }
+    sock = elt.sock;
 
-    switch (request->type) {
+    switch (elt.type) {
 	case CONNECT:
 
 	    if (s->error != EOK) {
@@ -210,7 +232,7 @@ void HandleTCPStatus(SockRequestResponse * s, int & respond) {
 		    SendAppMessage(s, sock);
 		}
 
-		socks.CloseSocket(sock);
+		CloseSock(sock);
 	    }
 
 	    break;
@@ -237,12 +259,19 @@ void HandleTCPStatus(SockRequestResponse * s, int & respond) {
 
 	    break;
 
+	case SETSOCKOPT:
+	case STATUS:
+	    // s carries the TCPInfo for an mGETSOCKOPT
+	    if (app != MINET_NOHANDLE) {
+		SendAppMessage(s, sock);
+	    }
+
+	    break;
+
 	default:
 	    break;
     }
 
-    delete elt;
-
     return;    
 }
 
@@ -270,17 +299,12 @@ void ProcessTCPMessage(SockRequestResponse * s, int & respond) {
 }
 
 
-void SendUDPRequest (SockRequestResponse * s, int sock) {
-    MinetSend(udp, *s);
-
-    if (s->type != STATUS) {
-	RequestRecord * elt = new RequestRecord(s, sock);
-
-	udpq.Insert((void *)elt);
-
-    } else {
-	delete s;
+void SendUDPRequest (SockRequestResponse & s, int sock) {
+    if (s.type != STATUS) {
+	s.id = udpq.Insert(s.type, sock);
     }
+
+    MinetSend(udp, s);
 }
 
 static void HandleUDPWrite(SockRequestResponse * s, int & respond) {
@@ -337,16 +361,16 @@ static void HandleUDPWrite(SockRequestResponse * s, int & respond) {
 }
 
 static void HandleUDPStatus(SockRequestResponse * s, int & respond) {
-    RequestRecord * elt = NULL;
-    SockRequestResponse * request = NULL;
+    RequestRecord elt;
     int sock;
 
-    elt = (RequestRecord *) udpq.Remove();
+    if (!udpq.Remove(s->id, elt)) {
+	return;
+    }
 
-    request = elt->srr;
-    sock = elt->sock;
+    sock = elt.sock;
 
-    switch (request->type) {
+    switch (elt.type) {
 	case FORWARD:
 
 	    if (app != MINET_NOHANDLE) {
@@ -354,7 +378,7 @@ static void HandleUDPStatus(SockRequestResponse * s, int & respond) {
 	    }
 
 	    if (s->error != EOK) {
-		socks.CloseSocket(sock);
+		CloseSock(sock);
 	    } else if ( (socks.GetConnection(sock)->dest != IP_ADDRESS_ANY) &&
 			(socks.GetConnection(sock)->destport != PORT_ANY) ) {
 		socks.SetStatus(sock, CONNECTED);
@@ -383,8 +407,6 @@ static void HandleUDPStatus(SockRequestResponse * s, int & respond) {
 	    break;
     }
 
-    delete elt;
-
     return;
 }
 
@@ -411,20 +433,49 @@ void ProcessUDPMessage (SockRequestResponse * s, int & respond) {
     return;
 }
 
-void SendICMPRequest (SockRequestResponse *s, int sock) {
-  MinetSend(icmp,*s);
-  if (s->type != STATUS) {
-    RequestRecord * elt = new RequestRecord(s, sock);
-    icmpq.Insert((void *) elt);
+void SendICMPRequest (SockRequestResponse & s, int sock) {
+  if (s.type != STATUS)
+    s.id = icmpq.Insert(s.type, sock);
+  MinetSend(icmp,s);
+}
+
+// Path MTU discovery (RFC 1191): tells TCP the next hop's MTU for the
+// connection whose segment the ICMP message quotes, as an IP_MTU option
+void ForwardFragmentationNeeded(const ICMPHeader & icmph, const Buffer & quoted) {
+  Packet q(quoted);
+  q.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(q));
+  IPHeader iph = q.FindHeader(Headers::IPHeader);
+  unsigned char proto;
+  iph.GetProtocol(proto);
+  // the first 8 bytes of the segment: ports and sequence number
+  unsigned char head[8];
+  if (proto != IP_PROTO_TCP || tcp == MINET_NOHANDLE ||
+      q.GetPayload().GetData((char *)head, 8, 0) != 8) {
+    return;
   }
-  else
-    delete s;
+  // we sent it, so the source is this end
+  Connection c;
+  iph.GetSourceIP(c.src);
+  iph.GetDestIP(c.dest);
+  c.protocol = IP_PROTO_TCP;
+  c.srcport = (head[0] << 8) | head[1];
+  c.destport = (head[2] << 8) | head[3];
+  unsigned int seq = (head[4] << 24) | (head[5] << 16) | (head[6] << 8) | head[7];
+
+  unsigned short mtu;
+  icmph.GetSequenceNumber(mtu);
+  SockOption opt;
+  opt.level = IPPROTO_IP;
+  opt.name = IP_MTU;
+  opt.value = ntohs(mtu);
+  MinetSend(tcp, SockRequestResponse(SETSOCKOPT, c,
+				     Buffer((const char *)&opt, sizeof(opt)),
+				     seq, EOK));
 }
 
 void ProcessICMPMessage (SockRequestResponse * s, int & respond) {
   srrType type = s->type;
-  RequestRecord *elt = NULL;
-  SockRequestResponse * request = NULL;
+  RequestRecord elt;
   SockLibRequestResponse *appmsg = NULL;
   int sock;
 
@@ -434,7 +485,7 @@ void ProcessICMPMessage (SockRequestResponse * s, int & respond) {
   p.ExtractHeaderFromPayload<ICMPHeader>(ICMP_HEADER_LENGTH);
   IPHeader iph = p.FindHeader(Headers::IPHeader);
   ICMPHeader icmph = p.FindHeader(Headers::ICMPHeader);
-  Buffer &payload = p.GetPayload();
+  Buffer payload = p.GetPayload();
   unsigned char icmp_type;  unsigned char icmp_code;
   icmph.GetType(icmp_type);  icmph.GetCode(icmp_code);
   IPAddress address_mask;
@@ -496,6 +547,7 @@ void ProcessICMPMessage (SockRequestResponse * s, int & respond) {
       case FRAGMENTATION_NEEDED:
 	cerr << "[DESTINATION UNREACHABLE]" << endl;
 	cerr << "FRAGMENTATION NEEDED" << endl;
+	ForwardFragmentationNeeded(icmph, payload);
 	break;
       case SOURCE_ROUTE_FAILED:
 	cerr << "[DESTINATION UNREACHABLE]" << endl;
@@ -600,10 +652,11 @@ void ProcessICMPMessage (SockRequestResponse * s, int & respond) {
 
   case STATUS:
     respond = 0;
-    elt = (RequestRecord *) icmpq.Remove();
-    request = elt->srr;
-    sock = elt->sock;
-    switch (request->type) {
+    if (!icmpq.Remove(s->id, elt)) {
+      break;
+    }
+    sock = elt.sock;
+    switch (elt.type) {
     case FORWARD:
       if (app!=MINET_NOHANDLE) {
 	appmsg = new SockLibRequestResponse(mSTATUS,
@@ -616,7 +669,7 @@ void ProcessICMPMessage (SockRequestResponse * s, int & respond) {
 	delete appmsg;
       }
       if (s->error != EOK) {
-	socks.CloseSocket(sock);
+	CloseSock(sock);
       }
       else {
 	if ((socks.GetConnection(sock)->dest != IP_ADDRESS_ANY) &&
@@ -647,8 +700,10 @@ void ProcessICMPMessage (SockRequestResponse * s, int & respond) {
 	socks.SetStatus(sock, BOUND);
       }
       break;
+    default:
+      // nothing else is sent to icmp_module
+      break;
     }
-    delete elt;
     break;
 
   default:
@@ -665,9 +720,10 @@ int ResolveSrcPort (int sock, const Connection & c) {
   // If the source port in c is unbound, we try to find and reserve a port.
   // If it is bound, we check that it is available and reserve it.  In either
   // case, if we are successfull then we return the (newly reserved) port.  If
-  // we fail, we return -1.
+  // we fail, we return -1.  A port bound to IP_ADDRESS_ANY is reserved on
+  // MyIPAddr, which is the address the socket ends up with.
   int port = c.srcport;
-  IPAddress ip = c.src;
+  IPAddress ip = (c.src == IP_ADDRESS_ANY) ? MyIPAddr : c.src;
   if (port == PORT_NONE) {
     port = ports.FindFreePort(ip, sock);
     if (port < 0)
@@ -687,8 +743,9 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
   int sock, port;
   unsigned char protocol;
   Status status;
-  SockRequestResponse * srr;
-  Connection *c;
+  SockRequestResponse srr;
+  Connection c;
+  size_t len;
 
   slrrType type = s.type;
 
@@ -701,8 +758,9 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
     sock = socks.FindFreeSock();
     if (sock >= 0) {
       socks.SetStatus(sock, UNBOUND);
-      c = socks.GetConnection(sock);
-      c->protocol = s.connection.protocol;
+      c = Connection();
+      c.protocol = s.connection.protocol;
+      socks.SetConnection(sock, c);
       socks.SetFifoToApp(sock, app);
       socks.SetFifoFromApp(sock, app);
       s.sockfd = sock;
@@ -728,15 +786,16 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
     if (s.connection.src == IP_ADDRESS_ANY) {
       s.connection.src = MyIPAddr;
     }
-    c = socks.GetConnection(sock);
-    c->src = s.connection.src;
-    c->srcport = s.connection.srcport;
-    protocol = c->protocol;
+    c = *socks.GetConnection(sock);
+    c.src = s.connection.src;
+    c.srcport = s.connection.srcport;
+    socks.SetConnection(sock, c);
+    protocol = c.protocol;
     if (protocol == IP_PROTO_UDP) {
       if (udp!=MINET_NOHANDLE) {
 	respond = 0;
-	srr = new SockRequestResponse(FORWARD,
-				      *c,
+	srr = SockRequestResponse(FORWARD,
+				      c,
 				      s.data,
 				      s.bytes,
 				      s.error);
@@ -764,9 +823,10 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
       s.error = ENOT_SUPPORTED;
       break;
     }
-    c = socks.GetConnection(sock);
-    c->dest = IP_ADDRESS_ANY;
-    c->destport = PORT_ANY;
+    c = *socks.GetConnection(sock);
+    c.dest = IP_ADDRESS_ANY;
+    c.destport = PORT_ANY;
+    socks.SetConnection(sock, c);
     socks.SetStatus(sock, LISTENING);
     s.error = EOK;
     break;
@@ -786,9 +846,9 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
     }
     if (tcp!=MINET_NOHANDLE) {
       respond = 0;
-      srr = new SockRequestResponse(ACCEPT,
+      srr = SockRequestResponse(ACCEPT,
 				    *socks.GetConnection(sock),
-				    s.data,
+				    OptionData(sock),
 				    s.bytes,
 				    s.error);
       SendTCPRequest (srr, sock);
@@ -808,8 +868,8 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
       s.error = EINVALID_OP;
       break;
     }
-    c = socks.GetConnection(sock);
-    protocol = c->protocol;
+    c = *socks.GetConnection(sock);
+    protocol = c.protocol;
     if (protocol == IP_PROTO_UDP) {
       if (udp!=MINET_NOHANDLE) {
 	respond = 0;
@@ -820,17 +880,18 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
 	    s.error = ERESOURCE_UNAVAIL;
 	    break;
 	  }
-	  c->srcport = port;
+	  c.srcport = port;
 	  if (s.connection.src == IP_ADDRESS_ANY) {
-	    c->src = MyIPAddr;
+	    c.src = MyIPAddr;
 	  } else {
-	    c->src = s.connection.src;
+	    c.src = s.connection.src;
 	  }
 	}
-	c->dest = s.connection.dest;
-	c->destport = s.connection.destport;
-	srr = new SockRequestResponse(FORWARD,
-				      *c,
+	c.dest = s.connection.dest;
+	c.destport = s.connection.destport;
+	socks.SetConnection(sock, c);
+	srr = SockRequestResponse(FORWARD,
+				      c,
 				      s.data,
 				      s.bytes,
 				      s.error);
@@ -851,18 +912,19 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
 	    s.error = ERESOURCE_UNAVAIL;
 	    break;
 	  }
-	  c->srcport = port;
+	  c.srcport = port;
 	  if (s.connection.src == IP_ADDRESS_ANY) {
-	    c->src = MyIPAddr;
+	    c.src = MyIPAddr;
 	  } else {
-	    c->src = s.connection.src;
+	    c.src = s.connection.src;
 	  }
 	}
-	c->dest = s.connection.dest;
-	c->destport = s.connection.destport;
-	srr = new SockRequestResponse(CONNECT,
-				      *c,
-				      s.data,
+	c.dest = s.connection.dest;
+	c.destport = s.connection.destport;
+	socks.SetConnection(sock, c);
+	srr = SockRequestResponse(CONNECT,
+				      c,
+				      OptionData(sock),
 				      s.bytes,
 				      s.error);
 	SendTCPRequest (srr, sock);
@@ -884,17 +946,22 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
       s.error = EINVALID_OP;
       break;
     }
-    if (socks.GetBin(sock)->GetSize() > 0) {
-      s.data = *socks.GetBin(sock);
+    // the most to read is in bytes; older clients send a buffer that
+    // size instead
+    len = MAX((size_t)s.bytes, s.data.GetSize());
+    s.data.Clear();
+    if ((socks.GetBin(sock)->GetSize() > 0) || (len == 0)) {
+      s.data = socks.GetBin(sock)->ExtractFront(MIN(len, socks.GetBin(sock)->GetSize()));
+      s.bytes = s.data.GetSize();
       s.error = EOK;
       break;
     }
     if (! (socks.GetBlockingStatus(sock))) {
-      s.data.Clear();
       s.error = EWOULD_BLOCK;
       break;
     }
     respond = 0;
+    socks.SetReadLength(sock, len);
     socks.SetStatus(sock, READ_PENDING);
     break;
 
@@ -912,7 +979,7 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
     if (protocol == IP_PROTO_UDP) {
       if (udp!=MINET_NOHANDLE) {
 	respond = 0;
-	srr = new SockRequestResponse(WRITE,
+	srr = SockRequestResponse(WRITE,
 				      *socks.GetConnection(sock),
 				      s.data,
 				      s.bytes,
@@ -928,7 +995,7 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
     } else {
       if (tcp!=MINET_NOHANDLE) {
 	respond = 0;
-	srr = new SockRequestResponse(WRITE,
+	srr = SockRequestResponse(WRITE,
 				      *socks.GetConnection(sock),
 				      s.data,
 				      s.bytes,
@@ -951,7 +1018,7 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
     protocol = socks.GetConnection(sock)->protocol;
     if (protocol == IP_PROTO_UDP) {
       if (udp!=MINET_NOHANDLE) {
-	srr = new SockRequestResponse(CLOSE,
+	srr = SockRequestResponse(CLOSE,
 				      *socks.GetConnection(sock),
 				      s.data,
 				      s.bytes,
@@ -963,7 +1030,7 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
       }
     } else {
       if (tcp!=MINET_NOHANDLE) {
-	srr = new SockRequestResponse(CLOSE,
+	srr = SockRequestResponse(CLOSE,
 				      *socks.GetConnection(sock),
 				      s.data,
 				      s.bytes,
@@ -974,8 +1041,89 @@ void ProcessAppRequest(SockLibRequestResponse & s, int & respond)
 	s.error = ENOT_IMPLEMENTED;
       }
     }
-    socks.CloseSocket(sock);
+    CloseSock(sock);
+    break;
+
+  case mSETSOCKOPT: {
+    SockOption opt;
+    sock = s.sockfd;
+    if ((app != socks.GetFifoToApp(sock)) ||
+	(s.data.GetSize() != sizeof(opt))) {
+      s.error = EINVALID_OP;
+      break;
+    }
+    s.data.GetData((char *)&opt, sizeof(opt), 0);
+    opt.text[SOCK_OPTION_TEXT_MAX - 1] = 0;
+    if (!(opt.level == SOL_SOCKET &&
+	  (opt.name == SO_SNDBUF || opt.name == SO_RCVBUF) &&
+	  opt.value > 0) &&
+	!(opt.level == IPPROTO_TCP &&
+	  (opt.name == TCP_NODELAY || opt.name == TCP_CORK || opt.name == TCP_QUICKACK) &&
+	  opt.value >= 0) &&
+	!(opt.level == IPPROTO_TCP && opt.name == TCP_CONGESTION &&
+	  IsCongestionControl(opt.text))) {
+      s.error = ENOT_SUPPORTED;
+      break;
+    }
+    if (socks.GetConnection(sock)->protocol != IP_PROTO_TCP ||
+	tcp == MINET_NOHANDLE) {
+      s.error = ENOT_IMPLEMENTED;
+      break;
+    }
+    // for the socket's CONNECT or ACCEPT, and the sockets it accepts
+    socks.SetOption(sock, opt);
+    status = socks.GetStatus(sock);
+    if ((status == UNBOUND) || (status == BOUND) || (status == LISTENING)) {
+      // tcp has no connection for it, or gets it with the next ACCEPT
+      s.data.Clear();
+      s.error = EOK;
+      break;
+    }
+    respond = 0;
+    srr = SockRequestResponse(SETSOCKOPT,
+			      *socks.GetConnection(sock),
+			      s.data,
+			      0,
+			      EOK);
+    SendTCPRequest (srr, sock);
     break;
+  }
+
+  case mGETSOCKOPT: {
+    SockOption opt;
+    sock = s.sockfd;
+    if ((app != socks.GetFifoToApp(sock)) ||
+	(s.data.GetSize() != sizeof(opt))) {
+      s.error = EINVALID_OP;
+      break;
+    }
+    s.data.GetData((char *)&opt, sizeof(opt), 0);
+    s.data.Clear();
+    if (!(opt.level == IPPROTO_TCP && opt.name == TCP_INFO)) {
+      s.error = ENOT_SUPPORTED;
+      break;
+    }
+    if (socks.GetConnection(sock)->protocol != IP_PROTO_TCP ||
+	tcp == MINET_NOHANDLE) {
+      s.error = ENOT_IMPLEMENTED;
+      break;
+    }
+    status = socks.GetStatus(sock);
+    if ((status == UNBOUND) || (status == BOUND)) {
+      s.error = ENOMATCH;
+      break;
+    }
+    respond = 0;
+    srr = SockRequestResponse(STATUS,
+			      *socks.GetConnection(sock),
+			      Buffer(),
+			      TCP_INFO_REQUEST,
+			      EOK);
+    // unlike the STATUS that answers a WRITE, this one wants a reply
+    srr.id = tcpq.Insert(STATUS, sock);
+    MinetSend(tcp, srr);
+    break;
+  }
 
   default:
     break;
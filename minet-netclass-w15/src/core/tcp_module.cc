@@ -12,16 +12,897 @@
 
 
 #include <iostream>
+#include <deque>
+#include <map>
 
 using namespace std;
 
 #include "Minet.h"
+#include "tcpstate.h"
 
 
-int main(int argc, char *argv[])
+// Connections established on a listening port that no accept() has
+// taken yet, how many accepts are waiting there for one, and the
+// options the listening socket set, for each connection it makes
+struct Listener {
+  unsigned accepts;
+  std::deque<Connection> ready;
+  Buffer options;
+
+  Listener() : accepts(0) {}
+};
+
+static MinetHandle mux, sock;
+static ConnectionList<TCPState> clist;
+// connections holding back an ACK, by when it is due.  A timer is
+// never cancelled; one that finds the ACK already sent does nothing.
+static TimerWheel<Connection> delacks;
+// by local port
+static std::map<unsigned short, Listener> listeners;
+
+
+// An initial sequence number from the clock, which goes round once
+// an MSL (RFC 793)
+static unsigned int NewIsn()
+{
+  struct timeval tv;
+  gettimeofday(&tv,0);
+  return tv.tv_sec*SECOND_MULTIPLIER+tv.tv_usec*MICROSEC_MULTIPLIER;
+}
+
+// Sends one segment for c.  With segsize set, data is a run of
+// segments of that size for ip_module to split (see SplitTCPSuperSegment).
+static void SendPacket(const Connection &c, const unsigned int seq, const unsigned int ack,
+		       const unsigned char flags, const unsigned short window, const TCPOptions &o,
+		       const Buffer &data, const unsigned short segsize=0)
+{
+  Packet p(data);
+  if (segsize>0) {
+    // the checksums are computed per segment when it is split
+    p.SetSegmentSize(segsize);
+    p.MarkChecksumsPending();
+  }
+  IPHeader ih;
+  ih.SetProtocol(IP_PROTO_TCP);
+  ih.SetSourceIP(c.src);
+  ih.SetDestIP(c.dest);
+  ih.SetTotalLength(IP_HEADER_BASE_LENGTH+TCP_HEADER_BASE_LENGTH+o.len+data.GetSize());
+  p.PushFrontHeader(ih);
+
+  TCPHeader th;
+  th.SetSourcePort(c.srcport,p);
+  th.SetDestPort(c.destport,p);
+  th.SetSeqNum(seq,p);
+  th.SetAckNum(ack,p);
+  th.SetFlags(flags,p);
+  th.SetWinSize(window,p);
+  th.SetUrgentPtr(0,p);
+  th.SetHeaderLen(TCP_HEADER_BASE_LENGTH/4,p);
+  if (o.len>0) {
+    th.SetOptions(o,p);
+  }
+  p.PushBackHeader(th);
+  MinetSend(mux,p);
+}
+
+// Sends a segment of m's starting at seq, with the options the
+// connection uses.  A SYN carries those we offer, or on a SYN-ACK those
+// the peer offered too, and its window is never scaled.  With ACK set
+// it acks everything received so far, with SACK blocks while there is
+// a gap.
+static void SendSegment(ConnectionToStateMapping<TCPState> &m, const unsigned int seq,
+			const unsigned char flags, const Buffer &data, const double now,
+			const unsigned short segsize=0)
+{
+  TCPState &s = m.state;
+  TCPOptions o;
+  bool syn=IS_SYN(flags), synack=syn && IS_ACK(flags);
+  if (syn) {
+    o.AddMss(TCP_MSS_OFFER);
+  }
+  if (syn && (!synack || s.IsWindowScaleOk())) {
+    o.AddWindowScale(s.GetWindowScaleOffer());
+  }
+  if (syn && (!synack || s.IsSackPermitted())) {
+    o.AddSackPermitted();
+  }
+  if (s.TimestampsOk() || (syn && !synack)) {
+    o.AddTimestamp(TCPState::TimestampNow(now),s.TimestampEcho());
+  }
+  if (!syn && s.IsSackPermitted() && s.HasReassemblyGap()) {
+    TCPSackBlock blocks[TCP_SACK_MAX_BLOCKS];
+    unsigned n=s.GetSackBlocks(blocks,s.TimestampsOk() ? 3 : 4);
+    o.AddSack(blocks,n);
+  }
+  SendPacket(m.connection,seq,IS_ACK(flags) ? s.GetLastRecvd()+1 : 0,flags,
+	     s.GetAdvertisedWindow(syn),o,data,segsize);
+  if (IS_ACK(flags)) {
+    s.AckSent();
+  }
+}
+
+static void SendAck(ConnectionToStateMapping<TCPState> &m, const double now)
+{
+  unsigned char flags=0;
+  SET_ACK(flags);
+  SendSegment(m,m.state.GetLastSent()+1,flags,Buffer(),now);
+}
+
+// Our SYN, or SYN-ACK in SYN_RCVD, again if it is a retry.  It takes
+// the sequence number before the first byte of data.
+static void SendSyn(ConnectionToStateMapping<TCPState> &m, const bool again, const double now)
+{
+  TCPState &s = m.state;
+  unsigned int seq=s.GetLastAcked()+1;
+  unsigned char flags=0;
+  SET_SYN(flags);
+  if (s.GetState()==SYN_RCVD) {
+    SET_ACK(flags);
+  }
+  SendSegment(m,seq,flags,Buffer(),now);
+  s.SetLastSent(seq);
+  s.SegmentSent(seq,1,again,now);
+}
+
+// Answers a segment that no connection here can take (RFC 793): a RST
+// at what it acked, or one that acks what it carried if it acked nothing
+static void SendReset(const Connection &c, const TCPHeader &tcph, const unsigned len)
+{
+  unsigned char flags, rflags=0;
+  unsigned int seq, ack;
+  tcph.GetFlags(flags);
+  tcph.GetSeqNum(seq);
+  tcph.GetAckNum(ack);
+  if (IS_RST(flags)) {
+    return;
+  }
+  SET_RST(rflags);
+  if (IS_ACK(flags)) {
+    SendPacket(c,ack,0,rflags,0,TCPOptions(),Buffer());
+  } else {
+    SET_ACK(rflags);
+    SendPacket(c,0,seq+len+(IS_SYN(flags) ? 1 : 0)+(IS_FIN(flags) ? 1 : 0),rflags,0,TCPOptions(),Buffer());
+  }
+}
+
+// Resets a connection we are giving up on
+static void Abort(ConnectionToStateMapping<TCPState> &m)
+{
+  unsigned char flags=0;
+  SET_RST(flags);
+  SET_ACK(flags);
+  SendPacket(m.connection,m.state.GetLastSent()+1,m.state.GetLastRecvd()+1,flags,0,TCPOptions(),Buffer());
+}
+
+// Our FIN goes once the socket is closed and all of SendBuffer is out,
+// and takes the sequence number after its last byte
+static bool Closing(TCPState &s)
+{
+  return s.GetState()==FIN_WAIT1 || s.GetState()==CLOSING || s.GetState()==LAST_ACK;
+}
+
+static bool FinSent(TCPState &s)
+{
+  return Closing(s) && s.GetLastSent()-s.GetLastAcked()>s.SendBuffer.GetSize();
+}
+
+// Resends len bytes from seq, which SendBuffer holds unless it is our FIN
+static void Resend(ConnectionToStateMapping<TCPState> &m, const unsigned int seq, const size_t len,
+		   const double now)
+{
+  TCPState &s = m.state;
+  Buffer queued(s.SendBuffer);
+  Buffer data=queued.Extract(seq-(s.GetLastAcked()+1),len);
+  unsigned char flags=0;
+  SET_ACK(flags);
+  if (data.GetSize()<len && FinSent(s)) {
+    SET_FIN(flags);
+  }
+  SendSegment(m,seq,flags,data,now);
+  s.SegmentSent(seq,len,true,now);
+}
+
+// Resends the first range the peer has neither acked nor SACKed, at the
+// current MSS
+static void Retransmit(ConnectionToStateMapping<TCPState> &m, const double now)
+{
+  TCPState &s = m.state;
+  unsigned int seq;
+  size_t len;
+  s.RestartRetransmission();
+  if (s.NextRetransmission(seq,len,s.GetMss())) {
+    Resend(m,seq,len,now);
+  }
+}
+
+// Resends what a timeout left lost, as the congestion window opens again
+static void ResendLost(ConnectionToStateMapping<TCPState> &m, const double now)
 {
-  MinetHandle mux, sock;
+  TCPState &s = m.state;
+  unsigned int seq;
+  size_t len;
+  while (s.NextLostSegment(seq,len)) {
+    Resend(m,seq,len,now);
+  }
+}
+
+// Sends the peer the first byte it has no window for, which it answers
+// with an ACK carrying the window it has now.  The byte is not counted
+// as sent, so it goes again as data once the window opens.
+static void SendWindowProbe(ConnectionToStateMapping<TCPState> &m, const double now)
+{
+  TCPState &s = m.state;
+  Buffer queued(s.SendBuffer);
+  unsigned char flags=0;
+  SET_ACK(flags);
+  SendSegment(m,s.GetLastAcked()+1,flags,queued.Extract(0,1),now);
+}
+
+// Sends what SendBuffer holds as far as the windows, Nagle and TCP_CORK
+// allow, in full segments where there is enough, then our FIN if the
+// socket is closed, and arms the retransmission timer if it is not
+// running, or the persist timer if the peer's window is shut.  Full
+// segments back to back go to ip_mux as one super-segment.  Returns
+// whether anything was sent, and so acked.
+static bool SendData(ConnectionList<TCPState>::iterator cs, const double now)
+{
+  TCPState &s = (*cs).state;
+  unsigned int start, seq;
+  size_t len, total;
+  bool sent=false;
+
+  if (s.GetState()!=ESTABLISHED && s.GetState()!=CLOSE_WAIT && !Closing(s)) {
+    return false;
+  }
+  while (s.NextSegment(start,len)) {
+    seq=start;
+    total=0;
+    do {
+      s.SetLastSent(seq+len-1);
+      s.SegmentSent(seq,len,false,now);
+      total+=len;
+    } while (len==s.GetMss() && total+s.GetMss()<=TCP_GSO_MAX_SIZE && s.NextSegment(seq,len));
+
+    // SendBuffer starts at last_acked+1
+    unsigned offset=start-(s.GetLastAcked()+1);
+    Buffer queued(s.SendBuffer);
+    Buffer data=queued.Extract(offset,total);
+    unsigned char flags=0;
+    SET_ACK(flags);
+    if (queued.GetSize()==offset) {
+      SET_PSH(flags);
+    }
+    SendSegment(*cs,start,flags,data,now,total>s.GetMss() ? s.GetMss() : 0);
+    sent=true;
+  }
+  if (Closing(s) && !FinSent(s) && s.GetLastSent()-s.GetLastAcked()==s.SendBuffer.GetSize()) {
+    unsigned char flags=0;
+    SET_ACK(flags);
+    SET_FIN(flags);
+    SendSegment(*cs,s.GetLastSent()+1,flags,Buffer(),now);
+    s.SetLastSent(s.GetLastSent()+1);
+    sent=true;
+  }
+  if ((sent || s.WindowShut()) && !(*cs).bTmrActive) {
+    clist.SetTimer(cs,Time(now+s.GetRto()));
+  }
+  return sent;
+}
+
+// The entry for exactly c, a listener's wildcard connection included
+static ConnectionList<TCPState>::iterator FindExact(const Connection &c)
+{
+  ConnectionList<TCPState>::iterator cs;
+  if (IsFullySpecified(c)) {
+    cs=clist.FindMatching(c);
+    return (cs!=clist.end() && ConnectionKey((*cs).connection)==ConnectionKey(c)) ? cs : clist.end();
+  }
+  for (cs=clist.begin(); cs!=clist.end(); ++cs) {
+    if (ConnectionKey((*cs).connection)==ConnectionKey(c)) {
+      break;
+    }
+  }
+  return cs;
+}
+
+// Whether c waits on its listener for an accept(); take removes it
+static bool Unaccepted(const Connection &c, const bool take=false)
+{
+  std::map<unsigned short, Listener>::iterator l=listeners.find(c.srcport);
+  if (l==listeners.end()) {
+    return false;
+  }
+  std::deque<Connection> &ready=(*l).second.ready;
+  for (std::deque<Connection>::iterator r=ready.begin(); r!=ready.end(); ++r) {
+    if (ConnectionKey(*r)==ConnectionKey(c)) {
+      if (take) {
+	ready.erase(r);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Tells sock_module about a connection.  An empty WRITE says it is
+// established, or once it was, that the peer has closed it; one with
+// an error that it failed.
+static void NotifySock(const Connection &c, const int error)
+{
+  SockRequestResponse write(WRITE,c,Buffer(),0,error);
+  MinetSend(sock,write);
+}
+
+// Passes what has arrived in order up to the socket.  Until an accept()
+// takes the connection there is no socket, and it waits in RecvBuffer.
+static void Deliver(ConnectionToStateMapping<TCPState> &m, const double now)
+{
+  TCPState &s = m.state;
+  size_t n=s.RecvBuffer.GetSize();
+  if (n>0 && !Unaccepted(m.connection)) {
+    SockRequestResponse write(WRITE,m.connection,s.RecvBuffer.ExtractFront(n),n,EOK);
+    MinetSend(sock,write);
+    s.AutotuneReceive(n,now);
+  }
+}
+
+// Gives the connections ready on a listener to the accepts waiting there,
+// with what arrived for them meanwhile
+static void HandOff(Listener &l, const double now)
+{
+  while (l.accepts>0 && !l.ready.empty()) {
+    ConnectionList<TCPState>::iterator cs=clist.FindMatching(l.ready.front());
+    l.ready.pop_front();
+    if (cs==clist.end() || ((*cs).state.GetState()!=ESTABLISHED && (*cs).state.GetState()!=CLOSE_WAIT)) {
+      continue;
+    }
+    NotifySock((*cs).connection,EOK);
+    l.accepts--;
+    if ((*cs).state.RecvBuffer.GetSize()>0) {
+      Deliver(*cs,now);
+      // the window it held shut is open again
+      SendAck(*cs,now);
+    }
+    if ((*cs).state.GetState()==CLOSE_WAIT) {
+      NotifySock((*cs).connection,EOK);
+    }
+  }
+}
+
+// Forgets a connection that failed or was reset, telling its socket if
+// it has one
+static void Drop(ConnectionList<TCPState>::iterator cs, const int error)
+{
+  unsigned int state=(*cs).state.GetState();
+  if ((state==SYN_SENT || state==ESTABLISHED || state==CLOSE_WAIT) && !Unaccepted((*cs).connection,true)) {
+    NotifySock((*cs).connection,error);
+  }
+  clist.erase(cs);
+}
 
+// Both FINs are acked: the connection stays for twice the MSL to ack
+// the peer's FIN again if it comes back
+static void TimeWait(ConnectionList<TCPState>::iterator cs, const double now)
+{
+  (*cs).state.SetState(TIME_WAIT);
+  clist.SetTimer(cs,Time(now+2*MSL_TIME_SECS));
+}
+
+// Sets the options a socket's CONNECT or ACCEPT carries, one SockOption
+// after another, on a connection before its SYN goes
+static void TakeOptions(TCPState &s, const Buffer &options)
+{
+  SockOption opt;
+  for (unsigned off=0; off+sizeof(opt)<=options.GetSize(); off+=sizeof(opt)) {
+    options.GetData((char *)&opt,sizeof(opt),off);
+    s.SetSocketOption(opt);
+  }
+}
+
+// Takes what the peer's SYN says: where its data starts, its window,
+// which is never scaled on a SYN, the largest segment it takes, and the
+// options both ends must offer.  A SYN-ACK's timestamp echo times the
+// handshake.
+static void TakeSyn(TCPState &s, const unsigned int seq, const unsigned short win, const TCPOptions &o,
+		    const double now)
+{
+  unsigned char shift=0;
+  unsigned short mss=0;
+  unsigned int val=0, ecr=0;
+  bool scaled=o.GetWindowScale(shift), sized=o.GetMss(mss), stamped=o.GetTimestamp(val,ecr);
+  s.SetLastRecvd(seq);
+  s.SetSendRwnd(win);
+  s.NegotiateWindowScale(scaled,shift);
+  s.NegotiateMss(sized,mss);
+  s.SetSackPermitted(o.HasSackPermitted());
+  s.SetTimestampsOk(stamped);
+  if (stamped) {
+    s.TimestampReceived(seq,val,ecr,true,now);
+  }
+}
+
+// The socket was closed: the FIN follows whatever is still queued
+static void Close(ConnectionList<TCPState>::iterator cs, const double now)
+{
+  TCPState &s = (*cs).state;
+  switch (s.GetState()) {
+  case LISTEN: {
+    std::map<unsigned short, Listener>::iterator l=listeners.find((*cs).connection.srcport);
+    if (l!=listeners.end()) {
+      // connections no accept() took are reset
+      std::deque<Connection> &ready=(*l).second.ready;
+      for (std::deque<Connection>::iterator r=ready.begin(); r!=ready.end(); ++r) {
+	ConnectionList<TCPState>::iterator child=FindExact(*r);
+	if (child!=clist.end()) {
+	  Abort(*child);
+	  clist.erase(child);
+	}
+      }
+      listeners.erase(l);
+    }
+    clist.erase(cs);
+    break;
+  }
+  case SYN_SENT:
+    clist.erase(cs);
+    break;
+  case SYN_RCVD:
+  case ESTABLISHED:
+    s.SetState(FIN_WAIT1);
+    SendData(cs,now);
+    break;
+  case CLOSE_WAIT:
+    s.SetState(LAST_ACK);
+    SendData(cs,now);
+    break;
+  default:
+    break;
+  }
+}
+
+// The connection timer went off: resend a SYN, or what is in flight as
+// the congestion window allows, backing off from the connection's own
+// estimate until its tries run out.  With the peer's window shut it is
+// probed instead, backing off the same way but for as long as it takes.
+// A closed connection done waiting is forgotten.
+static void TimerExpired(ConnectionList<TCPState>::iterator cs, const double now)
+{
+  TCPState &s = (*cs).state;
+  MINET_LOG(TCP, DEBUG, "Timer expired for " << (*cs).connection);
+  switch (s.GetState()) {
+  case FIN_WAIT2:
+  case TIME_WAIT:
+    clist.erase(cs);
+    break;
+  case SYN_SENT:
+  case SYN_RCVD:
+    if (s.ExpireTimerTries()) {
+      Drop(cs,ECONN_FAILED);
+      return;
+    }
+    s.RetransmitTimeout(now);
+    SendSyn(*cs,true,now);
+    clist.SetTimer(cs,Time(now+s.GetRto()));
+    break;
+  default:
+    if (s.WindowShut()) {
+      s.ExpireTimerTries();
+      SendWindowProbe(*cs,now);
+      clist.SetTimer(cs,Time(now+s.GetRto()));
+      break;
+    }
+    if (s.ExpireTimerTries()) {
+      Abort(*cs);
+      Drop(cs,ECONN_FAILED);
+      return;
+    }
+    s.RetransmitTimeout(now);
+    s.RestartRetransmission();
+    ResendLost(*cs,now);
+    clist.SetTimer(cs,Time(now+s.GetRto()));
+    break;
+  }
+}
+
+// A SYN for a listener: a new connection in SYN_RCVD, which goes to
+// the listener's accepts once the handshake is done
+static void Listen(const Connection &c, const unsigned int seq, const unsigned short win,
+		   const TCPOptions &o, const double now)
+{
+  TCPState s(NewIsn()-1,SYN_RCVD,NUM_SYN_TRIES);
+  TakeOptions(s,listeners[c.srcport].options);
+  TakeSyn(s,seq,win,o,now);
+  ConnectionList<TCPState>::iterator cs=
+    clist.insert(clist.end(),ConnectionToStateMapping<TCPState>(c,Time(),s,false));
+  SendSyn(*cs,false,now);
+  clist.SetTimer(cs,Time(now+(*cs).state.GetRto()));
+}
+
+static void SegmentArrived(Packet &p)
+{
+  unsigned tcphlen=TCPHeader::EstimateTCPHeaderLength(p);
+  MINET_LOG(TCP, TRACE, "estimated header len="<<tcphlen);
+  p.ExtractHeaderFromPayload<TCPHeader>(tcphlen);
+  IPHeader ipl=p.FindHeader(Headers::IPHeader);
+  TCPHeader tcph=p.FindHeader(Headers::TCPHeader);
+
+  MINET_LOG(TCP, TRACE, "TCP Packet: IP Header is "<<ipl<<" and TCP Header is "<<tcph
+	    <<" and Checksum is "<<(tcph.IsCorrectChecksum(p) ? "VALID" : "INVALID"));
+  if (!tcph.IsCorrectChecksum(p)) {
+    return;
+  }
+
+  Connection c;
+  ipl.GetDestIP(c.src);
+  ipl.GetSourceIP(c.dest);
+  ipl.GetProtocol(c.protocol);
+  tcph.GetDestPort(c.srcport);
+  tcph.GetSourcePort(c.destport);
+  unsigned short len, win;
+  unsigned char iphlen, flags;
+  unsigned int seq, ack;
+  TCPOptions o;
+  ipl.GetTotalLength(len);
+  ipl.GetHeaderLength(iphlen);
+  len-=iphlen*4+tcphlen;
+  tcph.GetFlags(flags);
+  tcph.GetSeqNum(seq);
+  tcph.GetAckNum(ack);
+  tcph.GetWinSize(win);
+  tcph.GetOptions(o);
+  Time now;
+
+  ConnectionList<TCPState>::iterator cs=clist.FindMatching(c);
+  if (cs==clist.end()) {
+    SendReset(c,tcph,len);
+    return;
+  }
+  TCPState &s=(*cs).state;
+
+  switch (s.GetState()) {
+  case LISTEN:
+    if (IS_SYN(flags) && !IS_ACK(flags) && !IS_RST(flags)) {
+      Listen(c,seq,win,o,(double)now);
+    } else {
+      SendReset(c,tcph,len);
+    }
+    return;
+  case SYN_SENT:
+    if (IS_ACK(flags) && ack!=s.GetLastSent()+1) {
+      SendReset(c,tcph,len);
+      return;
+    }
+    if (IS_RST(flags)) {
+      if (IS_ACK(flags)) {
+	Drop(cs,ECONN_FAILED);
+      }
+      return;
+    }
+    // no simultaneous open
+    if (!IS_SYN(flags) || !IS_ACK(flags)) {
+      return;
+    }
+    TakeSyn(s,seq,win,o,(double)now);
+    s.SetState(ESTABLISHED);
+    s.SetTimerTries(NUM_DATA_TRIES);
+    s.ProcessAck(ack,false,(double)now);
+    clist.ClearTimer(cs);
+    SendAck(*cs,(double)now);
+    NotifySock((*cs).connection,EOK);
+    return;
+  case SYN_RCVD:
+    if (IS_RST(flags)) {
+      if (seq==s.GetLastRecvd()+1) {
+	clist.erase(cs);
+      }
+      return;
+    }
+    if (IS_SYN(flags)) {
+      // our SYN-ACK was lost
+      SendSyn(*cs,true,(double)now);
+      return;
+    }
+    if (!IS_ACK(flags)) {
+      return;
+    }
+    if (ack!=s.GetLastSent()+1) {
+      SendReset(c,tcph,len);
+      return;
+    }
+    if (listeners.find(c.srcport)==listeners.end()) {
+      // the listener was closed since
+      Abort(*cs);
+      clist.erase(cs);
+      return;
+    }
+    s.SetState(ESTABLISHED);
+    s.SetTimerTries(NUM_DATA_TRIES);
+    listeners[c.srcport].ready.push_back((*cs).connection);
+    HandOff(listeners[c.srcport],(double)now);
+    break;
+  case TIME_WAIT:
+    // our ACK of its FIN was lost
+    if (IS_FIN(flags) && !IS_RST(flags)) {
+      SendAck(*cs,(double)now);
+      TimeWait(cs,(double)now);
+    }
+    return;
+  default:
+    break;
+  }
+
+  // a synchronized connection: take its ACK, then its data, which is
+  // acked now or once a second segment comes or the delayed ACK timer
+  // goes off, unless data going back carries the ACK first
+  if (IS_RST(flags)) {
+    if (seq==s.GetLastRecvd()+1) {
+      Drop(cs,ECONN_FAILED);
+    }
+    return;
+  }
+  if (IS_SYN(flags)) {
+    // our ACK of its SYN-ACK was lost
+    SendAck(*cs,(double)now);
+    return;
+  }
+  if (!IS_ACK(flags)) {
+    return;
+  }
+
+  unsigned int val, ecr;
+  if (s.TimestampsOk() && o.GetTimestamp(val,ecr)) {
+    s.TimestampReceived(seq,val,ecr,(int)(ack-1-s.GetLastAcked())>0,(double)now);
+  }
+  unsigned int oldrwnd=s.rwnd;
+  s.SetSendRwnd(win);
+  bool maybedup=len==0 && !IS_FIN(flags) && s.rwnd==oldrwnd;
+  if (oldrwnd==0 && s.rwnd>0 && s.GetLastSent()==s.GetLastAcked() && s.SendBuffer.GetSize()>0) {
+    // the window opened: the persist timer and its backoff are done
+    s.SetTimerTries(NUM_DATA_TRIES);
+    clist.ClearTimer(cs);
+  }
+  eAckAction action=s.ProcessAck(ack,maybedup,(double)now);
+  if (s.IsSackPermitted()) {
+    // what the peer holds past the gap is not sent again
+    TCPSackBlock blocks[TCP_SACK_MAX_BLOCKS];
+    s.UpdateScoreboard(blocks,o.GetSack(blocks,TCP_SACK_MAX_BLOCKS));
+  }
+  switch (action) {
+  case ACK_RETRANSMIT:
+    Retransmit(*cs,(double)now);
+    break;
+  case ACK_NEW:
+    // progress: the backoff starts over
+    s.SetTimerTries(NUM_DATA_TRIES);
+    if (s.GetLastSent()==s.GetLastAcked()) {
+      clist.ClearTimer(cs);
+    } else {
+      ResendLost(*cs,(double)now);
+      clist.SetTimer(cs,Time((double)now+s.GetRto()));
+    }
+    break;
+  default:
+    break;
+  }
+
+  // our FIN is acked
+  if (Closing(s) && s.GetLastSent()==s.GetLastAcked() && s.SendBuffer.GetSize()==0) {
+    switch (s.GetState()) {
+    case FIN_WAIT1:
+      // the socket is closed, so the peer's FIN is not waited for forever
+      s.SetState(FIN_WAIT2);
+      clist.SetTimer(cs,Time((double)now+FIN_WAIT2_TIME_SECS));
+      break;
+    case CLOSING:
+      TimeWait(cs,(double)now);
+      return;
+    case LAST_ACK:
+      clist.erase(cs);
+      return;
+    default:
+      break;
+    }
+  }
+
+  bool acknow=false, pending=s.AckPending();
+  if (len>0 && (s.GetState()==ESTABLISHED || s.GetState()==FIN_WAIT1 || s.GetState()==FIN_WAIT2)) {
+    size_t delivered=s.ReceiveSegment(seq,p.GetPayload().ExtractFront(len));
+    acknow=s.SegmentReceived(len,delivered,(double)now);
+    if (s.GetState()==ESTABLISHED) {
+      Deliver(*cs,(double)now);
+    } else {
+      // the socket is closed, so it is acked and dropped
+      s.RecvBuffer.Clear();
+    }
+  } else if (len>0) {
+    // sent again after its FIN
+    acknow=true;
+  }
+  if (IS_FIN(flags)) {
+    acknow=true;
+    if (seq+len==s.GetLastRecvd()+1) {
+      switch (s.GetState()) {
+      case ESTABLISHED:
+	s.SetLastRecvd(seq+len);
+	s.SetState(CLOSE_WAIT);
+	// the end of the data
+	if (!Unaccepted((*cs).connection)) {
+	  NotifySock((*cs).connection,EOK);
+	}
+	break;
+      case FIN_WAIT1:
+	s.SetLastRecvd(seq+len);
+	s.SetState(CLOSING);
+	break;
+      case FIN_WAIT2:
+	s.SetLastRecvd(seq+len);
+	SendAck(*cs,(double)now);
+	TimeWait(cs,(double)now);
+	return;
+      default:
+	break;
+      }
+    }
+  }
+  bool sent=SendData(cs,(double)now);
+  if (acknow && !sent) {
+    SendAck(*cs,(double)now);
+  } else if (!pending && s.AckPending()) {
+    delacks.Arm(s.GetDelayedAckDue(),c);
+  }
+}
+
+static void SockRequest(SockRequestResponse &s)
+{
+  MINET_LOG(TCP, DEBUG, "Received Socket Request:" << s);
+  Time now;
+  switch (s.type) {
+  case CONNECT: {
+    int error=EOK;
+    if (!IsFullySpecified(s.connection) || FindExact(s.connection)!=clist.end()) {
+      error=EINVALID_OP;
+    }
+    SockRequestResponse repl(STATUS,s.connection,Buffer(),0,error);
+    repl.id=s.id;
+    MinetSend(sock,repl);
+    if (error==EOK) {
+      TCPState st(NewIsn()-1,SYN_SENT,NUM_SYN_TRIES);
+      TakeOptions(st,s.data);
+      ConnectionList<TCPState>::iterator cs=
+	clist.insert(clist.end(),ConnectionToStateMapping<TCPState>(s.connection,Time(),st,false));
+      SendSyn(*cs,false,(double)now);
+      clist.SetTimer(cs,Time((double)now+(*cs).state.GetRto()));
+    }
+    break;
+  }
+  case ACCEPT: {
+    // each accept() asks again, on the listener's connection
+    ConnectionList<TCPState>::iterator cs=FindExact(s.connection);
+    int error=EOK;
+    if (cs==clist.end()) {
+      clist.push_back(ConnectionToStateMapping<TCPState>(s.connection,Time(),TCPState(0,LISTEN,0),false));
+    } else if ((*cs).state.GetState()!=LISTEN) {
+      error=EINVALID_OP;
+    }
+    SockRequestResponse repl(STATUS,s.connection,Buffer(),0,error);
+    repl.id=s.id;
+    MinetSend(sock,repl);
+    if (error==EOK) {
+      Listener &l=listeners[s.connection.srcport];
+      l.options=s.data;
+      l.accepts++;
+      HandOff(l,(double)now);
+    }
+    break;
+  }
+  case STATUS:
+    if (s.bytes==TCP_INFO_REQUEST) {
+      ConnectionList<TCPState>::iterator cs=FindExact(s.connection);
+      TCPInfo info;
+      memset(&info,0,sizeof(info));
+      if (cs!=clist.end()) {
+	(*cs).state.GetInfo(info);
+      }
+      SockRequestResponse repl(STATUS,s.connection,Buffer((const char *)&info,sizeof(info)),sizeof(info),
+			       cs!=clist.end() ? EOK : ENOMATCH);
+      repl.id=s.id;
+      MinetSend(sock,repl);
+    }
+    break;
+  case WRITE: {
+    // coalesced in SendBuffer, and sent as Nagle and TCP_CORK allow
+    ConnectionList<TCPState>::iterator cs=FindExact(s.connection);
+    size_t bytes=0;
+    int error=ENOMATCH;
+    if (cs!=clist.end() && ((*cs).state.GetState()==ESTABLISHED || (*cs).state.GetState()==CLOSE_WAIT)) {
+      bytes=(*cs).state.QueueSend(s.data);
+      error=EOK;
+      SendData(cs,(double)now);
+    } else if (cs!=clist.end()) {
+      error=EINVALID_OP;
+    }
+    SockRequestResponse repl(STATUS,s.connection,Buffer(),bytes,error);
+    repl.id=s.id;
+    MinetSend(sock,repl);
+    break;
+  }
+  case CLOSE: {
+    ConnectionList<TCPState>::iterator cs=FindExact(s.connection);
+    SockRequestResponse repl(STATUS,s.connection,Buffer(),0,cs!=clist.end() ? EOK : ENOMATCH);
+    repl.id=s.id;
+    MinetSend(sock,repl);
+    if (cs!=clist.end()) {
+      Close(cs,(double)now);
+    }
+    break;
+  }
+  case SETSOCKOPT:
+    if (s.data.GetSize()==sizeof(SockOption)) {
+      ConnectionList<TCPState>::iterator cs=FindExact(s.connection);
+      SockOption opt;
+      s.data.GetData((char *)&opt,sizeof(opt),0);
+      if (opt.level==IPPROTO_IP && opt.name==IP_MTU) {
+	// from an ICMP fragmentation needed message: what was in
+	// flight was dropped, so send it again in smaller segments.
+	// sock_module expects no reply.
+	if (cs!=clist.end() && (*cs).state.PathMtuReduced(opt.value,s.bytes)) {
+	  Retransmit(*cs,(double)now);
+	}
+	break;
+      }
+      int error=ENOMATCH;
+      if (cs!=clist.end()) {
+	error=(*cs).state.SetSocketOption(opt);
+	if (error==EOK && (*cs).state.GetState()==LISTEN) {
+	  // and the connections it has yet to make
+	  listeners[(*cs).connection.srcport].options.AddBack(s.data);
+	}
+	// turning TCP_NODELAY on or TCP_CORK off may free a short segment
+	SendData(cs,(double)now);
+      }
+      SockRequestResponse repl(STATUS,s.connection,Buffer(),0,error);
+      repl.id=s.id;
+      MinetSend(sock,repl);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Sends the delayed ACKs and handles the connection timers that are due
+static void ExpireTimers(const double now)
+{
+  std::vector<Connection> expired;
+  delacks.Expire(now,expired);
+  for (std::vector<Connection>::iterator c=expired.begin(); c!=expired.end(); ++c) {
+    ConnectionList<TCPState>::iterator cs=FindExact(*c);
+    if (cs!=clist.end() && (*cs).state.AckPending() && (*cs).state.GetDelayedAckDue()<=now) {
+      SendAck(*cs,now);
+    }
+  }
+  expired.clear();
+  clist.ExpireTimers(expired,Time(now));
+  for (std::vector<Connection>::iterator c=expired.begin(); c!=expired.end(); ++c) {
+    ConnectionList<TCPState>::iterator cs=FindExact(*c);
+    if (cs!=clist.end()) {
+      TimerExpired(cs,now);
+    }
+  }
+}
+
+// The sooner of two MinetGetNextEvent timeouts, where -1 is none
+static double Sooner(const double a, const double b)
+{
+  if (a<0) {
+    return b;
+  }
+  return (b<0 || a<b) ? a : b;
+}
+
+
+int main(int argc, char *argv[])
+{
   MinetInit(MINET_TCP_MODULE);
 
   mux=MinetIsModuleInConfig(MINET_IP_MUX) ? MinetConnect(MINET_IP_MUX) : MINET_NOHANDLE;
@@ -41,32 +922,28 @@ int main(int argc, char *argv[])
 
   MinetEvent event;
 
-  while (MinetGetNextEvent(event)==0) {
-    if (event.eventtype!=MinetEvent::Dataflow 
+  // wake up when the earliest connection timer or delayed ACK is due, if
+  // nothing comes first.  Timers are checked after every event, as under
+  // steady traffic MinetGetNextEvent never times out.
+  while (MinetGetNextEvent(event,Sooner(clist.NextTimeout(),delacks.TimeUntilNext((double)Time())))==0) {
+    if (event.eventtype==MinetEvent::Timeout) {
+      // a connection timer or delayed ACK is due
+    } else if (event.eventtype!=MinetEvent::Dataflow
 	|| event.direction!=MinetEvent::IN) {
       MinetSendToMonitor(MinetMonitoringEvent("Unknown event ignored."));
     } else {
       if (event.handle==mux) {
 	Packet p;
 	MinetReceive(mux,p);
-	unsigned tcphlen=TCPHeader::EstimateTCPHeaderLength(p);
-	cerr << "estimated header len="<<tcphlen<<"\n";
-	p.ExtractHeaderFromPayload<TCPHeader>(tcphlen);
-	IPHeader ipl=p.FindHeader(Headers::IPHeader);
-	TCPHeader tcph=p.FindHeader(Headers::TCPHeader);
-
-	cerr << "TCP Packet: IP Header is "<<ipl<<" and ";
-	cerr << "TCP Header is "<<tcph << " and ";
-
-	cerr << "Checksum is " << (tcph.IsCorrectChecksum(p) ? "VALID" : "INVALID");
-	
+	SegmentArrived(p);
       }
       if (event.handle==sock) {
 	SockRequestResponse s;
 	MinetReceive(sock,s);
-	cerr << "Received Socket Request:" << s << endl;
+	SockRequest(s);
       }
     }
+    ExpireTimers((double)Time());
   }
   return 0;
 }
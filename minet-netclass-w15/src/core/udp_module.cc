@@ -84,7 +84,7 @@ int main(int argc, char *argv[])
 	if (cs!=clist.end()) {
 	  udph.GetLength(len);
 	  len-=UDP_HEADER_LENGTH;
-	  Buffer &data = p.GetPayload().ExtractFront(len);
+	  Buffer data = p.GetPayload().ExtractFront(len);
 	  SockRequestResponse write(WRITE,
 				    (*cs).connection,
 				    data,
@@ -111,6 +111,7 @@ int main(int argc, char *argv[])
 	  { // ignored, send OK response
 	    SockRequestResponse repl;
 	    repl.type=STATUS;
+	    repl.id=req.id;
 	    repl.connection=req.connection;
 	    // buffer is zero bytes
 	    repl.bytes=0;
@@ -133,6 +134,10 @@ int main(int argc, char *argv[])
 	    ih.SetSourceIP(req.connection.src);
 	    ih.SetDestIP(req.connection.dest);
 	    ih.SetTotalLength(bytes+UDP_HEADER_LENGTH+IP_HEADER_BASE_LENGTH);
+	    // a datagram too big for one frame goes out in fragments
+	    if (bytes+UDP_HEADER_LENGTH+IP_HEADER_BASE_LENGTH>ETHERNET_DATA_MAX) {
+	      ih.SetFlags(0);
+	    }
 	    // push it onto the packet
 	    p.PushFrontHeader(ih);
 	    // Now build the UDP header
@@ -148,6 +153,7 @@ int main(int argc, char *argv[])
 	    SockRequestResponse repl;
 	    // repl.type=SockRequestResponse::STATUS;
 	    repl.type=STATUS;
+	    repl.id=req.id;
 	    repl.connection=req.connection;
 	    repl.bytes=bytes;
 	    repl.error=EOK;
@@ -168,6 +174,7 @@ int main(int argc, char *argv[])
 	    SockRequestResponse repl;
 	    // repl.type=SockRequestResponse::STATUS;
 	    repl.type=STATUS;
+	    repl.id=req.id;
 	    repl.connection=req.connection;
 	    repl.error=EOK;
 	    repl.bytes=0;
@@ -182,6 +189,7 @@ int main(int argc, char *argv[])
 	    repl.connection=req.connection;
 	    // repl.type=SockRequestResponse::STATUS;
 	    repl.type=STATUS;
+	    repl.id=req.id;
 	    if (cs==clist.end()) {
 	      repl.error=ENOMATCH;
 	    } else {
@@ -196,6 +204,7 @@ int main(int argc, char *argv[])
 	    SockRequestResponse repl;
 	    // repl.type=SockRequestResponse::STATUS;
 	    repl.type=STATUS;
+	    repl.id=req.id;
 	    repl.error=EWHAT;
 	    MinetSend(sock,repl);
 	  }
@@ -1,5 +1,6 @@
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -11,6 +12,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
 
 
 #include <cstdio>
@@ -23,6 +25,7 @@
 #include "error.h"
 #include "config.h"
 #include "util.h"
+#include "shmring.h"
 
 #define MONITOR   1
 
@@ -253,6 +256,17 @@ struct FifoData {
     MinetModule module;
     int         from;
     int         to;
+    ShmRing    *inring;
+    ShmRing    *outring;
+    unsigned    received;   // messages taken off this connection so far
+    bool        unpolled;   // epoll refused it (a regular file): always ready
+};
+
+// A connection found ready by the event engine but not yet handed out.
+// received lets us notice that the message was read in the meantime.
+struct ReadyData {
+    MinetHandle handle;
+    unsigned    received;
 };
 
 class Fifos : public std::deque<FifoData> {
@@ -280,12 +294,72 @@ static MinetModule MyModuleType = MINET_DEFAULT;
 static Fifos MyFifos;
 static int   MyNextHandle;
 static int   MyMonitorFifo      = -1;
+static int   MyEpollFD          = -1;
+static std::deque<ReadyData> MyReady;
 
 MinetHandle MinetGetNextHandle() {
     return MyNextHandle++;
 }
 
 
+// Connections are registered with the event engine once, here, rather
+// than on every MinetGetNextEvent.
+static void MinetAddFifo(FifoData &con)
+{
+    con.received=0;
+    con.unpolled=false;
+
+    if (con.from>=0) {
+        struct epoll_event ev;
+        ev.events=EPOLLIN;
+        ev.data.u64=con.handle;
+        if (MyEpollFD<0) {
+            MyEpollFD=epoll_create1(EPOLL_CLOEXEC);
+        }
+        if (epoll_ctl(MyEpollFD,EPOLL_CTL_ADD,con.from,&ev)<0) {
+            // select() called a regular file always readable; epoll
+            // won't take one at all, so we do what select() did
+            con.unpolled = errno==EPERM;
+            debug(0) << "Can't register connection " << con.handle << " with epoll: "
+                     << strerror(errno) << (con.unpolled ? ", treating it as always ready" : "") << endl;
+            MinetSendToMonitor(MinetMonitoringEvent("Can't register connection with epoll"));
+        }
+    }
+    MyFifos.push_back(con);
+}
+
+
+// Open one direction of a connection.  If MINET_RINGS names this fifo,
+// the data goes through a shared memory ring and the fifo only carries
+// doorbells.  The writer sets the ring up before its open() so that it
+// is ready by the time the reader's open() returns.
+static int MinetOpenFifo(const char *name, const bool writer, ShmRing * &ring)
+{
+    int fd;
+    bool useRing;
+
+    ring=0;
+    if (name==0) {
+        return -1;
+    }
+    useRing=ShmRing::IsConfigured(name);
+    if (useRing && writer && (ring=ShmRing::Create(name))==0) {
+        Die("Can't create shared memory ring.");
+    }
+
+    fd=open(name, writer ? O_WRONLY : O_RDONLY);
+
+    if (useRing && !writer && fd>=0 && (ring=ShmRing::Attach(name))==0) {
+        Die("Can't attach shared memory ring.");
+    }
+    if (ring!=0) {
+        debug(5) << tab << "Using shared memory ring for " << name << endl;
+        ring->Bind(fd);
+    }
+    return fd;
+}
+
+
 const char * MinetGetMonitorFifoName(const MinetModule &mod) {
 #if MONITOR
     const char * env = getenv("MINET_MONITOR");
@@ -369,8 +443,12 @@ int         MinetInit(const MinetModule &mod)
     assert(MyModuleType==MINET_DEFAULT);
     MyModuleType=mod;
     MyFifos.clear();
+    MyReady.clear();
     MyNextHandle=0;
     MyMonitorFifo=-1;
+    if (MyEpollFD<0) {
+        MyEpollFD=epoll_create1(EPOLL_CLOEXEC);
+    }
 
 
     signal(SIGPIPE,death);
@@ -418,6 +496,7 @@ int         MinetDeinit()
     assert(MyModuleType!=MINET_DEFAULT);
     MyModuleType=MINET_DEFAULT;
     MyFifos.clear();
+    MyReady.clear();
     MyNextHandle=0;
 
     MinetMonitoringEventDescription desc;
@@ -708,10 +787,10 @@ MinetHandle MinetConnect(const MinetModule &mod)
     con.handle=MinetGetNextHandle();
     con.module=mod;
 
-    con.from = fifofrom!=0 ? open(fifofrom,O_RDONLY) : -1;
-    con.to = fifoto!=0 ? open(fifoto,O_WRONLY) : -1;
+    con.from = MinetOpenFifo(fifofrom,false,con.inring);
+    con.to = MinetOpenFifo(fifoto,true,con.outring);
 
-    MyFifos.push_back(con);
+    MinetAddFifo(con);
 
     MinetMonitoringEventDescription desc;
 
@@ -971,12 +1050,12 @@ MinetHandle MinetAccept(const MinetModule &mod)
     con.handle=MinetGetNextHandle();
     con.module=mod;
 
-    con.to= fifoto !=0 ? open(fifoto,O_WRONLY) : -1;
-    con.from= fifofrom!=0 ? open(fifofrom,O_RDONLY) : -1 ;
+    con.to= MinetOpenFifo(fifoto,true,con.outring);
+    con.from= MinetOpenFifo(fifofrom,false,con.inring);
 
     debug(5) << tab << "In MinetAccept(): returned from open()" << endl;
 
-    MyFifos.push_back(con);
+    MinetAddFifo(con);
 
     MinetMonitoringEventDescription desc;
 
@@ -1000,8 +1079,10 @@ int MinetAddExternalConnection(const int inputfd, const int outputfd)
     con.module=MINET_EXTERNAL;
     con.to= outputfd;
     con.from= inputfd;
+    con.inring=0;
+    con.outring=0;
 
-    MyFifos.push_back(con);
+    MinetAddFifo(con);
 
     MinetMonitoringEventDescription desc;
 
@@ -1023,6 +1104,11 @@ int         MinetClose(const MinetHandle &mh)
     Fifos::iterator x=MyFifos.FindMatching(mh);
     if (x!=MyFifos.end())
     {
+        if ((*x).from>=0 && !(*x).unpolled) {
+            epoll_ctl(MyEpollFD,EPOLL_CTL_DEL,(*x).from,0);
+        }
+        delete (*x).inring;
+        delete (*x).outring;
         close((*x).from);
         close((*x).to);
         mod=(*x).module;
@@ -1058,91 +1144,186 @@ int MinetHandleToInputOutputFDs(const MinetHandle &h, int *inputfd, int *outputf
 }
 
 
-int MinetGetNextEvent(MinetEvent &event, double timeout)
+static void MinetDataflowEvent(MinetEvent &event, const FifoData &fifo)
 {
-    int maxfd;
-    fd_set read_fds;
-    int rc;
+    event.eventtype=MinetEvent::Dataflow;
+    event.direction=MinetEvent::IN;
+    event.handle=fifo.handle;
+    event.error=0;
+    event.overtime=0.0;
 
-    Time doneby(timeout);
+    MinetMonitoringEventDescription desc;
 
+    desc.timestamp=Time();
+    desc.source=MyModuleType;
+    desc.from=fifo.module;
+    desc.to=MyModuleType;
+    desc.datatype=MINET_MONITORINGEVENT;
+    desc.optype=MINET_GETNEXTEVENT;
 
+    MinetSendToMonitor(desc);
+}
 
-    while (1)
-	{
-        FD_ZERO(&read_fds);
-        maxfd=-1;
-        Fifos::iterator i;
-        for (i=MyFifos.begin(); i!=MyFifos.end(); ++i)
-        {
-            FD_SET((*i).from, &read_fds);
-            maxfd=std::max(maxfd,(*i).from);
-        }
-        if (timeout==-1 && maxfd==-1)
+
+static void MinetTimeoutEvent(MinetEvent &event, const Time &doneby)
+{
+    event.eventtype=MinetEvent::Timeout;
+    event.direction=MinetEvent::NONE;
+    event.handle=MINET_NOHANDLE;
+    event.error=0;
+    Time now;
+    event.overtime=(double)now - (double) doneby;
+    MinetSendToMonitor(MinetMonitoringEvent("MinetGetNextEvent returning with timeout"));
+}
+
+
+// Wait for connections to become ready and queue one entry per ready
+// connection on MyReady.  Every connection that is ready gets exactly one
+// turn before anyone is polled again, which keeps a busy peer from
+// starving the others.  Returns the number queued, 0 on timeout, <0 on
+// error.
+static int MinetPollReady(const Time &doneby, const bool forever)
+{
+    struct epoll_event evs[64];
+    bool ringready=false;
+    int rc;
+
+    if (MyFifos.empty() && forever)
+    {
+        MinetSendToMonitor(MinetMonitoringEvent("MinetGetNextEvent called without connections or timeout"));
+        return -1;
+    }
+
+    // rings are checked directly; their fifos only serve to wake us up.
+    // Whatever epoll could not take is ready every time.
+    for (Fifos::iterator i=MyFifos.begin(); i!=MyFifos.end(); ++i)
+    {
+        if ((*i).unpolled || ((*i).inring && !(*i).inring->PrepareToSleep()))
         {
-            MinetSendToMonitor(MinetMonitoringEvent("MinetGetNextEvent called without connections or timeout"));
-            return -1;
+            ReadyData r = { (*i).handle, (*i).received };
+            MyReady.push_back(r);
+            ringready=true;
         }
+    }
 
-        if (timeout!=-1)
+    while (1)
+    {
+        int ms=-1;
+        if (ringready)
         {
-            rc = select(maxfd+1, &read_fds,0,0,&doneby);
+            ms=0;
         }
-        else
+        else if (!forever)
         {
-            rc = select(maxfd+1, &read_fds,0,0,0);
+            double left=(double)doneby-(double)Time();
+            ms = left>0 ? (int)(left*1000.0+0.999) : 0;
         }
+
+        rc=epoll_wait(MyEpollFD,evs,sizeof(evs)/sizeof(evs[0]),ms);
+
         if (rc<0)
         {
             if (errno==EINTR)
             {
                 continue;
             }
-            else
+            MinetSendToMonitor(MinetMonitoringEvent("MinetGetNextEvent returning with unknown error"));
+            return -1;
+        }
+        for (int j=0; j<rc; j++)
+        {
+            Fifos::iterator i=MyFifos.FindMatching((MinetHandle)evs[j].data.u64);
+            if (i==MyFifos.end())
+            {
+                continue;
+            }
+            if ((*i).inring)
             {
-                MinetSendToMonitor(MinetMonitoringEvent("MinetGetNextEvent returning with unknown error"));
-                return -1;
+                // a ring already queued above, or a stale doorbell
+                if (ringready || ((*i).inring->DrainDoorbell() && !(*i).inring->HasData()))
+                {
+                    continue;
+                }
             }
+            ReadyData r = { (*i).handle, (*i).received };
+            MyReady.push_back(r);
         }
-        else if (rc==0)
+        if (!MyReady.empty() || ms==0)
         {
-            event.eventtype=MinetEvent::Timeout;
-            event.direction=MinetEvent::NONE;
-            event.handle=MINET_NOHANDLE;
-            event.error=0;
-            Time now;
-            event.overtime=(double)now - (double) doneby;
-            MinetSendToMonitor(MinetMonitoringEvent("MinetGetNextEvent returning with timeout"));
-            return 0;
+            return MyReady.size();
         }
-        else
+    }
+}
+
+// Hand out the next queued connection that is still ready.
+static bool MinetNextReady(MinetEvent &event)
+{
+    while (!MyReady.empty())
+    {
+        ReadyData r=MyReady.front();
+        MyReady.pop_front();
+
+        Fifos::iterator i=MyFifos.FindMatching(r.handle);
+        if (i==MyFifos.end())
         {
-            for (Fifos::iterator i=MyFifos.begin(); i!=MyFifos.end(); ++i)
-            {
-                if (FD_ISSET((*i).from, &read_fds))
-                {
-                    event.eventtype=MinetEvent::Dataflow;
-                    event.direction=MinetEvent::IN;
-                    event.handle=(*i).handle;
-                    event.error=0;
-                    event.overtime=0.0;
+            continue;
+        }
+        // someone has read from it since it was found ready; if there is
+        // more it will show up again next round
+        if ((*i).received!=r.received)
+        {
+            continue;
+        }
+        if ((*i).inring && !(*i).inring->HasData())
+        {
+            continue;
+        }
+        MinetDataflowEvent(event,*i);
+        return true;
+    }
+    return false;
+}
 
-                    MinetMonitoringEventDescription desc;
 
-                    desc.timestamp=Time();
-                    desc.source=MyModuleType;
-                    desc.from=(*i).module;
-                    desc.to=MyModuleType;
-                    desc.datatype=MINET_MONITORINGEVENT;
-                    desc.optype=MINET_GETNEXTEVENT;
+int MinetGetNextEvent(MinetEvent &event, double timeout)
+{
+    return MinetGetNextEvents(&event,1,timeout)==1 ? 0 : -1;
+}
 
-                    MinetSendToMonitor(desc);
 
-                    return 0;
-                }
-            }
+int MinetGetNextEvents(MinetEvent *events, const int maxevents, double timeout)
+{
+    Time doneby;
+    int n=0;
+    int rc;
+
+    if (timeout!=-1)
+    {
+        doneby=(double)doneby+timeout;
+    }
+
+    while (n==0)
+    {
+        while (n<maxevents && MinetNextReady(events[n]))
+        {
+            n++;
+        }
+        if (n>0)
+        {
+            break;
+        }
+        rc=MinetPollReady(doneby,timeout==-1);
+        if (rc<0)
+        {
+            return -1;
+        }
+        if (rc==0 && timeout!=-1 && !((double)Time()<(double)doneby))
+        {
+            MinetTimeoutEvent(events[0],doneby);
+            return 1;
         }
     }
+    return n;
 }
 
 #define MINET_IMPL(TYPE, MINETTYPE) 					\
@@ -1200,6 +1381,9 @@ int MinetSend(const MinetHandle &handle, const TYPE &object)	\
       return -1;						\
     } else {  							\
       object.Serialize((*fifo).to);				\
+      if ((*fifo).outring) {					\
+        (*fifo).outring->Commit();				\
+      }								\
     }								\
     return 0;							\
   }								\
@@ -1211,6 +1395,7 @@ int MinetReceive(const MinetHandle &handle, TYPE &object)	\
     return -1;							\
   } else {							\
     object.Unserialize((*fifo).from);				\
+    (*fifo).received++;						\
     if (MinetMonitorReceive(handle,object)) {			\
       return -1;						\
     } else {							\
@@ -9,8 +9,10 @@
 
 #include "buffer.h"
 #include "debug.h"
+#include "log.h"
 #include "error.h"
 #include "util.h"
+#include "checksum.h"
 
 #include "raw_ethernet_packet.h"
 #include "raw_ethernet_packet_buffer.h"
@@ -22,6 +24,7 @@
 #include "packet.h"
 
 #include "ip.h"
+#include "ipfrag.h"
 #include "icmp.h"
 #include "udp.h"
 #include "tcp.h"
@@ -141,6 +144,10 @@ MinetHandle MinetAddExternalConnection(const int inputfd, const int outputfd);
 int         MinetClose(const MinetHandle &mh);
 
 int         MinetGetNextEvent(MinetEvent &event, double timeout = -1);
+// Fills in up to maxevents events and returns how many.  Each ready
+// connection appears at most once per call and is good for one
+// MinetReceive.  A timeout is returned as a single Timeout event.
+int         MinetGetNextEvents(MinetEvent *events, const int maxevents, double timeout = -1);
 
 
 #define MINET_DECL(TYPE)					        \
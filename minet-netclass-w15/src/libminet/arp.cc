@@ -1,6 +1,7 @@
 #include "arp.h"
 
 #include <netinet/in.h>
+#include <sys/time.h>
 
 ARPPacket::ARPPacket() : Packet()
 {}
@@ -301,6 +302,7 @@ std::ostream & ARPRequestResponse::Print(std::ostream &os) const
        << ((flag == REQUEST)          ? "REQUEST" :
 	   (flag == RESPONSE_OK)      ? "RESPONSE_OK" :
 	   (flag == RESPONSE_UNKNOWN) ? "RESPONSE_UNKNOWN" :
+	   (flag == SUBSCRIBE)        ? "SUBSCRIBE" :
 	   "UNKNOWN_FLAG") 
        << ")";
     
@@ -308,25 +310,203 @@ std::ostream & ARPRequestResponse::Print(std::ostream &os) const
 }
 
 
+static double Now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+ARPCacheEntry::ARPCacheEntry() : state(INCOMPLETE), deadline(0), tries(0)
+{}
+
+std::ostream & ARPCacheEntry::Print(std::ostream &os) const
+{
+    os << "ARPCacheEntry"
+       << "( mapping="  << mapping
+       << ", state="    << ((state == INCOMPLETE) ? "INCOMPLETE" :
+			    (state == REACHABLE)  ? "REACHABLE" :
+			    (state == STALE)      ? "STALE" :
+			    (state == FAILED)     ? "FAILED" :
+			    (state == PERMANENT)  ? "PERMANENT" :
+			    "UNKNOWN_STATE")
+       << ", deadline=" << deadline
+       << ", tries="    << tries
+       << ")";
+
+    return os;
+}
+
+
+ARPCache::ARPCache(const double r, const double s, const double t, const unsigned m, const double n) :
+    reachable(r), stale(s), retrans(t), maxtries(m), negative(n), probestale(false), next(0)
+{}
+
+void ARPCache::Schedule(ARPCacheEntry &e, const ARPCacheEntry::State s, const double deadline)
+{
+    e.state    = s;
+    e.deadline = deadline;
+    if (s != ARPCacheEntry::PERMANENT && (next == 0 || deadline < next)) {
+	next = deadline;
+    }
+}
+
+void ARPCache::Update(const ARPRequestResponse &x, const double now, const bool permanent)
+{
+    ARPCacheEntry &e = data[x.ipaddr];
+
+    if (e.state == ARPCacheEntry::PERMANENT && !permanent) {
+	return;
+    }
+    e.mapping      = x;
+    e.mapping.flag = ARPRequestResponse::RESPONSE_OK;
+    e.tries        = 0;
+    if (permanent) {
+	Schedule(e, ARPCacheEntry::PERMANENT, 0);
+    } else {
+	Schedule(e, ARPCacheEntry::REACHABLE, now + reachable);
+    }
+}
+
 void ARPCache::Update(const ARPRequestResponse &x)
 {
-    data[x.ipaddr] = x;
+    Update(x, Now());
 }
 
 void ARPCache::Lookup(ARPRequestResponse &x) const
 {
     DataType::const_iterator i = data.find(x.ipaddr);
     
-    if (i == data.end()) {
+    if (i == data.end() || !(*i).second.IsUsable()) {
 	x.flag = ARPRequestResponse::RESPONSE_UNKNOWN;
     } else {
-	x = (*i).second;
+	x = (*i).second.mapping;
     }
 }
 
+const EthernetAddr *ARPCache::Find(const IPAddress &a) const
+{
+    DataType::const_iterator i = data.find(a);
+
+    return (i == data.end() || !(*i).second.IsUsable()) ? 0 : &((*i).second.mapping.ethernetaddr);
+}
+
 void ARPCache::Delete(const IPAddress &ipaddr)
 {
-    data.erase(data.find(ipaddr));
+    data.erase(ipaddr);
+}
+
+bool ARPCache::Resolve(ARPRequestResponse &x, const double now)
+{
+    DataType::iterator i = data.find(x.ipaddr);
+
+    if (i == data.end()) {
+	ARPCacheEntry &e = data[x.ipaddr];
+	e.mapping = ARPRequestResponse(x.ipaddr, ETHERNET_BLANK_ADDR, ARPRequestResponse::RESPONSE_UNKNOWN);
+	e.tries   = 1;
+	Schedule(e, ARPCacheEntry::INCOMPLETE, now + retrans);
+	x.flag = ARPRequestResponse::RESPONSE_UNKNOWN;
+	stats.misses++;
+	stats.requests++;
+	return true;
+    }
+
+    ARPCacheEntry &e = (*i).second;
+
+    switch (e.state) {
+    case ARPCacheEntry::INCOMPLETE:
+	x.flag = ARPRequestResponse::RESPONSE_UNKNOWN;
+	stats.misses++;
+	return false;
+    case ARPCacheEntry::FAILED:
+	x.flag = ARPRequestResponse::RESPONSE_UNKNOWN;
+	stats.negativehits++;
+	return false;
+    case ARPCacheEntry::STALE:
+	x = e.mapping;
+	stats.hits++;
+	if (e.tries == 0) {
+	    // still good enough to use, but check it is
+	    e.tries = 1;
+	    Schedule(e, ARPCacheEntry::STALE, now + retrans);
+	    stats.requests++;
+	    return true;
+	}
+	return false;
+    default:
+	x = e.mapping;
+	stats.hits++;
+	return false;
+    }
+}
+
+void ARPCache::Expire(const double now, std::vector<IPAddress> &retry, std::vector<IPAddress> &gone)
+{
+    if (next == 0 || now < next) {
+	return;
+    }
+    next = 0;
+
+    for (DataType::iterator i = data.begin(); i != data.end(); ) {
+	ARPCacheEntry &e = (*i).second;
+
+	if (e.state == ARPCacheEntry::PERMANENT) {
+	    ++i;
+	    continue;
+	}
+	if (e.deadline > now) {
+	    Schedule(e, e.state, e.deadline);
+	    ++i;
+	    continue;
+	}
+
+	switch (e.state) {
+	case ARPCacheEntry::REACHABLE:
+	    Schedule(e, ARPCacheEntry::STALE, now + stale);
+	    break;
+	case ARPCacheEntry::INCOMPLETE:
+	case ARPCacheEntry::STALE:
+	    if (e.tries == 0 && probestale && e.state == ARPCacheEntry::STALE) {
+		// nobody asked for it here, but it may be in use elsewhere
+		retry.push_back((*i).first);
+		e.tries = 1;
+		Schedule(e, e.state, now + retrans);
+		stats.requests++;
+		break;
+	    }
+	    if (e.tries == 0) {
+		// stale and nobody asked for it
+		gone.push_back((*i).first);
+		i = data.erase(i);
+		continue;
+	    }
+	    if (e.tries >= maxtries) {
+		gone.push_back((*i).first);
+		e.tries = 0;
+		Schedule(e, ARPCacheEntry::FAILED, now + negative);
+		stats.failures++;
+		break;
+	    }
+	    retry.push_back((*i).first);
+	    Schedule(e, e.state, now + retrans * (1U << e.tries));
+	    e.tries++;
+	    stats.requests++;
+	    break;
+	default:
+	    i = data.erase(i);
+	    continue;
+	}
+	++i;
+    }
+}
+
+double ARPCache::TimeUntilNext(const double now) const
+{
+    if (next == 0) {
+	return -1;
+    }
+    return (next > now) ? next - now : 0;
 }
 
 std::ostream & operator<< (std::ostream &os, std::pair<IPAddress,ARPRequestResponse> &pair)
@@ -337,10 +517,100 @@ std::ostream & operator<< (std::ostream &os, std::pair<IPAddress,ARPRequestRespo
 
 std::ostream & ARPCache::Print(std::ostream &os) const
 {
-    os << "ARPCache" << "( size=" << data.size();
+    os << "ARPCache" << "( size=" << data.size()
+       << " hits=" << stats.hits << " misses=" << stats.misses
+       << " negativehits=" << stats.negativehits << " requests=" << stats.requests
+       << " failures=" << stats.failures;
 
     os << " contents={";    
-    for_each(data.begin(), data.end() ,PrintFunc<std::pair<IPAddress,ARPRequestResponse> >(os));
+    for (DataType::const_iterator i = data.begin(); i != data.end(); ++i) {
+	os << (*i).second << " ";
+    }
+    os << "}";
+
+    os << ")";
+
+    return os;
+}
+
+
+ARPPendingQueues::ARPPendingQueues(const size_t mp, const unsigned mt, const double iv) :
+    maxpackets(mp), maxtries(mt), interval(iv), dropped(0)
+{}
+
+bool ARPPendingQueues::Enqueue(const IPAddress &a, const Packet &p, const double now)
+{
+    std::pair<DataType::iterator, bool> r = data.insert(std::make_pair(a, Pending()));
+    Pending &q = (*r.first).second;
+
+    if (r.second) {
+	q.next  = now + interval;
+	q.tries = 1;
+    }
+    if (q.packets.size() >= maxpackets) {
+	q.packets.pop_front();
+	dropped++;
+    }
+    q.packets.push_back(p);
+
+    return r.second;
+}
+
+bool ARPPendingQueues::Take(const IPAddress &a, std::deque<Packet> &out)
+{
+    DataType::iterator i = data.find(a);
+
+    if (i == data.end()) {
+	return false;
+    }
+    out.swap((*i).second.packets);
+    data.erase(i);
+    return true;
+}
+
+void ARPPendingQueues::Expire(const double now, std::vector<IPAddress> &retry, std::vector<IPAddress> &failed)
+{
+    for (DataType::iterator i = data.begin(); i != data.end(); ) {
+	Pending &q = (*i).second;
+	if (q.next > now) {
+	    ++i;
+	} else if (q.tries >= maxtries) {
+	    failed.push_back((*i).first);
+	    dropped += q.packets.size();
+	    i = data.erase(i);
+	} else {
+	    retry.push_back((*i).first);
+	    q.tries++;
+	    q.next = now + interval;
+	    ++i;
+	}
+    }
+}
+
+double ARPPendingQueues::TimeUntilNext(const double now) const
+{
+    double best = -1;
+
+    for (DataType::const_iterator i = data.begin(); i != data.end(); ++i) {
+	double left = (*i).second.next - now;
+	if (left < 0) {
+	    left = 0;
+	}
+	if (best < 0 || left < best) {
+	    best = left;
+	}
+    }
+    return best;
+}
+
+std::ostream & ARPPendingQueues::Print(std::ostream &os) const
+{
+    os << "ARPPendingQueues" << "( size=" << data.size() << " dropped=" << dropped;
+
+    os << " contents={";
+    for (DataType::const_iterator i = data.begin(); i != data.end(); ++i) {
+	os << (*i).first << ":" << (*i).second.packets.size() << "/" << (*i).second.tries << " ";
+    }
     os << "}";
 
     os << ")";
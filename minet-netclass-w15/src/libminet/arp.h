@@ -3,6 +3,8 @@
 
 #include <functional>
 #include <unordered_map>
+#include <deque>
+#include <vector>
 // Note: Looks like "hash_map" is deprecated and we're supposed to use "unordered_map" now.
 // However, unordered_map is not yet part of standard C++, so that's not ideal, either.-------
 //
@@ -165,7 +167,11 @@ struct ARPRequestResponse {
     IPAddress    ipaddr;
     EthernetAddr ethernetaddr;
 
-    enum Flag {REQUEST = 1, RESPONSE_OK = 2, RESPONSE_UNKNOWN = 4} flag;
+    // SUBSCRIBE asks arp_module to push a RESPONSE_OK to the sender for
+    // every entry it has now and every entry it learns or changes later,
+    // so the sender can keep its own copy of the cache and resolve
+    // without a round trip.  REQUESTs still get an immediate response.
+    enum Flag {REQUEST = 1, RESPONSE_OK = 2, RESPONSE_UNKNOWN = 4, SUBSCRIBE = 8} flag;
     
     ARPRequestResponse();
     ARPRequestResponse(const ARPRequestResponse &rhs);
@@ -207,18 +213,109 @@ struct hashipaddress : public std::hash<unsigned> {
 std::ostream & operator<< (std::ostream &os, const std::pair<IPAddress, ARPRequestResponse> &pair);
 
 
+//
+// One neighbor.  INCOMPLETE entries have a request out and no address
+// yet.  REACHABLE entries were confirmed within the last reachable
+// seconds; after that they go STALE, which are still used but get
+// re-requested the next time somebody asks for them, and are forgotten
+// if nobody does for a while.  With SetProbeStale, for a cache whose
+// users look addresses up in copies of their own, a STALE entry nobody
+// asked about is requested again instead of being forgotten, and goes
+// only if it does not answer.  An address that did not answer maxtries
+// requests is FAILED, a negative entry that answers lookups with
+// RESPONSE_UNKNOWN (without asking the network again) until it times
+// out.  PERMANENT entries, such as our own address, never change on
+// their own.
+//
+struct ARPCacheEntry {
+    enum State {INCOMPLETE, REACHABLE, STALE, FAILED, PERMANENT} state;
+
+    ARPRequestResponse mapping;
+    // when the entry next changes on its own: the next retry while a
+    // request is out, otherwise the end of the current state
+    double             deadline;
+    // requests sent without an answer
+    unsigned           tries;
+
+    ARPCacheEntry();
+
+    bool IsUsable() const { return state == REACHABLE || state == STALE || state == PERMANENT; }
+
+    std::ostream & Print(std::ostream &os) const;
+
+    friend std::ostream &operator<<(std::ostream &os, const ARPCacheEntry& e) {
+	return e.Print(os);
+    }
+};
+
+struct ARPCacheStats {
+    size_t hits;          // lookups answered with an address
+    size_t misses;        // lookups that found nothing or an INCOMPLETE entry
+    size_t negativehits;  // lookups answered from a FAILED entry
+    size_t requests;      // requests that should have gone out, retries included
+    size_t failures;      // entries that went FAILED
+
+    ARPCacheStats() : hits(0), misses(0), negativehits(0), requests(0), failures(0) {}
+};
+
+
 class ARPCache {
  private:
 
     //typedef hash_map<IPAddress,ARPRequestResponse,hashipaddress,eqipaddress> DataType;
-    typedef std::unordered_map<IPAddress, ARPRequestResponse, hashipaddress, eqipaddress> DataType;
+    typedef std::unordered_map<IPAddress, ARPCacheEntry, hashipaddress, eqipaddress> DataType;
 
     DataType data;
 
+    double   reachable;
+    double   stale;
+    double   retrans;
+    unsigned maxtries;
+    double   negative;
+    bool     probestale;
+
+    // no entry changes on its own before this
+    double   next;
+
+    ARPCacheStats stats;
+
+    void Schedule(ARPCacheEntry &e, const ARPCacheEntry::State s, const double deadline);
+
  public:
+    typedef DataType::const_iterator const_iterator;
+
+    // Times are in seconds.  Requests are retried after retrans, 2*retrans,
+    // 4*retrans, ... seconds until maxtries have gone unanswered.
+    ARPCache(const double reachable=30, const double stale=60,
+	     const double retrans=1, const unsigned maxtries=3, const double negative=20);
+
+    // Records a confirmed address (x.flag is ignored)
+    void Update(const ARPRequestResponse &x, const double now, const bool permanent=false);
     void Update(const ARPRequestResponse &x);
     void Delete(const IPAddress &a);
+    // Answers from what is known, without counting or changing anything
     void Lookup(ARPRequestResponse &x) const;
+    // Returns 0 unless there is a usable address for a
+    const EthernetAddr *Find(const IPAddress &a) const;
+
+    // Answers a lookup for x.ipaddr in x and returns true if a request
+    // for it should be sent now.  At most one request per address is
+    // ever outstanding; the rest come from Expire.
+    bool Resolve(ARPRequestResponse &x, const double now);
+    // Moves entries along: retry holds the addresses whose request is due
+    // to be sent again, gone those that were usable or being resolved
+    // and no longer are.  Cheap when nothing is due.
+    void Expire(const double now, std::vector<IPAddress> &retry, std::vector<IPAddress> &gone);
+    // Seconds until Expire next has something to do, -1 if never
+    double TimeUntilNext(const double now) const;
+    // Whether STALE entries are checked before they are forgotten
+    void SetProbeStale(const bool probe) { probestale = probe; }
+
+    const ARPCacheStats &GetStats() const { return stats; }
+    size_t size() const { return data.size(); }
+
+    const_iterator begin() const { return data.begin(); }
+    const_iterator end() const { return data.end(); }
     
     std::ostream & Print(std::ostream &os) const;
     
@@ -228,5 +325,53 @@ class ARPCache {
 };
 
 
+//
+// Outgoing packets parked until their next hop resolves.  The first
+// packet to an unresolved address opens a queue for it and should
+// trigger an ARP request; later packets just join the queue (the oldest
+// is dropped once it is full).  When the address resolves, Take hands
+// back the queue in order.  Expire reports queues whose request is due
+// for a retry, and gives up on (and empties) queues that have been
+// retried maxtries times without an answer.  Times are in seconds, as
+// doubles, like everything else that schedules in Minet.
+//
+class ARPPendingQueues {
+ private:
+    struct Pending {
+	std::deque<Packet> packets;
+	double             next;
+	unsigned           tries;
+    };
+    typedef std::unordered_map<IPAddress, Pending, hashipaddress, eqipaddress> DataType;
+
+    DataType data;
+    size_t   maxpackets;
+    unsigned maxtries;
+    double   interval;
+    size_t   dropped;
+
+ public:
+    ARPPendingQueues(const size_t maxpackets=16, const unsigned maxtries=3, const double interval=1.0);
+
+    // True if this opened a new queue, ie, a request should go out now
+    bool Enqueue(const IPAddress &a, const Packet &p, const double now);
+    // False if nothing was waiting for a
+    bool Take(const IPAddress &a, std::deque<Packet> &out);
+    void Expire(const double now, std::vector<IPAddress> &retry, std::vector<IPAddress> &failed);
+    // Seconds until Expire next has something to do, -1 if never
+    double TimeUntilNext(const double now) const;
+
+    bool   IsPending(const IPAddress &a) const { return data.find(a)!=data.end(); }
+    size_t size() const { return data.size(); }
+    size_t NumDropped() const { return dropped; }
+
+    std::ostream & Print(std::ostream &os) const;
+
+    friend std::ostream &operator<<(std::ostream &os, const ARPPendingQueues& q) {
+	return q.Print(os);
+    }
+};
+
+
 
 #endif
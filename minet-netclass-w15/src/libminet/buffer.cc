@@ -1,17 +1,28 @@
+#include <string.h>
 #include "buffer.h"
 #include "util.h"
 
 
-Buffer::Buffer()
+Buffer::Buffer() : size(0)
 {
 }
 
-Buffer::Buffer(const char * data, size_t size) : datarope(data, size)
+Buffer::Buffer(const char * data, size_t len) : size(0)
+{
+  if (len>0) {
+    slices.push_back(Slice(std::make_shared<std::string>(data,len),0,len));
+    size=len;
+  }
+}
+
+Buffer::Buffer(const Buffer &rhs) : slices(rhs.slices), size(rhs.size)
 {
 }
 
-Buffer::Buffer(const Buffer &rhs) : datarope(rhs.datarope)
+Buffer::Buffer(Buffer &&rhs) : slices(std::move(rhs.slices)), size(rhs.size)
 {
+  rhs.slices.clear();
+  rhs.size=0;
 }
 
 Buffer::~Buffer()
@@ -19,165 +30,356 @@ Buffer::~Buffer()
 }
 
 
+// Find the slice holding byte offset, and the position within it.
+// offset==size yields slice==slices.size().
+void Buffer::Locate(unsigned offset, unsigned &slice, size_t &within) const
+{
+  for (slice=0; slice<slices.size(); slice++) {
+    if (offset<slices[slice].len) {
+      within=offset;
+      return;
+    }
+    offset-=slices[slice].len;
+  }
+  within=0;
+}
+
+// Make sure a slice boundary exists at offset and return the index of
+// the slice that starts there.  Neither slice's bytes are touched.
+unsigned Buffer::Split(unsigned offset)
+{
+  unsigned i;
+  size_t within;
+
+  Locate(offset,i,within);
+  if (within==0) {
+    return i;
+  }
+  Slice tail(slices[i].block, slices[i].offset+within, slices[i].len-within);
+  slices[i].len=within;
+  slices.insert(slices.begin()+i+1,tail);
+  return i+1;
+}
+
+// Give slice i a block of its own if it shares one, and return a pointer
+// to its first byte.
+char * Buffer::MakeWritable(unsigned i)
+{
+  Slice &s=slices[i];
+  if (!s.block.unique()) {
+    s.block=std::make_shared<std::string>(s.block->data()+s.offset,s.len);
+    s.offset=0;
+  }
+  return &((*s.block)[s.offset]);
+}
+
+void Buffer::Append(const char *buf, size_t len)
+{
+  if (len==0) {
+    return;
+  }
+  if (slices.size()>0) {
+    Slice &s=slices.back();
+    if (s.block.unique() && s.offset+s.len==s.block->size()) {
+      if (buf) {
+	s.block->append(buf,len);
+      } else {
+	s.block->append(len,0);
+      }
+      s.len+=len;
+      size+=len;
+      return;
+    }
+  }
+  std::shared_ptr<std::string> b = buf ? std::make_shared<std::string>(buf,len)
+                                       : std::make_shared<std::string>(len,0);
+  slices.push_back(Slice(b,0,len));
+  size+=len;
+}
+
+// Merge slice i into slice i-1 if it continues the same block, or if
+// the two are small enough that copying them beats carrying both.
+void Buffer::Coalesce(unsigned i)
+{
+  if (i==0 || i>=slices.size()) {
+    return;
+  }
+  Slice &a=slices[i-1];
+  const Slice &b=slices[i];
+
+  if (a.block==b.block && a.offset+a.len==b.offset) {
+    a.len+=b.len;
+  } else if (a.len+b.len<=BUFFER_COALESCE) {
+    if (!a.block.unique() || a.offset+a.len!=a.block->size()) {
+      std::shared_ptr<std::string> n=std::make_shared<std::string>();
+      n->reserve(BUFFER_COALESCE);
+      n->append(a.block->data()+a.offset,a.len);
+      a.block=n;
+      a.offset=0;
+    }
+    a.block->append(b.block->data()+b.offset,b.len);
+    a.len+=b.len;
+  } else {
+    return;
+  }
+  slices.erase(slices.begin()+i);
+}
+
+
 char Buffer::operator[] (const unsigned offset)
 {
-    return datarope[offset];
+  unsigned i;
+  size_t within;
+
+  Locate(offset,i,within);
+  if (i>=slices.size()) {
+    return 0;
+  }
+  return (*slices[i].block)[slices[i].offset+within];
 }
 
 const Buffer & Buffer::operator = (const Buffer & rhs)
 {
-    datarope = rhs.datarope;
-    return *this;
+  slices = rhs.slices;
+  size = rhs.size;
+  return *this;
+}
+
+const Buffer & Buffer::operator = (Buffer && rhs)
+{
+  if (this!=&rhs) {
+    slices.swap(rhs.slices);
+    size = rhs.size;
+    rhs.slices.clear();
+    rhs.size = 0;
+  }
+  return *this;
 }
 
 void Buffer::Clear()
 {
-    datarope.erase(0, datarope.size());
+  slices.clear();
+  size=0;
 }
 
 void Buffer::Insert(const Buffer &rhs, unsigned offset)
 {
-    datarope.insert(offset, rhs.datarope);
+  if (rhs.size==0) {
+    return;
+  }
+  if (offset>size) {
+    offset=size;
+  }
+  std::deque<Slice> add(rhs.slices);
+  unsigned i=Split(offset);
+  slices.insert(slices.begin()+i,add.begin(),add.end());
+  size+=rhs.size;
+  Coalesce(i+add.size());
+  Coalesce(i);
 }
 
 
 void Buffer::AddBack(const Buffer &rhs)
 {
-    datarope += rhs.datarope;
+  Insert(rhs,size);
 }
 
 void Buffer::AddFront(const Buffer &rhs)
 {
-    datarope.insert(0, rhs.datarope);
+  Insert(rhs,0);
 }
 
-void Buffer::Erase(unsigned offset, size_t size)
+void Buffer::Erase(unsigned offset, size_t len)
 {
-    datarope.erase(offset, size);
+  if (offset>=size) {
+    return;
+  }
+  len=MIN(len,size-offset);
+  unsigned i=Split(offset);
+  unsigned j=Split(offset+len);
+  slices.erase(slices.begin()+i,slices.begin()+j);
+  size-=len;
 }
 
-Buffer & Buffer::Extract(unsigned offset, size_t size)
+void Buffer::Extract(unsigned offset, size_t len, Buffer &out)
 {
-    Buffer * temp = new Buffer();
+  if (&out==this) {
+    return;
+  }
+  out.Clear();
+  if (offset>=size) {
+    return;
+  }
+  len=MIN(len,size-offset);
+  unsigned i=Split(offset);
+  unsigned j=Split(offset+len);
+  out.slices.assign(slices.begin()+i,slices.begin()+j);
+  out.size=len;
+  slices.erase(slices.begin()+i,slices.begin()+j);
+  size-=len;
+}
 
-    temp->datarope = datarope.substr(offset, size);
-    datarope.erase(offset, size);
+void Buffer::ExtractFront(size_t len, Buffer &out)
+{
+  Extract(0,len,out);
+}
 
-    return *temp;
+void Buffer::ExtractBack(size_t len, Buffer &out)
+{
+  Extract(len<size ? size-len : 0,len,out);
 }
 
-Buffer & Buffer::ExtractFront(size_t size)
+Buffer Buffer::Extract(unsigned offset, size_t len)
 {
-    return Extract(0,size);
+  Buffer temp;
+  Extract(offset,len,temp);
+  return temp;
 }
 
+Buffer Buffer::ExtractFront(size_t len)
+{
+  Buffer temp;
+  ExtractFront(len,temp);
+  return temp;
+}
 
-Buffer & Buffer::ExtractBack(size_t size)
+Buffer Buffer::ExtractBack(size_t len)
 {
-    return Extract(GetSize()-size,size);
+  Buffer temp;
+  ExtractBack(len,temp);
+  return temp;
 }
 
 size_t Buffer::GetSize() const
 {
-  return datarope.size();
+  return size;
 }
 
-size_t Buffer::GetData(char *buf, size_t size, unsigned offset) const
+unsigned Buffer::GetNumSlices() const
 {
-  //  datarope.copy(offset,size,buf);
-  //  ROPE_COPY(datarope,offset,size,buf);
+  return slices.size();
+}
 
-  // MIGHT REGRET: making crope -> string conversion permanent
-  datarope.copy(buf, size, offset);
+const char *Buffer::GetSlice(unsigned i, size_t &len) const
+{
+  len=slices[i].len;
+  return slices[i].block->data()+slices[i].offset;
+}
 
-  return size;
+size_t Buffer::GetData(char *buf, size_t len, unsigned offset) const
+{
+  unsigned i;
+  size_t within;
+  size_t done=0;
+
+  Locate(offset,i,within);
+  for (;i<slices.size() && done<len; i++, within=0) {
+    size_t n=MIN(len-done,slices[i].len-within);
+    memcpy(buf+done,slices[i].block->data()+slices[i].offset+within,n);
+    done+=n;
+  }
+
+  return len;
 }
 
 size_t Buffer::SetData(const char *buf, size_t len, unsigned offset)
 {
-  size_t size=datarope.size();
+  if (offset>size) {
+    Append(0,offset-size);
+  }
 
-  if ((offset + len) <= size) {
-    datarope.replace(offset,len,buf,len);
-  } else if (offset>=size) {
-    if (offset-size>0) {
-      datarope.append(offset-size,0);
-    }
-    datarope.append(buf,len);
-  } else {
-    size_t r1=size-offset;
-    size_t r2=offset+len-size;
-    if (r1>0) {
-      datarope.replace(offset,r1,buf,r1);
-    }
-    if (r2>0) {
-      datarope.append(&(buf[r1]),r2);
+  size_t over=MIN(len,size-offset);
+
+  if (over>0) {
+    unsigned i;
+    size_t within;
+    size_t done=0;
+    Locate(offset,i,within);
+    for (;done<over; i++, within=0) {
+      size_t n=MIN(over-done,slices[i].len-within);
+      memcpy(MakeWritable(i)+within,buf+done,n);
+      done+=n;
     }
   }
+  Append(buf+over,len-over);
   return len;
 }
 
+// The length and then the slices, BUFFER_SERIALIZE_IOVS to a writev,
+// since writev takes no more than IOV_MAX
 void Buffer::Serialize(const int fd) const
 {
-  int size = GetSize();
-  char *buf = new char [size];
-
-  if (writeall(fd,(char*)&size,sizeof(size),0,1)!=sizeof(size)) {
-    throw SerializationException();
-  }
-
-  GetData(buf,size,0);
-
-  if (writeall(fd,buf,size,0,1)!=size) {
-    throw SerializationException();
+  int len = GetSize();
+  struct iovec iov[BUFFER_SERIALIZE_IOVS];
+  int n=1, want=sizeof(len);
+
+  iov[0].iov_base=&len;
+  iov[0].iov_len=sizeof(len);
+  for (unsigned i=0;i<=slices.size();i++) {
+    if (n==BUFFER_SERIALIZE_IOVS || (i==slices.size() && n>0)) {
+      if (writevall(fd,iov,n)!=want) {
+	throw SerializationException();
+      }
+      n=0;
+      want=0;
+    }
+    if (i<slices.size()) {
+      iov[n].iov_base=(void*)(slices[i].block->data()+slices[i].offset);
+      iov[n].iov_len=slices[i].len;
+      want+=slices[i].len;
+      n++;
+    }
   }
-
-  delete [] buf;
 }
 
 void Buffer::Unserialize(const int fd)
 {
-  int size;
-
-  if (readall(fd,(char*)&size,sizeof(size))!=sizeof(size)) {
-    throw SerializationException();
-  }
-
-  char *buf = new char[size];
+  int len;
 
-  if (readall(fd,buf,size)!=size) {
+  if (readall(fd,(char*)&len,sizeof(len))!=sizeof(len)) {
     throw SerializationException();
   }
 
-  datarope = std::string(buf,size);
+  Clear();
 
-  delete [] buf;
+  if (len>0) {
+    std::shared_ptr<std::string> b = std::make_shared<std::string>(len,0);
 
+    if (readall(fd,&((*b)[0]),len)!=len) {
+      throw SerializationException();
+    }
+    slices.push_back(Slice(b,0,len));
+    size=len;
+  }
 }
 
 
 std::ostream & Buffer::Print(std::ostream &os) const
 {
-  size_t size=GetSize();
   char hex[2];
   unsigned i;
+  size_t j;
 
   os<<"Buffer(size="<<size<<", data=";
-  for (i=0;i<size;i++) {
-    bytetohexbyte(datarope[i],hex);
-    os<<hex[0]<<hex[1];
+  for (i=0;i<slices.size();i++) {
+    const char *p=slices[i].block->data()+slices[i].offset;
+    for (j=0;j<slices[i].len;j++) {
+      bytetohexbyte(p[j],hex);
+      os<<hex[0]<<hex[1];
+    }
   }
   os<<", text=\"";
-  for (i=0;i<size;i++) {
-    char c=datarope[i];
-    if (c>=32 && c<=126) {
-      os<<c;
-    } else {
-      os<<'.';
+  for (i=0;i<slices.size();i++) {
+    const char *p=slices[i].block->data()+slices[i].offset;
+    for (j=0;j<slices[i].len;j++) {
+      char c=p[j];
+      if (c>=32 && c<=126) {
+	os<<c;
+      } else {
+	os<<'.';
+      }
     }
   }
   os << "\")";
   return os;
 }
-
-
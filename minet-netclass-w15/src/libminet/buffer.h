@@ -3,20 +3,48 @@
 
 #include <iostream>
 #include <string>
+#include <deque>
+#include <memory>
 //#include <rope>
 #include "config.h"
 #include "util.h"
 
 
+//
+// A Buffer is a chain of slices of reference counted byte blocks.
+// A block is never written while anyone else refers to it, so copying,
+// splitting, prepending and appending only shuffle slice descriptors.
+// SetData copies a slice's bytes only if its block is shared.
+// Slices are kept in a deque, so adding at either end is O(1), and
+// where two meet they are merged if they continue the same block or are
+// together no more than BUFFER_COALESCE bytes, so a buffer built up from
+// many small pieces does not become a long chain of them.
+//
 class Buffer {
  private:
-  std::string datarope;
+  struct Slice {
+    std::shared_ptr<std::string> block;
+    size_t offset;
+    size_t len;
+    Slice() : offset(0), len(0) {}
+    Slice(const std::shared_ptr<std::string> &b, size_t o, size_t l) : block(b), offset(o), len(l) {}
+  };
+  std::deque<Slice> slices;
+  size_t size;
+
+  void   Locate(unsigned offset, unsigned &slice, size_t &within) const;
+  unsigned Split(unsigned offset);
+  char * MakeWritable(unsigned slice);
+  void   Append(const char *buf, size_t len);
+  void   Coalesce(unsigned slice);
  public:
   Buffer();
   Buffer(const char *data, size_t size);
   Buffer(const Buffer &rhs);
+  Buffer(Buffer &&rhs);
   virtual ~Buffer();
   virtual const Buffer & operator = (const Buffer &rhs);
+  virtual const Buffer & operator = (Buffer &&rhs);
 
   virtual char operator [] (const unsigned offset);
 
@@ -27,14 +55,23 @@ class Buffer {
   virtual void AddBack(const Buffer &rhs);
   virtual void Erase(unsigned offset, size_t size);
 
-  virtual Buffer & Extract(unsigned offset, size_t size);
-  virtual Buffer & ExtractFront(size_t size);
-  virtual Buffer & ExtractBack(size_t size);
+  virtual Buffer Extract(unsigned offset, size_t size);
+  virtual Buffer ExtractFront(size_t size);
+  virtual Buffer ExtractBack(size_t size);
+
+  // Split in place: the extracted bytes replace the contents of out
+  virtual void Extract(unsigned offset, size_t size, Buffer &out);
+  virtual void ExtractFront(size_t size, Buffer &out);
+  virtual void ExtractBack(size_t size, Buffer &out);
 
   virtual size_t GetSize() const;
   virtual size_t GetData(char *buf, size_t size, unsigned offset) const;
   virtual size_t SetData(const char *buf, size_t size, unsigned offset);
 
+  // Direct read-only access to the underlying slices, in order
+  virtual unsigned GetNumSlices() const;
+  virtual const char *GetSlice(unsigned i, size_t &len) const;
+
   virtual void Serialize(const int fd) const;
   virtual void Unserialize(const int fd);
 
@@ -55,13 +92,20 @@ class TaggedBuffer : public Buffer {
   TaggedBuffer(TAGTYPE t) : Buffer(), tag(t) {}
   TaggedBuffer(TAGTYPE t, const char *data, size_t size) : Buffer(data,size), tag(t)  {}
   TaggedBuffer(const TaggedBuffer<TAGTYPE> &rhs) : Buffer(rhs), tag(rhs.tag) {}
+  TaggedBuffer(TaggedBuffer<TAGTYPE> &&rhs) : Buffer(std::move(rhs)), tag(rhs.tag) {}
   TaggedBuffer(TAGTYPE t, const Buffer &rhs) : Buffer(rhs), tag(t) {}
+  TaggedBuffer(TAGTYPE t, Buffer &&rhs) : Buffer(std::move(rhs)), tag(t) {}
   virtual ~TaggedBuffer() {}
   virtual const TaggedBuffer<TAGTYPE> & operator = (const TaggedBuffer<TAGTYPE> &rhs) {
     tag=rhs.tag;
     Buffer::operator=(rhs);
     return *this;
   }
+  virtual const TaggedBuffer<TAGTYPE> & operator = (TaggedBuffer<TAGTYPE> &&rhs) {
+    tag=rhs.tag;
+    Buffer::operator=(std::move(rhs));
+    return *this;
+  }
 
   virtual TAGTYPE GetTag() const { return tag;}
 
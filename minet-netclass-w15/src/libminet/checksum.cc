@@ -0,0 +1,258 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CHECKSUM_HAVE_AVX2 1
+#endif
+
+#include "checksum.h"
+
+//
+// All the kernels add the data as 32 bit words in memory order into 64
+// bit accumulators, so carries pile up in the top halves and are folded
+// back in once, at the end.  Since 2^16 == 1 mod 2^16-1, that gives the
+// same ones-complement sum as adding 16 bit words one at a time.
+//
+
+typedef uint64_t (*ChecksumKernel)(const unsigned char *p, size_t len, uint64_t acc);
+
+static uint64_t AddGeneric(const unsigned char *p, size_t len, uint64_t acc)
+{
+  uint64_t acc2=0;
+
+  while (len>=16) {
+    uint32_t w[4];
+    memcpy(w,p,16);
+    acc+=w[0];
+    acc2+=w[1];
+    acc+=w[2];
+    acc2+=w[3];
+    p+=16;
+    len-=16;
+  }
+  while (len>=4) {
+    uint32_t w;
+    memcpy(&w,p,4);
+    acc+=w;
+    p+=4;
+    len-=4;
+  }
+  if (len>=2) {
+    uint16_t w;
+    memcpy(&w,p,2);
+    acc+=w;
+    p+=2;
+    len-=2;
+  }
+  if (len) {
+    // pad with a zero byte
+    uint16_t w=0;
+    memcpy(&w,p,1);
+    acc+=w;
+  }
+  return acc+acc2;
+}
+
+#if defined(__SSE2__)
+static uint64_t AddSSE2(const unsigned char *p, size_t len, uint64_t acc)
+{
+  const __m128i zero=_mm_setzero_si128();
+  __m128i a=zero, b=zero;
+
+  while (len>=32) {
+    __m128i v=_mm_loadu_si128((const __m128i *)p);
+    __m128i w=_mm_loadu_si128((const __m128i *)(p+16));
+    a=_mm_add_epi64(a,_mm_unpacklo_epi32(v,zero));
+    b=_mm_add_epi64(b,_mm_unpackhi_epi32(v,zero));
+    a=_mm_add_epi64(a,_mm_unpacklo_epi32(w,zero));
+    b=_mm_add_epi64(b,_mm_unpackhi_epi32(w,zero));
+    p+=32;
+    len-=32;
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes,_mm_add_epi64(a,b));
+  return AddGeneric(p,len,acc+lanes[0]+lanes[1]);
+}
+#endif
+
+#if defined(CHECKSUM_HAVE_AVX2)
+__attribute__((target("avx2")))
+static uint64_t AddAVX2(const unsigned char *p, size_t len, uint64_t acc)
+{
+  const __m256i zero=_mm256_setzero_si256();
+  __m256i a=zero, b=zero;
+
+  while (len>=64) {
+    __m256i v=_mm256_loadu_si256((const __m256i *)p);
+    __m256i w=_mm256_loadu_si256((const __m256i *)(p+32));
+    a=_mm256_add_epi64(a,_mm256_unpacklo_epi32(v,zero));
+    b=_mm256_add_epi64(b,_mm256_unpackhi_epi32(v,zero));
+    a=_mm256_add_epi64(a,_mm256_unpacklo_epi32(w,zero));
+    b=_mm256_add_epi64(b,_mm256_unpackhi_epi32(w,zero));
+    p+=64;
+    len-=64;
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes,_mm256_add_epi64(a,b));
+  return AddGeneric(p,len,acc+lanes[0]+lanes[1]+lanes[2]+lanes[3]);
+}
+#endif
+
+
+static ChecksumImpl   impl;
+static ChecksumKernel kernel=0;
+static int            deferred=-1;
+
+static void PickKernel()
+{
+#if defined(CHECKSUM_HAVE_AVX2)
+  if (ChecksumSetImpl(CHECKSUM_AVX2)) {
+    return;
+  }
+#endif
+  if (!ChecksumSetImpl(CHECKSUM_SSE2)) {
+    ChecksumSetImpl(CHECKSUM_GENERIC);
+  }
+}
+
+bool ChecksumSetImpl(const ChecksumImpl i)
+{
+  switch (i) {
+  case CHECKSUM_GENERIC:
+    kernel=AddGeneric;
+    break;
+#if defined(__SSE2__)
+  case CHECKSUM_SSE2:
+    kernel=AddSSE2;
+    break;
+#endif
+#if defined(CHECKSUM_HAVE_AVX2)
+  case CHECKSUM_AVX2:
+    if (!__builtin_cpu_supports("avx2")) {
+      return false;
+    }
+    kernel=AddAVX2;
+    break;
+#endif
+  default:
+    return false;
+  }
+  impl=i;
+  return true;
+}
+
+ChecksumImpl ChecksumGetImpl()
+{
+  if (kernel==0) {
+    PickKernel();
+  }
+  return impl;
+}
+
+const char *ChecksumImplName(const ChecksumImpl i)
+{
+  return (i==CHECKSUM_GENERIC) ? "generic" :
+         (i==CHECKSUM_SSE2)    ? "sse2" :
+         (i==CHECKSUM_AVX2)    ? "avx2" :
+         "unknown";
+}
+
+
+static unsigned Fold64(uint64_t acc)
+{
+  acc=(acc&0xffffffffULL)+(acc>>32);
+  acc=(acc&0xffffffffULL)+(acc>>32);
+  return (unsigned)acc;
+}
+
+unsigned ChecksumAdd(const void *data, size_t len, unsigned sum)
+{
+  if (kernel==0) {
+    PickKernel();
+  }
+  return Fold64(kernel((const unsigned char *)data,len,sum));
+}
+
+unsigned ChecksumAddAt(const void *data, size_t len, size_t at, unsigned sum)
+{
+  if (!(at&1)) {
+    return ChecksumAdd(data,len,sum);
+  }
+  // every byte is in the other half of its word, so the sum of the
+  // piece comes out byte swapped
+  unsigned short s=ChecksumFold(ChecksumAdd(data,len));
+  s=(unsigned short)((s<<8)|(s>>8));
+  return Fold64((uint64_t)sum+s);
+}
+
+unsigned ChecksumAdd(const Buffer &b, unsigned offset, size_t len, size_t at, unsigned sum)
+{
+  unsigned n=b.GetNumSlices();
+
+  for (unsigned i=0; i<n && len>0; i++) {
+    size_t slen;
+    const char *s=b.GetSlice(i,slen);
+    if (offset>=slen) {
+      offset-=slen;
+      continue;
+    }
+    size_t take=slen-offset;
+    if (take>len) {
+      take=len;
+    }
+    sum=ChecksumAddAt(s+offset,take,at,sum);
+    at+=take;
+    len-=take;
+    offset=0;
+  }
+  return sum;
+}
+
+unsigned short ChecksumFold(unsigned sum)
+{
+  sum=(sum&0xffff)+(sum>>16);
+  sum=(sum&0xffff)+(sum>>16);
+  return (unsigned short)sum;
+}
+
+unsigned short ChecksumFinish(unsigned sum)
+{
+  return (unsigned short)~ChecksumFold(sum);
+}
+
+// HC' = ~(~HC + ~m + m')  (RFC 1624, eqn 3)
+unsigned short ChecksumUpdate16(unsigned short check, unsigned short oldw, unsigned short neww)
+{
+  unsigned sum=(unsigned short)~check;
+  sum+=(unsigned short)~oldw;
+  sum+=neww;
+  return ChecksumFinish(sum);
+}
+
+unsigned short ChecksumUpdate32(unsigned short check, unsigned oldw, unsigned neww)
+{
+  unsigned sum=(unsigned short)~check;
+  sum+=(unsigned short)~(oldw&0xffff);
+  sum+=(unsigned short)~(oldw>>16);
+  sum+=neww&0xffff;
+  sum+=neww>>16;
+  return ChecksumFinish(sum);
+}
+
+
+void ChecksumSetDeferred(const bool d)
+{
+  deferred=d;
+}
+
+bool ChecksumIsDeferred()
+{
+  if (deferred<0) {
+    // minet.cfg values may arrive with their quotes
+    const char *env=getenv("MINET_DEFER_CHECKSUMS");
+    deferred = env!=0 && atoi(env+strspn(env,"\""))!=0;
+  }
+  return deferred;
+}
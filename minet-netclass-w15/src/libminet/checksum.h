@@ -0,0 +1,49 @@
+#ifndef _checksum
+#define _checksum
+
+#include <stddef.h>
+#include "buffer.h"
+
+//
+// The Internet checksum (RFC 1071).
+//
+// Partial sums are plain unsigned ints that can be chained from one
+// piece of a message to the next and are only folded at the end.  They
+// are kept in the byte order of the data, so the result of
+// ChecksumFinish is stored with memcpy, not htons (or is ntohs'ed to
+// compare with a host order value).  A piece that starts an odd number
+// of bytes into the message must be added with ChecksumAddAt, which
+// accounts for the shift; a piece of odd length is padded with a zero,
+// as the last piece of a message should be.
+//
+// The bulk of the work is done by the fastest kernel the processor has
+// (AVX2, then SSE2, then a portable loop with a 64 bit accumulator).
+//
+
+enum ChecksumImpl {CHECKSUM_GENERIC, CHECKSUM_SSE2, CHECKSUM_AVX2};
+
+unsigned       ChecksumAdd(const void *data, size_t len, unsigned sum=0);
+unsigned       ChecksumAddAt(const void *data, size_t len, size_t at, unsigned sum=0);
+// len bytes of b from offset on, which sit at bytes at... of the message
+unsigned       ChecksumAdd(const Buffer &b, unsigned offset, size_t len, size_t at, unsigned sum=0);
+
+unsigned short ChecksumFold(unsigned sum);
+unsigned short ChecksumFinish(unsigned sum);
+
+// RFC 1624 incremental update: the new checksum when a 16 or 32 bit
+// word it covers goes from oldw to neww, all in the data's byte order
+unsigned short ChecksumUpdate16(unsigned short check, unsigned short oldw, unsigned short neww);
+unsigned short ChecksumUpdate32(unsigned short check, unsigned oldw, unsigned neww);
+
+// Picks a kernel by hand, returns false if this processor lacks it
+bool           ChecksumSetImpl(const ChecksumImpl impl);
+ChecksumImpl   ChecksumGetImpl();
+const char *   ChecksumImplName(const ChecksumImpl impl);
+
+// In deferred mode the TCP and UDP setters only mark the packet and its
+// checksums are computed once, when it is serialized.  Set from
+// MINET_DEFER_CHECKSUMS unless changed here.
+void           ChecksumSetDeferred(const bool deferred);
+bool           ChecksumIsDeferred();
+
+#endif
@@ -34,6 +34,11 @@ extern char * WRITER_ARGS[];
 
 const int DEFAULT_BUFFER_SIZE = 1024;
 
+// Adjacent Buffer slices this small or smaller together are copied into one
+#define BUFFER_COALESCE 256
+// iovecs Buffer::Serialize hands writev at a time; at most IOV_MAX
+#define BUFFER_SERIALIZE_IOVS 64
+
 const char ether2mux_fifo_name[] = "./fifos/ether2mux";
 const char mux2ether_fifo_name[] = "./fifos/mux2ether";
 
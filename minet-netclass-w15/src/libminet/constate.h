@@ -2,7 +2,13 @@
 #define _constate
 
 #include "sockint.h"
+#include "timerwheel.h"
 #include <deque>
+#include <iterator>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -46,18 +52,19 @@ struct ConnectionToStateMapping {
     Time       timeout;
     STATE      state;
     bool       bTmrActive;
+    TimerHandle timer;   // set by ConnectionList::SetTimer
     
     ConnectionToStateMapping(const ConnectionToStateMapping<STATE> &rhs) :
-	connection(rhs.connection), timeout(rhs.timeout), state(rhs.state), bTmrActive(rhs.bTmrActive) 
+	connection(rhs.connection), timeout(rhs.timeout), state(rhs.state), bTmrActive(rhs.bTmrActive), timer(rhs.timer) 
     {
     }
     
     ConnectionToStateMapping(const Connection &c, const Time &t, const STATE &s, const bool &b) :
-	connection(c), timeout(t), state(s), bTmrActive(b) 
+	connection(c), timeout(t), state(s), bTmrActive(b), timer(TIMER_NONE) 
     {
     }
     
-    ConnectionToStateMapping() : connection(), timeout(), state(), bTmrActive() {
+    ConnectionToStateMapping() : connection(), timeout(), state(), bTmrActive(), timer(TIMER_NONE) {
     }
     
     ConnectionToStateMapping<STATE> & operator=(const ConnectionToStateMapping<STATE> &rhs)  {
@@ -65,6 +72,7 @@ struct ConnectionToStateMapping {
 	timeout    = rhs.timeout; 
 	state      = rhs.state;
 	bTmrActive = rhs.bTmrActive; 
+	timer      = rhs.timer;
 
 	return *this;
     }
@@ -102,35 +110,249 @@ struct ConnectionToStateMapping {
 
 
 
+// A connection with IP_ADDRESS_ANY or PORT_ANY in it is a wildcard
+// (a listener, say) and can match many others
+inline bool IsFullySpecified(const Connection &c)
+{
+    return !(c.src == IP_ADDRESS_ANY || c.dest == IP_ADDRESS_ANY
+	     || c.srcport == PORT_ANY || c.destport == PORT_ANY);
+}
+
+
+// FindMatching for a fully specified connection is a hash lookup.
+// Connections are indexed by their exact 5-tuple, and wildcards by
+// their local port.  An exact entry wins over a wildcard, then a
+// wildcard on the same local port over one on any port.  Lookups that
+// themselves contain wildcards scan the list, as before.
+//
+// The entries are kept in a std::list, so that the index can hold
+// iterators, which only the methods here can add to or take from; the
+// list itself is private.  Do not change an entry's connection in place;
+// erase it and add it again.  operator[] walks the list.
+//
+// Timers set through SetTimer/ClearTimer live in a timing wheel, so
+// NextTimeout and ExpireTimers cost nothing per idle connection.
+// FindEarliest still scans, for code that sets timeout and bTmrActive
+// by hand.
 template <class STATE>
-class ConnectionList : public std::deque<ConnectionToStateMapping<STATE> > {
+class ConnectionList {
+ private:
+    typedef std::list<ConnectionToStateMapping<STATE> > container;
  public:
-    ConnectionList(const ConnectionList &rhs) : std::deque<ConnectionToStateMapping<STATE> >(rhs) {}
+    typedef typename container::value_type value_type;
+    typedef typename container::size_type size_type;
+    typedef typename container::reference reference;
+    typedef typename container::const_reference const_reference;
+    typedef typename container::iterator iterator;
+    typedef typename container::const_iterator const_iterator;
+
+ private:
+    typedef std::unordered_multimap<ConnectionKey, iterator, ConnectionKeyHash> ExactIndex;
+    typedef std::unordered_map<unsigned short, std::list<iterator> > WildcardIndex;
+
+    container             items;
+    ExactIndex            exact;
+    WildcardIndex         wildcards;
+    TimerWheel<iterator>  timers;
+
+    void Index(iterator i) {
+	if (IsFullySpecified((*i).connection)) {
+	    exact.insert(std::make_pair(ConnectionKey((*i).connection), i));
+	} else {
+	    wildcards[(*i).connection.srcport].push_back(i);
+	}
+    }
+
+    // Drop i from the index and the timers, before it leaves the list
+    void Forget(iterator i) {
+	timers.Cancel((*i).timer);
+	(*i).timer = TIMER_NONE;
+	if (IsFullySpecified((*i).connection)) {
+	    std::pair<typename ExactIndex::iterator, typename ExactIndex::iterator> r =
+		exact.equal_range(ConnectionKey((*i).connection));
+	    for (typename ExactIndex::iterator x = r.first; x != r.second; ++x) {
+		if ((*x).second == i) {
+		    exact.erase(x);
+		    break;
+		}
+	    }
+	} else {
+	    typename WildcardIndex::iterator w = wildcards.find((*i).connection.srcport);
+	    if (w != wildcards.end()) {
+		(*w).second.remove(i);
+		if ((*w).second.empty()) {
+		    wildcards.erase(w);
+		}
+	    }
+	}
+    }
+
+    void Rebuild() {
+	exact.clear();
+	wildcards.clear();
+	for (iterator i = begin(); i != end(); ++i) {
+	    Index(i);
+	    (*i).timer = (*i).bTmrActive ? timers.Arm((double)(*i).timeout, i) : TIMER_NONE;
+	}
+    }
+
+    iterator FindWildcard(const unsigned short port, const Connection &rhs) {
+	typename WildcardIndex::iterator w = wildcards.find(port);
+	if (w != wildcards.end()) {
+	    for (typename std::list<iterator>::iterator x = (*w).second.begin(); x != (*w).second.end(); ++x) {
+		if ((**x).Matches(rhs)) {
+		    return *x;
+		}
+	    }
+	}
+	return end();
+    }
+
+ public:
+    ConnectionList(const ConnectionList &rhs) : items(rhs.items) {
+	Rebuild();
+    }
     ConnectionList() {}
-	
-    typedef typename ConnectionList<STATE>::iterator iterator;
-    typedef typename ConnectionList<STATE>::const_iterator const_iterator;
+
+    ConnectionList & operator=(const ConnectionList &rhs) {
+	if (this != &rhs) {
+	    clear();
+	    items = rhs.items;
+	    Rebuild();
+	}
+	return *this;
+    }
+
+    iterator begin() { return items.begin(); }
+    iterator end() { return items.end(); }
+    const_iterator begin() const { return items.begin(); }
+    const_iterator end() const { return items.end(); }
+
+    size_type size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+
+    reference front() { return items.front(); }
+    reference back() { return items.back(); }
+    const_reference front() const { return items.front(); }
+    const_reference back() const { return items.back(); }
+
+    reference operator[](const size_type n) {
+	iterator i = begin();
+	std::advance(i, n);
+	return *i;
+    }
+    const_reference operator[](const size_type n) const {
+	const_iterator i = begin();
+	std::advance(i, n);
+	return *i;
+    }
+
+    void push_back(const ConnectionToStateMapping<STATE> &m) {
+	insert(end(), m);
+    }
+
+    void push_front(const ConnectionToStateMapping<STATE> &m) {
+	insert(begin(), m);
+    }
+
+    iterator insert(iterator pos, const ConnectionToStateMapping<STATE> &m) {
+	iterator i = items.insert(pos, m);
+	(*i).timer = TIMER_NONE;
+	Index(i);
+	if (m.bTmrActive) {
+	    SetTimer(i, m.timeout);
+	}
+	return i;
+    }
+
+    iterator erase(iterator i) {
+	Forget(i);
+	return items.erase(i);
+    }
+
+    iterator erase(iterator first, iterator last) {
+	while (first != last) {
+	    first = erase(first);
+	}
+	return last;
+    }
+
+    void pop_front() {
+	erase(begin());
+    }
+
+    void pop_back() {
+	erase(--end());
+    }
+
+    void clear() {
+	erase(begin(), end());
+    }
+
+    void SetTimer(iterator i, const Time &when) {
+	timers.Cancel((*i).timer);
+	(*i).timeout = when;
+	(*i).bTmrActive = true;
+	(*i).timer = timers.Arm((double)when, i);
+    }
+
+    void ClearTimer(iterator i) {
+	timers.Cancel((*i).timer);
+	(*i).bTmrActive = false;
+	(*i).timer = TIMER_NONE;
+    }
+
+    // Timeout for MinetGetNextEvent: seconds until the next timer is
+    // due, or -1 if none is set
+    double NextTimeout(const Time &now = Time()) const {
+	return timers.TimeUntilNext((double)now);
+    }
+
+    // Appends the connections whose timers are due to expired and clears
+    // their timers.  Returns how many there were.
+    unsigned ExpireTimers(std::vector<Connection> &expired, const Time &now = Time()) {
+	std::vector<iterator> fired;
+	unsigned n = 0;
+
+	timers.Expire((double)now, fired);
+	for (typename std::vector<iterator>::iterator x = fired.begin(); x != fired.end(); ++x) {
+	    iterator i = *x;
+	    (*i).timer = TIMER_NONE;
+	    if (!(*i).bTmrActive) {
+		continue;
+	    }
+	    // timeout may have been moved by hand since
+	    if (now < (*i).timeout) {
+		SetTimer(i, (*i).timeout);
+		continue;
+	    }
+	    (*i).bTmrActive = false;
+	    expired.push_back((*i).connection);
+	    n++;
+	}
+	return n;
+    }
     
     typename ConnectionList<STATE>::iterator FindEarliest() {
-	typename ConnectionList<STATE>::iterator ptr = this->end();
-	typename ConnectionList<STATE>::iterator i = this->begin();
+	typename ConnectionList<STATE>::iterator ptr = end();
+	typename ConnectionList<STATE>::iterator i = begin();
 	
 	// No connections in list
-	if(this->empty())
-	    return this->end();
+	if(empty())
+	    return end();
 	
 	// 1 connection in list
-	if(this->size() == 1) {
+	if(size() == 1) {
 	    if((*i).bTmrActive == true)
-		return this->begin();
+		return begin();
 	    else {
-		return this->end();
+		return end();
 	    }
 	}
 	
 	// More than one connection in list
 	Time min=(*i).timeout;
-	for (; i != this->end(); ++i) {
+	for (; i != end(); ++i) {
 	    if ((*i).bTmrActive == true && (*i).timeout <= min) {
 		min=(*i).timeout;
 		ptr=i;
@@ -140,41 +362,25 @@ class ConnectionList : public std::deque<ConnectionToStateMapping<STATE> > {
     }
     
     typename ConnectionList<STATE>::iterator FindMatching(const Connection &rhs) {
-	for (typename ConnectionList<STATE>::iterator i = this->begin(); i != this->end(); ++i) {
-	    if ((*i).Matches(rhs)) {
-		return i;
-		}
-	}
-	return this->end();
-    }
-    typename ConnectionList<STATE>::iterator FindMatchingSource(const Connection &rhs) {
-	for (typename ConnectionList<STATE>::iterator i = this->begin(); i != this->end(); ++i) {
-	    if ((*i).MatchesSource(rhs)) {
-		return i;
-	    }
-	}
-	return this->end();
-    }
-    typename ConnectionList<STATE>::iterator FindMatchingDest(const Connection &rhs) {
-	for (typename ConnectionList<STATE>::iterator i = this->begin(); i != this->end(); ++i) {
-	    if ((*i).MatchesDest(rhs)) {
-		return i;
+	if (IsFullySpecified(rhs)) {
+	    typename ExactIndex::iterator x = exact.find(ConnectionKey(rhs));
+	    if (x != exact.end()) {
+		return (*x).second;
 	    }
+	    iterator i = FindWildcard(rhs.srcport, rhs);
+	    return i != end() ? i : FindWildcard(PORT_ANY, rhs);
 	}
-	return this->end();
-    }
-    typename ConnectionList<STATE>::iterator FindMatchingProtocol(const Connection &rhs) {
-	for (typename ConnectionList<STATE>::iterator i = this->begin(); i != this->end(); ++i) {
-	    if ((*i).MatchesProtocol(rhs)) {
+	for (typename ConnectionList<STATE>::iterator i = begin(); i != end(); ++i) {
+	    if ((*i).Matches(rhs)) {
 		return i;
-	    }
+		}
 	}
-	return this->end();
+	return end();
     }
     
     std::ostream & Print(std::ostream &os) const {
 	os << "ConnectionList(";
-	for (const_iterator i = this->begin(); i != this->end(); ++i) {
+	for (const_iterator i = begin(); i != end(); ++i) {
 	    os << (*i);
 	}
 	os << ")";
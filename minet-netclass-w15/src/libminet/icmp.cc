@@ -198,16 +198,12 @@ void ICMPHeader::SetAddressMask(Buffer &payload, const IPAddress &address_mask)
 // ***** ICMPHeader HELPER FUNCTIONS *****
 unsigned short ICMPHeader::ComputeChecksum(const Packet &p) const
 {
-  size_t data_length = ((Packet&)p).GetPayload().GetSize();
-  size_t total_length = ICMP_HEADER_LENGTH + data_length;
-
-  unsigned short buffer[total_length];
-  memset((char*)buffer, 0, 2*total_length);
+  Buffer payload = p.GetPayload();
 
-  GetData((char*)&(buffer[0]), ICMP_HEADER_LENGTH, 0);
-  ((Packet&)p).GetPayload().GetData((char*)&(buffer[ICMP_HEADER_LENGTH]), data_length, 0);
+  unsigned sum = ChecksumAdd(*this, 0, ICMP_HEADER_LENGTH, 0);
+  sum = ChecksumAdd(payload, 0, payload.GetSize(), ICMP_HEADER_LENGTH, sum);
 
-  return ~(OnesComplementSum(buffer, total_length));
+  return ntohs(ChecksumFinish(sum));
 }
 
 bool ICMPHeader::IsCorrectChecksum(const Packet &p) const
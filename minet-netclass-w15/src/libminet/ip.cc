@@ -5,6 +5,7 @@
 #include <arpa/inet.h>
 
 #include "util.h"
+#include "checksum.h"
 #include "error.h"
 
 IPAddress MyIPAddr(getenv("MINET_IPADDR") ?
@@ -83,6 +84,13 @@ static unsigned short ip_id_counter = 0;
 
 IPHeader::IPHeader() : Header(Headers::IPHeader)
 {
+    // start from all zeros, whose checksum is 0xffff, so that the setters
+    // can patch it as they go
+    char zero[IP_HEADER_BASE_LENGTH];
+    memset(zero, 0, IP_HEADER_BASE_LENGTH);
+    SetData(zero, IP_HEADER_BASE_LENGTH, 0);
+    SetChecksum(0xffff);
+
     SetVersion(IP_HEADER_REQUIRED_VERSION);
     SetHeaderLength(IP_HEADER_BASE_LENGTH_IN_WORDS);  // 20 bytes, 5 words
     SetTOS(IP_HEADER_DEFAULT_TOS);
@@ -126,7 +134,7 @@ IPHeader & IPHeader::operator=(const IPHeader &rhs)
 unsigned IPHeader::EstimateIPHeaderLength(Packet &p)
 {
     unsigned char len;
-    Buffer &b = p.GetPayload();
+    Buffer b = p.GetPayload();
 
     b.GetData((char *)&len, 1, 0);
 
@@ -153,9 +161,7 @@ void IPHeader::SetVersion(const unsigned char &version)
 
     GetData((char *)&t, 1, 0);
     t = (t & 0x0f) | ((version << 4) & 0xf0);
-    SetData((char *)&t, 1, 0);
-
-    RecomputeChecksum();
+    SetField((char *)&t, 1, 0);
 }
 
 void IPHeader::GetHeaderLength(unsigned char &hlen) const
@@ -171,9 +177,7 @@ void IPHeader::SetHeaderLength(const unsigned char &hlen)
 
     GetData((char *)&t, 1, 0);
     t = (t & 0xf0) | (hlen & 0x0f);
-    SetData((char *)&t, 1, 0);
-
-    RecomputeChecksum();
+    SetField((char *)&t, 1, 0);
 }
 
 void IPHeader::GetTOS(unsigned char &tos) const
@@ -183,8 +187,7 @@ void IPHeader::GetTOS(unsigned char &tos) const
 
 void IPHeader::SetTOS(const unsigned char &tos)
 {
-    SetData((char *)&tos, 1, 1);
-    RecomputeChecksum();
+    SetField((char *)&tos, 1, 1);
 }
 
 void IPHeader::GetTotalLength(unsigned short &len) const
@@ -198,9 +201,7 @@ void IPHeader::SetTotalLength(const unsigned short &len)
 {
     unsigned short l = htons(len);
 
-    SetData((char *)&l, 2, 2);
-
-    RecomputeChecksum();
+    SetField((char *)&l, 2, 2);
 }
 
 
@@ -214,9 +215,7 @@ void IPHeader::SetID(const unsigned short &id)
 {
     unsigned short i = htons(id);
 
-    SetData((char *)&i, 2, 4);
-
-    RecomputeChecksum();
+    SetField((char *)&i, 2, 4);
 }
 
 void IPHeader::GetFlags(unsigned char &flags) const
@@ -232,9 +231,7 @@ void IPHeader::SetFlags(const unsigned char &flags)
     GetData((char *)&t, 1, 6);
     t &= 0x1f;
     t |= ((0x7 & flags) << 5);
-    SetData((char *)&t, 1, 6);
-
-    RecomputeChecksum();
+    SetField((char *)&t, 1, 6);
 }
 
 void IPHeader::GetFragOffset(unsigned short &offset) const
@@ -252,10 +249,8 @@ void IPHeader::SetFragOffset(const unsigned short &offset)
     unsigned short o = htons(offset);
 
     GetFlags(f);
-    SetData((char *)&o, 2, 6);
+    SetField((char *)&o, 2, 6);
     SetFlags(f);
-
-    RecomputeChecksum();
 }
 
 
@@ -266,8 +261,7 @@ void IPHeader::GetTTL(unsigned char &ttl) const
 
 void IPHeader::SetTTL(const unsigned char &ttl)
 {
-    SetData((char *)&ttl, 1, 8);
-    RecomputeChecksum();
+    SetField((char *)&ttl, 1, 8);
 }
 
 void IPHeader::GetProtocol(unsigned char &proto) const
@@ -277,22 +271,45 @@ void IPHeader::GetProtocol(unsigned char &proto) const
 
 void IPHeader::SetProtocol(const unsigned char &proto)
 {
-    SetData((char *)&proto, 1, 9);
-    RecomputeChecksum();
+    SetField((char *)&proto, 1, 9);
 }
 
 
+// Writes a field and patches the checksum to match (RFC 1624), which
+// only touches the words the field covers.  A header that is not all
+// there yet gets its checksum recomputed instead.
+void IPHeader::SetField(const char *data, const unsigned len, const unsigned offset)
+{
+    unsigned start = offset & ~1U;
+    unsigned end   = (offset + len + 1) & ~1U;
+
+    if (GetSize() < IP_HEADER_BASE_LENGTH || end > IP_HEADER_BASE_LENGTH) {
+	SetData(data, len, offset);
+	RecomputeChecksum();
+	return;
+    }
+
+    unsigned short before[IP_HEADER_BASE_LENGTH / 2], after[IP_HEADER_BASE_LENGTH / 2], check;
+
+    GetData((char *)before, end - start, start);
+    SetData(data, len, offset);
+    GetData((char *)after, end - start, start);
+    GetData((char *)&check, 2, 10);
+
+    for (unsigned i = 0; i < (end - start) / 2; i++) {
+	check = ChecksumUpdate16(check, before[i], after[i]);
+    }
+    SetData((char *)&check, 2, 10);
+}
+
 unsigned short IPHeader::ComputeChecksum() const
 {
-    unsigned short buf[IP_HEADER_MAX_LENGTH / 2];
     unsigned char len;
 
     GetHeaderLength(len);
     len *= 4;
 
-    GetData((char *)buf, len, 0);
-
-    return ~(OnesComplementSum(buf, len / 2));
+    return ntohs(ChecksumFinish(ChecksumAdd(*this, 0, len, 0)));
 }
 
 
@@ -329,8 +346,7 @@ void IPHeader::GetSourceIP(IPAddress &addr) const
 void IPHeader::SetSourceIP(const IPAddress &addr)
 {
     unsigned a = htonl(addr);
-    SetData((char *)&a, 4, 12);
-    RecomputeChecksum();
+    SetField((char *)&a, 4, 12);
 }
 
 void IPHeader::GetDestIP(IPAddress &addr) const
@@ -343,9 +359,7 @@ void IPHeader::SetDestIP(const IPAddress &addr)
 {
     unsigned a = htonl(addr);
 
-    SetData((char *)&a, 4, 16);
-
-    RecomputeChecksum();
+    SetField((char *)&a, 4, 16);
 }
 
 
@@ -67,6 +67,8 @@ struct IPOptions {
 
 
 class IPHeader : public Header {
+ private:
+  void SetField(const char *data, const unsigned len, const unsigned offset);
 
  public:
   IPHeader();
@@ -0,0 +1,235 @@
+#include "ipfrag.h"
+#include "util.h"
+
+
+Packet FlattenIPPacket(const Packet &p)
+{
+    Packet q(p);
+
+    q.FinalizeChecksums();
+
+    Buffer rest = q.GetPayload();
+    Header h = q.PopBackHeader();
+    while (h.GetTag() != Headers::IPHeader) {
+	rest.AddFront(h);
+	h = q.PopBackHeader();
+    }
+    Packet flat(rest);
+    flat.PushFrontHeader(h);
+    return flat;
+}
+
+
+unsigned FragmentIPPacket(const Packet &p, const unsigned short mtu, std::vector<Packet> &fragments)
+{
+    IPHeader ih = p.FindHeader(Headers::IPHeader);
+    unsigned char hlen, flags;
+    unsigned short offset;
+
+    ih.GetHeaderLength(hlen);
+    ih.GetFlags(flags);
+    ih.GetFragOffset(offset);
+
+    size_t iplen = hlen * 4;
+    if (p.GetRawSize() <= mtu) {
+	fragments.push_back(p);
+	return 1;
+    }
+    if ((flags & IP_HEADER_FLAG_DONTFRAG) || mtu < iplen + 8) {
+	return 0;
+    }
+
+    Buffer rest = FlattenIPPacket(p).GetPayload();
+    size_t total = rest.GetSize();
+    size_t size = (mtu - iplen) / 8 * 8;
+    unsigned n = 0;
+
+    for (size_t at = 0; at < total; at += size, n++) {
+	size_t len = MIN_MACRO(size, total - at);
+	bool last = at + len == total;
+	Packet frag(rest.ExtractFront(len));
+
+	IPHeader fh(ih);
+	fh.SetTotalLength(iplen + len);
+	// the last keeps the original's MF, in case it was a fragment too
+	fh.SetFlags(last ? flags : (flags | IP_HEADER_FLAG_MOREFRAG));
+	fh.SetFragOffset(offset + at / 8);
+	frag.PushFrontHeader(fh);
+	fragments.push_back(frag);
+    }
+    return n;
+}
+
+
+IPReassembler::IPReassembler(const double to, const size_t mm) :
+    timeout(to), maxmemory(mm), memory(0), dropped(0)
+{}
+
+void IPReassembler::Remove(DataType::iterator i)
+{
+    memory -= (*i).second.bytes;
+    order.erase((*i).second.age);
+    data.erase(i);
+}
+
+bool IPReassembler::Add(const Packet &p, const double now, Packet &out)
+{
+    IPHeader ih = p.FindHeader(Headers::IPHeader);
+    unsigned char hlen, flags;
+    unsigned short total, offset;
+    Key k;
+
+    ih.GetHeaderLength(hlen);
+    ih.GetTotalLength(total);
+    ih.GetFlags(flags);
+    ih.GetFragOffset(offset);
+    ih.GetSourceIP(k.src);
+    ih.GetDestIP(k.dest);
+    ih.GetID(k.id);
+    ih.GetProtocol(k.protocol);
+
+    // the payload may have link padding after the data
+    Buffer frag = p.GetPayload();
+    size_t iplen = hlen * 4;
+    size_t first = offset * 8;
+    size_t len = total > iplen ? total - iplen : 0;
+    size_t end = first + len;
+    bool more = flags & IP_HEADER_FLAG_MOREFRAG;
+
+    if (len == 0 || frag.GetSize() < len || (more && len % 8 != 0) ||
+	iplen + end > IP_PACKET_MAX_LENGTH) {
+	dropped++;
+	return false;
+    }
+    frag.Erase(len, frag.GetSize() - len);
+
+    std::pair<DataType::iterator, bool> r = data.insert(std::make_pair(k, Datagram()));
+    Datagram &d = (*r.first).second;
+
+    if (r.second) {
+	// no fragment can reach past IP_PACKET_MAX_LENGTH
+	d.holes.push_back(Hole(0, IP_PACKET_MAX_LENGTH));
+	d.havefirst = false;
+	d.length    = 0;
+	d.top       = 0;
+	d.bytes     = IP_REASSEMBLY_OVERHEAD;
+	d.fragments = 0;
+	d.created   = now;
+	d.age       = order.insert(order.end(), k);
+	memory     += d.bytes;
+    }
+
+    if ((d.length != 0 && end > d.length) ||
+	(!more && (d.length != 0 ? end != d.length : end < d.top))) {
+	dropped++;
+	return false;
+    }
+    d.fragments++;
+    d.top = MAX_MACRO(d.top, end);
+
+    if (!more) {
+	// nothing comes after the last fragment
+	d.length = end;
+	for (std::list<Hole>::iterator h = d.holes.begin(); h != d.holes.end(); ) {
+	    if ((*h).first >= end) {
+		h = d.holes.erase(h);
+	    } else {
+		(*h).last = MIN_MACRO((*h).last, end);
+		++h;
+	    }
+	}
+    }
+    if (first == 0 && !d.havefirst) {
+	d.first     = p;
+	d.havefirst = true;
+    }
+
+    for (std::list<Hole>::iterator h = d.holes.begin(); h != d.holes.end(); ) {
+	if (first >= (*h).last || end <= (*h).first) {
+	    ++h;
+	    continue;
+	}
+	size_t from = MAX_MACRO(first, (*h).first);
+	size_t to   = MIN_MACRO(end, (*h).last);
+	Buffer piece(frag);
+	d.pieces[from] = piece.Extract(from - first, to - from);
+	d.bytes += to - from;
+	memory  += to - from;
+
+	if ((*h).first < from) {
+	    d.holes.insert(h, Hole((*h).first, from));
+	}
+	if (to < (*h).last) {
+	    d.holes.insert(h, Hole(to, (*h).last));
+	}
+	h = d.holes.erase(h);
+    }
+
+    if (d.holes.empty()) {
+	Buffer whole;
+	for (std::map<size_t, Buffer>::const_iterator i = d.pieces.begin(); i != d.pieces.end(); ++i) {
+	    whole.AddBack((*i).second);
+	}
+	IPHeader wh = d.first.FindHeader(Headers::IPHeader);
+	unsigned char wflags, whlen;
+	wh.GetFlags(wflags);
+	wh.GetHeaderLength(whlen);
+	wh.SetFlags(wflags & ~IP_HEADER_FLAG_MOREFRAG);
+	wh.SetFragOffset(0);
+	wh.SetTotalLength(whlen * 4 + d.length);
+
+	out = Packet(whole);
+	out.PushFrontHeader(wh);
+	Remove(r.first);
+	return true;
+    }
+
+    while (memory > maxmemory && !order.empty()) {
+	DataType::iterator i = data.find(order.front());
+	dropped += (*i).second.fragments;
+	Remove(i);
+    }
+    return false;
+}
+
+void IPReassembler::Expire(const double now, std::vector<Packet> &timedout)
+{
+    while (!order.empty()) {
+	DataType::iterator i = data.find(order.front());
+	Datagram &d = (*i).second;
+	if (d.created + timeout > now) {
+	    break;
+	}
+	if (d.havefirst) {
+	    timedout.push_back(d.first);
+	}
+	dropped += d.fragments;
+	Remove(i);
+    }
+}
+
+double IPReassembler::TimeUntilNext(const double now) const
+{
+    if (order.empty()) {
+	return -1;
+    }
+    double left = (*data.find(order.front())).second.created + timeout - now;
+    return left < 0 ? 0 : left;
+}
+
+std::ostream & IPReassembler::Print(std::ostream &os) const
+{
+    os << "IPReassembler" << "( size=" << data.size() << " memory=" << memory
+       << " dropped=" << dropped;
+
+    os << " contents={";
+    for (DataType::const_iterator i = data.begin(); i != data.end(); ++i) {
+	os << (*i).first.src << ">" << (*i).first.dest << "/" << (*i).first.id << ":"
+	   << (*i).second.fragments << "/" << (*i).second.holes.size() << " ";
+    }
+    os << "}";
+
+    os << ")";
+
+    return os;
+}
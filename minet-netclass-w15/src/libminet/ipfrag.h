@@ -0,0 +1,124 @@
+#ifndef _ipfrag
+#define _ipfrag
+
+#include <iostream>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "packet.h"
+#include "ip.h"
+
+
+// A packet as it goes on the wire: the IP header, and everything after
+// it (transport headers included) as the payload, with any deferred
+// checksums done.  This is also how a packet arrives from ip_module.
+Packet FlattenIPPacket(const Packet &p);
+
+// Fragmentation.  If p fits in mtu bytes it is appended as it is.
+// Otherwise, unless it has DF set, it is cut into fragments of at most
+// mtu bytes that share its payload rather than copying it; each has a
+// copy of its IP header (options included) with its own length, offset
+// and MF flag.  A packet that is itself a fragment is fragmented
+// further.  Returns how many packets were appended, 0 if p is too big
+// and may not be fragmented.
+unsigned FragmentIPPacket(const Packet &p, const unsigned short mtu, std::vector<Packet> &fragments);
+
+
+// Seconds a partly reassembled datagram is kept for the rest of it
+const double IP_REASSEMBLY_TIMEOUT=30.0;
+// Bytes all of them may hold between them; the oldest go first
+const size_t IP_REASSEMBLY_MEMORY_MAX=4*1024*1024;
+// What each datagram is charged on top of its data
+const size_t IP_REASSEMBLY_OVERHEAD=256;
+
+//
+// Reassembly of incoming fragments.  Datagrams are told apart by source,
+// destination, protocol and ID, and each keeps a list of the holes it
+// still has (RFC 815): a fragment fills what it covers of any hole and
+// leaves what is on either side, so duplicates and overlaps cost
+// nothing and the first data to arrive for any byte is what is kept.
+// The pieces are kept as they came, and the datagram is put together
+// without copying once the last hole is filled.  A datagram that is not
+// complete within the timeout is given up on, as are the oldest when
+// the data held would pass the memory cap.  Fragments that cannot be
+// part of a valid datagram (one that would end past 65535 bytes, or
+// disagree with where the last fragment said it ends) are dropped.
+//
+class IPReassembler {
+ private:
+    struct Key {
+	IPAddress      src;
+	IPAddress      dest;
+	unsigned short id;
+	unsigned char  protocol;
+
+	bool operator==(const Key &rhs) const {
+	    return src==rhs.src && dest==rhs.dest && id==rhs.id && protocol==rhs.protocol;
+	}
+    };
+    struct HashKey {
+	size_t operator()(const Key &k) const {
+	    return std::hash<unsigned>()((unsigned)k.src ^ ((unsigned)k.dest << 7) ^
+					 ((unsigned)k.id << 16) ^ k.protocol);
+	}
+    };
+    // bytes [first,last) of the data are still missing
+    struct Hole {
+	size_t first;
+	size_t last;
+
+	Hole(const size_t f, const size_t l) : first(f), last(l) {}
+    };
+    struct Datagram {
+	std::list<Hole>          holes;
+	std::map<size_t, Buffer> pieces;     // by offset
+	Packet                   first;      // the fragment at offset 0
+	bool                     havefirst;
+	size_t                   length;     // 0 until the last fragment comes
+	size_t                   top;        // end of the furthest fragment
+	size_t                   bytes;      // charged against the cap
+	unsigned                 fragments;
+	double                   created;
+	std::list<Key>::iterator age;
+    };
+    typedef std::unordered_map<Key, Datagram, HashKey> DataType;
+
+    DataType       data;
+    std::list<Key> order;      // oldest first
+    double         timeout;
+    size_t         maxmemory;
+    size_t         memory;
+    size_t         dropped;
+
+    void Remove(DataType::iterator i);
+
+ public:
+    IPReassembler(const double timeout=IP_REASSEMBLY_TIMEOUT, const size_t maxmemory=IP_REASSEMBLY_MEMORY_MAX);
+
+    // p is a fragment as it arrives, with its payload everything after
+    // the IP header.  True if it completed a datagram, which is put in
+    // out with an IP header that no longer marks it as a fragment.
+    bool Add(const Packet &p, const double now, Packet &out);
+    // Gives up on datagrams older than the timeout; for each that had
+    // its first fragment, that fragment is appended to timedout so the
+    // sender can be told (ICMP time exceeded during reassembly)
+    void Expire(const double now, std::vector<Packet> &timedout);
+    // Seconds until Expire next has something to do, -1 if never
+    double TimeUntilNext(const double now) const;
+
+    size_t size() const { return data.size(); }
+    size_t GetMemory() const { return memory; }
+    // fragments dropped, alone or with the datagram they were part of
+    size_t NumDropped() const { return dropped; }
+
+    std::ostream & Print(std::ostream &os) const;
+
+    friend std::ostream &operator<<(std::ostream &os, const IPReassembler& r) {
+	return r.Print(os);
+    }
+};
+
+
+#endif
@@ -0,0 +1,139 @@
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "log.h"
+
+
+static const char *levelnames[] = {"NONE", "ERROR", "WARN", "INFO", "DEBUG", "TRACE"};
+
+struct LogRing {
+  std::atomic<unsigned long long> next;
+  char                            *slots;
+
+  LogRing();
+};
+
+LogRing::LogRing() : next(0), slots(0)
+{
+  const size_t len=MINET_LOG_RECORDS*MINET_LOG_RECORD_LEN;
+  const char *env=getenv("MINET_LOG_DIR");
+
+  // minet.cfg values may arrive with their quotes
+  std::string dir(env ? env+strspn(env,"\"") : "");
+  dir.erase(std::remove(dir.begin(),dir.end(),'"'),dir.end());
+
+  if (!dir.empty()) {
+    std::string path=dir+"/"+program_invocation_short_name+".trace";
+    int fd=open(path.c_str(),O_RDWR|O_CREAT|O_TRUNC,0644);
+    if (fd>=0 && ftruncate(fd,len)==0) {
+      void *m=mmap(0,len,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+      if (m!=MAP_FAILED) {
+	slots=(char*)m;
+      }
+    }
+    if (slots==0) {
+      fprintf(stderr,"log: can't map %s (%s), keeping the trace in memory\n",path.c_str(),strerror(errno));
+    }
+    if (fd>=0) {
+      close(fd);
+    }
+  }
+  if (slots==0) {
+    slots=new char[len];
+  }
+  // empty records are blank lines, so the file is always text
+  memset(slots,' ',len);
+  for (size_t i=MINET_LOG_RECORD_LEN-1; i<len; i+=MINET_LOG_RECORD_LEN) {
+    slots[i]='\n';
+  }
+}
+
+static LogRing &Ring()
+{
+  static LogRing ring;
+  return ring;
+}
+
+
+MinetLogRecord::Stream &MinetLogRecord::GetStream()
+{
+  static thread_local Stream stream;
+  return stream;
+}
+
+MinetLogRecord::MinetLogRecord(const char *m, const MinetLogLevel l) :
+  s(GetStream()), module(m), level(l)
+{
+  // nothing the last record set carries over
+  s.buf.reset();
+  s.os.clear();
+  s.os.flags(std::ios_base::dec|std::ios_base::skipws);
+  s.os.precision(6);
+}
+
+MinetLogRecord::~MinetLogRecord()
+{
+  MinetLogWrite(module,level,s.buf.text,s.buf.size());
+}
+
+
+void MinetLogWrite(const char *module, const MinetLogLevel level, const char *text, const size_t len)
+{
+  LogRing &ring=Ring();
+  unsigned long long seq=ring.next.fetch_add(1,std::memory_order_relaxed)+1;
+  char line[MINET_LOG_RECORD_LEN];
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  int n=snprintf(line,sizeof(line),"%12llu %ld.%06ld %-5s %-8s ",seq,(long)tv.tv_sec,
+		 (long)tv.tv_usec,levelnames[level],module);
+  size_t end=n;
+  // a record is one line, so whatever the text has for line breaks
+  // becomes spaces
+  for (size_t i=0; i<len && end<sizeof(line)-1; i++) {
+    char c=text[i];
+    line[end++] = (c=='\n' || c=='\r' || c=='\t') ? ' ' : c;
+  }
+  while (end>(size_t)n && line[end-1]==' ') {
+    end--;
+  }
+  line[end]='\n';
+
+  if (level<=MINET_LOG_ECHO) {
+    ssize_t w=write(2,line,end+1);
+    (void)w;
+  }
+  memset(line+end,' ',sizeof(line)-1-end);
+  line[sizeof(line)-1]='\n';
+  memcpy(ring.slots+((seq-1)%MINET_LOG_RECORDS)*MINET_LOG_RECORD_LEN,line,sizeof(line));
+}
+
+void MinetLogDump(std::ostream &os)
+{
+  LogRing &ring=Ring();
+  std::vector<std::string> records;
+
+  for (unsigned i=0; i<MINET_LOG_RECORDS; i++) {
+    std::string r(ring.slots+i*MINET_LOG_RECORD_LEN,MINET_LOG_RECORD_LEN);
+    size_t end=r.find_last_not_of(" \n");
+    if (end!=std::string::npos) {
+      records.push_back(r.substr(0,end+1));
+    }
+  }
+  // the sequence numbers are right-aligned to the same width
+  std::sort(records.begin(),records.end());
+  for (unsigned i=0; i<records.size(); i++) {
+    os << records[i] << "\n";
+  }
+  os.flush();
+}
@@ -0,0 +1,139 @@
+#ifndef _log
+#define _log
+
+#include <iostream>
+#include <streambuf>
+
+//
+// Tracing for the packet paths.
+//
+// MINET_LOG(module, level, what) makes a record of what, anything that
+// can be put on an ostream, for example
+//
+//   MINET_LOG(TCP, DEBUG, "Timer expired for " << (*cs).connection);
+//
+// Each module has a level fixed when it is compiled, MINET_LOG_LEVEL_TCP
+// and so on, and statements less severe than it are constant-false
+// branches that the compiler drops: what is not evaluated and costs
+// nothing.  A level can be raised for one module by defining its macro
+// before including Minet.h, or for a build with, e.g.,
+//
+//   make CXXFLAGS="-g -Wall -std=c++0x -fPIC -DMINET_LOG_LEVEL_IP=MINET_LOG_TRACE"
+//
+// Records that are compiled in go to a ring of the last
+// MINET_LOG_RECORDS, which writers claim slots in with an atomic
+// increment and never wait on.  Records at MINET_LOG_ECHO or more
+// severe are also written to stderr as they are made.  If MINET_LOG_DIR
+// is set the ring is a file there, <program>.trace, mapped into memory,
+// so it can be read while the module runs and after it is killed: each
+// record is a fixed-width line starting with its sequence number, and
+// "sort -n" puts them in order.  Otherwise MinetLogDump prints it.
+//
+// debug(level) is for setup and errors; its level is checked at run
+// time on every <<, so it does not belong on a per-packet path.
+//
+
+enum MinetLogLevel {
+  MINET_LOG_NONE=0,
+  MINET_LOG_ERROR,
+  MINET_LOG_WARNING,
+  MINET_LOG_INFO,
+  MINET_LOG_DEBUG,
+  MINET_LOG_TRACE
+};
+
+#define MINET_LOG_RECORDS    4096
+#define MINET_LOG_RECORD_LEN 256     // bytes per record, newline included
+
+#ifndef MINET_LOG_ECHO
+#define MINET_LOG_ECHO MINET_LOG_WARNING
+#endif
+
+#ifndef MINET_LOG_LEVEL_DEFAULT
+#define MINET_LOG_LEVEL_DEFAULT MINET_LOG_WARNING
+#endif
+#ifndef MINET_LOG_LEVEL_ETHERMUX
+#define MINET_LOG_LEVEL_ETHERMUX MINET_LOG_LEVEL_DEFAULT
+#endif
+#ifndef MINET_LOG_LEVEL_ARP
+#define MINET_LOG_LEVEL_ARP MINET_LOG_LEVEL_DEFAULT
+#endif
+#ifndef MINET_LOG_LEVEL_IP
+#define MINET_LOG_LEVEL_IP MINET_LOG_LEVEL_DEFAULT
+#endif
+#ifndef MINET_LOG_LEVEL_IPMUX
+#define MINET_LOG_LEVEL_IPMUX MINET_LOG_LEVEL_DEFAULT
+#endif
+#ifndef MINET_LOG_LEVEL_ICMP
+#define MINET_LOG_LEVEL_ICMP MINET_LOG_LEVEL_DEFAULT
+#endif
+#ifndef MINET_LOG_LEVEL_UDP
+#define MINET_LOG_LEVEL_UDP MINET_LOG_LEVEL_DEFAULT
+#endif
+#ifndef MINET_LOG_LEVEL_TCP
+#define MINET_LOG_LEVEL_TCP MINET_LOG_LEVEL_DEFAULT
+#endif
+#ifndef MINET_LOG_LEVEL_SOCK
+#define MINET_LOG_LEVEL_SOCK MINET_LOG_LEVEL_DEFAULT
+#endif
+#ifndef MINET_LOG_LEVEL_OTHER
+#define MINET_LOG_LEVEL_OTHER MINET_LOG_LEVEL_DEFAULT
+#endif
+
+#define MINET_LOG(module, level, what)                                  \
+  do {                                                                  \
+    if (MINET_LOG_##level <= MINET_LOG_LEVEL_##module) {                \
+      MinetLogRecord minet_log_record(#module, MINET_LOG_##level);      \
+      minet_log_record.stream() << what;                                \
+    }                                                                   \
+  } while (0)
+
+// Is a MINET_LOG statement at this level compiled in?  For work done
+// only to be logged.
+#define MINET_LOG_ENABLED(module, level) \
+  (MINET_LOG_##level <= MINET_LOG_LEVEL_##module)
+
+
+// One record being made; it goes into the ring when destroyed.  Text
+// past what a record holds is dropped.  Each thread makes its records
+// on a stream of its own, set up once, since setting up an ostream
+// costs more than the rest of a record.
+class MinetLogRecord {
+ private:
+  class Buf : public std::streambuf {
+   public:
+    char text[MINET_LOG_RECORD_LEN];
+
+    void reset() { setp(text, text+sizeof(text)); }
+    size_t size() const { return pptr()-pbase(); }
+   protected:
+    int overflow(int c) { return c; }
+  };
+  struct Stream {
+    Buf          buf;
+    std::ostream os;
+
+    Stream() : os(&buf) {}
+  };
+
+  Stream        &s;
+  const char    *module;
+  MinetLogLevel level;
+
+  static Stream &GetStream();
+
+  MinetLogRecord(const MinetLogRecord &rhs);
+  MinetLogRecord & operator=(const MinetLogRecord &rhs);
+ public:
+  MinetLogRecord(const char *module, const MinetLogLevel level);
+  ~MinetLogRecord();
+
+  std::ostream &stream() { return s.os; }
+};
+
+// Adds a record of len bytes of text to the ring
+void MinetLogWrite(const char *module, const MinetLogLevel level, const char *text, const size_t len);
+// The records in the ring, oldest first, one to a line
+void MinetLogDump(std::ostream &os);
+
+#endif
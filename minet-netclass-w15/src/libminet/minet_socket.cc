@@ -4,6 +4,7 @@
 #include "minet_socket.h"
 
 #include <string>
+#include <map>
 
 #define UNINIT_SOCKS -1
 #define KERNEL_SOCKS 1
@@ -1068,8 +1069,9 @@ EXTERNC int minet_read(int fd, char * buf, int len) {
 	    return read(fd, buf, len);
 	    break;
 	case MINET_SOCKS: {
+	    // sock_module needs only the length, not the buffer
 	    SockLibRequestResponse slrr(mREAD, Connection(), fd,
-					Buffer(buf, len), 0, 0);
+					Buffer(), len, 0);
 	    MinetSend(sock, slrr);
 	    MinetReceive(sock, slrr);
 	    minet_errno = slrr.error;
@@ -1078,11 +1080,8 @@ EXTERNC int minet_read(int fd, char * buf, int len) {
 		return -1;
 	    }
 
-	    Buffer b;
-	    b = slrr.data;
-	    b.GetData(buf, b.GetSize(), 0);
-
-	    return (b.GetSize());
+	    return (slrr.data.GetData(buf, MIN_MACRO(slrr.data.GetSize(),
+						     (size_t)len), 0));
 
 	    break;
 	}
@@ -1200,6 +1199,264 @@ EXTERNC int minet_write(int fd, char * buf, int len)
 }
 
 
+static size_t IovecLength(const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+	len += iov[i].iov_len;
+    }
+    return len;
+}
+
+static Buffer GatherIovec(const struct iovec *iov, int iovcnt) {
+    Buffer b;
+    for (int i = 0; i < iovcnt; i++) {
+	b.AddBack(Buffer((const char *)iov[i].iov_base, iov[i].iov_len));
+    }
+    return b;
+}
+
+static size_t ScatterIovec(const Buffer &b, const struct iovec *iov, int iovcnt) {
+    size_t done = 0;
+    for (int i = 0; i < iovcnt && done < b.GetSize(); i++) {
+	done += b.GetData((char *)iov[i].iov_base,
+			  MIN_MACRO(iov[i].iov_len, b.GetSize() - done), done);
+    }
+    return done;
+}
+
+
+/**
+ * @brief Read from a socket into several buffers.
+ *
+ * This function behaves as minet_read() does, but fills the buffers
+ * in \c iov in turn, like readv() from the POSIX API (<tt>man 2
+ * readv</tt>).  With the Minet user stack, the whole read is one
+ * request to the socket module.
+ *
+ * @return The number of bytes read, or -1 on error.
+ */
+EXTERNC int minet_readv(int fd, const struct iovec * iov, int iovcnt) {
+    switch (socket_type) {
+	case UNINIT_SOCKS:
+	    errno = ENODEV;            // "No such device" error
+	    return -1;
+	    break;
+	case KERNEL_SOCKS:
+	    return readv(fd, iov, iovcnt);
+	    break;
+	case MINET_SOCKS: {
+	    SockLibRequestResponse slrr(mREAD, Connection(), fd,
+					Buffer(), IovecLength(iov, iovcnt), 0);
+	    MinetSend(sock, slrr);
+	    MinetReceive(sock, slrr);
+	    minet_errno = slrr.error;
+
+	    if (minet_errno != EOK) {
+		return -1;
+	    }
+
+	    return ScatterIovec(slrr.data, iov, iovcnt);
+	    break;
+	}
+	default:
+	    minet_errno = ENODEV;
+	    break;
+    }
+
+    return -1;
+}
+
+
+/**
+ * @brief Write several buffers to a socket.
+ *
+ * This function behaves as minet_write() does, but sends the buffers
+ * in \c iov one after the other, like writev() from the POSIX API
+ * (<tt>man 2 writev</tt>).  With the Minet user stack, the whole write
+ * is one request to the socket module.
+ *
+ * @return The number of bytes written, or -1 on error.
+ */
+EXTERNC int minet_writev(int fd, const struct iovec * iov, int iovcnt) {
+    switch (socket_type) {
+	case UNINIT_SOCKS:
+	    errno = ENODEV;            // "No such device" error
+	    return -1;
+	    break;
+	case KERNEL_SOCKS:
+	    return writev(fd, iov, iovcnt);
+	    break;
+	case MINET_SOCKS: {
+	    SockLibRequestResponse slrr(mWRITE, Connection(), fd,
+					GatherIovec(iov, iovcnt), 0, 0);
+	    MinetSend(sock, slrr);
+	    MinetReceive(sock, slrr);
+	    minet_errno = slrr.error;
+
+	    if (minet_errno != EOK) {
+		return -1;
+	    }
+
+	    return (slrr.bytes);
+	    break;
+	}
+	default:
+	    minet_errno = ENODEV;
+	    break;
+    }
+
+    return -1;
+}
+
+
+// Sends the requests for a batch of reads or writes, then collects the
+// replies, which may come in any order and are matched by socket.  The
+// socket module works on one request per socket at a time, so a socket
+// that appears again in the batch starts a new round.
+static int minet_batch(slrrType type, struct minet_mmsghdr * msgs, int vlen) {
+    int moved = 0;
+    int done = 0;
+
+    while (done < vlen) {
+	std::map<unsigned, int> round;
+	int end = done;
+	while ((end < vlen) &&
+	       round.insert(std::make_pair((unsigned)msgs[end].msg_fd, end)).second) {
+	    end++;
+	}
+
+	for (int i = done; i < end; i++) {
+	    msgs[i].msg_len = -1;
+	    msgs[i].msg_error = EOK;
+	    if (type == mWRITE) {
+		SockLibRequestResponse slrr(mWRITE, Connection(), msgs[i].msg_fd,
+					    GatherIovec(msgs[i].msg_iov,
+							msgs[i].msg_iovlen),
+					    0, 0);
+		MinetSend(sock, slrr);
+	    } else {
+		SockLibRequestResponse slrr(mREAD, Connection(), msgs[i].msg_fd,
+					    Buffer(),
+					    IovecLength(msgs[i].msg_iov,
+							msgs[i].msg_iovlen),
+					    0);
+		MinetSend(sock, slrr);
+	    }
+	}
+
+	while (!round.empty()) {
+	    SockLibRequestResponse slrr;
+	    MinetReceive(sock, slrr);
+	    std::map<unsigned, int>::iterator r = round.find(slrr.sockfd);
+	    if (r == round.end()) {
+		continue;
+	    }
+	    struct minet_mmsghdr &m = msgs[r->second];
+	    round.erase(r);
+	    m.msg_error = slrr.error;
+	    if (slrr.error != EOK) {
+		minet_errno = slrr.error;
+		continue;
+	    }
+	    if (type == mWRITE) {
+		m.msg_len = slrr.bytes;
+	    } else {
+		m.msg_len = ScatterIovec(slrr.data, m.msg_iov, m.msg_iovlen);
+	    }
+	    moved++;
+	}
+
+	done = end;
+    }
+
+    return moved;
+}
+
+
+// With the kernel stack, a batch is a loop of readv or writev
+static int kernel_batch(slrrType type, struct minet_mmsghdr * msgs, int vlen) {
+    int moved = 0;
+    for (int i = 0; i < vlen; i++) {
+	if (type == mWRITE) {
+	    msgs[i].msg_len = writev(msgs[i].msg_fd, msgs[i].msg_iov, msgs[i].msg_iovlen);
+	} else {
+	    msgs[i].msg_len = readv(msgs[i].msg_fd, msgs[i].msg_iov, msgs[i].msg_iovlen);
+	}
+	msgs[i].msg_error = msgs[i].msg_len < 0 ? errno : EOK;
+	if (msgs[i].msg_len >= 0) {
+	    moved++;
+	}
+    }
+    return moved;
+}
+
+
+/**
+ * @brief Read from many sockets in one round trip.
+ *
+ * Each message in \c msgs names a socket and the buffers to read
+ * into.  With the Minet user stack, the read requests all go to the
+ * socket module before any reply is waited for.  A blocking socket
+ * with nothing to read holds up the batch until it has, so batches
+ * are best made of non-blocking sockets (see minet_set_nonblocking()).
+ *
+ * @return
+ *	The number of messages that read successfully.  Each message's
+ *	\c msg_len is the bytes read, or -1 with the error in \c
+ *	msg_error.  Returns -1 if Minet is not initialized.
+ */
+EXTERNC int minet_recvmmsg(struct minet_mmsghdr * msgs, int vlen) {
+    switch (socket_type) {
+	case UNINIT_SOCKS:
+	    errno = ENODEV;            // "No such device" error
+	    return -1;
+	    break;
+	case KERNEL_SOCKS:
+	    return kernel_batch(mREAD, msgs, vlen);
+	    break;
+	case MINET_SOCKS:
+	    return minet_batch(mREAD, msgs, vlen);
+	    break;
+	default:
+	    minet_errno = ENODEV;
+	    break;
+    }
+
+    return -1;
+}
+
+
+/**
+ * @brief Write to many sockets in one round trip.
+ *
+ * As minet_recvmmsg(), for writes.  Each message's \c msg_len is the
+ * bytes written, or -1 with the error in \c msg_error.
+ *
+ * @return
+ *	The number of messages that wrote successfully, or -1 if Minet
+ *	is not initialized.
+ */
+EXTERNC int minet_sendmmsg(struct minet_mmsghdr * msgs, int vlen) {
+    switch (socket_type) {
+	case UNINIT_SOCKS:
+	    errno = ENODEV;            // "No such device" error
+	    return -1;
+	    break;
+	case KERNEL_SOCKS:
+	    return kernel_batch(mWRITE, msgs, vlen);
+	    break;
+	case MINET_SOCKS:
+	    return minet_batch(mWRITE, msgs, vlen);
+	    break;
+	default:
+	    minet_errno = ENODEV;
+	    break;
+    }
+
+    return -1;
+}
+
+
 /**
  * @brief Receive data from a socket and store the source address.
  *
@@ -1938,3 +2195,104 @@ EXTERNC int minet_can_read_now(int sockfd) {
 
     return -1;
 }
+
+
+EXTERNC int minet_getsockopt(int sockfd, int level, int optname,
+			     void *optval, socklen_t *optlen) {
+    switch (socket_type) {
+	case UNINIT_SOCKS:
+	    errno = ENODEV;            // "No such device" error
+	    return -1;
+	    break;
+
+	case KERNEL_SOCKS:
+	    return getsockopt(sockfd, level, optname, optval, optlen);
+	    break;
+
+	case MINET_SOCKS: {
+	    if (optval == NULL || optlen == NULL) {
+		minet_errno = EINVALID_OP;
+		return -1;
+	    }
+
+	    SockOption opt;
+	    opt.level = level;
+	    opt.name = optname;
+
+	    SockLibRequestResponse slrr(mGETSOCKOPT, Connection(), sockfd,
+					Buffer((const char *)&opt, sizeof(opt)),
+					0, 0);
+	    MinetSend(sock, slrr);
+	    MinetReceive(sock, slrr);
+	    minet_errno = slrr.error;
+
+	    if (minet_errno != EOK) {
+		return -1;
+	    }
+
+	    *optlen = slrr.data.GetData((char *)optval, *optlen, 0);
+	    return 0;
+	    break;
+	}
+	default:
+	    minet_errno = ENODEV;
+	    break;
+    }
+
+    return -1;
+}
+
+
+EXTERNC int minet_setsockopt(int sockfd, int level, int optname,
+			     const void *optval, socklen_t optlen) {
+    switch (socket_type) {
+	case UNINIT_SOCKS:
+	    errno = ENODEV;            // "No such device" error
+	    return -1;
+	    break;
+
+	case KERNEL_SOCKS:
+	    return setsockopt(sockfd, level, optname, optval, optlen);
+	    break;
+
+	case MINET_SOCKS: {
+	    SockOption opt;
+	    opt.level = level;
+	    opt.name = optname;
+
+	    if (level == IPPROTO_TCP && optname == TCP_CONGESTION) {
+		// the algorithm's name, as Linux has it
+		if (optval == NULL || optlen == 0 ||
+		    optlen >= SOCK_OPTION_TEXT_MAX) {
+		    minet_errno = EINVALID_OP;
+		    return -1;
+		}
+		memcpy(opt.text, optval, optlen);
+	    } else if (optval == NULL || optlen != sizeof(int)) {
+		minet_errno = EINVALID_OP;
+		return -1;
+	    } else {
+		memcpy(&opt.value, optval, sizeof(int));
+	    }
+
+	    SockLibRequestResponse slrr(mSETSOCKOPT, Connection(), sockfd,
+					Buffer((const char *)&opt, sizeof(opt)),
+					0, 0);
+	    MinetSend(sock, slrr);
+	    MinetReceive(sock, slrr);
+	    minet_errno = slrr.error;
+
+	    if (minet_errno != EOK) {
+		return -1;
+	    }
+
+	    return 0;
+	    break;
+	}
+	default:
+	    minet_errno = ENODEV;
+	    break;
+    }
+
+    return -1;
+}
@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <cstdio>
 #include <sys/poll.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 #define EXTERNC extern "C"
@@ -67,6 +68,38 @@ EXTERNC int minet_write (int   fd,
 			 int   len);
   // Write to a connected socket (returns # bytes actually written).
 
+EXTERNC int minet_readv (int                 fd,
+			 const struct iovec *iov,
+			 int                 iovcnt);
+  // Read from a connected socket into several buffers, as readv, in
+  // one request to sock_module.
+
+EXTERNC int minet_writev (int                 fd,
+			  const struct iovec *iov,
+			  int                 iovcnt);
+  // Write several buffers to a connected socket, as writev, in one
+  // request to sock_module.
+
+struct minet_mmsghdr {
+  int           msg_fd;      // socket
+  struct iovec *msg_iov;     // buffers
+  int           msg_iovlen;  // number of buffers
+  int           msg_len;     // out: bytes moved, or -1
+  int           msg_error;   // out: minet error for this message
+};
+
+EXTERNC int minet_recvmmsg (struct minet_mmsghdr *msgs,
+			    int                   vlen);
+  // Read into each of msgs from its socket.  The requests go to
+  // sock_module together and their replies are collected after, so a
+  // batch costs about one round trip, however many sockets are in it.
+  // Each message gets its own msg_len and msg_error.  Returns the
+  // number of messages that moved data, or -1.
+
+EXTERNC int minet_sendmmsg (struct minet_mmsghdr *msgs,
+			    int                   vlen);
+  // Write each of msgs to its socket, as minet_recvmmsg.
+
 EXTERNC int minet_recvfrom (int                 fd,
 			    char               *buf,
 			    int                 len,
@@ -128,4 +161,30 @@ EXTERNC int minet_can_write_now (int sockfd);
 EXTERNC int minet_can_read_now (int sockfd);
   // Check if a socket is ready for reading.
 
+EXTERNC int minet_setsockopt (int         sockfd,
+			      int         level,
+			      int         optname,
+			      const void *optval,
+			      socklen_t   optlen);
+  // Set a socket option, as setsockopt.  optval points to an int.
+  // Minet sockets know SOL_SOCKET's SO_SNDBUF and SO_RCVBUF, which
+  // also turn off buffer autotuning for the connection, and
+  // IPPROTO_TCP's TCP_NODELAY, TCP_CORK and TCP_QUICKACK, and
+  // TCP_CONGESTION, for which optval is the name of the congestion
+  // control algorithm ("reno", "newreno" or "cubic").  Any of them
+  // may be set before connect() or listen(), SO_RCVBUF to size the
+  // window scale the SYN offers, and a socket made by accept() starts
+  // with its listener's.
+
+EXTERNC int minet_getsockopt (int        sockfd,
+			      int        level,
+			      int        optname,
+			      void      *optval,
+			      socklen_t *optlen);
+  // Get a socket option, as getsockopt.  Minet sockets know
+  // IPPROTO_TCP's TCP_INFO, which fills optval with the connection's
+  // TCPInfo (see tcpstate.h): its state, RTT estimate and RTO, window
+  // and what is in flight.  *optlen says how much room there is, and
+  // is set to how much was filled in.
+
 #endif
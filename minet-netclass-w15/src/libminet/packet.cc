@@ -1,19 +1,24 @@
 #include <assert.h>
 #include "packet.h"
+#include "tcp.h"
+#include "udp.h"
 
-Packet::Packet()
+Packet::Packet() : checksumspending(false), segmentsize(0)
 {}
 
-Packet::Packet(const Packet &rhs) : headers(rhs.headers), payload(rhs.payload), trailers(rhs.trailers)
+Packet::Packet(const Packet &rhs) : headers(rhs.headers), payload(rhs.payload), trailers(rhs.trailers), checksumspending(rhs.checksumspending), segmentsize(rhs.segmentsize)
 {}
 
-Packet::Packet(const Buffer &rhs) : payload(rhs)
+Packet::Packet(Packet &&rhs) : headers(std::move(rhs.headers)), payload(std::move(rhs.payload)), trailers(std::move(rhs.trailers)), checksumspending(rhs.checksumspending), segmentsize(rhs.segmentsize)
 {}
 
-Packet::Packet(const RawEthernetPacket &rhs) : payload(rhs.data,rhs.size)
+Packet::Packet(const Buffer &rhs) : payload(rhs), checksumspending(false), segmentsize(0)
 {}
 
-Packet::Packet(const char *buf, size_t size) : payload(buf,size)
+Packet::Packet(const RawEthernetPacket &rhs) : payload(rhs.data,rhs.size), checksumspending(false), segmentsize(0)
+{}
+
+Packet::Packet(const char *buf, size_t size) : payload(buf,size), checksumspending(false), segmentsize(0)
 {}
 
 Packet::~Packet()
@@ -30,6 +35,18 @@ const Packet & Packet::operator= (const Packet &rhs)
   headers=rhs.headers;
   payload=rhs.payload;
   trailers=rhs.trailers;
+  checksumspending=rhs.checksumspending;
+  segmentsize=rhs.segmentsize;
+  return *this;
+}
+
+const Packet & Packet::operator= (Packet &&rhs)
+{
+  headers=std::move(rhs.headers);
+  payload=std::move(rhs.payload);
+  trailers=std::move(rhs.trailers);
+  checksumspending=rhs.checksumspending;
+  segmentsize=rhs.segmentsize;
   return *this;
 }
 
@@ -38,6 +55,13 @@ void Packet::Serialize(const int fd) const
 {
   size_t num;
 
+  if (checksumspending && segmentsize==0) {
+    Packet finished(*this);
+    finished.FinalizeChecksums();
+    finished.Serialize(fd);
+    return;
+  }
+
   num=headers.size();
   if (writeall(fd,(char*)&num,sizeof(num))!=sizeof(num)) {
     throw SerializationException();
@@ -53,6 +77,9 @@ void Packet::Serialize(const int fd) const
   for (std::deque<Trailer>::const_iterator p=trailers.begin();p!=trailers.end();p++) {
     (*p).Serialize(fd);
   }
+  if (writeall(fd,(char*)&segmentsize,sizeof(segmentsize))!=sizeof(segmentsize)) {
+    throw SerializationException();
+  }
 }
 
 
@@ -64,6 +91,8 @@ void Packet::Unserialize(const int fd)
   headers.clear();
   payload.Clear();
   trailers.clear();
+  checksumspending=false;
+  segmentsize=0;
 
   if (readall(fd,(char*)&num,sizeof(num))!=sizeof(num)) {
     throw SerializationException();
@@ -82,6 +111,9 @@ void Packet::Unserialize(const int fd)
     t.Unserialize(fd);
     trailers.push_back(t);
   }
+  if (readall(fd,(char*)&segmentsize,sizeof(segmentsize))!=sizeof(segmentsize)) {
+    throw SerializationException();
+  }
 }
 
 size_t Packet::GetRawSize() const
@@ -99,12 +131,57 @@ size_t Packet::GetRawSize() const
 }
 
 
+void Packet::MarkChecksumsPending() const
+{
+  checksumspending=true;
+}
+
+bool Packet::ChecksumsPending() const
+{
+  return checksumspending;
+}
+
+void Packet::FinalizeChecksums()
+{
+  checksumspending=false;
+  for (std::deque<Header>::iterator p=headers.begin();p!=headers.end();p++) {
+    if ((*p).GetTag()==Headers::TCPHeader) {
+      TCPHeader h(*p);
+      h.RecomputeChecksum(*this);
+      *p=h;
+    } else if ((*p).GetTag()==Headers::UDPHeader) {
+      UDPHeader h(*p);
+      h.RecomputeChecksum(*this);
+      *p=h;
+    }
+  }
+}
+
+
+void Packet::SetSegmentSize(const unsigned short size)
+{
+  segmentsize=size;
+}
+
+unsigned short Packet::GetSegmentSize() const
+{
+  return segmentsize;
+}
+
+
 void Packet::DupeRaw(char * buf, size_t size) const
 {
   int offset=0;
 
   assert(size>=GetRawSize());
 
+  if (checksumspending) {
+    Packet finished(*this);
+    finished.FinalizeChecksums();
+    finished.DupeRaw(buf,size);
+    return;
+  }
+
   for (std::deque<Header>::const_iterator p=headers.begin();p!=headers.end();p++) {
     (*p).GetData(&(buf[offset]),(*p).GetSize(),0);
     offset+=(*p).GetSize();
@@ -125,6 +202,8 @@ void Packet::WriteRaw(const int fd) const
   DupeRaw(buf,GetRawSize());
 
   writeall(fd,buf,GetRawSize());
+
+  delete [] buf;
 }
 
 void Packet::PushHeader(const Header &header)
@@ -143,21 +222,21 @@ void Packet::PushBackHeader(const Header &header)
 }
 
 
-Header & Packet::PopHeader()
+Header Packet::PopHeader()
 {
   return PopFrontHeader();
 }
 
-Header & Packet::PopFrontHeader()
+Header Packet::PopFrontHeader()
 {
-  Header &x=headers.front();
+  Header x(std::move(headers.front()));
   headers.pop_front();
   return x;
 }
 
-Header & Packet::PopBackHeader()
+Header Packet::PopBackHeader()
 {
-  Header &x=headers.front();
+  Header x(std::move(headers.back()));
   headers.pop_back();
   return x;
 }
@@ -170,10 +249,13 @@ struct find_pred : public std::unary_function<T,bool> {
 };
 
 
-Header &  Packet::FindHeader(Headers::HeaderType ht) const
+Header  Packet::FindHeader(Headers::HeaderType ht) const
 {
   std::deque<Header>::const_iterator i = find_if(headers.begin(), headers.end(), find_pred<Header,Headers::HeaderType>(ht));
-  return *(new Header(*i));
+  if (i==headers.end()) {
+    return Header(ht);
+  }
+  return *i;
 }
 
 void Packet::SetHeader(const Header &h)
@@ -181,10 +263,13 @@ void Packet::SetHeader(const Header &h)
   replace_if(headers.begin(), headers.end(), find_pred<Header,Headers::HeaderType>(h.GetTag()), h);
 }
 
-Trailer & Packet::FindTrailer(Trailers::TrailerType ht) const
+Trailer Packet::FindTrailer(Trailers::TrailerType ht) const
 {
   std::deque<Trailer>::const_iterator i = find_if(trailers.begin(), trailers.end(), find_pred<Trailer,Trailers::TrailerType>(ht));
-  return *(new Trailer(*i));
+  if (i==trailers.end()) {
+    return Trailer(ht);
+  }
+  return *i;
 }
 
 void Packet::SetTrailer(const Trailer &h)
@@ -193,9 +278,9 @@ void Packet::SetTrailer(const Trailer &h)
 }
 
 
-Buffer & Packet::GetPayload()
+Buffer Packet::GetPayload() const
 {
-  return *(new Buffer(payload));
+  return payload;
 }
 
 void       Packet::PushTrailer(const Trailer &trailer)
@@ -214,33 +299,35 @@ void       Packet::PushFrontTrailer(const Trailer &trailer)
 }
 
 
-Trailer &  Packet::PopTrailer()
+Trailer    Packet::PopTrailer()
 {
   return PopFrontTrailer();
 }
 
-Trailer &  Packet::PopFrontTrailer()
+Trailer    Packet::PopFrontTrailer()
 {
-  Trailer &x=trailers.front();
+  Trailer x(std::move(trailers.front()));
   trailers.pop_front();
   return x;
 }
 
-Trailer &  Packet::PopBackTrailer()
+Trailer    Packet::PopBackTrailer()
 {
-  Trailer &x=trailers.front();
+  Trailer x(std::move(trailers.back()));
   trailers.pop_back();
   return x;
 }
 
 void Packet::ExtractHeaderFromPayload(Headers::HeaderType type, size_t size)
 {
-  headers.push_back(Header(type,payload.ExtractFront(size)));
+  headers.push_back(Header(type));
+  payload.ExtractFront(size,headers.back());
 }
 
 void Packet::ExtractTrailerFromPayload(Trailers::TrailerType type, size_t size)
 {
-  trailers.push_front(Trailer(type,payload.ExtractBack(size)));
+  trailers.push_front(Trailer(type));
+  payload.ExtractBack(size,trailers.front());
 }
 
 
@@ -14,15 +14,22 @@ class Packet {
   std::deque<Header>  headers;
   Buffer         payload;
   std::deque<Trailer> trailers;
+  // set by TCP and UDP header setters in deferred checksum mode
+  mutable bool        checksumspending;
+  // segmentation offload: if not 0, the payload is a run of TCP
+  // segments of this size sharing one set of headers (see tcp.h)
+  unsigned short      segmentsize;
  public:
   Packet();
   Packet(const Packet &rhs);
+  Packet(Packet &&rhs);
   Packet(const Buffer &rhs);
   Packet(const char *buf, size_t size);
   Packet(const RawEthernetPacket &rhs);
   virtual ~Packet();
 
   virtual const Packet & operator= (const Packet &rhs);
+  virtual const Packet & operator= (Packet &&rhs);
 
   virtual void Serialize(const int fd) const;
   virtual void Unserialize(const int fd);
@@ -30,6 +37,17 @@ class Packet {
 
   virtual size_t GetRawSize() const;
 
+  // Deferred checksums (see checksum.h): the transport checksum is
+  // computed here, once, and Serialize and DupeRaw do it on the way out
+  virtual void MarkChecksumsPending() const;
+  virtual bool ChecksumsPending() const;
+  virtual void FinalizeChecksums();
+
+  // A super-segment's checksums are left for when it is split, so
+  // serializing one does not compute them
+  virtual void SetSegmentSize(const unsigned short size);
+  virtual unsigned short GetSegmentSize() const;
+
   virtual void WriteRaw(const int fd) const;
   virtual void DupeRaw(char *buf, size_t size) const;
 
@@ -37,24 +55,24 @@ class Packet {
   virtual void       PushFrontHeader(const Header &header);
   virtual void       PushBackHeader(const Header &header);
 
-  virtual Header &   PopHeader();
-  virtual Header &   PopFrontHeader();
-  virtual Header &   PopBackHeader();
+  virtual Header     PopHeader();
+  virtual Header     PopFrontHeader();
+  virtual Header     PopBackHeader();
 
   virtual void       PushTrailer(const Trailer &trailer);
   virtual void       PushFrontTrailer(const Trailer &trailer);
   virtual void       PushBackTrailer(const Trailer &trailer);
 
-  virtual Trailer &  PopTrailer();
-  virtual Trailer &  PopFrontTrailer();
-  virtual Trailer &  PopBackTrailer();
+  virtual Trailer    PopTrailer();
+  virtual Trailer    PopFrontTrailer();
+  virtual Trailer    PopBackTrailer();
 
-  virtual Header &   FindHeader(Headers::HeaderType ht) const;
+  virtual Header     FindHeader(Headers::HeaderType ht) const;
   virtual void       SetHeader(const Header &h);
-  virtual Trailer &  FindTrailer(Trailers::TrailerType tt) const;
+  virtual Trailer    FindTrailer(Trailers::TrailerType tt) const;
   virtual void       SetTrailer(const Trailer &h);
 
-  virtual Buffer &   GetPayload();
+  virtual Buffer     GetPayload() const;
 
   virtual void ExtractHeaderFromPayload(Headers::HeaderType type, size_t bytes);
   virtual void ExtractTrailerFromPayload(Trailers::TrailerType type, size_t bytes);
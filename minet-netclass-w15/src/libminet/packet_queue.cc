@@ -34,9 +34,9 @@ void PacketQueue::PushPacket(const Packet &p)
   queue.push_back(p);
 }
 
-Packet & PacketQueue::PullPacket()
+Packet PacketQueue::PullPacket()
 {
-  Packet &p = queue.front();
+  Packet p(std::move(queue.front()));
   queue.pop_front();
   return p;
 }
@@ -17,7 +17,7 @@ class PacketQueue {
   bool     IsEmpty() const ;
   unsigned NumItems() const;
   void     PushPacket(const Packet &packet);
-  Packet & PullPacket();
+  Packet   PullPacket();
 };
 
 
@@ -50,10 +50,9 @@ RawEthernetPacket::~RawEthernetPacket()
 {}
 
 
-Packet & RawEthernetPacket::ConvertToPacket() const
+Packet RawEthernetPacket::ConvertToPacket() const
 {
-  Packet *p = new Packet(data,size);
-  return *p;
+  return Packet(data,size);
 }
 
 
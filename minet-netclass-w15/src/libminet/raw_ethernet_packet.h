@@ -18,7 +18,7 @@ struct RawEthernetPacket {
   const RawEthernetPacket & operator= (const Packet &rhs);
   virtual ~RawEthernetPacket();
 
-  Packet & ConvertToPacket() const;
+  Packet   ConvertToPacket() const;
 
   void Serialize(const int fd) const;
   void Unserialize(const int fd);
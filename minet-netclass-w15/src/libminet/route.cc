@@ -1,4 +1,5 @@
 #include "route.h"
+#include "checksum.h"
 
 
 #define	NET		0
@@ -151,8 +152,7 @@ void add_route(route_table_t *table, char *net, char *gateway, char *mask,	\
 	       char *flags, char *metric, char *ref,				\
        	       char *use, char *iface)
 {
-  route_t *current = (route_t *)malloc(sizeof(route_t));
-  current = make_route(net, mask, iface, gateway, flags, metric, ref, use);
+  route_t *current = make_route(net, mask, iface, gateway, flags, metric, ref, use);
 
   if(strcmp(current->net, "default") == 0)
     table->deflt = current;
@@ -177,29 +177,25 @@ void add_route(route_table_t *table, char *net, char *gateway, char *mask,	\
 // If two routes have the same match length just take the first occurance
 route_t *match_route(route_table_t *table, char *net_addr)
 {
-  int match_count = 0;
-  int max_match = 0;
-  route_t *matched = (route_t *)malloc(sizeof(route_t));
-  route_t *current = (route_t *)malloc(sizeof(route_t));
-
-  current = table->first;
-  while(current->next != NULL) {
-    if(strcmp(current->net, net_addr) == 0) {
-      matched = current;
-      free(current);
-      return matched;
+  int max_match = -1;
+  route_t *matched = NULL;
+  unsigned addr = IPAddress(net_addr);
+
+  // compare prefixes numerically; the net and mask strings are dotted
+  // decimal
+  for (route_t *current = table->first; current != NULL; current = current->next) {
+    if (current == table->deflt) {
+      continue;
     }
-    else {
-      match_count = match_func(current->net, net_addr);
-      if(match_count > max_match) {
-	max_match = match_count;
-	matched = current;
-      }
+    unsigned mask = IPAddress(current->mask);
+    int len = __builtin_popcount(mask);
+    if ((addr & mask) == ((unsigned)IPAddress(current->net) & mask) && len > max_match) {
+      max_match = len;
+      matched = current;
     }
-    current = current->next;
   }
 
-  if(max_match == 0)
+  if (matched == NULL)
     matched = table->deflt;
   return matched;
 }
@@ -421,3 +417,696 @@ void print_if_list(if_list_t *if_list)
   free(current);
   return;
 }
+
+
+////////////////////////////////////////////////////////////////////////////////////////
+// RouteEntry / RouteTable
+////////////////////////////////////////////////////////////////////////////////////////
+
+static unsigned PrefixMask(const unsigned prefixlen)
+{
+  return prefixlen==0 ? 0 : (0xffffffffU << (32-prefixlen));
+}
+
+RouteEntry::RouteEntry() : net(IP_ADDRESS_ANY), prefixlen(0), gateway(IP_ADDRESS_ANY), iface(), metric(0)
+{}
+
+RouteEntry::RouteEntry(const IPAddress &n, const unsigned p, const IPAddress &g,
+		       const char *i, const unsigned m) :
+  net(n), prefixlen(p>32 ? 32 : p), gateway(g), iface(i ? i : ""), metric(m)
+{
+  net=(unsigned)net & PrefixMask(prefixlen);
+}
+
+IPAddress RouteEntry::GetMask() const
+{
+  return IPAddress(PrefixMask(prefixlen));
+}
+
+IPAddress RouteEntry::GetNextHop(const IPAddress &dest) const
+{
+  return gateway==IP_ADDRESS_ANY ? dest : gateway;
+}
+
+std::ostream & RouteEntry::Print(std::ostream &os) const
+{
+  os << "RouteEntry(net=" << net << "/" << prefixlen
+     << ", gateway=" << gateway
+     << ", iface=" << iface
+     << ", metric=" << metric << ")";
+  return os;
+}
+
+
+RouteTable::RouteTable() :
+  count(0), dir(1<<16), level2(256), level3(256,-1)
+{
+  // chunk 0 of each level stands for "none"
+  NewNode();
+  for (unsigned i=0;i<dir.size();i++) {
+    dir[i].route=-1;
+    dir[i].chunk=0;
+  }
+}
+
+RouteTable::RouteTable(const RouteTable &rhs) :
+  nodes(rhs.nodes), freenodes(rhs.freenodes), routes(rhs.routes),
+  freeroutes(rhs.freeroutes), count(rhs.count), dir(rhs.dir),
+  level2(rhs.level2), level3(rhs.level3), free2(rhs.free2), free3(rhs.free3)
+{}
+
+RouteTable::~RouteTable()
+{}
+
+RouteTable & RouteTable::operator=(const RouteTable &rhs)
+{
+  nodes=rhs.nodes;
+  freenodes=rhs.freenodes;
+  routes=rhs.routes;
+  freeroutes=rhs.freeroutes;
+  count=rhs.count;
+  dir=rhs.dir;
+  level2=rhs.level2;
+  level3=rhs.level3;
+  free2=rhs.free2;
+  free3=rhs.free3;
+  return *this;
+}
+
+unsigned RouteTable::NewNode()
+{
+  unsigned n;
+  if (!freenodes.empty()) {
+    n=freenodes.back();
+    freenodes.pop_back();
+  } else {
+    n=nodes.size();
+    nodes.push_back(Node());
+  }
+  nodes[n].child[0]=nodes[n].child[1]=0;
+  nodes[n].route=-1;
+  return n;
+}
+
+// Follow addr from node, which is at depth from, down to depth to.
+// best picks up routes on the way (not the one at node itself).
+// Returns the node at depth to, or 0 if the path ends first.
+unsigned RouteTable::Walk(unsigned node, const unsigned addr, const unsigned from,
+			  const unsigned to, int &best) const
+{
+  for (unsigned d=from; d<to; d++) {
+    node=nodes[node].child[(addr>>(31-d))&1];
+    if (node==0) {
+      break;
+    }
+    if (nodes[node].route>=0) {
+      best=nodes[node].route;
+    }
+  }
+  return node;
+}
+
+unsigned RouteTable::NewChunk(std::vector<DirEntry> &level, std::vector<unsigned> &freelist)
+{
+  unsigned c;
+  if (!freelist.empty()) {
+    c=freelist.back();
+    freelist.pop_back();
+  } else {
+    c=level.size()/256;
+    level.resize(level.size()+256);
+  }
+  for (unsigned i=0;i<256;i++) {
+    level[c*256+i].route=-1;
+    level[c*256+i].chunk=0;
+  }
+  return c;
+}
+
+unsigned RouteTable::NewChunk3()
+{
+  unsigned c;
+  if (!free3.empty()) {
+    c=free3.back();
+    free3.pop_back();
+  } else {
+    c=level3.size()/256;
+    level3.resize(level3.size()+256);
+  }
+  for (unsigned i=0;i<256;i++) {
+    level3[c*256+i]=-1;
+  }
+  return c;
+}
+
+void RouteTable::FreeChunk2(const unsigned chunk)
+{
+  for (unsigned i=0;i<256;i++) {
+    if (level2[chunk*256+i].chunk) {
+      free3.push_back(level2[chunk*256+i].chunk);
+    }
+  }
+  free2.push_back(chunk);
+}
+
+// Rebuild the lookup entries covered by addr/prefixlen from the trie
+void RouteTable::Refresh(const unsigned addr, const unsigned prefixlen)
+{
+  int none;
+
+  if (prefixlen<=16) {
+    unsigned first=addr>>16;
+    for (unsigned s=first; s<first+(1<<(16-prefixlen)); s++) {
+      int best=nodes[0].route;
+      Walk(0,s<<16,0,16,best);
+      dir[s].route=best;
+    }
+    return;
+  }
+
+  // longer routes only matter below the /16 (and /24) they are in, and
+  // the chunks there exist only while such routes do
+  unsigned s=addr>>16;
+  unsigned n16=Walk(0,addr,0,16,none);
+  if (n16==0 || (nodes[n16].child[0]==0 && nodes[n16].child[1]==0)) {
+    if (dir[s].chunk) {
+      FreeChunk2(dir[s].chunk);
+      dir[s].chunk=0;
+    }
+    return;
+  }
+  if (dir[s].chunk==0) {
+    unsigned c=NewChunk(level2,free2);
+    dir[s].chunk=c;
+  }
+  unsigned c2=dir[s].chunk;
+
+  if (prefixlen<=24) {
+    unsigned first=(addr>>8)&255;
+    for (unsigned j=first; j<first+(1<<(24-prefixlen)); j++) {
+      int best=-1;
+      Walk(n16,(s<<16)|(j<<8),16,24,best);
+      level2[c2*256+j].route=best;
+    }
+    return;
+  }
+
+  unsigned j=(addr>>8)&255;
+  unsigned n24=Walk(n16,addr,16,24,none);
+  if (n24==0 || (nodes[n24].child[0]==0 && nodes[n24].child[1]==0)) {
+    if (level2[c2*256+j].chunk) {
+      free3.push_back(level2[c2*256+j].chunk);
+      level2[c2*256+j].chunk=0;
+    }
+    return;
+  }
+  if (level2[c2*256+j].chunk==0) {
+    unsigned c=NewChunk3();
+    level2[c2*256+j].chunk=c;
+  }
+  unsigned c3=level2[c2*256+j].chunk;
+  unsigned first=addr&255;
+  for (unsigned k=first; k<first+(1<<(32-prefixlen)); k++) {
+    int best=-1;
+    Walk(n24,(addr&~255U)|k,24,32,best);
+    level3[c3*256+k]=best;
+  }
+}
+
+unsigned RouteTable::Add(const RouteEntry &r)
+{
+  RouteEntry route(r.net,r.prefixlen,r.gateway,r.iface.c_str(),r.metric);
+  unsigned addr=route.net;
+  unsigned node=0;
+
+  for (unsigned d=0; d<route.prefixlen; d++) {
+    unsigned bit=(addr>>(31-d))&1;
+    if (nodes[node].child[bit]==0) {
+      unsigned c=NewNode();
+      nodes[node].child[bit]=c;
+    }
+    node=nodes[node].child[bit];
+  }
+  if (nodes[node].route>=0) {
+    routes[nodes[node].route]=route;
+  } else {
+    if (!freeroutes.empty()) {
+      nodes[node].route=freeroutes.back();
+      freeroutes.pop_back();
+      routes[nodes[node].route]=route;
+    } else {
+      nodes[node].route=routes.size();
+      routes.push_back(route);
+    }
+    count++;
+  }
+  Refresh(addr,route.prefixlen);
+  return nodes[node].route;
+}
+
+bool RouteTable::Delete(const IPAddress &net, const unsigned plen)
+{
+  unsigned prefixlen = plen>32 ? 32 : plen;
+  unsigned addr=(unsigned)net & PrefixMask(prefixlen);
+  unsigned path[33];
+  unsigned node=0;
+
+  path[0]=0;
+  for (unsigned d=0; d<prefixlen; d++) {
+    node=nodes[node].child[(addr>>(31-d))&1];
+    if (node==0) {
+      return false;
+    }
+    path[d+1]=node;
+  }
+  if (nodes[node].route<0) {
+    return false;
+  }
+  freeroutes.push_back(nodes[node].route);
+  routes[nodes[node].route]=RouteEntry();
+  nodes[node].route=-1;
+  count--;
+
+  // drop nodes that no longer lead anywhere
+  for (unsigned d=prefixlen; d>0; d--) {
+    unsigned n=path[d];
+    if (nodes[n].route>=0 || nodes[n].child[0] || nodes[n].child[1]) {
+      break;
+    }
+    nodes[path[d-1]].child[(addr>>(32-d))&1]=0;
+    freenodes.push_back(n);
+  }
+  Refresh(addr,prefixlen);
+  return true;
+}
+
+const RouteEntry *RouteTable::Lookup(const IPAddress &a) const
+{
+  int best=Find(a);
+
+  return best>=0 ? &routes[best] : 0;
+}
+
+int RouteTable::Find(const IPAddress &a) const
+{
+  unsigned addr=a;
+  const DirEntry &e=dir[addr>>16];
+  int best=e.route;
+
+  if (e.chunk) {
+    const DirEntry &e2=level2[e.chunk*256+((addr>>8)&255)];
+    if (e2.route>=0) {
+      best=e2.route;
+    }
+    if (e2.chunk && level3[e2.chunk*256+(addr&255)]>=0) {
+      best=level3[e2.chunk*256+(addr&255)];
+    }
+  }
+  return best;
+}
+
+int RouteTable::Index(const IPAddress &net, const unsigned plen) const
+{
+  unsigned prefixlen = plen>32 ? 32 : plen;
+  unsigned addr=(unsigned)net & PrefixMask(prefixlen);
+  unsigned node=0;
+
+  for (unsigned d=0; d<prefixlen; d++) {
+    node=nodes[node].child[(addr>>(31-d))&1];
+    if (node==0) {
+      return -1;
+    }
+  }
+  return nodes[node].route;
+}
+
+#define ROUTE_BATCH 16
+
+void RouteTable::Lookup(const IPAddress *addrs, const RouteEntry **out, const unsigned n) const
+{
+  for (unsigned base=0; base<n; base+=ROUTE_BATCH) {
+    unsigned m = n-base<ROUTE_BATCH ? n-base : ROUTE_BATCH;
+    const DirEntry *e[ROUTE_BATCH];
+    const DirEntry *e2[ROUTE_BATCH];
+    int best[ROUTE_BATCH];
+
+    // one level at a time across the batch, so that the cache misses of
+    // each level are in flight together
+    for (unsigned k=0; k<m; k++) {
+      e[k]=&dir[(unsigned)addrs[base+k]>>16];
+      __builtin_prefetch(e[k]);
+    }
+    for (unsigned k=0; k<m; k++) {
+      best[k]=e[k]->route;
+      e2[k] = e[k]->chunk ? &level2[e[k]->chunk*256+(((unsigned)addrs[base+k]>>8)&255)] : 0;
+      if (e2[k]) {
+	__builtin_prefetch(e2[k]);
+      }
+    }
+    for (unsigned k=0; k<m; k++) {
+      if (e2[k]) {
+	if (e2[k]->route>=0) {
+	  best[k]=e2[k]->route;
+	}
+	if (e2[k]->chunk) {
+	  int r=level3[e2[k]->chunk*256+((unsigned)addrs[base+k]&255)];
+	  if (r>=0) {
+	    best[k]=r;
+	  }
+	}
+      }
+      out[base+k] = best[k]>=0 ? &routes[best[k]] : 0;
+    }
+  }
+}
+
+int RouteTable::Load(const char *filename)
+{
+  FILE *f;
+  char  field[8][BUFFER];
+  char  tok[BUFFER];
+  int   n=0;
+
+  if ((f=fopen(filename,"r"))==NULL) {
+    return -1;
+  }
+  // skip the header up to the first destination
+  while (fscanf(f,"%99s",tok)==1) {
+    if (strchr(tok,'.')!=NULL || strcmp(tok,"default")==0) {
+      break;
+    }
+  }
+  while (!feof(f)) {
+    strcpy(field[NET],tok);
+    int i;
+    for (i=GATEWAY; i<=IFACE; i++) {
+      if (fscanf(f,"%99s",field[i])!=1) {
+	break;
+      }
+    }
+    if (i<=IFACE) {
+      break;
+    }
+    IPAddress net = strcmp(field[NET],"default")==0 ? IP_ADDRESS_ANY : IPAddress(field[NET]);
+    IPAddress gw  = (strcmp(field[GATEWAY],"*")==0 || strcmp(field[GATEWAY],"default")==0)
+                    ? IP_ADDRESS_ANY : IPAddress(field[GATEWAY]);
+    unsigned mask = strcmp(field[NET],"default")==0 ? 0 : (unsigned)IPAddress(field[MASK]);
+    Add(RouteEntry(net,__builtin_popcount(mask),gw,field[IFACE],atoi(field[METRIC])));
+    n++;
+    if (fscanf(f,"%99s",tok)!=1) {
+      break;
+    }
+  }
+  fclose(f);
+  return n;
+}
+
+void RouteTable::GetRoutes(std::vector<RouteEntry> &out) const
+{
+  std::vector<unsigned> stack;
+
+  // depth first, so routes come out in address order
+  stack.push_back(0);
+  while (!stack.empty()) {
+    unsigned node=stack.back();
+    stack.pop_back();
+    if (nodes[node].route>=0) {
+      out.push_back(routes[nodes[node].route]);
+    }
+    if (nodes[node].child[1]) {
+      stack.push_back(nodes[node].child[1]);
+    }
+    if (nodes[node].child[0]) {
+      stack.push_back(nodes[node].child[0]);
+    }
+  }
+}
+
+std::ostream & RouteTable::Print(std::ostream &os) const
+{
+  std::vector<RouteEntry> all;
+
+  GetRoutes(all);
+  os << "RouteTable(" << count << " routes";
+  for (unsigned i=0;i<all.size();i++) {
+    os << ", " << all[i];
+  }
+  os << ")";
+  return os;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////
+// ForwardingTable
+////////////////////////////////////////////////////////////////////////////////////////
+
+ForwardingTable::ForwardingTable(const EthernetAddr &s) : src(s)
+{}
+
+// The adjacency for nexthop, made unresolved if there is none
+unsigned ForwardingTable::Attach(const IPAddress &nexthop)
+{
+  NextHopMap::const_iterator i=bynexthop.find(nexthop);
+  unsigned a;
+
+  if (i!=bynexthop.end()) {
+    return (*i).second;
+  }
+  if (!freeadjs.empty()) {
+    a=freeadjs.back();
+    freeadjs.pop_back();
+  } else {
+    a=adjs.size();
+    adjs.push_back(Adjacency());
+  }
+  adjs[a].nexthop=nexthop;
+  adjs[a].resolved=false;
+  adjs[a].refs=0;
+  adjs[a].host=-1;
+  bynexthop[nexthop]=a;
+  return a;
+}
+
+void ForwardingTable::Detach(const unsigned a)
+{
+  adjs[a].refs--;
+  Release(a);
+}
+
+// An adjacency goes once no route uses it and it has nothing to tell
+void ForwardingTable::Release(const unsigned a)
+{
+  if (adjs[a].refs==0 && !adjs[a].resolved) {
+    bynexthop.erase(adjs[a].nexthop);
+    freeadjs.push_back(a);
+  }
+}
+
+void ForwardingTable::SetRouteAdjacency(const unsigned route, const int a)
+{
+  if (route>=routeadj.size()) {
+    routeadj.resize(route+1,CONNECTED);
+  }
+  int old=routeadj[route];
+  routeadj[route]=a;
+  if (a>=0) {
+    adjs[a].refs++;
+  }
+  if (old>=0) {
+    Detach(old);
+  }
+}
+
+void ForwardingTable::AddHostRoute(const unsigned a)
+{
+  RouteEntry net=table.GetRoute(table.Find(adjs[a].nexthop));
+  unsigned r=table.Add(RouteEntry(adjs[a].nexthop,32,IP_ADDRESS_ANY,net.iface.c_str(),net.metric));
+
+  adjs[a].host=r;
+  SetRouteAdjacency(r,a);
+}
+
+void ForwardingTable::DeleteHostRoute(const unsigned a)
+{
+  int r=adjs[a].host;
+
+  adjs[a].host=-1;
+  table.Delete(adjs[a].nexthop,32);
+  SetRouteAdjacency(r,CONNECTED);
+}
+
+// Host routes are taken out while the routes they were cloned from
+// change, and hosts says what they were, to put them back with
+void ForwardingTable::DeleteHostRoutes(std::vector<std::pair<IPAddress, EthernetAddr> > &hosts)
+{
+  std::vector<unsigned> cloned;
+
+  for (NextHopMap::const_iterator i=bynexthop.begin(); i!=bynexthop.end(); ++i) {
+    if (adjs[(*i).second].host>=0) {
+      cloned.push_back((*i).second);
+    }
+  }
+  for (unsigned i=0;i<cloned.size();i++) {
+    hosts.push_back(std::make_pair(adjs[cloned[i]].nexthop,adjs[cloned[i]].addr));
+    DeleteHostRoute(cloned[i]);
+  }
+}
+
+void ForwardingTable::Add(const RouteEntry &route)
+{
+  std::vector<std::pair<IPAddress, EthernetAddr> > hosts;
+
+  DeleteHostRoutes(hosts);
+  unsigned r=table.Add(route);
+  if (route.gateway!=IP_ADDRESS_ANY) {
+    SetRouteAdjacency(r,Attach(route.gateway));
+  } else {
+    SetRouteAdjacency(r,table.GetRoute(r).net==IP_ADDRESS_LO ? LOCAL : CONNECTED);
+  }
+  for (unsigned i=0;i<hosts.size();i++) {
+    SetNeighbor(hosts[i].first,hosts[i].second);
+  }
+}
+
+bool ForwardingTable::Delete(const IPAddress &net, const unsigned prefixlen)
+{
+  std::vector<std::pair<IPAddress, EthernetAddr> > hosts;
+
+  DeleteHostRoutes(hosts);
+  int r=table.Index(net,prefixlen);
+  bool deleted = r>=0 && table.Delete(net,prefixlen);
+  if (deleted) {
+    SetRouteAdjacency(r,CONNECTED);
+  }
+  for (unsigned i=0;i<hosts.size();i++) {
+    SetNeighbor(hosts[i].first,hosts[i].second);
+  }
+  return deleted;
+}
+
+int ForwardingTable::Load(const char *filename)
+{
+  RouteTable t;
+  std::vector<RouteEntry> routes;
+  int n=t.Load(filename);
+
+  t.GetRoutes(routes);
+  for (unsigned i=0;i<routes.size();i++) {
+    Add(routes[i]);
+  }
+  return n;
+}
+
+void ForwardingTable::SetNeighbor(const IPAddress &addr, const EthernetAddr &hw)
+{
+  NextHopMap::const_iterator i=bynexthop.find(addr);
+  int r=table.Find(addr);
+  bool connected = r>=0 && routeadj[r]==CONNECTED;
+
+  // neither a gateway nor on a net of ours
+  if (i==bynexthop.end() && !connected) {
+    return;
+  }
+  unsigned a = i!=bynexthop.end() ? (*i).second : Attach(addr);
+  Adjacency &adj=adjs[a];
+  EthernetHeader h;
+
+  h.SetSrcAddr(src);
+  h.SetDestAddr(hw);
+  h.SetProtocolType(PROTO_IP);
+  adj.resolved=true;
+  adj.addr=hw;
+  adj.ethheader=h;
+  h.GetData(adj.header,ETHERNET_HEADER_LEN,0);
+
+  if (connected && table.GetRoute(r).prefixlen<32) {
+    AddHostRoute(a);
+  }
+}
+
+void ForwardingTable::ClearNeighbor(const IPAddress &addr)
+{
+  NextHopMap::const_iterator i=bynexthop.find(addr);
+
+  if (i==bynexthop.end()) {
+    return;
+  }
+  unsigned a=(*i).second;
+  adjs[a].resolved=false;
+  if (adjs[a].host>=0) {
+    DeleteHostRoute(a);
+  } else {
+    Release(a);
+  }
+}
+
+ForwardResult ForwardingTable::Lookup(const IPAddress &dest, const Adjacency *&adj, IPAddress &nexthop) const
+{
+  int r=table.Find(dest);
+
+  if (r<0) {
+    return FORWARD_NO_ROUTE;
+  }
+  int a=routeadj[r];
+  if (a==LOCAL) {
+    return FORWARD_LOCAL;
+  }
+  if (a==CONNECTED) {
+    // a host with no host route yet, or on a connected /32
+    NextHopMap::const_iterator i=bynexthop.find(dest);
+    if (i==bynexthop.end()) {
+      nexthop=dest;
+      return FORWARD_UNRESOLVED;
+    }
+    a=(*i).second;
+  }
+  adj=&adjs[a];
+  nexthop=adj->nexthop;
+  return adj->resolved ? FORWARD_OK : FORWARD_UNRESOLVED;
+}
+
+ForwardResult ForwardingTable::Forward(RawEthernetPacket &frame, IPAddress &nexthop) const
+{
+  unsigned char *ip=(unsigned char *)frame.data+ETHERNET_HEADER_LEN;
+  unsigned hlen=(ip[0]&15)*4;
+
+  if (frame.size<ETHERNET_HEADER_LEN+IP_HEADER_BASE_LENGTH ||
+      (ip[0]>>4)!=IP_HEADER_REQUIRED_VERSION || hlen<IP_HEADER_BASE_LENGTH ||
+      frame.size<ETHERNET_HEADER_LEN+hlen ||
+      memcmp(frame.data,src.addr,6)!=0 ||
+      ChecksumFinish(ChecksumAdd(ip,hlen))!=0) {
+    return FORWARD_DISCARD;
+  }
+  if (ip[8]<=1) {
+    return FORWARD_TTL_EXCEEDED;
+  }
+
+  unsigned dest;
+  const Adjacency *adj;
+  memcpy(&dest,ip+16,4);
+  ForwardResult r=Lookup(IPAddress(ntohl(dest)),adj,nexthop);
+  if (r!=FORWARD_OK) {
+    return r;
+  }
+
+  unsigned short before, after, check;
+  memcpy(&before,ip+8,2);
+  ip[8]--;
+  memcpy(&after,ip+8,2);
+  memcpy(&check,ip+10,2);
+  check=ChecksumUpdate16(check,before,after);
+  memcpy(ip+10,&check,2);
+  memcpy(frame.data,adj->header,ETHERNET_HEADER_LEN);
+  return FORWARD_OK;
+}
+
+std::ostream & ForwardingTable::Print(std::ostream &os) const
+{
+  os << "ForwardingTable(" << table.size() << " routes, adjacencies={";
+  for (NextHopMap::const_iterator i=bynexthop.begin(); i!=bynexthop.end(); ++i) {
+    const Adjacency &a=adjs[(*i).second];
+    os << a.nexthop << (a.resolved ? ":resolved/" : ":unresolved/") << a.refs << " ";
+  }
+  os << "})";
+  return os;
+}
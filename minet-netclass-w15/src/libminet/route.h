@@ -1,7 +1,13 @@
+#ifndef _route
+#define _route
+
 #include <iostream>
 #include <cstdio>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -9,6 +15,7 @@
 
 #include "ip.h"
 #include "ethernet.h"
+#include "arp.h"
 
 
 struct route_t
@@ -52,6 +59,202 @@ struct if_list_t
 };
 
 
+//
+// Numeric routing table
+//
+// Routes are kept in a binary trie on the destination prefix, which is
+// what Add and Delete work on.  Lookups go through a three level table
+// built from it, with strides of 16, 8 and 8 bits (DIR-16-8-8): each
+// level holds the best route whose prefix ends within that level, and
+// the second and third level chunks exist only under /16s and /24s that
+// have longer routes.  A lookup is at most three array accesses however
+// many routes there are, and a change rewrites only the entries its
+// prefix covers at its own level.
+//
+
+struct RouteEntry {
+  IPAddress    net;
+  unsigned     prefixlen;
+  IPAddress    gateway;     // IP_ADDRESS_ANY for a directly connected net
+  std::string  iface;
+  unsigned     metric;
+
+  RouteEntry();
+  RouteEntry(const IPAddress &net, const unsigned prefixlen,
+             const IPAddress &gateway, const char *iface, const unsigned metric=0);
+
+  IPAddress GetMask() const;
+  // Where to send a packet for dest: the gateway, or dest itself
+  IPAddress GetNextHop(const IPAddress &dest) const;
+
+  std::ostream & Print(std::ostream &os) const;
+
+  friend std::ostream &operator<<(std::ostream &os, const RouteEntry& L) {
+    return L.Print(os);
+  }
+};
+
+class RouteTable {
+ private:
+  struct Node {
+    unsigned child[2];   // 0 if none; the root is never a child
+    int      route;      // index into routes, or -1
+  };
+  struct DirEntry {
+    int      route;      // best route of 16 bits or less, or -1
+    unsigned chunk;      // second level chunk, or 0
+  };
+
+  std::vector<Node>       nodes;
+  std::vector<unsigned>   freenodes;
+  std::vector<RouteEntry> routes;
+  std::vector<unsigned>   freeroutes;
+  unsigned                count;
+
+  std::vector<DirEntry>   dir;       // 2^16 entries, by the top 16 bits
+  std::vector<DirEntry>   level2;    // 256 entry chunks, by the next 8
+  std::vector<int>        level3;    // 256 entry chunks, by the last 8
+  std::vector<unsigned>   free2;
+  std::vector<unsigned>   free3;
+
+  unsigned NewNode();
+  unsigned Walk(unsigned node, const unsigned addr, const unsigned from,
+                const unsigned to, int &best) const;
+  unsigned NewChunk(std::vector<DirEntry> &level, std::vector<unsigned> &freelist);
+  unsigned NewChunk3();
+  void     FreeChunk2(const unsigned chunk);
+  void     Refresh(const unsigned addr, const unsigned prefixlen);
+
+ public:
+  RouteTable();
+  RouteTable(const RouteTable &rhs);
+  virtual ~RouteTable();
+
+  RouteTable & operator=(const RouteTable &rhs);
+
+  // Adds a route, replacing any with the same net and prefix length.
+  // Returns its index (see Find).
+  unsigned Add(const RouteEntry &route);
+  // Returns false if there was no such route
+  bool Delete(const IPAddress &net, const unsigned prefixlen);
+
+  // Longest prefix match.  Returns 0 if no route matches.  The pointer
+  // stays valid until the table is next changed.
+  const RouteEntry *Lookup(const IPAddress &addr) const;
+  // The same as an index, or -1.  A route keeps its index until it is
+  // deleted, and indices are small, so they can key tables of their own.
+  int Find(const IPAddress &addr) const;
+  // The index of the route for exactly this net, or -1
+  int Index(const IPAddress &net, const unsigned prefixlen) const;
+  const RouteEntry &GetRoute(const unsigned index) const { return routes[index]; }
+  // Every route, in address order
+  void GetRoutes(std::vector<RouteEntry> &out) const;
+  // Looks up n addresses at once, interleaving the walks so that their
+  // memory accesses overlap
+  void Lookup(const IPAddress *addrs, const RouteEntry **out, const unsigned n) const;
+
+  // Reads "route -n" style output: Destination Gateway Genmask Flags
+  // Metric Ref Use Iface.  Returns the number of routes read, or -1.
+  int Load(const char *filename);
+
+  unsigned size() const { return count; }
+  bool     empty() const { return count==0; }
+
+  std::ostream & Print(std::ostream &os) const;
+
+  friend std::ostream &operator<<(std::ostream &os, const RouteTable& L) {
+    return L.Print(os);
+  }
+};
+
+
+//
+// Forwarding table
+//
+// A RouteTable with every route's next hop worked out ahead of time.
+// Routes through the same gateway share an adjacency for it, and a host
+// on a directly connected net gets a host route of its own, with its
+// adjacency, once its address resolves.  A resolved adjacency holds the
+// Ethernet header a frame to its next hop needs, ready to copy in, so
+// sending a packet on is one lookup and a header, with no formatting
+// and no IPC.  Adjacencies follow the neighbor cache through SetNeighbor
+// and ClearNeighbor.  Routes to IP_ADDRESS_LO are local.
+//
+
+struct Adjacency {
+  IPAddress      nexthop;
+  bool           resolved;
+  EthernetAddr   addr;
+  char           header[ETHERNET_HEADER_LEN];   // dest, source and type
+  EthernetHeader ethheader;                     // the same, for a Packet
+  unsigned       refs;                          // routes through it
+  int            host;                          // its host route, or -1
+};
+
+enum ForwardResult {
+  FORWARD_OK,            // the adjacency is resolved, send it
+  FORWARD_LOCAL,         // for this machine
+  FORWARD_NO_ROUTE,
+  FORWARD_UNRESOLVED,    // the next hop has to be resolved first
+  FORWARD_TTL_EXCEEDED,
+  FORWARD_DISCARD,       // malformed, or not sent to our Ethernet address
+};
+
+class ForwardingTable {
+ private:
+  typedef std::unordered_map<IPAddress, unsigned, hashipaddress, eqipaddress> NextHopMap;
+
+  RouteTable             table;
+  std::vector<int>       routeadj;    // by route index; -1 for a connected net
+  std::vector<Adjacency> adjs;
+  std::vector<unsigned>  freeadjs;
+  NextHopMap             bynexthop;
+  EthernetAddr           src;
+
+  // routeadj for routes with no adjacency of their own
+  enum {CONNECTED=-1, LOCAL=-2};
+
+  unsigned Attach(const IPAddress &nexthop);
+  void     Detach(const unsigned adj);
+  void     Release(const unsigned adj);
+  void     SetRouteAdjacency(const unsigned route, const int adj);
+  void     AddHostRoute(const unsigned adj);
+  void     DeleteHostRoute(const unsigned adj);
+  void     DeleteHostRoutes(std::vector<std::pair<IPAddress, EthernetAddr> > &hosts);
+
+ public:
+  ForwardingTable(const EthernetAddr &src);
+
+  void Add(const RouteEntry &route);
+  bool Delete(const IPAddress &net, const unsigned prefixlen);
+  // As RouteTable::Load
+  int  Load(const char *filename);
+
+  // The neighbor cache learned or lost an address
+  void SetNeighbor(const IPAddress &addr, const EthernetAddr &hw);
+  void ClearNeighbor(const IPAddress &addr);
+
+  // Where a packet for dest goes.  adj is set for FORWARD_OK, and
+  // nexthop for FORWARD_OK and FORWARD_UNRESOLVED.
+  ForwardResult Lookup(const IPAddress &dest, const Adjacency *&adj, IPAddress &nexthop) const;
+  // The fast path for a frame passing through, done on the frame as it
+  // is: checks its IP header, looks up its destination and, if the next
+  // hop is resolved, takes one off its TTL, updates its checksum to
+  // match (RFC 1624) and copies in the next hop's Ethernet header.  On
+  // anything but FORWARD_OK the frame is left alone.
+  ForwardResult Forward(RawEthernetPacket &frame, IPAddress &nexthop) const;
+
+  const RouteTable &GetRoutes() const { return table; }
+  size_t NumAdjacencies() const { return bynexthop.size(); }
+
+  std::ostream & Print(std::ostream &os) const;
+
+  friend std::ostream &operator<<(std::ostream &os, const ForwardingTable& L) {
+    return L.Print(os);
+  }
+};
+
+
 // Function prototypes relating to route_tables
 route_table_t *make_route_table(void);
 //static route_t *make_route(char *net, char *mask, char *iface, char *gateway,
@@ -80,3 +283,5 @@ int is_empty_list(if_list_t *if_list);
 intface_t *make_intface(char *name, char *status, char *IPAddr,                         \
 			char *NetAddr);
 void print_if_list(if_list_t *if_list);
+
+#endif
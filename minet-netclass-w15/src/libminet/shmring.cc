@@ -0,0 +1,315 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "shmring.h"
+#include "util.h"
+
+#define SHMRING_MAX_FD  1024
+#define SHMRING_WAIT_NS 50000000   // recheck the peer every 50 ms
+
+static ShmRing *rings_by_fd[SHMRING_MAX_FD];
+
+static size_t ControlLength()
+{
+  // keep the data area cache line aligned
+  return (sizeof(ShmRingControl)+63) & ~((size_t)63);
+}
+
+static void FutexWait(std::atomic<uint32_t> *addr, uint32_t val)
+{
+  struct timespec ts;
+  ts.tv_sec=0;
+  ts.tv_nsec=SHMRING_WAIT_NS;
+  syscall(SYS_futex,(uint32_t*)addr,FUTEX_WAIT,val,&ts,0,0);
+}
+
+static void FutexWake(std::atomic<uint32_t> *addr)
+{
+  syscall(SYS_futex,(uint32_t*)addr,FUTEX_WAKE,1,0,0,0);
+}
+
+
+ShmRing *ShmRingForFD(const int fd)
+{
+  return (fd>=0 && fd<SHMRING_MAX_FD) ? rings_by_fd[fd] : 0;
+}
+
+
+ShmRing::ShmRing() : ctl(0), data(0), maplen(0), fd(-1), producer(false), pending(0)
+{}
+
+ShmRing::~ShmRing()
+{
+  Unbind();
+  if (ctl) {
+    if (producer) {
+      Publish();
+      ctl->closed.store(1);
+      FutexWake(&ctl->tail);
+    }
+    munmap(ctl,maplen);
+  }
+}
+
+bool ShmRing::MakeName(const char *fifoname, char *name, size_t len)
+{
+  struct stat st;
+
+  // the fifo's identity keeps separate Minet instances apart
+  if (stat(fifoname,&st)<0) {
+    return false;
+  }
+  snprintf(name,len,"/minet-%lx-%lx",(unsigned long)st.st_dev,(unsigned long)st.st_ino);
+  return true;
+}
+
+bool ShmRing::IsConfigured(const char *fifoname)
+{
+  const char *env=getenv("MINET_RINGS");
+  const char *base=strrchr(fifoname,'/');
+  base = base ? base+1 : fifoname;
+
+  if (env==0) {
+    return false;
+  }
+  // minet.cfg values arrive with their quotes
+  while (*env) {
+    size_t n;
+    env+=strspn(env," \t,\"");
+    n=strcspn(env," \t,\"");
+    if (n>0 && ((n==3 && !strncmp(env,"all",3)) ||
+		(n==strlen(base) && !strncmp(env,base,n)))) {
+      return true;
+    }
+    env+=n;
+  }
+  return false;
+}
+
+ShmRing *ShmRing::Create(const char *fifoname, size_t size)
+{
+  char name[64];
+  int sfd;
+
+  // round up to a power of two
+  size_t s=4096;
+  while (s<size) {
+    s<<=1;
+  }
+
+  if (!MakeName(fifoname,name,sizeof(name))) {
+    return 0;
+  }
+  shm_unlink(name);
+  if ((sfd=shm_open(name,O_CREAT|O_EXCL|O_RDWR,0600))<0) {
+    return 0;
+  }
+
+  ShmRing *r = new ShmRing;
+  r->maplen=ControlLength()+s;
+  r->producer=true;
+
+  void *m=MAP_FAILED;
+  if (ftruncate(sfd,r->maplen)==0) {
+    m=mmap(0,r->maplen,PROT_READ|PROT_WRITE,MAP_SHARED,sfd,0);
+  }
+  close(sfd);
+  if (m==MAP_FAILED) {
+    shm_unlink(name);
+    delete r;
+    return 0;
+  }
+  memset(m,0,ControlLength());
+  r->ctl=(ShmRingControl*)m;
+  r->data=(char*)m+ControlLength();
+  r->ctl->size=s;
+  r->ctl->magic=SHMRING_MAGIC;
+  return r;
+}
+
+ShmRing *ShmRing::Attach(const char *fifoname)
+{
+  char name[64];
+  struct stat st;
+  int sfd;
+
+  if (!MakeName(fifoname,name,sizeof(name))) {
+    return 0;
+  }
+  if ((sfd=shm_open(name,O_RDWR,0600))<0) {
+    return 0;
+  }
+  void *m=MAP_FAILED;
+  if (fstat(sfd,&st)==0 && (size_t)st.st_size>ControlLength()) {
+    m=mmap(0,st.st_size,PROT_READ|PROT_WRITE,MAP_SHARED,sfd,0);
+  }
+  close(sfd);
+  // both ends have it mapped now, so the name is no longer needed
+  shm_unlink(name);
+  if (m==MAP_FAILED) {
+    return 0;
+  }
+
+  ShmRing *r = new ShmRing;
+  r->maplen=st.st_size;
+  r->ctl=(ShmRingControl*)m;
+  r->data=(char*)m+ControlLength();
+  if (r->ctl->magic!=SHMRING_MAGIC || r->ctl->size+ControlLength()!=r->maplen) {
+    delete r;
+    return 0;
+  }
+  return r;
+}
+
+void ShmRing::Bind(const int f)
+{
+  Unbind();
+  if (f>=0 && f<SHMRING_MAX_FD) {
+    fd=f;
+    rings_by_fd[fd]=this;
+    // only doorbells go through the fifo now, and we never want to block on them
+    fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+  }
+}
+
+void ShmRing::Unbind()
+{
+  if (fd>=0 && rings_by_fd[fd]==this) {
+    rings_by_fd[fd]=0;
+  }
+  fd=-1;
+}
+
+
+void ShmRing::Publish()
+{
+  if (ctl->tail.load(std::memory_order_relaxed)!=pending) {
+    ctl->tail.store(pending);
+    if (ctl->reader_waiting.load()) {
+      FutexWake(&ctl->tail);
+    }
+  }
+}
+
+int ShmRing::Write(const char *buf, const int len)
+{
+  uint32_t mask=ctl->size-1;
+  uint32_t t=pending;
+  int done=0;
+
+  while (done<len) {
+    uint32_t h=ctl->head.load(std::memory_order_acquire);
+    uint32_t room=ctl->size-(t-h);
+    if (room==0) {
+      // the message is bigger than the ring; let the reader at what we have
+      Publish();
+      ctl->writer_waiting.store(1);
+      if (ctl->head.load()==h) {
+	FutexWait(&ctl->head,h);
+      }
+      ctl->writer_waiting.store(0);
+      if (ctl->head.load()==h) {
+	// still full; poke the reader, which also tells us if it is gone
+	char c=0;
+	if (::write(fd,&c,1)<0 && errno==EPIPE) {
+	  return done;
+	}
+      }
+      continue;
+    }
+    uint32_t n=MIN((uint32_t)(len-done),room);
+    uint32_t off=t&mask;
+    uint32_t first=MIN(n,ctl->size-off);
+    memcpy(data+off,buf+done,first);
+    memcpy(data,buf+done+first,n-first);
+    t+=n;
+    done+=n;
+    pending=t;
+  }
+  return done;
+}
+
+int ShmRing::Read(char *buf, const int len)
+{
+  uint32_t mask=ctl->size-1;
+  uint32_t h=ctl->head.load(std::memory_order_relaxed);
+  int done=0;
+
+  while (done<len) {
+    uint32_t t=ctl->tail.load(std::memory_order_acquire);
+    uint32_t avail=t-h;
+    if (avail==0) {
+      if (ctl->closed.load()) {
+	return done;
+      }
+      ctl->reader_waiting.store(1);
+      if (ctl->tail.load()==t) {
+	FutexWait(&ctl->tail,t);
+      }
+      ctl->reader_waiting.store(0);
+      if (ctl->tail.load()==t && !DrainDoorbell()) {
+	// writer is gone
+	return done;
+      }
+      continue;
+    }
+    uint32_t n=MIN((uint32_t)(len-done),avail);
+    uint32_t off=h&mask;
+    uint32_t first=MIN(n,ctl->size-off);
+    memcpy(buf+done,data+off,first);
+    memcpy(buf+done+first,data,n-first);
+    h+=n;
+    done+=n;
+    ctl->head.store(h);
+    // let a blocked writer sleep until there is real room, not a few bytes
+    if (ctl->writer_waiting.load() && t-h<=ctl->size/2 && ctl->writer_waiting.exchange(0)) {
+      FutexWake(&ctl->head);
+    }
+  }
+  return done;
+}
+
+void ShmRing::Commit()
+{
+  Publish();
+  if (ctl->reader_sleeping.exchange(0)) {
+    char c=0;
+    if (::write(fd,&c,1)<0) {
+      // a full doorbell fifo already has the reader's attention
+    }
+  }
+}
+
+bool ShmRing::HasData() const
+{
+  return ctl->tail.load(std::memory_order_acquire)!=ctl->head.load(std::memory_order_relaxed);
+}
+
+// Returns true if the caller may block on the doorbell, false if data
+// arrived in the meantime.
+bool ShmRing::PrepareToSleep()
+{
+  ctl->reader_sleeping.store(1);
+  return !HasData();
+}
+
+// Empties the doorbell fifo.  Returns false once the writer has closed it.
+bool ShmRing::DrainDoorbell()
+{
+  char junk[256];
+  int rc;
+
+  // a short read means the fifo is empty, which saves a system call
+  while ((rc=::read(fd,junk,sizeof(junk)))==sizeof(junk)) {
+  }
+  return !(rc==0 || ctl->closed.load());
+}
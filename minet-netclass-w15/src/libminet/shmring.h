@@ -0,0 +1,92 @@
+#ifndef _shmring
+#define _shmring
+
+#include <atomic>
+#include <stdint.h>
+
+//
+// Shared memory transport between modules.
+//
+// A ShmRing is a single-producer/single-consumer byte ring living in a
+// POSIX shared memory segment.  Once a fifo descriptor is bound to a
+// ring, readall/writeall/writevall on that descriptor copy straight into
+// and out of the ring instead of making system calls, so every
+// Serialize/Unserialize method works over it unchanged.
+//
+// The producer publishes a message to the consumer as a whole, at
+// Commit().  The fifo itself is kept as a doorbell: when the consumer is
+// about to block in MinetGetNextEvent it says so in the ring, and the
+// producer writes one byte to the fifo at the next Commit().  Waits
+// inside a message (ring empty on read, full on write) use futexes on
+// the ring indices.
+//
+// Which fifos use rings is set by MINET_RINGS, a list of fifo names
+// (e.g. "tcp2ipmux ipmux2tcp") or "all".  Both ends read the same
+// variable, so both agree on the transport.
+//
+
+#define SHMRING_DEFAULT_SIZE (1<<20)
+#define SHMRING_MAGIC        0x4d524e47
+
+struct ShmRingControl {
+  std::atomic<uint32_t> head;            // consumer position
+  char                  pad0[60];
+  std::atomic<uint32_t> tail;            // producer position
+  char                  pad1[60];
+  std::atomic<uint32_t> reader_sleeping; // consumer wants a doorbell
+  std::atomic<uint32_t> reader_waiting;  // consumer in futex wait on tail
+  std::atomic<uint32_t> writer_waiting;  // producer in futex wait on head
+  std::atomic<uint32_t> closed;          // producer has gone away
+  uint32_t              size;            // bytes of data, a power of two
+  uint32_t              magic;
+};
+
+
+class ShmRing {
+ private:
+  ShmRingControl *ctl;
+  char           *data;
+  size_t          maplen;
+  int             fd;        // fifo used as doorbell
+  bool            producer;
+  uint32_t        pending;   // producer: tail not yet published
+
+  void Publish();
+
+  ShmRing();
+  ShmRing(const ShmRing &rhs);
+
+  static bool MakeName(const char *fifoname, char *name, size_t len);
+ public:
+  virtual ~ShmRing();
+
+  // Producer side, called before the fifo is opened for writing
+  static ShmRing *Create(const char *fifoname, size_t size=SHMRING_DEFAULT_SIZE);
+  // Consumer side, called after the fifo has been opened for reading
+  static ShmRing *Attach(const char *fifoname);
+  // Is this fifo configured to use a ring?
+  static bool     IsConfigured(const char *fifoname);
+
+  // Route I/O on fd through this ring.  fd is the fifo it replaces.
+  void Bind(const int fd);
+  void Unbind();
+
+  int  Write(const char *buf, const int len);
+  int  Read(char *buf, const int len);
+
+  // Producer: end of a message; publish it and ring the doorbell if
+  // the reader sleeps
+  void Commit();
+
+  // Consumer: event loop support
+  bool HasData() const;
+  bool PrepareToSleep();
+  bool DrainDoorbell();
+
+  int  GetFD() const { return fd; }
+  bool IsProducer() const { return producer; }
+};
+
+ShmRing *ShmRingForFD(const int fd);
+
+#endif
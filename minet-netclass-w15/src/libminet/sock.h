@@ -1,7 +1,7 @@
 #ifndef _sock
 #define _sock
 
-#define NUM_SOCKS           100   // The maximum number of sockets we support.
+#define NUM_SOCKS           65536 // The maximum number of sockets we support.
                                   // Notes:
                                   //   1) No allowance is made for reusing sock
                                   //      numbers on different addresses; this
@@ -11,12 +11,20 @@
                                   //      value (as indicated below) which 
                                   //      indicates that the socket is
                                   //      unspecified.
+                                  //   3) The socket table starts with
+                                  //      SOCK_TABLE_INITIAL entries and
+                                  //      doubles as needed up to this.
+                                  //   4) minet_select can only watch socks
+                                  //      below FD_SETSIZE; use minet_poll
+                                  //      for more.
+#define SOCK_TABLE_INITIAL  16    // The initial size of the socket table.
 #define NUM_PORTS           65536 // The number of ports on each IP address.
                                   //   As above, 0 is a special case that 
                                   //   indicates that the port is unassigned.
-#define NUM_IP_INTERFACES   10    // The number of distinct IP addresses we can
-                                  //   support (limitation is imposed to 
-                                  //   constrain the size of the port array).
+#define EPHEMERAL_PORT_MIN  49152 // The range that ports are chosen from when
+#define EPHEMERAL_PORT_MAX  65535 //   a socket is bound to PORT_NONE.
+#define REQUEST_QUEUE_SIZE  64    // The initial number of requests that can
+                                  //   be outstanding at each protocol module.
 #define BIN_SIZE            65536 // The size of the input buffer.
 #define BOUT_SIZE           65536 // The size of the output buffer/
 
@@ -1,3 +1,5 @@
+#include <sys/time.h>
+#include <unistd.h>
 #include "sock_mod_structs.h"
 
 
@@ -11,7 +13,8 @@ SockRecord::SockRecord() :
   blocking(1),
   forward_read_notification(0),
   forward_write_notification(0),
-  forward_exception_notification(0)
+  forward_exception_notification(0),
+  readlen(0)
 {
   bin.Clear();
   //  bout.Clear();
@@ -28,7 +31,9 @@ SockRecord::SockRecord(const SockRecord &rhs) :
   blocking(rhs.blocking),
   forward_read_notification(rhs.forward_read_notification),
   forward_write_notification(rhs.forward_write_notification),
-  forward_exception_notification(rhs.forward_exception_notification)
+  forward_exception_notification(rhs.forward_exception_notification),
+  readlen(rhs.readlen),
+  options(rhs.options)
 {}
 
 
@@ -51,7 +56,8 @@ SockRecord::SockRecord(const Connection &c,
   blocking(b),
   forward_read_notification(frn),
   forward_write_notification(fwn),
-  forward_exception_notification(fwn)
+  forward_exception_notification(fwn),
+  readlen(0)
 {}
 
 
@@ -67,6 +73,8 @@ SockRecord & SockRecord::operator= (const SockRecord &rhs) {
   forward_write_notification = rhs.forward_write_notification;
   forward_exception_notification =
     rhs.forward_exception_notification;
+  readlen = rhs.readlen;
+  options = rhs.options;
   return *this;
 }
 
@@ -94,82 +102,141 @@ std::ostream & SockRecord::Print(std::ostream &rhs) const {
 }
 
 
-SockStatus::SockStatus(const SockStatus &rhs) {
-  int i;
-  for (i = 0; i < NUM_SOCKS; i++)
-    sockArray[i] = rhs.sockArray[i];
-}
+SockStatus::SockStatus() :
+  sockArray(1)
+{}
+
+
+SockStatus::SockStatus(const SockStatus &rhs) :
+  sockArray(rhs.sockArray),
+  freeSocks(rhs.freeSocks),
+  index(rhs.index)
+{}
 
 
 SockStatus & SockStatus::operator=(const SockStatus &rhs) {
-  int i;
-  for (i = 0; i < NUM_SOCKS; i++)
-    sockArray[i] = rhs.sockArray[i];
+  sockArray = rhs.sockArray;
+  freeSocks = rhs.freeSocks;
+  index = rhs.index;
   return *this;
 }
 
 
-int SockStatus::FindFreeSock() {
-  int i;
-  for (i = 1; i < NUM_SOCKS; i++)
-    if (sockArray[i].status == FREE)
-      break;
-  if (i < NUM_SOCKS)
-    return i;
+void SockStatus::Index(unsigned sock) {
+  index[ConnectionKey(sockArray[sock].connection)].insert(sock);
+}
+
+
+void SockStatus::Unindex(unsigned sock) {
+  ConnectionIndex::iterator i =
+    index.find(ConnectionKey(sockArray[sock].connection));
+  if (i != index.end()) {
+    i->second.erase(sock);
+    if (i->second.empty())
+      index.erase(i);
+  }
+}
+
+
+int SockStatus::FindIndexed(const Connection & c, unsigned statuses) {
+  ConnectionIndex::iterator i = index.find(ConnectionKey(c));
+  if (i == index.end())
+    return -1;
+  std::set<unsigned>::iterator j;
+  for (j = i->second.begin(); j != i->second.end(); j++)
+    if ((statuses == 0) || (statuses & (1 << sockArray[*j].status)))
+      return *j;
   return -1;
 }
 
 
+int SockStatus::FindFreeSock() {
+  if (freeSocks.empty()) {
+    unsigned size = sockArray.size();
+    unsigned grown = size < SOCK_TABLE_INITIAL ? SOCK_TABLE_INITIAL : 2 * size;
+    if (grown > NUM_SOCKS)
+      grown = NUM_SOCKS;
+    if (grown <= size)
+      return -1;
+    sockArray.resize(grown);
+    for (unsigned i = size; i < grown; i++)
+      freeSocks.insert(freeSocks.end(), i);
+  }
+  return *freeSocks.begin();
+}
+
+
+void SockStatus::CloseSocket(unsigned sock) {
+  if (!Valid(sock) || (sockArray[sock].status == FREE))
+    return;
+  Unindex(sock);
+  sockArray[sock] = SockRecord();
+  freeSocks.insert(sock);
+}
+
+
+// An exact match, or failing that a socket waiting in accept() on c's
+// local address and port.  An accepted connection stays with its own
+// socket while the listener waits for the next one.
 int SockStatus::FindConnection(const Connection & c) {
-  int i;
-  for (i = 1; i < NUM_SOCKS; i++)
-    if (((c.src == sockArray[i].connection.src) &&
-	 (c.dest == sockArray[i].connection.dest) &&
-	 (c.srcport == sockArray[i].connection.srcport) &&
-	 (c.destport == sockArray[i].connection.destport) &&
-	 (c.protocol == sockArray[i].connection.protocol))
-	||
-	((c.src == sockArray[i].connection.src) &&
-	 (IP_ADDRESS_ANY == sockArray[i].connection.dest) &&
-	 (c.srcport == sockArray[i].connection.srcport) &&
-	 (PORT_ANY == sockArray[i].connection.destport) &&
-	 (c.protocol == sockArray[i].connection.protocol) &&
-	 (ACCEPT_PENDING == sockArray[i].status)))
-      break;
-  if (i < NUM_SOCKS)
-    return i;
-  return -1;
+  int exact = FindIndexed(c, 0);
+  if (exact >= 0)
+    return exact;
+  Connection l(c);
+  l.dest = IP_ADDRESS_ANY;
+  l.destport = PORT_ANY;
+  return FindIndexed(l, 1 << ACCEPT_PENDING);
 }
 
 int SockStatus::FindPendingConnection(const Connection & c) {
-  int i;
-  for (i = 1; i < NUM_SOCKS; i++)
-    if ((c.src == sockArray[i].connection.src) &&
-	((c.dest == sockArray[i].connection.dest) ||
-	 (sockArray[i].connection.dest == IP_ADDRESS_ANY)) &&
-	(c.srcport == sockArray[i].connection.srcport) &&
-	((c.destport == sockArray[i].connection.destport) ||
-	 (sockArray[i].connection.destport == PORT_ANY)) &&
-	(c.protocol == sockArray[i].connection.protocol) &&
-	((sockArray[i].status == CONNECT_PENDING) ||
-	 (sockArray[i].status == ACCEPT_PENDING)))
-      break;
-  if (i < NUM_SOCKS)
-    return i;
-  return -1;
+  const unsigned pending = (1 << CONNECT_PENDING) | (1 << ACCEPT_PENDING);
+  int best = -1;
+  for (int i = 0; i < 4; i++) {
+    Connection l(c);
+    if (i & 1)
+      l.dest = IP_ADDRESS_ANY;
+    if (i & 2)
+      l.destport = PORT_ANY;
+    int sock = FindIndexed(l, pending);
+    if ((sock >= 0) && ((best < 0) || (sock < best)))
+      best = sock;
+  }
+  return best;
+}
+
+
+int SockStatus::SetConnection (unsigned sock, const Connection &c) {
+  if (!Valid(sock))
+    return -1;
+  if (sockArray[sock].status == FREE) {
+    sockArray[sock].connection = c;
+  } else {
+    Unindex(sock);
+    sockArray[sock].connection = c;
+    Index(sock);
+  }
+  return 0;
 }
 
 
 int SockStatus::SetStatus (unsigned sock, Status stat) {
-  if ((sock < 1) || (sock >= NUM_SOCKS))
+  if (!Valid(sock))
     return -1;
+  if (stat == FREE) {
+    CloseSocket(sock);
+    return 0;
+  }
+  if (sockArray[sock].status == FREE) {
+    freeSocks.erase(sock);
+    Index(sock);
+  }
   sockArray[sock].status = stat;
   return 0;
 }
 
 
 int SockStatus::SetFifoToApp (unsigned sock, int fd) {
-  if ((sock < 1) || (sock >= NUM_SOCKS) || (sockArray[sock].status == FREE))
+  if (!Valid(sock) || (sockArray[sock].status == FREE))
     return -1;
   sockArray[sock].toApp = fd;
   return 0;
@@ -177,7 +244,7 @@ int SockStatus::SetFifoToApp (unsigned sock, int fd) {
 
 
 int SockStatus::SetFifoFromApp (unsigned sock, int fd) {
-  if ((sock < 1) || (sock >= NUM_SOCKS) || (sockArray[sock].status == FREE))
+  if (!Valid(sock) || (sockArray[sock].status == FREE))
     return -1;
   sockArray[sock].fromApp = fd;
   return 0;
@@ -185,7 +252,7 @@ int SockStatus::SetFifoFromApp (unsigned sock, int fd) {
 
 
 int SockStatus::SetBlockingStatus (unsigned sock, int b) {
-  if ((sock < 1) || (sock >= NUM_SOCKS) || (sockArray[sock].status == FREE))
+  if (!Valid(sock) || (sockArray[sock].status == FREE))
     return -1;
   sockArray[sock].blocking = b;
   return 0;
@@ -193,7 +260,7 @@ int SockStatus::SetBlockingStatus (unsigned sock, int b) {
 
 
 int SockStatus::SetReadNotificationStatus (unsigned sock, int s) {
-  if ((sock < 1) || (sock >= NUM_SOCKS) || (sockArray[sock].status == FREE))
+  if (!Valid(sock) || (sockArray[sock].status == FREE))
     return -1;
   sockArray[sock].forward_read_notification = s;
   return 0;
@@ -201,7 +268,7 @@ int SockStatus::SetReadNotificationStatus (unsigned sock, int s) {
 
 
 int SockStatus::SetWriteNotificationStatus (unsigned sock, int s) {
-  if ((sock < 1) || (sock >= NUM_SOCKS) || (sockArray[sock].status == FREE))
+  if (!Valid(sock) || (sockArray[sock].status == FREE))
     return -1;
   sockArray[sock].forward_write_notification = s;
   return 0;
@@ -209,178 +276,221 @@ int SockStatus::SetWriteNotificationStatus (unsigned sock, int s) {
 
 
 int SockStatus::SetExceptionNotificationStatus (unsigned sock, int s) {
-  if ((sock < 1) || (sock >= NUM_SOCKS) || (sockArray[sock].status == FREE))
+  if (!Valid(sock) || (sockArray[sock].status == FREE))
     return -1;
   sockArray[sock].forward_exception_notification = s;
   return 0;
 }
 
 
-PortStatus::PortStatus() {
-  int i, j;
-  for (i = 0; i < NUM_IP_INTERFACES; i++) {
-    portArrayIndex[i] = IP_ADDRESS_ANY;
-    for (j = 0; j < NUM_PORTS; j++)
-      portArray[i][j] = 0;
-  }
+int SockStatus::SetReadLength (unsigned sock, unsigned len) {
+  if (!Valid(sock) || (sockArray[sock].status == FREE))
+    return -1;
+  sockArray[sock].readlen = len;
+  return 0;
 }
 
 
-PortStatus::PortStatus(const PortStatus & rhs) {
-  int i,j;
-  for (i = 0; i < NUM_IP_INTERFACES; i++) {
-    portArrayIndex[i] = rhs.portArrayIndex[i];
-    for (j = 0; j < NUM_PORTS; j++)
-      portArray[i][j] = rhs.portArray[i][j];
-  }
+int SockStatus::SetOption (unsigned sock, const SockOption &opt) {
+  if (!Valid(sock) || (sockArray[sock].status == FREE))
+    return -1;
+  std::vector<SockOption> &options = sockArray[sock].options;
+  std::vector<SockOption>::iterator i;
+  for (i = options.begin(); i != options.end(); i++)
+    if ((i->level == opt.level) && (i->name == opt.name)) {
+      *i = opt;
+      return 0;
+    }
+  options.push_back(opt);
+  return 0;
+}
+
+
+PortStatus::PortStatus() {
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  seed = (uint32_t)tv.tv_sec ^ ((uint32_t)tv.tv_usec << 12) ^ ((uint32_t)getpid() << 16);
+  if (seed == 0)
+    seed = 1;
 }
 
 
+PortStatus::PortStatus(const PortStatus & rhs) :
+  interfaces(rhs.interfaces),
+  seed(rhs.seed)
+{}
+
+
 PortStatus & PortStatus::operator=(const PortStatus & rhs) {
-  int i,j;
-  for (i = 0; i < NUM_IP_INTERFACES; i++) {
-    portArrayIndex[i] = rhs.portArrayIndex[i];
-    for (j = 0; j < NUM_PORTS; j++)
-      portArray[i][j] = rhs.portArray[i][j];
-  }
+  interfaces = rhs.interfaces;
+  seed = rhs.seed;
   return *this;
 }
 
+
+// xorshift; only needs to make the next port hard to guess
+unsigned PortStatus::Random() {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+
 int PortStatus::FindFreePort(IPAddress ip, unsigned sockfd) {
-  int i, j;
   if (sockfd >= NUM_SOCKS)
     return -1;
-  for (i = 0; i < NUM_IP_INTERFACES; i++)
-    if (portArrayIndex[i] == ip)
-      break;
-  if (i < NUM_IP_INTERFACES)
-    for (j = 1; j < NUM_PORTS; j++)
-      if (portArray[i][j] == 0) {
-	portArray[i][j] = sockfd;
-	return j;
-      }
+  Interface &inf = GetInterface(ip);
+  const unsigned range = EPHEMERAL_PORT_MAX - EPHEMERAL_PORT_MIN + 1;
+  unsigned port = EPHEMERAL_PORT_MIN + Random() % range;
+  // a word at a time from a random port to the top of the range, then
+  // from the bottom of the range back up to it
+  for (unsigned n = 0; n < range; ) {
+    unsigned left = MIN_MACRO(64 - port % 64, EPHEMERAL_PORT_MAX + 1 - port);
+    left = MIN_MACRO(left, range - n);
+    uint64_t avail = ~inf.used[port / 64] >> (port % 64);
+    if (left < 64)
+      avail &= ((uint64_t)1 << left) - 1;
+    if (avail) {
+      port += __builtin_ctzll(avail);
+      AssignPort(ip, port, sockfd);
+      return port;
+    }
+    n += left;
+    port += left;
+    if (port > EPHEMERAL_PORT_MAX)
+      port = EPHEMERAL_PORT_MIN;
+  }
   return -1;
 }
 
 int PortStatus::Socket(IPAddress ip, unsigned port) {
-  int i;
   if (port >= NUM_PORTS)
     return -1;
-  for (i = 0; i < NUM_IP_INTERFACES; i++)
-    if (portArrayIndex[i] == ip)
-      break;
-  if (i < NUM_IP_INTERFACES)
-    return(portArray[i][port]);
-  return -1;
+  Interface &inf = GetInterface(ip);
+  if (!(inf.used[port / 64] & ((uint64_t)1 << (port % 64))))
+    return 0;
+  return inf.owner[port];
 }
 
 int PortStatus::AssignPort(IPAddress ip, unsigned port, unsigned sockfd) {
-  int i;
   if ((port >= NUM_PORTS) || (port < 1) || (sockfd >= NUM_SOCKS))
     return -1;
-  for (i = 0; i < NUM_IP_INTERFACES; i++)
-    if (portArrayIndex[i] == ip)
-      break;
-  if ((i < NUM_IP_INTERFACES) && (portArray[i][port] == 0)) {
-    portArray[i][port] = sockfd;
-    return sockfd;
-  }
-  return -1;
+  Interface &inf = GetInterface(ip);
+  uint64_t bit = (uint64_t)1 << (port % 64);
+  if (inf.used[port / 64] & bit)
+    return -1;
+  inf.used[port / 64] |= bit;
+  inf.owner[port] = sockfd;
+  return sockfd;
 }
 
-
-RequestRecord::RequestRecord (SockRequestResponse *s, int fd) :
-    srr(s), sock(fd)
-{}
+int PortStatus::ReleasePort(IPAddress ip, unsigned port, unsigned sockfd) {
+  if ((port >= NUM_PORTS) || (port < 1))
+    return -1;
+  InterfaceMap::iterator i = interfaces.find(ip);
+  if (i == interfaces.end())
+    return -1;
+  std::unordered_map<unsigned short, unsigned>::iterator o =
+    i->second.owner.find(port);
+  if ((o == i->second.owner.end()) || (o->second != sockfd))
+    return -1;
+  i->second.owner.erase(o);
+  i->second.used[port / 64] &= ~((uint64_t)1 << (port % 64));
+  return 0;
+}
 
 
-RequestRecord::RequestRecord (const RequestRecord &rhs) :
-    srr(rhs.srr), sock(rhs.sock)
+RequestRecord::RequestRecord() :
+  id(0), type(STATUS), sock(0), pending(false)
 {}
 
 
-RequestRecord & RequestRecord::operator=(const RequestRecord & rhs) {
-  srr = rhs.srr;
-  sock = rhs.sock;
-  return *this;
-}
-
-
-QueueElt::QueueElt(const QueueElt &rhs) :
-  data(rhs.data),
-  front(rhs.front),
-  back(rhs.back)
+RequestRecord::RequestRecord (unsigned i, srrType t, int fd) :
+  id(i), type(t), sock(fd), pending(true)
 {}
 
 
-QueueElt::QueueElt(char *d, QueueElt *f, QueueElt *b) :
-  data(d),
-  front(f),
-  back(b)
+RequestRecord::RequestRecord (const RequestRecord &rhs) :
+  id(rhs.id), type(rhs.type), sock(rhs.sock), pending(rhs.pending)
 {}
 
 
-QueueElt & QueueElt::operator=(const QueueElt & rhs) {
-  data = rhs.data;
-  front = rhs.front;
-  back = rhs.back;
+RequestRecord & RequestRecord::operator=(const RequestRecord & rhs) {
+  id = rhs.id;
+  type = rhs.type;
+  sock = rhs.sock;
+  pending = rhs.pending;
   return *this;
 }
 
 
-Queue::Queue() :
-  front(NULL),
-  back(NULL)
+RequestQueue::RequestQueue(unsigned size) :
+  ring(size > 0 ? size : 1),
+  head(0),
+  count(0),
+  nextid(1)
 {}
 
 
-Queue::Queue(const Queue &rhs) :
-  front(rhs.front),
-  back(rhs.back)
+RequestQueue::RequestQueue(const RequestQueue &rhs) :
+  ring(rhs.ring),
+  head(rhs.head),
+  count(rhs.count),
+  nextid(rhs.nextid)
 {}
 
 
-Queue::~Queue() {
-  QueueElt *t;
-  while (front != NULL) {
-    t = front;
-    front = front->front;
-    delete t;
-  }
-}
-
-
-Queue & Queue::operator=(const Queue & rhs) {
-  front = rhs.front;
-  back = rhs.back;
+RequestQueue & RequestQueue::operator=(const RequestQueue & rhs) {
+  ring = rhs.ring;
+  head = rhs.head;
+  count = rhs.count;
+  nextid = rhs.nextid;
   return *this;
 }
 
 
-void Queue::Insert(void * d) {
-  QueueElt *q=new QueueElt;
-  q->data = d;
-  q->front = back;
-  q->back = NULL;
-  if (back != NULL)
-    back->back = q;
-  else
-    front = q;
-  back = q;
+unsigned RequestQueue::Insert(srrType type, int sock) {
+  if (count == ring.size()) {
+    std::vector<RequestRecord> grown(2 * ring.size());
+    for (unsigned i = 0; i < count; i++)
+      grown[i] = ring[(head + i) % ring.size()];
+    ring.swap(grown);
+    head = 0;
+  }
+  unsigned id = nextid++;
+  if (nextid == 0)
+    nextid = 1;
+  ring[(head + count) % ring.size()] = RequestRecord(id, type, sock);
+  count++;
+  return id;
 }
 
 
-void * Queue::Remove() {
-  if (front == NULL)
-    return NULL;
-  void * ret = front->data;
-  QueueElt * d = front;
-  front = front->back;
-  if (front != NULL)
-    front->front = NULL;
-  else
-    back = NULL;
-  delete d;
-  return ret;
+bool RequestQueue::Remove(unsigned id, RequestRecord &r) {
+  unsigned i;
+  if (id == 0) {
+    for (i = 0; i < count; i++)
+      if (ring[(head + i) % ring.size()].pending)
+	break;
+  } else {
+    // ids are consecutive from the head, except where they wrapped past 0
+    i = id - ring[head].id;
+    if ((i >= count) || (ring[(head + i) % ring.size()].id != id))
+      for (i = 0; i < count; i++)
+	if (ring[(head + i) % ring.size()].id == id)
+	  break;
+  }
+  if (i >= count)
+    return false;
+  RequestRecord &found = ring[(head + i) % ring.size()];
+  if (!found.pending)
+    return false;
+  r = found;
+  found.pending = false;
+  while ((count > 0) && !ring[head].pending) {
+    head = (head + 1) % ring.size();
+    count--;
+  }
+  return true;
 }
-
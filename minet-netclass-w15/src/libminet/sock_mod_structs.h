@@ -2,6 +2,11 @@
 #define _sock_mod_structs
 
 #include <iostream>
+#include <deque>
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
 #include "sockint.h"
 
 enum Status {FREE, UNBOUND, BOUND, LISTENING, ACCEPT_PENDING,
@@ -19,6 +24,8 @@ struct SockRecord {
   int           forward_read_notification;
   int           forward_write_notification;
   int           forward_exception_notification;
+  unsigned      readlen;
+  std::vector<SockOption> options;
 
   SockRecord();
   SockRecord(const SockRecord &rhs);
@@ -40,15 +47,36 @@ struct SockRecord {
   }
 };
 
+// The socket table grows as sockets are opened, up to NUM_SOCKS.  Free
+// socks are kept in a set so that FindFreeSock returns the lowest, as
+// before, and sockets in use are indexed by their connection, so that
+// FindConnection and FindPendingConnection are hash lookups.  The index
+// follows SetConnection and SetStatus, so change a socket's connection
+// only through SetConnection.
 struct SockStatus {
-  SockRecord sockArray[NUM_SOCKS];
+  typedef std::unordered_map<ConnectionKey, std::set<unsigned>,
+			     ConnectionKeyHash> ConnectionIndex;
+
+  std::deque<SockRecord> sockArray;            // never shrinks, so pointers
+                                               //   into it stay valid
+  std::set<unsigned>     freeSocks;
+  ConnectionIndex        index;
+
+  bool Valid (unsigned sock) const {           // Is sock in the table?
+    return (sock >= 1) && (sock < sockArray.size()); }
+  void Index (unsigned sock);                  // Add sock to, or remove it
+  void Unindex (unsigned sock);                //   from, the index.
+  int FindIndexed (const Connection &c,        // The lowest sock indexed
+		   unsigned statuses);         //   under exactly c whose
+                                               //   status is in the mask
+                                               //   (1 << status), or -1.
 
   int FindFreeSock();                          // Return the first free socket,
-                                               //   or -1 if no socket is
-                                               //   available.
+                                               //   growing the table if
+                                               //   need be, or -1 if no
+                                               //   socket is available.
 
-  void CloseSocket(unsigned sock) {            // Close the specified socket.
-    sockArray[sock] = SockRecord(); }
+  void CloseSocket(unsigned sock);             // Close the specified socket.
 
   int FindConnection(const Connection & c);    // Find a socket which matches
                                                //   this connection, return
@@ -60,8 +88,11 @@ struct SockStatus {
                                                //   waiting to complete its
                                                //   connection.  Return its fd
                                                //   or -1 if no socket matches.
-  Connection *GetConnection (unsigned sock) {  // Get the connection for the
-    return (&sockArray[sock].connection); }    //   specified socket.
+  const Connection *GetConnection (unsigned sock) {
+    return (&sockArray[sock].connection); }    // Get the connection for the
+                                               //   specified socket.
+  int SetConnection (unsigned sock,            // Set the connection for the
+		     const Connection &c);     //   specified socket.
 
   Buffer *GetBin (unsigned sock) {             // Get the input buffer for the
     return (&sockArray[sock].bin); }           //   specified socket.
@@ -70,13 +101,14 @@ struct SockStatus {
   //  return (&sockArray[sock].bout); }          //   the specified socket.
 
   Status GetStatus (unsigned sock) {           // Get the status of the
-    return (sockArray[sock].status); }         //   specified socket.
+    return (Valid(sock) ?                      //   specified socket.
+	    sockArray[sock].status : FREE); }
   int SetStatus (unsigned sock, Status stat);  // Set the status of the
                                                //   specified socket.
 
   int GetFifoToApp (unsigned sock) {           // Get the fd of the fifo to the
-    return (sockArray[sock].toApp); }          //   application layer for the
-                                               //   specified socket.
+    return (Valid(sock) ?                      //   application layer for the
+	    sockArray[sock].toApp : -1); }     //   specified socket.
   int SetFifoToApp (unsigned sock, int fd);    // Set the fd of the fifo to the
                                                //   application layer for the
                                                //   specified socket.
@@ -129,15 +161,44 @@ struct SockStatus {
                                                // Set the exception
                                                //   notification status
 
-  SockStatus() {}
+  std::vector<SockOption> *GetOptions (unsigned sock) {
+    return (&sockArray[sock].options); }       // Get the options set on the
+                                               //   specified socket.
+  int SetOption (unsigned sock,                // Record an option set on the
+		 const SockOption &opt);       //   specified socket, in place
+                                               //   of its earlier value.
+
+  unsigned GetReadLength (unsigned sock) {     // Get the most a pending
+    return (sockArray[sock].readlen); }        //   read can take.
+  int SetReadLength (unsigned sock,            // Set the most a pending
+		     unsigned len);            //   read can take.
+
+  SockStatus();
   SockStatus(const SockStatus &rhs);
   virtual ~SockStatus() {}
   SockStatus & operator=(const SockStatus &rhs);
 };
 
+// Ports in use on an address are marked in a bitmap, so a free
+// ephemeral port is found a word at a time, starting from a random
+// point in EPHEMERAL_PORT_MIN..EPHEMERAL_PORT_MAX.  Which socket has a
+// port is kept in a hash map.  An address gets its bitmap the first
+// time a port on it is looked up.
 struct PortStatus {
-  IPAddress portArrayIndex[NUM_IP_INTERFACES];
-  unsigned portArray[NUM_IP_INTERFACES][NUM_PORTS];
+  struct Interface {
+    std::vector<uint64_t>                        used;
+    std::unordered_map<unsigned short, unsigned> owner;
+
+    Interface() : used(NUM_PORTS / 64, 0) {}
+  };
+  typedef std::unordered_map<unsigned, Interface> InterfaceMap;
+
+  InterfaceMap interfaces;
+  uint32_t     seed;
+
+  Interface & GetInterface(IPAddress ip) {     // Get the ports of the
+    return interfaces[ip]; }                   //   specified ip.
+  unsigned Random();
 
   int FindFreePort(IPAddress ip,               // Return the port number of an
 		   unsigned sockfd);           //   available port for the
@@ -154,6 +215,9 @@ struct PortStatus {
   int AssignPort(IPAddress ip, unsigned port,  // Assign the specified port to
 		 unsigned sockfd);             //   the specified ip.  Return
                                                //   -1 on failure.
+  int ReleasePort(IPAddress ip, unsigned port, // Free the specified port if
+		  unsigned sockfd);            //   sockfd holds it.  Return
+                                               //   -1 on failure.
 
   PortStatus();
   PortStatus(const PortStatus &rhs);
@@ -162,42 +226,47 @@ struct PortStatus {
 };
 
 
+// A request sent to a protocol module and waiting for its STATUS
 struct RequestRecord {
-  SockRequestResponse *srr;
-  int sock;
+  unsigned id;
+  srrType  type;
+  int      sock;
+  bool     pending;
 
-  RequestRecord() {}
-  RequestRecord(SockRequestResponse *s, int fd);
+  RequestRecord();
+  RequestRecord(unsigned i, srrType t, int fd);
   RequestRecord(const RequestRecord &rhs);
-  ~RequestRecord() {
-    delete srr; }
+  virtual ~RequestRecord() {}
   RequestRecord & operator=(const RequestRecord & rhs);
 };
 
 
-struct QueueElt {
-  void *data;
-  QueueElt *front;
-  QueueElt *back;
-
-  QueueElt() {}
-  QueueElt(const QueueElt &rhs);
-  QueueElt(char *d, QueueElt *f, QueueElt *b);
-  virtual ~QueueElt() {}
-  QueueElt & operator=(const QueueElt & rhs);
-};
-
-struct Queue {
-  QueueElt *front;
-  QueueElt *back;
-
-  void Insert(void * d);
-  void * Remove();
-
-  Queue();
-  Queue(const Queue &rhs);
-  Queue & operator=(const Queue & rhs);
-  ~Queue();
+// The requests outstanding at one protocol module, in a ring that is
+// allocated once and doubles if it ever fills.  Requests get
+// consecutive ids, so the one a STATUS answers is found by its offset
+// from the oldest.  Answered requests leave a hole until those before
+// them are answered too.
+struct RequestQueue {
+  std::vector<RequestRecord> ring;
+  unsigned head;
+  unsigned count;
+  unsigned nextid;
+
+  unsigned Insert(srrType type, int sock);    // Queue a request and return
+                                               //   the id to send with it.
+  bool Remove(unsigned id, RequestRecord &r); // Take out the request with
+                                               //   the given id, or the
+                                               //   oldest if id is 0.
+                                               //   Return false if there
+                                               //   is no such request.
+  unsigned Size() const {                      // The number of requests
+    return count; }                            //   outstanding, holes
+                                               //   included.
+
+  RequestQueue(unsigned size = REQUEST_QUEUE_SIZE);
+  RequestQueue(const RequestQueue &rhs);
+  virtual ~RequestQueue() {}
+  RequestQueue & operator=(const RequestQueue & rhs);
 };
 
 #endif
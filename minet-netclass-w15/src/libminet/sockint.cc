@@ -124,16 +124,17 @@ SockRequestResponse::SockRequestResponse(const srrType &t,
 					 const Buffer &d,
 					 const unsigned &b,
 					 const int &err) :
-  type(t), connection(c), data(d), bytes(b), error(err)
+  type(t), connection(c), data(d), bytes(b), error(err), id(0)
 {}
 
-SockRequestResponse::SockRequestResponse()
+SockRequestResponse::SockRequestResponse() :
+  id(0)
 {}
 
 SockRequestResponse::SockRequestResponse(const
 					 SockRequestResponse &rhs) :
   type(rhs.type), connection(rhs.connection), data(rhs.data),
-  bytes(rhs.bytes), error(rhs.error)
+  bytes(rhs.bytes), error(rhs.error), id(rhs.id)
 {}
 
 SockRequestResponse::~SockRequestResponse()
@@ -147,6 +148,7 @@ SockRequestResponse::operator=(const SockRequestResponse &rhs)
   data=rhs.data;
   bytes=rhs.bytes;
   error=rhs.error;
+  id=rhs.id;
   return *this;
 }
 
@@ -164,6 +166,9 @@ void SockRequestResponse::Serialize(const int fd) const
   if (writeall(fd,(const char*)&error,sizeof(int))!=sizeof(int)) {
     throw SerializationException();
   }
+  if (writeall(fd,(const char*)&id,sizeof(unsigned))!=sizeof(unsigned)) {
+    throw SerializationException();
+  }
 }
 
 void SockRequestResponse::Unserialize(const int fd)
@@ -181,6 +186,9 @@ void SockRequestResponse::Unserialize(const int fd)
   if (readall(fd,(char*)&error,sizeof(int))!=sizeof(int)) {
     throw SerializationException();
   }
+  if (readall(fd,(char*)&id,sizeof(unsigned))!=sizeof(unsigned)) {
+    throw SerializationException();
+  }
 }
 
 std::ostream & SockRequestResponse::Print(std::ostream &rhs) const
@@ -192,11 +200,13 @@ std::ostream & SockRequestResponse::Print(std::ostream &rhs) const
 	  type==FORWARD ? "FORWARD" :
 	  type==CLOSE ? "CLOSE" :
 	  type==STATUS ? "STATUS" :
+	  type==SETSOCKOPT ? "SETSOCKOPT" :
 	  "UNKNOWN");
   rhs << ", connection=" << connection;
   rhs << ", data=" << data;
   rhs << ", bytes=" << bytes;
   rhs << ", error=" << error ;
+  rhs << ", id=" << id ;
   rhs << ")";
   return rhs;
 }
@@ -347,6 +357,8 @@ std::ostream & SockLibRequestResponse::Print(std::ostream &rhs) const
 	  type==mCAN_WRITE_NOW ? "CAN_WRITE_NOW" :
 	  type==mCAN_READ_NOW ? "CAN_READ_NOW" :
 	  type==mSTATUS ? "STATUS" :
+	  type==mSETSOCKOPT ? "SETSOCKOPT" :
+	  type==mGETSOCKOPT ? "GETSOCKOPT" :
 	  "UNKNOWN");
   rhs << ", connection=" << connection;
   rhs << ", sockfd=" << sockfd;
@@ -10,9 +10,11 @@
 //to lower-level modules.
 
 #include <iostream>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <string.h>
 #include "sock.h"
 #include "config.h"
 #include "buffer.h"
@@ -20,11 +22,41 @@
 #include "udp.h"
 #include "tcp.h"
 
-const unsigned NUM_SOCK_TYPES=6;
-enum srrType {CONNECT=0, ACCEPT=1, WRITE=2, FORWARD=3, CLOSE=4, STATUS=5};
+const unsigned NUM_SOCK_TYPES=7;
+enum srrType {CONNECT=0, ACCEPT=1, WRITE=2, FORWARD=3, CLOSE=4, STATUS=5,
+	      SETSOCKOPT=6};
 enum slrrType {mSOCKET, mBIND, mLISTEN, mACCEPT, mCONNECT, mREAD, mWRITE,
 	       mRECVFROM, mSENDTO, mCLOSE, mSELECT, mPOLL, mSET_BLOCKING,
-	       mSET_NONBLOCKING, mCAN_WRITE_NOW, mCAN_READ_NOW, mSTATUS};
+	       mSET_NONBLOCKING, mCAN_WRITE_NOW, mCAN_READ_NOW, mSTATUS,
+	       mSETSOCKOPT, mGETSOCKOPT};
+
+// The data of mSETSOCKOPT and SETSOCKOPT requests.  sock_module keeps
+// the options set on a socket and sends them, one SockOption after
+// another, as the data of its CONNECT and of each ACCEPT, so that TCP
+// has them before the SYN goes.  A socket made by accept starts with
+// its listener's.  An option set on a socket TCP already has a
+// connection for is passed on as a SETSOCKOPT too, which TCP answers
+// with a STATUS, ENOMATCH if there is no such connection.  sock_module
+// also sends TCP an IPPROTO_IP IP_MTU SETSOCKOPT for an ICMP
+// fragmentation needed message, with value the next hop's MTU and
+// bytes the sequence number of the segment it quotes.  That one gets
+// no reply.  IPPROTO_TCP's TCP_CONGESTION has the algorithm's name in
+// text rather than a value.
+//
+// mGETSOCKOPT carries a SockOption naming the option to read.  The one
+// there is, IPPROTO_TCP's TCP_INFO, is asked of TCP as a STATUS whose
+// bytes are TCP_INFO_REQUEST (see tcpstate.h), and the TCPInfo in its
+// reply goes back to the app as the data of the mSTATUS.
+const unsigned SOCK_OPTION_TEXT_MAX=16;
+
+struct SockOption {
+  int level;
+  int name;
+  int value;
+  char text[SOCK_OPTION_TEXT_MAX];
+
+  SockOption() : level(0), name(0), value(0) { memset(text, 0, sizeof(text)); }
+};
 
 const unsigned short PORT_NONE=0x0000;
 const unsigned short PORT_ANY=PORT_NONE;
@@ -59,12 +91,43 @@ struct Connection {
   }
 };
 
+// Exact 5-tuple key for hash indexes of connections, such as the
+// ConnectionList index and the sock module's socket table
+struct ConnectionKey {
+  unsigned       src, dest;
+  unsigned short srcport, destport;
+  unsigned char  protocol;
+
+  ConnectionKey(const Connection &c) :
+    src(c.src), dest(c.dest), srcport(c.srcport), destport(c.destport), protocol(c.protocol)
+  {
+  }
+
+  bool operator==(const ConnectionKey &rhs) const {
+    return src == rhs.src && dest == rhs.dest && srcport == rhs.srcport
+      && destport == rhs.destport && protocol == rhs.protocol;
+  }
+};
+
+struct ConnectionKeyHash {
+  size_t operator()(const ConnectionKey &k) const {
+    uint64_t a = ((uint64_t)k.src << 32) | k.dest;
+    uint64_t b = ((uint64_t)k.srcport << 24) | ((uint64_t)k.destport << 8) | k.protocol;
+    uint64_t h = a * 0x9e3779b97f4a7c15ULL ^ (b + 0x632be59bd9b4e019ULL) * 0xc2b2ae3d27d4eb4fULL;
+    return (size_t)(h ^ (h >> 29));
+  }
+};
+
+// id is chosen by sock_module for each request it sends down, and a
+// module answers with a STATUS carrying the same id, so replies may
+// come in any order.  A STATUS with id 0 answers the oldest request.
 struct SockRequestResponse {
   srrType    type;
   Connection connection;
   Buffer     data;
   unsigned   bytes;
   int        error;
+  unsigned   id;
   SockRequestResponse(const srrType &t,
 		      const Connection &c,
 		      const Buffer &d,
@@ -2,6 +2,8 @@
 
 #include <netinet/in.h>
 
+#include "checksum.h"
+
 //
 // Note - original version lost, this is a reconstruction
 //
@@ -36,7 +38,7 @@ TCPHeader & TCPHeader::operator=(const TCPHeader &rhs)
 unsigned TCPHeader::EstimateTCPHeaderLength(Packet &p)
 {
     unsigned char len;
-    Buffer &b = p.GetPayload();
+    Buffer b = p.GetPayload();
 
     b.GetData((char *)&len, 1, 12);
 
@@ -57,9 +59,7 @@ void TCPHeader::SetSourcePort(const unsigned short &port, const Packet &p)
 {
     unsigned short pt = htons(port);
 
-    SetData((char *)&pt, 2, 0);
-
-    RecomputeChecksum(p);
+    SetField((char *)&pt, 2, 0, p);
 }
 
 void TCPHeader::GetDestPort(unsigned short &port) const
@@ -72,9 +72,7 @@ void TCPHeader::SetDestPort(const unsigned short &port, const Packet &p)
 {
     unsigned short pt = htons(port);
 
-    SetData((char *)&pt, 2, 2);
-
-    RecomputeChecksum(p);
+    SetField((char *)&pt, 2, 2, p);
 }
 
 void TCPHeader::GetSeqNum(unsigned int &n) const
@@ -87,9 +85,7 @@ void TCPHeader::SetSeqNum(const unsigned int &n, const Packet &p)
 {
     unsigned int nt = htonl(n);
 
-    SetData((char*)&nt, 4, 4);
-
-    RecomputeChecksum(p);
+    SetField((char *)&nt, 4, 4, p);
 }
 
 void TCPHeader::GetAckNum(unsigned int &n) const
@@ -100,11 +96,9 @@ void TCPHeader::GetAckNum(unsigned int &n) const
 
 void TCPHeader::SetAckNum(const unsigned int &n, const Packet &p)
 {
-    unsigned int nt=htonl(n);
-    
-    SetData((char*)&nt,4,8);
-    
-    RecomputeChecksum(p);
+    unsigned int nt = htonl(n);
+
+    SetField((char *)&nt, 4, 8, p);
 }
 
 void TCPHeader::GetHeaderLen(unsigned char &len) const
@@ -121,7 +115,7 @@ void TCPHeader::SetHeaderLen(const unsigned char &new_len, const Packet &p)
   tmp_len = (tmp_len & 0x0f) | ((new_len << 4) & 0xf0);
   SetData((char *)&tmp_len, 1, 12);
 
-  RecomputeChecksum(p);
+  FieldChanged(p);
 }
 
 void TCPHeader::GetFlags(unsigned char &flags) const
@@ -137,9 +131,7 @@ void TCPHeader::SetFlags(const unsigned char &new_flags, const Packet &p)
   GetData((char*)&ft,1,13);
   ft&=64+128;
   ft|=(new_flags&(1+2+4+8+16+32));
-  SetData((char*)&ft,1,13);
-
-  RecomputeChecksum(p);
+  SetField((char*)&ft,1,13,p);
 }
 
 void TCPHeader::GetWinSize(unsigned short &w) const
@@ -151,14 +143,13 @@ void TCPHeader::GetWinSize(unsigned short &w) const
 void TCPHeader::SetWinSize(const unsigned short &w, const Packet &p)
 {
   unsigned short wt=htons(w);
-  SetData((char*)&wt,2,14);
-  RecomputeChecksum(p);
+  SetField((char*)&wt,2,14,p);
 }
 
 unsigned short TCPHeader::ComputeChecksum(const Packet &p) const
 {
   // assumes we DO have an IP header in the packet already
-  IPHeader iph= (IPHeader &) p.FindHeader(Headers::IPHeader);
+  IPHeader iph=p.FindHeader(Headers::IPHeader);
   IPAddress srcip, destip;
   unsigned char proto;
 
@@ -166,7 +157,7 @@ unsigned short TCPHeader::ComputeChecksum(const Packet &p) const
   iph.GetDestIP(destip); destip=htonl(destip);
   iph.GetProtocol(proto);
 
-  unsigned short len, buflen;
+  unsigned short len;
   unsigned char iphlen;
   unsigned char tcphlen;
 
@@ -177,24 +168,22 @@ unsigned short TCPHeader::ComputeChecksum(const Packet &p) const
 
   len-=iphlen*4;
 
-  buflen=((12+len)+(len%2?1:0))/2;
-
-  unsigned short buf[buflen];
+  unsigned short pseudo[6];
 
-  memset((char*)buf,0,2*buflen);
+  memcpy((char*)pseudo,&srcip,4);
+  memcpy((char*)(pseudo+2),&destip,4);
+  pseudo[4]=htons((unsigned short)proto);
+  pseudo[5]=htons(len);
 
-  memcpy((char*)buf,&srcip,4);
-  memcpy((char*)(buf+2),&destip,4);
-  buf[4]=htons((unsigned short)proto);
-  buf[5]=htons(len);
-
-  GetData((char*)&(buf[6]),tcphlen*4,0);
-
-  //YUCK FIX
-  ((Packet&)p).GetPayload().GetData((char*)(buf+6+tcphlen*2),len-tcphlen*4,0);
-
-  return ~(OnesComplementSum(buf,buflen));
+  // pseudo header, then header, then the data straight out of the
+  // payload's slices
+  unsigned sum=ChecksumAdd(pseudo,12);
+  sum=ChecksumAdd(*this,0,tcphlen*4,12,sum);
+  if (len>tcphlen*4) {
+    sum=ChecksumAdd(p.GetPayload(),0,len-tcphlen*4,12+tcphlen*4,sum);
+  }
 
+  return ntohs(ChecksumFinish(sum));
 }
 
 bool TCPHeader::IsCorrectChecksum(const Packet &p) const
@@ -211,7 +200,8 @@ bool TCPHeader::IsCorrectChecksum(const Packet &p) const
 void TCPHeader::RecomputeChecksum(const Packet &p)
 {
   if (GetSize()<TCP_HEADER_BASE_LENGTH) {
-    SetUrgentPtr(0,p);
+    unsigned short up=0;
+    SetData((char *)&up, 2, 18);
   }
   SetChecksum(0);
   unsigned short ck=ComputeChecksum(p);
@@ -220,6 +210,54 @@ void TCPHeader::RecomputeChecksum(const Packet &p)
 
 
 
+// The setters call this: either the checksum is brought up to date now,
+// or, in deferred mode or once p has it pending anyway, p computes it
+// once when it is serialized
+void TCPHeader::FieldChanged(const Packet &p)
+{
+  if (ChecksumIsDeferred() || p.ChecksumsPending()) {
+    p.MarkChecksumsPending();
+  } else {
+    RecomputeChecksum(p);
+  }
+}
+
+// Writes a field that leaves what the checksum covers the same, and
+// brings the checksum up to date.  Once the header has a checksum (it
+// is all there, its length is set and the checksum is not zero), that
+// is patched for the words the field covers (RFC 1624) rather than
+// computed over the whole segment again.  So the IP header and the
+// payload must be in place before the first setter, or need a
+// RecomputeChecksum after.
+void TCPHeader::SetField(const char *data, const unsigned len, const unsigned offset, const Packet &p)
+{
+  unsigned start=offset&~1U;
+  unsigned end=(offset+len+1)&~1U;
+  unsigned short check=0;
+  unsigned char hlen=0;
+
+  if (GetSize()>=TCP_HEADER_BASE_LENGTH) {
+    GetData((char*)&check,2,16);
+    GetHeaderLen(hlen);
+  }
+  if (ChecksumIsDeferred() || p.ChecksumsPending() || check==0
+      || hlen*4U<TCP_HEADER_BASE_LENGTH || end>TCP_HEADER_BASE_LENGTH) {
+    SetData(data,len,offset);
+    FieldChanged(p);
+    return;
+  }
+
+  unsigned short before[TCP_HEADER_BASE_LENGTH/2], after[TCP_HEADER_BASE_LENGTH/2];
+
+  GetData((char*)before,end-start,start);
+  SetData(data,len,offset);
+  GetData((char*)after,end-start,start);
+  for (unsigned i=0;i<(end-start)/2;i++) {
+    check=ChecksumUpdate16(check,before[i],after[i]);
+  }
+  SetData((char*)&check,2,16);
+}
+
 void TCPHeader::GetChecksum(unsigned short &checksum) const
 {
   GetData((char*)&checksum,2,16);
@@ -243,9 +281,7 @@ void TCPHeader::SetUrgentPtr(const unsigned short &up, const Packet &p)
 {
     unsigned short upt = htons(up);
 
-    SetData((char *)&upt, 2, 18);
-
-    RecomputeChecksum(p);
+    SetField((char *)&upt, 2, 18, p);
 }
 
 
@@ -266,6 +302,185 @@ void TCPHeader::SetOptions(const struct TCPOptions &o)
     SetData(o.data, o.len, TCP_HEADER_BASE_LENGTH);
 }
 
+void TCPHeader::SetOptions(const struct TCPOptions &o, const Packet &p)
+{
+    SetData(o.data, o.len, TCP_HEADER_BASE_LENGTH);
+    SetHeaderLen((TCP_HEADER_BASE_LENGTH + o.len + 3) / 4, p);
+}
+
+
+bool TCPOptions::Find(const unsigned kind, const char *&value, unsigned &vlen) const
+{
+    unsigned i = 0;
+
+    while (i < len) {
+	unsigned char k = data[i];
+	if (k == TCP_HEADER_OPTION_KIND_END) {
+	    break;
+	}
+	if (k == TCP_HEADER_OPTION_KIND_NOP) {
+	    i++;
+	    continue;
+	}
+	if (i + 1 >= len) {
+	    break;
+	}
+	unsigned char l = data[i + 1];
+	if (l < 2 || i + l > len) {
+	    // malformed, so trust nothing after it
+	    break;
+	}
+	if (k == kind) {
+	    value = data + i + 2;
+	    vlen = l - 2;
+	    return true;
+	}
+	i += l;
+    }
+    return false;
+}
+
+bool TCPOptions::AddSackPermitted()
+{
+    if (len + 4 > TCP_HEADER_OPTION_MAX_LENGTH) {
+	return false;
+    }
+    data[len++] = TCP_HEADER_OPTION_KIND_NOP;
+    data[len++] = TCP_HEADER_OPTION_KIND_NOP;
+    data[len++] = TCP_HEADER_OPTION_KIND_SACKOK;
+    data[len++] = TCP_HEADER_OPTION_KIND_SACKOK_LEN;
+    return true;
+}
+
+bool TCPOptions::AddSack(const TCPSackBlock *blocks, const unsigned n)
+{
+    unsigned optlen = 2 + n * TCP_HEADER_OPTION_SACK_BLOCK_LEN;
+
+    if (n == 0 || len + 2 + optlen > TCP_HEADER_OPTION_MAX_LENGTH) {
+	return false;
+    }
+    data[len++] = TCP_HEADER_OPTION_KIND_NOP;
+    data[len++] = TCP_HEADER_OPTION_KIND_NOP;
+    data[len++] = TCP_HEADER_OPTION_KIND_SACK;
+    data[len++] = optlen;
+    for (unsigned i = 0; i < n; i++) {
+	unsigned int edges[2] = { htonl(blocks[i].left), htonl(blocks[i].right) };
+	memcpy(data + len, edges, TCP_HEADER_OPTION_SACK_BLOCK_LEN);
+	len += TCP_HEADER_OPTION_SACK_BLOCK_LEN;
+    }
+    return true;
+}
+
+bool TCPOptions::AddTimestamp(const unsigned int val, const unsigned int ecr)
+{
+    if (len + 2 + TCP_HEADER_OPTION_KIND_TS_LEN > TCP_HEADER_OPTION_MAX_LENGTH) {
+	return false;
+    }
+    unsigned int v[2] = { htonl(val), htonl(ecr) };
+
+    data[len++] = TCP_HEADER_OPTION_KIND_NOP;
+    data[len++] = TCP_HEADER_OPTION_KIND_NOP;
+    data[len++] = TCP_HEADER_OPTION_KIND_TS;
+    data[len++] = TCP_HEADER_OPTION_KIND_TS_LEN;
+    memcpy(data + len, v, 8);
+    len += 8;
+    return true;
+}
+
+bool TCPOptions::AddWindowScale(const unsigned char shift)
+{
+    if (len + 4 > TCP_HEADER_OPTION_MAX_LENGTH) {
+	return false;
+    }
+    data[len++] = TCP_HEADER_OPTION_KIND_NOP;
+    data[len++] = TCP_HEADER_OPTION_KIND_WSF;
+    data[len++] = TCP_HEADER_OPTION_KIND_WSF_LEN;
+    data[len++] = shift;
+    return true;
+}
+
+bool TCPOptions::AddMss(const unsigned short mss)
+{
+    if (len + TCP_HEADER_OPTION_KIND_MSS_LEN > TCP_HEADER_OPTION_MAX_LENGTH) {
+	return false;
+    }
+    unsigned short v = htons(mss);
+
+    data[len++] = TCP_HEADER_OPTION_KIND_MSS;
+    data[len++] = TCP_HEADER_OPTION_KIND_MSS_LEN;
+    memcpy(data + len, &v, 2);
+    len += 2;
+    return true;
+}
+
+bool TCPOptions::HasSackPermitted() const
+{
+    const char *v;
+    unsigned vlen;
+
+    return Find(TCP_HEADER_OPTION_KIND_SACKOK, v, vlen);
+}
+
+bool TCPOptions::GetTimestamp(unsigned int &val, unsigned int &ecr) const
+{
+    const char *v;
+    unsigned vlen;
+
+    if (!Find(TCP_HEADER_OPTION_KIND_TS, v, vlen) || vlen != TCP_HEADER_OPTION_KIND_TS_LEN - 2) {
+	return false;
+    }
+    unsigned int t[2];
+    memcpy(t, v, 8);
+    val = ntohl(t[0]);
+    ecr = ntohl(t[1]);
+    return true;
+}
+
+bool TCPOptions::GetWindowScale(unsigned char &shift) const
+{
+    const char *v;
+    unsigned vlen;
+
+    if (!Find(TCP_HEADER_OPTION_KIND_WSF, v, vlen) || vlen != 1) {
+	return false;
+    }
+    // RFC 7323: larger shifts are taken as 14
+    shift = MIN_MACRO((unsigned char)v[0], TCP_WINDOW_SCALE_MAX);
+    return true;
+}
+
+bool TCPOptions::GetMss(unsigned short &mss) const
+{
+    const char *v;
+    unsigned vlen;
+    unsigned short m;
+
+    if (!Find(TCP_HEADER_OPTION_KIND_MSS, v, vlen) || vlen != TCP_HEADER_OPTION_KIND_MSS_LEN - 2) {
+	return false;
+    }
+    memcpy(&m, v, 2);
+    mss = ntohs(m);
+    return true;
+}
+
+unsigned TCPOptions::GetSack(TCPSackBlock *blocks, const unsigned max) const
+{
+    const char *v;
+    unsigned vlen;
+
+    if (!Find(TCP_HEADER_OPTION_KIND_SACK, v, vlen)) {
+	return 0;
+    }
+    unsigned n = vlen / TCP_HEADER_OPTION_SACK_BLOCK_LEN;
+    for (unsigned i = 0; i < n && i < max; i++) {
+	unsigned int edges[2];
+	memcpy(edges, v + i * TCP_HEADER_OPTION_SACK_BLOCK_LEN, TCP_HEADER_OPTION_SACK_BLOCK_LEN);
+	blocks[i].left = ntohl(edges[0]);
+	blocks[i].right = ntohl(edges[1]);
+    }
+    return n < max ? n : max;
+}
+
 
 std::ostream & TCPHeader::Print(std::ostream &os) const 
 {
@@ -307,3 +522,55 @@ std::ostream & TCPHeader::Print(std::ostream &os) const
 
     return os;    
 }
+
+
+unsigned SplitTCPSuperSegment(const Packet &p, std::vector<Packet> &segments)
+{
+    size_t size = p.GetSegmentSize();
+
+    if (size == 0) {
+	segments.push_back(p);
+	return 1;
+    }
+
+    IPHeader ih = p.FindHeader(Headers::IPHeader);
+    TCPHeader th = p.FindHeader(Headers::TCPHeader);
+    Buffer rest = p.GetPayload();
+    size_t total = rest.GetSize();
+    unsigned char iphlen, tcphlen, flags;
+    unsigned short id;
+    unsigned int seq;
+    unsigned n = 0;
+
+    ih.GetHeaderLength(iphlen);
+    th.GetHeaderLen(tcphlen);
+    th.GetFlags(flags);
+    th.GetSeqNum(seq);
+    ih.GetID(id);
+
+    for (size_t offset = 0; offset < total; offset += size, n++) {
+	size_t len = MIN_MACRO(size, total - offset);
+	bool last = offset + len == total;
+	Packet seg(rest.ExtractFront(len));
+	// the TCP setters only mark it, and it is done once at the end
+	seg.MarkChecksumsPending();
+
+	IPHeader sih(ih);
+	sih.SetTotalLength(iphlen * 4 + tcphlen * 4 + len);
+	sih.SetID(id + n);
+	seg.PushFrontHeader(sih);
+
+	TCPHeader sth(th);
+	unsigned char f = flags;
+	if (!last) {
+	    CLR_PSH(f);
+	    CLR_FIN(f);
+	}
+	sth.SetSeqNum(seq + offset, seg);
+	sth.SetFlags(f, seg);
+	seg.PushBackHeader(sth);
+	seg.FinalizeChecksums();
+	segments.push_back(seg);
+    }
+    return n;
+}
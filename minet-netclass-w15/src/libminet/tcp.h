@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <cstring>
+#include <vector>
 
 #include "config.h"
 #include "packet.h"
@@ -21,22 +22,60 @@ const unsigned TCP_HEADER_OPTION_KIND_MSS=2;
 const unsigned TCP_HEADER_OPTION_KIND_MSS_LEN=4;
 const unsigned TCP_HEADER_OPTION_KIND_WSF=3;
 const unsigned TCP_HEADER_OPTION_KIND_WSF_LEN=3;
+const unsigned TCP_WINDOW_SCALE_MAX=14;
 const unsigned TCP_HEADER_OPTION_KIND_TS=8;
 const unsigned TCP_HEADER_OPTION_KIND_TS_LEN=10;
+const unsigned TCP_HEADER_OPTION_KIND_SACKOK=4;
+const unsigned TCP_HEADER_OPTION_KIND_SACKOK_LEN=2;
+const unsigned TCP_HEADER_OPTION_KIND_SACK=5;
+const unsigned TCP_HEADER_OPTION_SACK_BLOCK_LEN=8;
+// 4 blocks fill 36 of the 40 option bytes, 3 leave room for timestamps
+const unsigned TCP_SACK_MAX_BLOCKS=4;
 
 const unsigned short TCP_PORT_NONE=0;
 const unsigned short TCP_PORT_ANY=0;
 
 
 
+// A run of data the receiver holds, from left up to (not including) right
+struct TCPSackBlock {
+  unsigned int left;
+  unsigned int right;
+};
+
+
 struct TCPOptions {
 public:
   unsigned len;
   char     data[TCP_HEADER_OPTION_MAX_LENGTH];
+
+  TCPOptions() : len(0) {}
+
+  // The first option of this kind; value points past its kind and length
+  bool Find(const unsigned kind, const char *&value, unsigned &vlen) const;
+
+  // These append an option, led by NOPs so len stays a multiple of 4,
+  // and return false if it does not fit
+  bool AddSackPermitted();
+  bool AddSack(const TCPSackBlock *blocks, const unsigned n);
+  bool AddTimestamp(const unsigned int val, const unsigned int ecr);
+  bool AddWindowScale(const unsigned char shift);
+  bool AddMss(const unsigned short mss);
+
+  bool HasSackPermitted() const;
+  // Fills in at most max blocks, returns how many there were
+  unsigned GetSack(TCPSackBlock *blocks, const unsigned max) const;
+  bool GetTimestamp(unsigned int &val, unsigned int &ecr) const;
+  bool GetWindowScale(unsigned char &shift) const;
+  bool GetMss(unsigned short &mss) const;
 };
 
 
 class TCPHeader : public Header {
+private:
+  void FieldChanged(const Packet &p);
+  void SetField(const char *data, const unsigned len, const unsigned offset, const Packet &p);
+
 public:
   TCPHeader();
   TCPHeader(const TCPHeader &rhs);
@@ -85,6 +124,8 @@ public:
 
   void GetOptions(struct TCPOptions &o) const;
   void SetOptions(const struct TCPOptions &o);
+  // also sets the header length to cover them
+  void SetOptions(const struct TCPOptions &o, const Packet &p);
 
 
   std::ostream & Print(std::ostream &os) const;
@@ -115,4 +156,17 @@ inline void CLR_RST(unsigned char &f) { f&=255-4; };
 inline void CLR_SYN(unsigned char &f) { f&=255-2; };
 inline void CLR_FIN(unsigned char &f) { f&=255-1; };
 
+
+// Segmentation offload.  tcp_module may send a run of full segments as
+// one packet whose payload is up to TCP_GSO_MAX_SIZE bytes, with the
+// headers of the first and GetSegmentSize() set to the MSS.  The IP
+// layer splits it with SplitTCPSuperSegment just before it goes out:
+// each segment gets its own IP length and ID, sequence number and
+// checksums, and only the last keeps PSH and FIN.  Returns how many
+// segments were appended; a packet that is not a super-segment is
+// appended as it is.
+const unsigned TCP_GSO_MAX_SIZE=0xffff-IP_HEADER_BASE_LENGTH-TCP_HEADER_MAX_LENGTH;
+
+unsigned SplitTCPSuperSegment(const Packet &p, std::vector<Packet> &segments);
+
 #endif
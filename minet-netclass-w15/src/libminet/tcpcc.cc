@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "tcpcc.h"
+#include "util.h"
+
+CongestionControl::CongestionControl(unsigned int m) :
+  mss(m), ssthresh(0xffffffff), bytes_acked(0), srtt(0)
+{
+  // initial window (RFC 5681 section 3.1)
+  cwnd = mss > 2190 ? 2*mss : mss > 1095 ? 3*mss : 4*mss;
+}
+
+CongestionControl::~CongestionControl()
+{}
+
+void CongestionControl::RenoIncrease(unsigned int acked)
+{
+  if (cwnd < ssthresh) {
+    cwnd += MIN_MACRO(acked, mss);
+  } else {
+    bytes_acked += acked;
+    if (bytes_acked >= cwnd) {
+      bytes_acked -= cwnd;
+      cwnd += mss;
+    }
+  }
+}
+
+unsigned int CongestionControl::HalfFlight(unsigned int flight) const
+{
+  return MAX_MACRO(flight/2, 2*mss);
+}
+
+void CongestionControl::OnAck(unsigned int acked, double now)
+{
+  RenoIncrease(acked);
+}
+
+void CongestionControl::OnLoss(unsigned int flight, double now)
+{
+  ssthresh = HalfFlight(flight);
+  cwnd = ssthresh + 3*mss;
+  bytes_acked = 0;
+}
+
+void CongestionControl::OnDupAck()
+{
+  cwnd += mss;
+}
+
+bool CongestionControl::OnPartialAck(unsigned int acked)
+{
+  return false;
+}
+
+void CongestionControl::OnRecoveryEnd(double now)
+{
+  cwnd = ssthresh;
+}
+
+void CongestionControl::OnRTO(unsigned int flight, double now)
+{
+  ssthresh = HalfFlight(flight);
+  cwnd = mss;
+  bytes_acked = 0;
+}
+
+void CongestionControl::OnRttSample(double rtt)
+{
+  srtt = (srtt == 0) ? rtt : srtt*7/8 + rtt/8;
+}
+
+void CongestionControl::SetMss(unsigned int newmss)
+{
+  mss = newmss;
+  cwnd = MAX_MACRO(cwnd, mss);
+}
+
+std::ostream & CongestionControl::Print(std::ostream &os) const
+{
+  os << "CongestionControl(" << Name()
+     << ", cwnd=" << cwnd
+     << ", ssthresh=" << ssthresh
+     << ", mss=" << mss
+     << ")";
+  return os;
+}
+
+
+bool NewRenoCongestionControl::OnPartialAck(unsigned int acked)
+{
+  // deflate by what left the network, and let one more segment out
+  cwnd = (cwnd > acked) ? cwnd - acked : 0;
+  if (acked >= mss) {
+    cwnd += mss;
+  }
+  cwnd = MAX_MACRO(cwnd, mss);
+  return true;
+}
+
+
+static const double CUBIC_C = 0.4;
+static const double CUBIC_BETA = 0.7;
+
+CubicCongestionControl::CubicCongestionControl(unsigned int m) :
+  NewRenoCongestionControl(m),
+  wmax(0), wlastmax(0), epoch(0), k(0), origin(0), west(0), growth(0)
+{}
+
+void CubicCongestionControl::Reduce()
+{
+  double w = (double)cwnd/mss;
+
+  // give up some room sooner when others are taking it (fast convergence)
+  if (w < wlastmax) {
+    wlastmax = w;
+    wmax = w*(1 + CUBIC_BETA)/2;
+  } else {
+    wlastmax = w;
+    wmax = w;
+  }
+  epoch = 0;
+  growth = 0;
+  ssthresh = MAX_MACRO((unsigned int)(cwnd*CUBIC_BETA), 2*mss);
+}
+
+void CubicCongestionControl::OnLoss(unsigned int flight, double now)
+{
+  Reduce();
+  cwnd = ssthresh + 3*mss;
+  bytes_acked = 0;
+}
+
+void CubicCongestionControl::OnRTO(unsigned int flight, double now)
+{
+  Reduce();
+  cwnd = mss;
+  bytes_acked = 0;
+}
+
+void CubicCongestionControl::OnAck(unsigned int acked, double now)
+{
+  if (cwnd < ssthresh) {
+    RenoIncrease(acked);
+    return;
+  }
+
+  double w = (double)cwnd/mss;
+  if (epoch == 0) {
+    epoch = now;
+    if (w < wmax) {
+      k = cbrt((wmax - w)/CUBIC_C);
+      origin = wmax;
+    } else {
+      k = 0;
+      origin = w;
+    }
+    west = w;
+  }
+
+  // where the curve will be an RTT from now, at most half as much again
+  double t = now - epoch + srtt;
+  double target = origin + CUBIC_C*(t - k)*(t - k)*(t - k);
+  target = MIN_MACRO(MAX_MACRO(target, w), 1.5*w);
+
+  // and no less than Reno with the same backoff would have
+  west += 3*(1 - CUBIC_BETA)/(1 + CUBIC_BETA)*acked/mss/w;
+  target = MAX_MACRO(target, west);
+
+  growth += (target - w)/w*acked;
+  if (growth >= 1) {
+    cwnd += (unsigned int)growth;
+    growth -= (unsigned int)growth;
+  }
+}
+
+
+CongestionControl *MakeCongestionControl(const char *name, unsigned int mss)
+{
+  if (!strcmp(name, "reno")) {
+    return new RenoCongestionControl(mss);
+  } else if (!strcmp(name, "newreno")) {
+    return new NewRenoCongestionControl(mss);
+  } else if (!strcmp(name, "cubic")) {
+    return new CubicCongestionControl(mss);
+  } else {
+    return 0;
+  }
+}
+
+bool IsCongestionControl(const char *name)
+{
+  // the mss does not matter to whether it exists
+  CongestionControl *cc = MakeCongestionControl(name, 1);
+
+  delete cc;
+  return cc != 0;
+}
+
+CongestionControl *MakeDefaultCongestionControl(unsigned int mss)
+{
+  const char *env = getenv("MINET_CC");
+  CongestionControl *cc = 0;
+
+  if (env) {
+    // minet.cfg values may arrive with their quotes
+    char name[16];
+    strncpy(name, env + strspn(env, "\""), sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    name[strcspn(name, "\"")] = 0;
+    cc = MakeCongestionControl(name, mss);
+  }
+  return cc ? cc : new NewRenoCongestionControl(mss);
+}
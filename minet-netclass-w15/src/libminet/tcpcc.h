@@ -0,0 +1,149 @@
+#ifndef _tcpcc
+#define _tcpcc
+
+#include <iostream>
+
+//
+// TCP congestion control.
+//
+// TCPState decides what an ACK means (new data, a duplicate, the start
+// or end of fast recovery, RFC 5681 and 6582) and tells the algorithm
+// through the hooks below; the algorithm only keeps cwnd and ssthresh,
+// in bytes.  Which one a connection gets is chosen by name: "reno",
+// "newreno" or "cubic", with MINET_CC giving the default (newreno).
+//
+
+class CongestionControl {
+ protected:
+  unsigned int mss;
+  unsigned int cwnd;
+  unsigned int ssthresh;
+  unsigned int bytes_acked; // toward the next increase in avoidance
+  double       srtt;
+
+  // slow start, or one mss per cwnd acked (RFC 3465 byte counting)
+  void RenoIncrease(unsigned int acked);
+  unsigned int HalfFlight(unsigned int flight) const;
+
+ public:
+  CongestionControl(unsigned int mss);
+  virtual ~CongestionControl();
+
+  virtual const char *Name() const = 0;
+  virtual CongestionControl *Clone() const = 0;
+
+  // acked new bytes outside of recovery
+  virtual void OnAck(unsigned int acked, double now);
+  // three duplicate ACKs with flight bytes outstanding: recovery begins
+  virtual void OnLoss(unsigned int flight, double now);
+  // a further duplicate ACK during recovery
+  virtual void OnDupAck();
+  // an ACK during recovery that does not cover everything outstanding
+  // when it began; returns true to stay in recovery (NewReno)
+  virtual bool OnPartialAck(unsigned int acked);
+  // everything outstanding at the loss is acked
+  virtual void OnRecoveryEnd(double now);
+  // the retransmission timer went off
+  virtual void OnRTO(unsigned int flight, double now);
+
+  virtual void OnRttSample(double rtt);
+
+  virtual void SetMss(unsigned int newmss);
+
+  unsigned int GetCwnd() const { return cwnd; }
+  unsigned int GetSsthresh() const { return ssthresh; }
+  unsigned int GetMss() const { return mss; }
+
+  virtual std::ostream & Print(std::ostream &os) const;
+
+  friend std::ostream &operator<<(std::ostream &os, const CongestionControl& L) {
+    return L.Print(os);
+  }
+};
+
+
+// Leaves recovery on the first ACK that moves last_acked (RFC 5681)
+class RenoCongestionControl : public CongestionControl {
+ public:
+  RenoCongestionControl(unsigned int mss) : CongestionControl(mss) {}
+
+  const char *Name() const { return "reno"; }
+  CongestionControl *Clone() const { return new RenoCongestionControl(*this); }
+};
+
+
+// Stays in recovery until all that was outstanding is acked, resending
+// the next hole on each partial ACK (RFC 6582)
+class NewRenoCongestionControl : public CongestionControl {
+ public:
+  NewRenoCongestionControl(unsigned int mss) : CongestionControl(mss) {}
+
+  const char *Name() const { return "newreno"; }
+  CongestionControl *Clone() const { return new NewRenoCongestionControl(*this); }
+
+  bool OnPartialAck(unsigned int acked);
+};
+
+
+// RFC 8312: after a loss the window grows back along a cubic centred
+// on where the loss happened, in time rather than per RTT, and never
+// slower than Reno would.  Recovery itself is NewReno's.
+class CubicCongestionControl : public NewRenoCongestionControl {
+ private:
+  double wmax;        // segments, at the last loss
+  double wlastmax;    // the one before, for fast convergence
+  double epoch;       // when the current growth period began, 0 if none
+  double k;           // seconds from epoch to reach wmax again
+  double origin;      // segments the curve is centred on
+  double west;        // segments Reno would have by now
+  double growth;      // bytes of cwnd increase not yet applied
+
+  void Reduce();
+
+ public:
+  CubicCongestionControl(unsigned int mss);
+
+  const char *Name() const { return "cubic"; }
+  CongestionControl *Clone() const { return new CubicCongestionControl(*this); }
+
+  void OnAck(unsigned int acked, double now);
+  void OnLoss(unsigned int flight, double now);
+  void OnRTO(unsigned int flight, double now);
+};
+
+
+// Returns 0 for an unknown name.  The default is MINET_CC's, or newreno.
+CongestionControl *MakeCongestionControl(const char *name, unsigned int mss);
+bool IsCongestionControl(const char *name);
+CongestionControl *MakeDefaultCongestionControl(unsigned int mss);
+
+
+// Owns an algorithm and copies it along with its owner, since
+// ConnectionList copies TCPStates about
+class CongestionControlPtr {
+ private:
+  CongestionControl *cc;
+
+ public:
+  CongestionControlPtr(CongestionControl *c=0) : cc(c) {}
+  CongestionControlPtr(const CongestionControlPtr &rhs) : cc(rhs.cc ? rhs.cc->Clone() : 0) {}
+  ~CongestionControlPtr() { delete cc; }
+
+  CongestionControlPtr & operator=(const CongestionControlPtr &rhs) {
+    if (this != &rhs) {
+      delete cc;
+      cc = rhs.cc ? rhs.cc->Clone() : 0;
+    }
+    return *this;
+  }
+
+  void Reset(CongestionControl *c) {
+    delete cc;
+    cc = c;
+  }
+
+  CongestionControl *operator->() const { return cc; }
+  CongestionControl &operator*() const { return *cc; }
+};
+
+#endif
@@ -5,9 +5,26 @@
  *
  ******************************************************************************/
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "tcpstate.h"
 
-TCPState::TCPState()
+TCPState::TCPState() : tmrTries(0), tmrTriesSet(0),
+  send_buffer_size(TCP_BUFFER_DEFAULT), send_buffer_locked(false),
+  nodelay(false), cork(false),
+  send_offset(0), retransmit_next(0),
+  cc(MakeDefaultCongestionControl(TCP_MAXIMUM_SEGMENT_SIZE)),
+  dupacks(0), in_recovery(false), recover(0),
+  srtt(0), rttvar(0), rto(TCP_RTO_INITIAL), rtt_valid(false), rtt_timing(false),
+  rtt_seq(0), rtt_start(0), ts_ok(false), ts_recent(0),
+  recv_offset(0), reassembly_bytes(0), sack_recent(0), sack_permitted(false),
+  wscale_ok(false), snd_wscale(0), rcv_wscale(WindowScaleFor(TCP_BUFFER_MAX)),
+  delack_timeout(DefaultDelayedAck()), delack_segments(0), delack_full(0), delack_due(0),
+  peer_mss(TCP_MAXIMUM_SEGMENT_SIZE), pmtu(ETHERNET_DATA_MAX), mss(TCP_MAXIMUM_SEGMENT_SIZE),
+  rcv_mss(TCP_MAXIMUM_SEGMENT_SIZE),
+  recv_buffer_locked(false),
+  rcv_space_bytes(0), rcv_space_start(0), TCP_BUFFER_SIZE(TCP_BUFFER_DEFAULT)
 {}
 
 // Passive/Active open constructor
@@ -15,16 +32,56 @@ TCPState::TCPState(unsigned int initialSequenceNum, unsigned int state, unsigned
 {
   stateOfcnx = state;
   tmrTries = timertries;
-  TCP_BUFFER_SIZE = 100*TCP_MAXIMUM_SEGMENT_SIZE; //100 packets in buffer
-  N = 16*TCP_MAXIMUM_SEGMENT_SIZE; //16 packets allowed in flight
+  tmrTriesSet = timertries;
+  TCP_BUFFER_SIZE = TCP_BUFFER_DEFAULT;
+  send_buffer_size = TCP_BUFFER_DEFAULT;
+  send_buffer_locked = false;
+  nodelay = false;
+  cork = false;
+  recv_buffer_locked = false;
+  rcv_space_bytes = 0;
+  rcv_space_start = 0;
+  wscale_ok = false;
+  snd_wscale = 0;
+  rcv_wscale = WindowScaleFor(TCP_BUFFER_MAX);
+  delack_timeout = DefaultDelayedAck();
+  delack_segments = 0;
+  delack_full = 0;
+  delack_due = 0;
+  peer_mss = TCP_MAXIMUM_SEGMENT_SIZE;
+  pmtu = ETHERNET_DATA_MAX;
+  mss = TCP_MAXIMUM_SEGMENT_SIZE;
+  rcv_mss = TCP_MAXIMUM_SEGMENT_SIZE;
+  N = 16*mss; //16 packets allowed in flight
 
   // Send side initialization
   last_acked = initialSequenceNum;
   last_sent  = last_acked;
   rwnd       = 0;
+  send_offset = 0;
+  retransmit_next = 0;
+
+  cc.Reset(MakeDefaultCongestionControl(TCP_MAXIMUM_SEGMENT_SIZE));
+  dupacks = 0;
+  in_recovery = false;
+  recover = initialSequenceNum;
+
+  srtt = 0;
+  rttvar = 0;
+  rto = TCP_RTO_INITIAL;
+  rtt_valid = false;
+  rtt_timing = false;
+  rtt_seq = 0;
+  rtt_start = 0;
+  ts_ok = false;
+  ts_recent = 0;
 
   // Receiver side initialization
   last_recvd = 0;
+  recv_offset = 0;
+  reassembly_bytes = 0;
+  sack_recent = 0;
+  sack_permitted = false;
 }
 
 
@@ -44,24 +101,29 @@ bool TCPState::ExpireTimerTries()
 
 bool TCPState::SetLastAcked(unsigned int newack)
 {
+  unsigned int old = last_acked;
+
   if(last_acked <= last_sent) {
     if(newack > last_acked && newack <= last_sent + 1) {
-      //Delete the front of the buffer
-      SendBuffer.Erase(0, newack - last_acked);
+      //Delete the front of the buffer, up to newack-1
+      SendBuffer.Erase(0, newack - 1 - last_acked);
       last_acked = newack - 1;
+      AdvanceScoreboard(last_acked - old);
       return true;
     } else {
       return false;
     }
   } else if(newack > last_acked && newack > last_sent) {
-    //Delete the front of the buffer
-    SendBuffer.Erase(0, newack - last_acked);
+    //Delete the front of the buffer, up to newack-1
+    SendBuffer.Erase(0, newack - 1 - last_acked);
     last_acked = newack - 1;
+    AdvanceScoreboard(last_acked - old);
     return true;
   } else if(newack < last_acked && newack <= last_sent + 1) {
     //Delete the front of the buffer
-    SendBuffer.Erase(0, (SEQ_LENGTH_MASK - last_acked + 1) + newack);
+    SendBuffer.Erase(0, (SEQ_LENGTH_MASK - last_acked) + newack);
     last_acked = newack - 1;
+    AdvanceScoreboard(last_acked - old);
     return true;
   } else
     return false;
@@ -69,11 +131,234 @@ bool TCPState::SetLastAcked(unsigned int newack)
 
 unsigned int TCPState::GetRwnd()
 {
-  return TCP_BUFFER_SIZE - RecvBuffer.GetSize();
+  return (RecvBuffer.GetSize() < TCP_BUFFER_SIZE) ? TCP_BUFFER_SIZE - RecvBuffer.GetSize() : 0;
+}
+
+unsigned char TCPState::WindowScaleFor(unsigned int size)
+{
+  unsigned char shift;
+
+  for (shift = 0; (size >> shift) > 0xffff && shift < TCP_WINDOW_SCALE_MAX; shift++)
+    ;
+  return shift;
+}
+
+void TCPState::NegotiateWindowScale(bool offered, unsigned char shift)
+{
+  wscale_ok = offered;
+  if (offered) {
+    snd_wscale = MIN_MACRO(shift, TCP_WINDOW_SCALE_MAX);
+  } else {
+    snd_wscale = 0;
+    rcv_wscale = 0;
+  }
+}
+
+unsigned short TCPState::GetAdvertisedWindow(bool syn)
+{
+  unsigned int window = GetRwnd() >> (syn ? 0 : rcv_wscale);
+
+  return MIN_MACRO(window, 0xffff);
+}
+
+void TCPState::UpdateMss()
+{
+  mss = MIN_MACRO(peer_mss, pmtu - IP_HEADER_BASE_LENGTH - TCP_HEADER_BASE_LENGTH);
+  N = 16*mss;
+  cc->SetMss(mss);
+}
+
+void TCPState::NegotiateMss(bool offered, unsigned short peer)
+{
+  // a peer asking for less than the options leave room for gets that
+  peer_mss = offered ? MAX_MACRO((unsigned int)peer, TCP_HEADER_OPTION_MAX_LENGTH + 8) : TCP_MAXIMUM_SEGMENT_SIZE;
+  UpdateMss();
+}
+
+bool TCPState::PathMtuReduced(unsigned int mtu, unsigned int seq)
+{
+  // the plateaus of RFC 1191, for routers that do not give the MTU
+  static const unsigned int plateaus[] = { 1492, 1006, 508, 296, 68, 0 };
+
+  // only for a segment in flight, not one a forger made up
+  if (seq - last_acked - 1 >= last_sent - last_acked) {
+    return false;
+  }
+  if (mtu == 0) {
+    for (unsigned i = 0; plateaus[i] != 0; i++) {
+      if (plateaus[i] < pmtu) {
+	mtu = plateaus[i];
+	break;
+      }
+    }
+  }
+  mtu = MAX_MACRO(mtu, TCP_PMTU_MIN);
+  if (mtu >= pmtu) {
+    return false;
+  }
+  pmtu = mtu;
+  UpdateMss();
+  return true;
+}
+
+unsigned int TCPState::GetSendSpace() const
+{
+  return (SendBuffer.GetSize() < send_buffer_size) ? send_buffer_size - SendBuffer.GetSize() : 0;
+}
+
+size_t TCPState::QueueSend(const Buffer &data)
+{
+  size_t len = MIN_MACRO(data.GetSize(), (size_t)GetSendSpace());
+  Buffer front(data);
+
+  if (len < front.GetSize()) {
+    front = front.ExtractFront(len);
+  }
+  SendBuffer.AddBack(front);
+  return len;
+}
+
+bool TCPState::NextSegment(unsigned int &seq, size_t &len)
+{
+  unsigned int inflight = last_sent - last_acked;
+  size_t unsent = (SendBuffer.GetSize() > inflight) ? SendBuffer.GetSize() - inflight : 0;
+  unsigned offset;
+
+  if (unsent == 0) {
+    return false;
+  }
+  SendPacketPayload(offset, len, unsent);
+  if (len == 0) {
+    return false;
+  }
+  if (len < GetMss()) {
+    if (len == unsent ? cork || (!nodelay && inflight > 0) : inflight > 0) {
+      return false;
+    }
+  }
+  seq = last_sent + 1;
+  return true;
+}
+
+int TCPState::SetSocketOption(int level, int name, int value)
+{
+  unsigned int size = MIN_MACRO(MAX_MACRO((unsigned int)value, TCP_BUFFER_MIN), TCP_BUFFER_MAX);
+
+  if (level == IPPROTO_TCP) {
+    switch (name) {
+    case TCP_NODELAY:
+      nodelay = value != 0;
+      return EOK;
+    case TCP_CORK:
+      cork = value != 0;
+      return EOK;
+    case TCP_QUICKACK:
+      SetDelayedAck(value ? 0 : DefaultDelayedAck());
+      return EOK;
+    default:
+      return ENOT_SUPPORTED;
+    }
+  }
+  if (level != SOL_SOCKET || value <= 0) {
+    return ENOT_SUPPORTED;
+  }
+  switch (name) {
+  case SO_SNDBUF:
+    send_buffer_size = size;
+    send_buffer_locked = true;
+    return EOK;
+  case SO_RCVBUF:
+    // never below what it holds, which was advertised already
+    TCP_BUFFER_SIZE = MAX_MACRO(size, (unsigned int)(RecvBuffer.GetSize() + reassembly_bytes));
+    recv_buffer_locked = true;
+    // before our SYN goes, it is all the window the SYN need offer
+    if (stateOfcnx <= SYN_SENT && last_sent == last_acked) {
+      rcv_wscale = WindowScaleFor(TCP_BUFFER_SIZE);
+    }
+    return EOK;
+  default:
+    return ENOT_SUPPORTED;
+  }
+}
+
+int TCPState::SetSocketOption(const SockOption &opt)
+{
+  if (opt.level == IPPROTO_TCP && opt.name == TCP_CONGESTION) {
+    char name[SOCK_OPTION_TEXT_MAX];
+    strncpy(name, opt.text, sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    return SetCongestionControl(name) ? EOK : ENOT_SUPPORTED;
+  }
+  return SetSocketOption(opt.level, opt.name, opt.value);
+}
+
+double TCPState::DefaultDelayedAck()
+{
+  const char *env = getenv("MINET_DELAYED_ACK");
+
+  if (!env) {
+    return TCP_DELAYED_ACK_DEFAULT;
+  }
+  // minet.cfg values may arrive with their quotes
+  double ms = atof(env + strspn(env, "\""));
+  return MIN_MACRO(MAX_MACRO(ms / 1000.0, 0.0), TCP_DELAYED_ACK_MAX);
+}
+
+bool TCPState::SegmentReceived(size_t len, size_t delivered, double now)
+{
+  // a gap just opened, or got smaller: the sender wants to know now
+  bool inorder = delivered == len && !HasReassemblyGap();
+
+  if (len == 0) {
+    return false;
+  }
+  delack_segments++;
+  if (len > rcv_mss) {
+    rcv_mss = MIN_MACRO(len, (size_t)TCP_MSS_OFFER);
+  }
+  if (len >= rcv_mss) {
+    delack_full++;
+  }
+  if (delack_timeout == 0 || !inorder || delack_full >= 2) {
+    return true;
+  }
+  if (delack_segments == 1) {
+    delack_due = now + delack_timeout;
+  }
+  return false;
+}
+
+void TCPState::AckSent()
+{
+  delack_segments = 0;
+  delack_full = 0;
+  delack_due = 0;
+}
+
+void TCPState::AutotuneReceive(size_t bytes, double now)
+{
+  double rtt = rtt_valid ? srtt : TCP_RTO_MIN;
+
+  rcv_space_bytes += bytes;
+  if (rcv_space_start == 0) {
+    rcv_space_start = now;
+    return;
+  }
+  if (now - rcv_space_start < rtt) {
+    return;
+  }
+  if (!recv_buffer_locked && 2*rcv_space_bytes > TCP_BUFFER_SIZE) {
+    TCP_BUFFER_SIZE = MIN_MACRO(2*rcv_space_bytes, (size_t)TCP_BUFFER_MAX);
+  }
+  rcv_space_bytes = 0;
+  rcv_space_start = now;
 }
 void TCPState::SetLastRecvd(unsigned int lastrecvd)
 {
+  // a new sequence space, so nothing queued can belong to it
   last_recvd = lastrecvd;
+  ReassemblyQueue.clear();
+  reassembly_bytes = 0;
 }
 
 bool TCPState::SetLastRecvd(unsigned int lastrecvd, unsigned int length)
@@ -91,6 +376,403 @@ bool TCPState::SetLastRecvd(unsigned int lastrecvd, unsigned int length)
   }
 }
 
+size_t TCPState::ReceiveSegment(unsigned int seq, const Buffer &data)
+{
+  Buffer rest(data);
+  unsigned int window = GetRwnd();
+  unsigned int start = seq - (last_recvd + 1);
+
+  // drop what we already have in order, and what does not fit
+  if ((int)start < 0) {
+    if ((unsigned int)-(int)start >= rest.GetSize()) {
+      return 0;
+    }
+    rest.Erase(0, -(int)start);
+    start = 0;
+  }
+  if (start >= window) {
+    return 0;
+  }
+  if (start > 0) {
+    sack_recent = recv_offset + start;
+  }
+  if (rest.GetSize() > window - start) {
+    rest.Erase(window - start, rest.GetSize() - (window - start));
+  }
+
+  unsigned long long s = recv_offset + start;
+  unsigned long long e = s + rest.GetSize();
+
+  // skip over what is queued already, keeping the bytes we had first
+  std::map<unsigned long long, Buffer>::iterator i = ReassemblyQueue.upper_bound(s);
+  if (i != ReassemblyQueue.begin()) {
+    std::map<unsigned long long, Buffer>::iterator prev = i;
+    --prev;
+    unsigned long long pe = (*prev).first + (*prev).second.GetSize();
+    if (pe >= e) {
+      return 0;
+    }
+    if (pe > s) {
+      rest.Erase(0, pe - s);
+      s = pe;
+    }
+  }
+  while (s < e) {
+    if (i == ReassemblyQueue.end() || (*i).first >= e) {
+      reassembly_bytes += e - s;
+      ReassemblyQueue[s] = rest;
+      break;
+    }
+    if ((*i).first > s) {
+      size_t n = (*i).first - s;
+      reassembly_bytes += n;
+      ReassemblyQueue[s] = rest.ExtractFront(n);
+      s += n;
+    }
+    unsigned long long ie = (*i).first + (*i).second.GetSize();
+    if (ie >= e) {
+      break;
+    }
+    rest.Erase(0, ie - s);
+    s = ie;
+    ++i;
+  }
+
+  // hand over whatever is now contiguous
+  size_t delivered = 0;
+  while (!ReassemblyQueue.empty() && ReassemblyQueue.begin()->first == recv_offset) {
+    Buffer &b = ReassemblyQueue.begin()->second;
+    size_t n = b.GetSize();
+    RecvBuffer.AddBack(b);
+    last_recvd += n;
+    recv_offset += n;
+    reassembly_bytes -= n;
+    delivered += n;
+    ReassemblyQueue.erase(ReassemblyQueue.begin());
+  }
+  return delivered;
+}
+
+unsigned TCPState::GetSackBlocks(TCPSackBlock *blocks, unsigned max) const
+{
+  std::vector<std::pair<unsigned long long, unsigned long long> > runs;
+  std::map<unsigned long long, Buffer>::const_iterator i;
+
+  // neighbouring pieces of the queue make up one block
+  for (i = ReassemblyQueue.begin(); i != ReassemblyQueue.end(); ++i) {
+    unsigned long long e = (*i).first + (*i).second.GetSize();
+    if (!runs.empty() && runs.back().second == (*i).first) {
+      runs.back().second = e;
+    } else {
+      runs.push_back(std::make_pair((*i).first, e));
+    }
+  }
+
+  // the newest first, then the rest from the top down
+  std::vector<unsigned> order;
+  for (unsigned k = 0; k < runs.size(); k++) {
+    if (runs[k].first <= sack_recent && sack_recent < runs[k].second) {
+      order.push_back(k);
+    }
+  }
+  for (unsigned k = runs.size(); k > 0; k--) {
+    if (order.empty() || order[0] != k - 1) {
+      order.push_back(k - 1);
+    }
+  }
+
+  unsigned n;
+  for (n = 0; n < max && n < order.size(); n++) {
+    blocks[n].left = last_recvd + 1 + (unsigned int)(runs[order[n]].first - recv_offset);
+    blocks[n].right = last_recvd + 1 + (unsigned int)(runs[order[n]].second - recv_offset);
+  }
+  return n;
+}
+
+void TCPState::AdvanceScoreboard(unsigned int acked)
+{
+  send_offset += acked;
+  while (!Scoreboard.empty() && Scoreboard.begin()->first < send_offset) {
+    std::map<unsigned long long, unsigned long long>::iterator i = Scoreboard.begin();
+    unsigned long long e = (*i).second;
+    Scoreboard.erase(i);
+    if (e > send_offset) {
+      Scoreboard[send_offset] = e;
+      break;
+    }
+  }
+}
+
+void TCPState::UpdateScoreboard(const TCPSackBlock *blocks, unsigned n)
+{
+  unsigned int outstanding = last_sent - last_acked;
+
+  for (unsigned k = 0; k < n; k++) {
+    unsigned int l = blocks[k].left - (last_acked + 1);
+    unsigned int r = blocks[k].right - (last_acked + 1);
+    if ((int)r <= 0 || r > outstanding || (int)(r - l) <= 0) {
+      continue;
+    }
+    if ((int)l < 0) {
+      l = 0;
+    }
+    unsigned long long s = send_offset + l, e = send_offset + r;
+
+    // merge with whatever it touches
+    std::map<unsigned long long, unsigned long long>::iterator i = Scoreboard.upper_bound(s);
+    if (i != Scoreboard.begin()) {
+      std::map<unsigned long long, unsigned long long>::iterator prev = i;
+      --prev;
+      if ((*prev).second >= s) {
+	s = (*prev).first;
+	if ((*prev).second > e) {
+	  e = (*prev).second;
+	}
+	i = prev;
+      }
+    }
+    while (i != Scoreboard.end() && (*i).first <= e) {
+      if ((*i).second > e) {
+	e = (*i).second;
+      }
+      Scoreboard.erase(i++);
+    }
+    Scoreboard[s] = e;
+  }
+}
+
+void TCPState::ClearScoreboard()
+{
+  Scoreboard.clear();
+}
+
+size_t TCPState::GetSackedBytes() const
+{
+  size_t n = 0;
+  std::map<unsigned long long, unsigned long long>::const_iterator i;
+
+  for (i = Scoreboard.begin(); i != Scoreboard.end(); ++i) {
+    n += (*i).second - (*i).first;
+  }
+  return n;
+}
+
+void TCPState::RestartRetransmission()
+{
+  retransmit_next = send_offset;
+}
+
+bool TCPState::NextRetransmission(unsigned int &seq, size_t &len, size_t maxlen)
+{
+  unsigned long long end = send_offset + (unsigned int)(last_sent - last_acked);
+  unsigned long long s = retransmit_next > send_offset ? retransmit_next : send_offset;
+
+  // step over SACKed ranges to the start of the next hole
+  std::map<unsigned long long, unsigned long long>::const_iterator i = Scoreboard.upper_bound(s);
+  if (i != Scoreboard.begin()) {
+    std::map<unsigned long long, unsigned long long>::const_iterator prev = i;
+    --prev;
+    if ((*prev).second > s) {
+      s = (*prev).second;
+    }
+  }
+  if (s >= end || maxlen == 0) {
+    retransmit_next = end;
+    return false;
+  }
+  unsigned long long e = end;
+  if (i != Scoreboard.end() && (*i).first < e) {
+    e = (*i).first;
+  }
+  if (e - s > maxlen) {
+    e = s + maxlen;
+  }
+  seq = last_acked + 1 + (unsigned int)(s - send_offset);
+  len = e - s;
+  retransmit_next = e;
+  return true;
+}
+
+bool TCPState::NextLostSegment(unsigned int &seq, size_t &len)
+{
+  // RetransmitTimeout set recover to what had been sent
+  int lost = (int)(recover - last_acked);
+  unsigned long long resent = retransmit_next > send_offset ? retransmit_next - send_offset : 0;
+
+  if (in_recovery || lost <= 0 || resent >= (unsigned int)lost || resent >= GetCwnd()) {
+    return false;
+  }
+  return NextRetransmission(seq, len, MIN_MACRO((size_t)GetMss(), (size_t)(lost - resent)));
+}
+
+bool TCPState::SetCongestionControl(const char *name)
+{
+  CongestionControl *c = MakeCongestionControl(name, cc->GetMss());
+
+  if (c == 0) {
+    return false;
+  }
+  cc.Reset(c);
+  return true;
+}
+
+eAckAction TCPState::ProcessAck(unsigned int ack, bool maybedup, double now)
+{
+  unsigned int old = last_acked;
+  unsigned int flight = last_sent - last_acked;
+
+  if ((int)(ack - 1 - last_acked) > 0) {
+    if (!SetLastAcked(ack)) {
+      return ACK_OLD;
+    }
+    unsigned int acked = last_acked - old;
+    dupacks = 0;
+    if (rtt_timing && !ts_ok && (int)(last_acked - rtt_seq) >= 0) {
+      rtt_timing = false;
+      RttSample(now - rtt_start);
+    }
+    if (!in_recovery) {
+      cc->OnAck(acked, now);
+      // room for two windows, so the sender is never held up by it
+      if (!send_buffer_locked && send_buffer_size < 2*GetCwnd()) {
+	send_buffer_size = MIN_MACRO(2*GetCwnd(), TCP_BUFFER_MAX);
+      }
+      return ACK_NEW;
+    }
+    if ((int)(last_acked - recover) >= 0) {
+      in_recovery = false;
+      cc->OnRecoveryEnd(now);
+      return ACK_NEW;
+    }
+    if (cc->OnPartialAck(acked)) {
+      // the next hole is lost too
+      return ACK_RETRANSMIT;
+    }
+    in_recovery = false;
+    cc->OnRecoveryEnd(now);
+    return ACK_NEW;
+  }
+
+  if (ack - 1 != last_acked || !maybedup || flight == 0) {
+    return ACK_OLD;
+  }
+  dupacks++;
+  if (in_recovery) {
+    cc->OnDupAck();
+    return ACK_DUPLICATE;
+  }
+  // not again for losses from before the last recovery (RFC 6582)
+  if (dupacks == TCP_DUPACK_THRESHOLD && (int)(last_acked - recover) >= 0) {
+    in_recovery = true;
+    recover = last_sent;
+    cc->OnLoss(flight, now);
+    return ACK_RETRANSMIT;
+  }
+  return ACK_DUPLICATE;
+}
+
+void TCPState::RetransmitTimeout(double now)
+{
+  cc->OnRTO(last_sent - last_acked, now);
+  dupacks = 0;
+  in_recovery = false;
+  recover = last_sent;
+  // whatever was being timed will be resent
+  rtt_timing = false;
+}
+
+void TCPState::SegmentSent(unsigned int seq, size_t len, bool retransmission, double now)
+{
+  if (retransmission) {
+    if (rtt_timing && (int)(seq - rtt_seq) <= 0) {
+      rtt_timing = false;
+    }
+  } else if (!rtt_timing && len > 0) {
+    rtt_timing = true;
+    rtt_seq = seq + len - 1;
+    rtt_start = now;
+  }
+}
+
+void TCPState::RttSample(double rtt)
+{
+  if (rtt < 0) {
+    return;
+  }
+  if (!rtt_valid) {
+    srtt = rtt;
+    rttvar = rtt/2;
+    rtt_valid = true;
+  } else {
+    double err = rtt - srtt;
+    rttvar = rttvar*3/4 + (err < 0 ? -err : err)/4;
+    srtt = srtt*7/8 + rtt/8;
+  }
+  rto = srtt + MAX_MACRO(TCP_CLOCK_GRANULARITY, 4*rttvar);
+  rto = MIN_MACRO(MAX_MACRO(rto, TCP_RTO_MIN), TCP_RTO_MAX);
+  cc->OnRttSample(rtt);
+}
+
+double TCPState::GetRto() const
+{
+  double r = rto;
+
+  for (unsigned int i = tmrTries; i < tmrTriesSet && r < TCP_RTO_MAX; i++) {
+    r *= 2;
+  }
+  return MIN_MACRO(r, TCP_RTO_MAX);
+}
+
+unsigned int TCPState::TimestampNow(double now)
+{
+  return (unsigned int)(unsigned long long)(now/TCP_CLOCK_GRANULARITY);
+}
+
+void TCPState::TimestampReceived(unsigned int seq, unsigned int val, unsigned int ecr, bool newack, double now)
+{
+  // only a segment at the left edge of the window may move ts_recent
+  if ((int)(seq - (last_recvd + 1)) <= 0) {
+    ts_recent = val;
+  }
+  if (ts_ok && newack && ecr != 0) {
+    RttSample((TimestampNow(now) - ecr)*TCP_CLOCK_GRANULARITY);
+  }
+}
+
+void TCPState::GetInfo(TCPInfo &info) const
+{
+  info.state = stateOfcnx;
+  info.srtt = (unsigned int)(srtt*1e6);
+  info.rttvar = (unsigned int)(rttvar*1e6);
+  info.rto = (unsigned int)(GetRto()*1e6);
+  info.backoff = tmrTriesSet - tmrTries;
+  info.cwnd = cc->GetCwnd();
+  info.ssthresh = cc->GetSsthresh();
+  info.in_flight = last_sent - last_acked;
+  info.sacked = GetSackedBytes();
+  info.queued = reassembly_bytes;
+  info.mss = mss;
+  info.pmtu = pmtu;
+}
+
+std::ostream & TCPInfo::Print(std::ostream &os) const
+{
+  os << "TCPInfo(state=" << state
+     << ", srtt=" << srtt << "us"
+     << ", rttvar=" << rttvar << "us"
+     << ", rto=" << rto << "us"
+     << ", backoff=" << backoff
+     << ", cwnd=" << cwnd
+     << ", ssthresh=" << ssthresh
+     << ", in_flight=" << in_flight
+     << ", sacked=" << sacked
+     << ", queued=" << queued
+     << ", mss=" << mss
+     << ", pmtu=" << pmtu
+     << ")";
+  return os;
+}
+
 void TCPState::SendPacketPayload(unsigned &offsetlastsent, size_t &bytesize, unsigned bytes)
 {
   if(last_acked < last_sent) {
@@ -99,7 +781,9 @@ void TCPState::SendPacketPayload(unsigned &offsetlastsent, size_t &bytesize, uns
     offsetlastsent = SEQ_LENGTH_MASK - last_acked + last_sent + 1;
   }
 
-  bytesize = MIN_MACRO((rwnd - offsetlastsent), (N - offsetlastsent));
+  // the least of what the peer, we and the network will take
+  unsigned int window = MIN_MACRO((unsigned int)rwnd, GetCwnd());
+  bytesize = (offsetlastsent < window) ? window - offsetlastsent : 0;
   bytesize = MIN_MACRO(bytesize, bytes);
-  bytesize = MIN_MACRO(bytesize, TCP_MAXIMUM_SEGMENT_SIZE);
+  bytesize = MIN_MACRO(bytesize, (size_t)GetMss());
 }
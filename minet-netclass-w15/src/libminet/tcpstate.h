@@ -11,17 +11,55 @@
 #define _tcpstate
 
 #include <iostream>
+#include <map>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <vector>
 #include "Minet.h"
+#include "tcpcc.h"
 
 // The following two constants provide the proper sequence increments for an MSL
 //  of 2 mins
 const unsigned int SECOND_MULTIPLIER=35791394; // (1s * 2^32) / 120s
 const unsigned int MICROSEC_MULTIPLIER=36;     // (1us * 2^32) / 120s
 const unsigned int MSL_TIME_SECS=120;          // MSL time is 2 minutes
+const unsigned int FIN_WAIT2_TIME_SECS=60;     // Wait for the peer's FIN 1 minute
 const unsigned int NUM_SYN_TRIES=8;            // Send SYN 8x before fail (~80secs)
+const unsigned int NUM_DATA_TRIES=12;          // Resend data 12x before fail (~7mins)
 const unsigned int SEQ_LENGTH_MASK=0xFFFFFFFF; // Masks off first 32 bits
 
+// The MSS to assume when the peer's SYN has no MSS option (RFC 1122),
+// and the one we offer, what fits an Ethernet frame.  Path MTU discovery
+// (RFC 1191) never takes the path MTU below TCP_PMTU_MIN, so a forged
+// ICMP message cannot shrink segments to nothing.
 const unsigned int TCP_MAXIMUM_SEGMENT_SIZE=536;
+const unsigned int TCP_MSS_OFFER=ETHERNET_DATA_MAX-IP_HEADER_BASE_LENGTH-TCP_HEADER_BASE_LENGTH;
+const unsigned int TCP_PMTU_MIN=552;
+
+// Socket buffer sizes in bytes.  Unless set by SO_SNDBUF or SO_RCVBUF
+// they start at the default and grow with the bandwidth-delay product.
+const unsigned int TCP_BUFFER_MIN=4*TCP_MAXIMUM_SEGMENT_SIZE;
+const unsigned int TCP_BUFFER_DEFAULT=100*TCP_MAXIMUM_SEGMENT_SIZE;
+const unsigned int TCP_BUFFER_MAX=4*1024*1024;
+const unsigned int TCP_DUPACK_THRESHOLD=3;     // dup ACKs before fast retransmit
+
+// Retransmission timeout bounds in seconds (RFC 6298).  The minimum is
+// below the RFC's 1s, as most stacks have it, so a LAN loss costs little.
+const double TCP_RTO_INITIAL=1.0;
+const double TCP_RTO_MIN=0.2;
+const double TCP_RTO_MAX=60.0;
+const double TCP_CLOCK_GRANULARITY=0.001;      // of Time, and of timestamps
+
+// How long an ACK for in-order data may wait for a second segment or
+// data going the other way (RFC 1122 allows up to 500 ms).  MINET_DELAYED_ACK
+// sets it in milliseconds, 0 to ACK every segment at once.
+const double TCP_DELAYED_ACK_DEFAULT=0.040;
+const double TCP_DELAYED_ACK_MAX=0.5;
+
+// Sent as the bytes of a STATUS request, asks tcp_module for a TCPInfo
+// about the connection, in the data of its STATUS reply
+const unsigned int TCP_INFO_REQUEST=0xffffffff;
 
 const unsigned int NUM_TCP_STATES=13;
 
@@ -39,22 +77,124 @@ enum eState { CLOSED      = 0,
 	      FIN_WAIT2   = 11,
 	      TIME_WAIT   = 12 };
 
+// What STATUS reports about a connection; times in microseconds
+struct TCPInfo {
+  unsigned int state;
+  unsigned int srtt;
+  unsigned int rttvar;
+  unsigned int rto;
+  unsigned int backoff;
+  unsigned int cwnd;
+  unsigned int ssthresh;
+  unsigned int in_flight;
+  unsigned int sacked;
+  unsigned int queued;
+  unsigned int mss;
+  unsigned int pmtu;
+
+  std::ostream & Print(std::ostream &os) const;
+
+  friend std::ostream &operator<<(std::ostream &os, const TCPInfo& L) {
+    return L.Print(os);
+  }
+};
+
+// What an arriving ACK asks of the sender (see ProcessAck)
+enum eAckAction { ACK_OLD            = 0,   // nothing to do
+		  ACK_NEW            = 1,   // data acked, the window may have opened
+		  ACK_DUPLICATE      = 2,   // counted, send new data if the window allows
+		  ACK_RETRANSMIT     = 3 }; // resend the first unacked segment now
+
 
 class TCPState {
+ private:
+    void AdvanceScoreboard(unsigned int acked);
+    void UpdateMss();
+
  public:
     unsigned int stateOfcnx;
     unsigned int tmrTries;
+    unsigned int tmrTriesSet; // tmrTries as last set, for the backoff
 
     // Sender side
     unsigned int last_acked, last_sent;
-    unsigned short rwnd;
+    unsigned int rwnd;
     Buffer SendBuffer;
+    unsigned int send_buffer_size;
+    bool send_buffer_locked;
+    // TCP_NODELAY turns off Nagle's algorithm; TCP_CORK holds back
+    // anything short of a full segment until it is turned off again
+    bool nodelay;
+    bool cork;
+
+    // What the peer has SACKed, as start -> end offsets in the sent
+    // stream.  send_offset is the offset of last_acked+1, and
+    // retransmit_next is where NextRetransmission carries on from.
+    std::map<unsigned long long, unsigned long long> Scoreboard;
+    unsigned long long send_offset;
+    unsigned long long retransmit_next;
+
+    // Congestion control, and fast retransmit and recovery: recover is
+    // last_sent when recovery began, which must be acked to end it
+    CongestionControlPtr cc;
+    unsigned int dupacks;
+    bool in_recovery;
+    unsigned int recover;
+
+    // RTT estimation (RFC 6298).  Without timestamps one segment at a
+    // time is timed, ending at rtt_seq, and never one that was resent
+    // (Karn).  With them (RFC 7323) every ACK of new data is a sample.
+    double srtt, rttvar, rto;
+    bool rtt_valid;
+    bool rtt_timing;
+    unsigned int rtt_seq;
+    double rtt_start;
+    bool ts_ok;
+    unsigned int ts_recent;
 
     //Receiver side
     unsigned int last_recvd;
     Buffer RecvBuffer;
 
-    unsigned int TCP_BUFFER_SIZE; //Buffer size of SendBuffer and RecvBuffer
+    // Data that arrived ahead of a gap, keyed by its offset in the
+    // received stream, which unlike a sequence number never wraps.
+    // recv_offset is the offset of last_recvd+1.
+    std::map<unsigned long long, Buffer> ReassemblyQueue;
+    unsigned long long recv_offset;
+    size_t reassembly_bytes;
+    // where the newest queued data starts, the first SACK block reported
+    unsigned long long sack_recent;
+
+    // Both ends offered SACK (RFC 2018) on their SYNs
+    bool sack_permitted;
+
+    // Window scaling (RFC 7323): whether both SYNs carried the option,
+    // and the shifts of the peer's window fields and of ours, 0 unless
+    // they did
+    bool wscale_ok;
+    unsigned char snd_wscale, rcv_wscale;
+
+    // Delayed ACK: segments not yet acked and how many of them were full
+    // sized, and when the ACK is due.  delack_timeout 0 turns it off.
+    double delack_timeout;
+    unsigned int delack_segments;
+    unsigned int delack_full;
+    double delack_due;
+
+    // Segment sizes: the peer's MSS, and what we send, which is also
+    // within the path MTU.  rcv_mss is the largest segment we have had,
+    // up to our offer, for telling full-sized ones.
+    unsigned int peer_mss;
+    unsigned int pmtu;
+    unsigned int mss;
+    unsigned int rcv_mss;
+
+    // Receive buffer autotuning: what the socket took since rcv_space_start
+    bool recv_buffer_locked;
+    size_t rcv_space_bytes;
+    double rcv_space_start;
+
+    unsigned int TCP_BUFFER_SIZE; //Buffer size of RecvBuffer
     unsigned int N; //Window size
 
     TCPState();
@@ -79,6 +219,7 @@ class TCPState {
     inline void SetTimerTries(unsigned int numtries)
     {
       tmrTries = numtries;
+      tmrTriesSet = numtries;
     }
 
     bool ExpireTimerTries();
@@ -99,11 +240,175 @@ class TCPState {
       return last_sent;
     }
 
+    // The window field of an arriving segment
     inline void SetSendRwnd(unsigned short window)
     {
-      rwnd = window;
+      rwnd = (unsigned int)window << snd_wscale;
+    }
+
+    // Whether the peer's window is shut on data we hold with nothing in
+    // flight, so that only a window probe will learn when it opens
+    inline bool WindowShut()
+    {
+      return rwnd == 0 && last_sent == last_acked && SendBuffer.GetSize() > 0;
+    }
+
+    // The shift our SYN offers, enough for the largest buffer we allow,
+    // or for SO_RCVBUF if that was set before the SYN went
+    inline unsigned char GetWindowScaleOffer() const
+    {
+      return rcv_wscale;
+    }
+
+    inline bool IsWindowScaleOk() const
+    {
+      return wscale_ok;
+    }
+
+    // Once the peer's SYN is in: whether it had the option, and its shift
+    void NegotiateWindowScale(bool offered, unsigned char shift);
+    static unsigned char WindowScaleFor(unsigned int size);
+
+    // The window field to send, from the free space in RecvBuffer.  A SYN
+    // carries it unscaled.
+    unsigned short GetAdvertisedWindow(bool syn=false);
+
+    // Once the peer's SYN is in: whether it had the MSS option, and its value
+    void NegotiateMss(bool offered, unsigned short peer);
+
+    // An ICMP fragmentation needed message quoting a segment at seq:
+    // the next hop's MTU, or 0 if the router did not say, in which case
+    // the next plateau down is tried (RFC 1191).  Returns true if the
+    // segments in flight are now too big and should be sent again.
+    bool PathMtuReduced(unsigned int mtu, unsigned int seq);
+    inline unsigned int GetPathMtu() const
+    {
+      return pmtu;
+    }
+
+    // The data a full segment carries, less the timestamp option
+    inline unsigned int GetMss() const
+    {
+      return mss - (ts_ok ? 2 + TCP_HEADER_OPTION_KIND_TS_LEN : 0);
+    }
+
+    // What SendBuffer can still take
+    unsigned int GetSendSpace() const;
+
+    // Appends what fits of a write to SendBuffer; returns how much that was
+    size_t QueueSend(const Buffer &data);
+
+    // The next segment of new data to send from SendBuffer, if any: as
+    // much as the windows allow, up to a full segment.  A short one
+    // goes only if it is all that is queued and neither Nagle's
+    // algorithm (RFC 896, data still unacked) nor TCP_CORK holds it,
+    // or if it is window limited and nothing is in flight.  Call
+    // SetLastSent and SegmentSent once it is sent, then again.
+    bool NextSegment(unsigned int &seq, size_t &len);
+
+    // SO_SNDBUF and SO_RCVBUF, TCP_NODELAY and TCP_CORK, and
+    // TCP_QUICKACK to turn delayed ACKs off (or back on), from a
+    // SETSOCKOPT request or those sent with CONNECT and ACCEPT.  What
+    // TCP_CORK held is sendable once it is off.  Returns EOK, or
+    // ENOT_SUPPORTED for another option.  The SockOption form also
+    // takes TCP_CONGESTION, which starts the named algorithm afresh
+    // (see SetCongestionControl).
+    int SetSocketOption(int level, int name, int value);
+    int SetSocketOption(const SockOption &opt);
+
+    // Call for each data segment that arrives, with what ReceiveSegment
+    // gave for it.  Returns true if it must be acked now: it was out of
+    // order or filled a gap, it is the second full-sized segment since
+    // the last ACK, or delayed ACKs are off.  Otherwise the ACK is put
+    // off until GetDelayedAckDue.
+    bool SegmentReceived(size_t len, size_t delivered, double now);
+    // Call whenever a segment carrying an ACK goes out, data or not
+    void AckSent();
+    inline bool AckPending() const
+    {
+      return delack_segments > 0;
+    }
+
+    inline double GetDelayedAckDue() const
+    {
+      return delack_due;
+    }
+
+    inline void SetDelayedAck(double timeout)
+    {
+      delack_timeout = MIN_MACRO(MAX_MACRO(timeout, 0.0), TCP_DELAYED_ACK_MAX);
+    }
+
+    // MINET_DELAYED_ACK, or the default
+    static double DefaultDelayedAck();
+
+    // Call with what is handed to the socket: once per round trip the
+    // receive buffer grows to twice what went up in it, unless locked
+    void AutotuneReceive(size_t bytes, double now);
+
+    // By name, as MakeCongestionControl; false if there is no such one
+    bool SetCongestionControl(const char *name);
+    inline const CongestionControl &GetCongestionControl() const
+    {
+      return *cc;
+    }
+
+    inline unsigned int GetCwnd() const
+    {
+      return cc->GetCwnd();
+    }
+
+    inline bool InRecovery() const
+    {
+      return in_recovery;
+    }
+
+    // Called with each arriving ACK; maybedup is true if it could be a
+    // duplicate, ie, it carries no data, SYN or FIN and does not change
+    // the window.  Moves last_acked, counts duplicates and drives the
+    // congestion window through slow start, avoidance and recovery.
+    eAckAction ProcessAck(unsigned int ack, bool maybedup, double now);
+    // Called when the retransmission timer goes off
+    void RetransmitTimeout(double now);
+
+    // Call for every data segment sent, so one can be timed
+    void SegmentSent(unsigned int seq, size_t len, bool retransmission, double now);
+    void RttSample(double rtt);
+    // The timeout to arm the retransmission timer with: the estimate,
+    // doubled for each of the tries ExpireTimerTries has used up
+    double GetRto() const;
+    inline double GetSrtt() const
+    {
+      return srtt;
+    }
+
+    inline double GetRttvar() const
+    {
+      return rttvar;
+    }
+
+    // Timestamps (RFC 7323), if both SYNs had them.  TimestampNow is
+    // our clock for TSval; TimestampReceived takes the option of an
+    // arriving segment, and TimestampEcho what to send back as TSecr.
+    inline void SetTimestampsOk(bool ok)
+    {
+      ts_ok = ok;
+    }
+
+    inline bool TimestampsOk() const
+    {
+      return ts_ok;
+    }
+
+    static unsigned int TimestampNow(double now);
+    void TimestampReceived(unsigned int seq, unsigned int val, unsigned int ecr, bool newack, double now);
+    inline unsigned int TimestampEcho() const
+    {
+      return ts_recent;
     }
 
+    void GetInfo(TCPInfo &info) const;
+
     unsigned int GetRwnd();
 
     void SetLastRecvd(unsigned int lastrecvd);
@@ -113,13 +418,76 @@ class TCPState {
       return last_recvd;
     }
 
+    // Takes the data of a segment starting at seq, in order or not.
+    // Whatever is new and inside the receive window is kept.  If it fills
+    // the gap at last_recvd+1, it and any queued data it joins up with
+    // are appended to RecvBuffer and last_recvd moves past them.  Returns
+    // the number of bytes appended, ie, what can go to the socket now.
+    size_t ReceiveSegment(unsigned int seq, const Buffer &data);
+
+    inline bool HasReassemblyGap() const
+    {
+      return !ReassemblyQueue.empty();
+    }
+
+    inline size_t GetReassemblyBytes() const
+    {
+      return reassembly_bytes;
+    }
+
+    inline void SetSackPermitted(bool permitted)
+    {
+      sack_permitted = permitted;
+    }
+
+    inline bool IsSackPermitted() const
+    {
+      return sack_permitted;
+    }
+
+    // The runs of data held past the gap as SACK blocks, the one holding
+    // the newest segment first; returns how many were filled in
+    unsigned GetSackBlocks(TCPSackBlock *blocks, unsigned max) const;
+
+    // Records the blocks of an arriving ACK.  Blocks that are already
+    // covered by last_acked or go past what was sent are ignored.
+    void UpdateScoreboard(const TCPSackBlock *blocks, unsigned n);
+    // For when the peer reneges on what it SACKed
+    void ClearScoreboard();
+    size_t GetSackedBytes() const;
+
+    // After a timeout (or three duplicate ACKs), call
+    // RestartRetransmission and then NextRetransmission until it returns
+    // false: each call gives the next range of at most maxlen bytes that
+    // was sent but is neither acked nor SACKed, so only what is missing
+    // is sent again.  seq - (last_acked+1) is its offset in SendBuffer.
+    void RestartRetransmission();
+    bool NextRetransmission(unsigned int &seq, size_t &len, size_t maxlen);
+    // After a timeout, what was in flight then is lost: this is the next
+    // segment of it to send again, as far as the congestion window allows
+    // with what has already been resent and not yet acked.  Called again
+    // as ACKs open the window, until all of it has gone.
+    bool NextLostSegment(unsigned int &seq, size_t &len);
+
     void SendPacketPayload(unsigned &offsetlastsent, size_t &bytesize, unsigned bytes);
 
     std::ostream & Print(std::ostream &os) const { os <<"TCPState(stateOfcnx=" << stateOfcnx
 					  << ", last_acked=" << last_acked
 					  << ", last_sent=" << last_sent
 					  << ", rwnd=" << rwnd
+					  << ", wscale=" << (unsigned)snd_wscale << "/" << (unsigned)rcv_wscale
+					  << ", buffers=" << send_buffer_size << "/" << TCP_BUFFER_SIZE
 					  << ", last_recvd=" << last_recvd
+					  << ", queued=" << reassembly_bytes
+					  << ", sack=" << (sack_permitted ? "on" : "off")
+					  << ", mss=" << mss << "/" << pmtu
+					  << ", delack=" << delack_timeout
+					  << (nodelay ? ", nodelay" : "")
+					  << (cork ? ", corked" : "")
+					  << ", " << *cc
+					  << (in_recovery ? ", recovering" : "")
+					  << ", srtt=" << srtt
+					  << ", rto=" << GetRto()
 					  << ")"; return os;}
 
    friend std::ostream &operator<<(std::ostream &os, const TCPState& L) {
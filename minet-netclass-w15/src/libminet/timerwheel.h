@@ -0,0 +1,322 @@
+#ifndef _timerwheel
+#define _timerwheel
+
+#include <vector>
+#include <stdint.h>
+#include <sys/time.h>
+
+//
+// Hierarchical timing wheel.
+//
+// Four wheels of 256 slots each cover 2^32 ticks (about 50 days at the
+// default 1 ms tick).  A timer sits in the wheel matching how far away
+// it is and drops to a finer wheel when the finer wheel comes round to
+// its block, so arming and cancelling are O(1) and expiring costs only
+// the timers that fire plus an occasional cascade.
+//
+// Timers are identified by a TimerHandle.  Handles carry a generation
+// count, so cancelling a timer that already fired or was cancelled is
+// harmless.  The payload T is handed back when the timer fires.  Times
+// are in seconds, as given by (double)Time.
+//
+
+typedef uint64_t TimerHandle;
+#define TIMER_NONE ((TimerHandle)0)
+
+#define TIMERWHEEL_LEVELS 4
+#define TIMERWHEEL_BITS   8
+#define TIMERWHEEL_SLOTS  (1<<TIMERWHEEL_BITS)
+#define TIMERWHEEL_MASK   (TIMERWHEEL_SLOTS-1)
+#define TIMERWHEEL_NIL    0xffffffff
+
+template <class T>
+class TimerWheel {
+ private:
+  struct Entry {
+    uint64_t expires;  // tick
+    uint32_t gen;      // odd while armed
+    uint32_t next, prev;
+    uint16_t slot;     // level*TIMERWHEEL_SLOTS+index
+    T        data;
+  };
+
+  std::vector<Entry> entries;
+  uint32_t           freelist;
+  uint32_t           head[TIMERWHEEL_LEVELS*TIMERWHEEL_SLOTS];
+  uint64_t           occupied[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS/64];
+  uint64_t           cur;       // next tick to be processed
+  bool               overdue;   // armed in the past since the last Expire
+  unsigned           count;
+  double             origin;
+  double             resolution;
+
+  uint64_t ToTick(const double t, const bool roundup) const {
+    double d=(t-origin)/resolution;
+    if (d<=0) {
+      return 0;
+    }
+    uint64_t tick=(uint64_t)d;
+    if (roundup && (double)tick<d) {
+      tick++;
+    }
+    return tick;
+  }
+
+  double ToTime(const uint64_t tick) const {
+    return origin+(double)tick*resolution;
+  }
+
+  void Link(const uint32_t i) {
+    Entry &e=entries[i];
+    uint64_t exp = e.expires<cur ? cur : e.expires;
+    uint64_t delta=exp-cur;
+    unsigned level=0;
+
+    // clamp timers beyond the outermost wheel
+    if (delta>=((uint64_t)1<<(TIMERWHEEL_LEVELS*TIMERWHEEL_BITS))) {
+      exp=cur+((uint64_t)1<<(TIMERWHEEL_LEVELS*TIMERWHEEL_BITS))-1;
+      delta=exp-cur;
+    }
+    while (level<TIMERWHEEL_LEVELS-1 && delta>=((uint64_t)1<<((level+1)*TIMERWHEEL_BITS))) {
+      level++;
+    }
+    unsigned index=(exp>>(level*TIMERWHEEL_BITS))&TIMERWHEEL_MASK;
+    unsigned s=level*TIMERWHEEL_SLOTS+index;
+
+    e.slot=s;
+    e.prev=TIMERWHEEL_NIL;
+    e.next=head[s];
+    if (head[s]!=TIMERWHEEL_NIL) {
+      entries[head[s]].prev=i;
+    }
+    head[s]=i;
+    occupied[level][index/64]|=(uint64_t)1<<(index%64);
+  }
+
+  void Unlink(const uint32_t i) {
+    Entry &e=entries[i];
+    unsigned s=e.slot;
+    if (e.prev!=TIMERWHEEL_NIL) {
+      entries[e.prev].next=e.next;
+    } else {
+      head[s]=e.next;
+    }
+    if (e.next!=TIMERWHEEL_NIL) {
+      entries[e.next].prev=e.prev;
+    }
+    if (head[s]==TIMERWHEEL_NIL) {
+      unsigned index=s%TIMERWHEEL_SLOTS;
+      occupied[s/TIMERWHEEL_SLOTS][index/64]&=~((uint64_t)1<<(index%64));
+    }
+  }
+
+  void Release(const uint32_t i) {
+    entries[i].gen++;
+    entries[i].data=T();
+    entries[i].next=freelist;
+    freelist=i;
+    count--;
+  }
+
+  // Redistribute one slot of a coarse wheel into the finer ones
+  void Cascade(const unsigned level, const unsigned index) {
+    unsigned s=level*TIMERWHEEL_SLOTS+index;
+    uint32_t i=head[s];
+    head[s]=TIMERWHEEL_NIL;
+    occupied[level][index/64]&=~((uint64_t)1<<(index%64));
+    while (i!=TIMERWHEEL_NIL) {
+      uint32_t next=entries[i].next;
+      Link(i);
+      i=next;
+    }
+  }
+
+  bool LevelEmpty(const unsigned level) const {
+    for (unsigned w=0;w<TIMERWHEEL_SLOTS/64;w++) {
+      if (occupied[level][w]) {
+	return false;
+      }
+    }
+    return true;
+  }
+
+  // Distance in slots from index to the next occupied slot of level,
+  // or TIMERWHEEL_SLOTS if there is none
+  unsigned NextOccupied(const unsigned level, const unsigned index) const {
+    for (unsigned d=0;d<TIMERWHEEL_SLOTS;) {
+      unsigned s=(index+d)&TIMERWHEEL_MASK;
+      uint64_t bits=occupied[level][s/64]>>(s%64);
+      if (bits) {
+	d+=__builtin_ctzll(bits);
+	return d<TIMERWHEEL_SLOTS ? d : TIMERWHEEL_SLOTS;
+      }
+      d+=64-(s%64);
+    }
+    return TIMERWHEEL_SLOTS;
+  }
+
+  TimerWheel(const TimerWheel &rhs);
+  TimerWheel &operator=(const TimerWheel &rhs);
+
+ public:
+  TimerWheel(const double res=0.001) :
+    freelist(TIMERWHEEL_NIL), cur(0), overdue(false), count(0), resolution(res)
+  {
+    struct timeval now;
+    gettimeofday(&now,0);
+    origin=(double)now.tv_sec+(double)now.tv_usec/1e6;
+    for (unsigned s=0;s<TIMERWHEEL_LEVELS*TIMERWHEEL_SLOTS;s++) {
+      head[s]=TIMERWHEEL_NIL;
+    }
+    for (unsigned l=0;l<TIMERWHEEL_LEVELS;l++) {
+      for (unsigned w=0;w<TIMERWHEEL_SLOTS/64;w++) {
+	occupied[l][w]=0;
+      }
+    }
+  }
+
+  unsigned size() const { return count; }
+  bool     empty() const { return count==0; }
+
+  TimerHandle Arm(const double when, const T &data) {
+    uint32_t i;
+    if (freelist!=TIMERWHEEL_NIL) {
+      i=freelist;
+      freelist=entries[i].next;
+    } else {
+      i=entries.size();
+      entries.push_back(Entry());
+      entries[i].gen=0;
+    }
+    Entry &e=entries[i];
+    e.gen++;
+    e.expires=ToTick(when,true);
+    e.data=data;
+    count++;
+    if (e.expires<cur) {
+      overdue=true;
+    }
+    Link(i);
+    return ((TimerHandle)e.gen<<32) | i;
+  }
+
+  bool IsArmed(const TimerHandle h) const {
+    uint32_t i=(uint32_t)h;
+    return h!=TIMER_NONE && i<entries.size() && entries[i].gen==(uint32_t)(h>>32);
+  }
+
+  // Returns false if the timer had already fired or been cancelled
+  bool Cancel(const TimerHandle h) {
+    if (!IsArmed(h)) {
+      return false;
+    }
+    Unlink((uint32_t)h);
+    Release((uint32_t)h);
+    return true;
+  }
+
+  // Fire every timer due at or before now.  Payloads are appended to
+  // fired in deadline order, to within a tick.  Returns how many fired.
+  unsigned Expire(const double now, std::vector<T> &fired) {
+    uint64_t target=ToTick(now,false);
+    unsigned n=0;
+
+    if (count==0) {
+      if (cur<=target) {
+	cur=target+1;
+      }
+      return 0;
+    }
+    // timers armed in the past wait in the current slot; fire them now
+    // rather than a tick later
+    if (overdue && target<cur) {
+      unsigned index=cur&TIMERWHEEL_MASK;
+      uint32_t i=head[index];
+      while (i!=TIMERWHEEL_NIL) {
+	uint32_t next=entries[i].next;
+	if (entries[i].expires<cur) {
+	  fired.push_back(entries[i].data);
+	  Unlink(i);
+	  Release(i);
+	  n++;
+	}
+	i=next;
+      }
+    }
+    overdue=false;
+    while (cur<=target) {
+      unsigned index=cur&TIMERWHEEL_MASK;
+      if (index==0) {
+	for (unsigned l=1;l<TIMERWHEEL_LEVELS;l++) {
+	  unsigned li=(cur>>(l*TIMERWHEEL_BITS))&TIMERWHEEL_MASK;
+	  Cascade(l,li);
+	  if (li!=0) {
+	    break;
+	  }
+	}
+      }
+      uint32_t i=head[index];
+      head[index]=TIMERWHEEL_NIL;
+      occupied[0][index/64]&=~((uint64_t)1<<(index%64));
+      while (i!=TIMERWHEEL_NIL) {
+	uint32_t next=entries[i].next;
+	fired.push_back(entries[i].data);
+	Release(i);
+	n++;
+	i=next;
+      }
+      cur++;
+      // nothing left in the finest wheel for this turn, so skip to the
+      // next cascade point
+      if ((cur&TIMERWHEEL_MASK)!=0 && LevelEmpty(0)) {
+	uint64_t next=(cur|TIMERWHEEL_MASK)+1;
+	cur = next<=target ? next : target+1;
+      }
+    }
+    return n;
+  }
+
+  // Earliest time at which Expire might fire something.  Exact for
+  // timers in the finest wheel, otherwise the start of the block they
+  // are waiting in.  Returns false if no timers are armed.
+  bool NextDeadline(double &when) const {
+    if (count==0) {
+      return false;
+    }
+    uint64_t best=~(uint64_t)0;
+    unsigned d=NextOccupied(0,cur&TIMERWHEEL_MASK);
+    if (d<TIMERWHEEL_SLOTS) {
+      best=cur+d;
+    }
+    for (unsigned l=1;l<TIMERWHEEL_LEVELS;l++) {
+      uint64_t block=cur>>(l*TIMERWHEEL_BITS);
+      // once cur has moved into a block its slot has been cascaded, and
+      // anything in it belongs to the next time round
+      if (cur&((((uint64_t)1)<<(l*TIMERWHEEL_BITS))-1)) {
+	block++;
+      }
+      d=NextOccupied(l,block&TIMERWHEEL_MASK);
+      if (d<TIMERWHEEL_SLOTS) {
+	uint64_t t=(block+d)<<(l*TIMERWHEEL_BITS);
+	if (t<best) {
+	  best=t;
+	}
+      }
+    }
+    when=ToTime(best);
+    return true;
+  }
+
+  // Timeout to hand to MinetGetNextEvent: seconds until the next
+  // deadline, or -1 (wait forever) if nothing is armed
+  double TimeUntilNext(const double now) const {
+    double when;
+    if (!NextDeadline(when)) {
+      return -1;
+    }
+    double left=when-now;
+    return left>0 ? left : 0;
+  }
+};
+
+#endif
@@ -2,6 +2,8 @@
 
 #include <netinet/in.h>
 
+#include "checksum.h"
+
 
 UDPHeader::UDPHeader() : Header(Headers::UDPHeader)
 {
@@ -39,8 +41,7 @@ void UDPHeader::GetSourcePort(unsigned short &port) const
 void UDPHeader::SetSourcePort(const unsigned short &port, const Packet &p)
 {
   unsigned short pt=htons(port);
-  SetData((char*)&pt,2,0);
-  RecomputeChecksum(p);
+  SetField((char*)&pt,2,0,p);
 }
 
 void UDPHeader::GetDestPort(unsigned short &port) const
@@ -52,8 +53,7 @@ void UDPHeader::GetDestPort(unsigned short &port) const
 void UDPHeader::SetDestPort(const unsigned short &port, const Packet &p)
 {
   unsigned short pt=htons(port);
-  SetData((char*)&pt,2,2);
-  RecomputeChecksum(p);
+  SetField((char*)&pt,2,2,p);
 }
 
 
@@ -67,13 +67,13 @@ void UDPHeader::SetLength(const unsigned short &len, const Packet &p)
 {
   unsigned short l=htons(len);
   SetData((char*)&l,2,4);
-  RecomputeChecksum(p);
+  FieldChanged(p);
 }
 
 unsigned short UDPHeader::ComputeChecksum(const Packet &p) const
 {
   // assumes we DO have an IP header in the packet already
-  IPHeader iph= (IPHeader &) p.FindHeader(Headers::IPHeader);
+  IPHeader iph=p.FindHeader(Headers::IPHeader);
   IPAddress srcip, destip;
   unsigned char proto;
 
@@ -81,27 +81,24 @@ unsigned short UDPHeader::ComputeChecksum(const Packet &p) const
   iph.GetDestIP(destip); destip=htonl(destip);
   iph.GetProtocol(proto);
 
-  unsigned short len, buflen;
+  unsigned short len;
 
   GetLength(len);
 
-  buflen=((12+len)+(len%2?1:0))/2;
-
-  unsigned short buf[buflen];
-
-  memset((char*)buf,0,2*buflen);
-
-  memcpy((char*)buf,&srcip,4);
-  memcpy((char*)(buf+2),&destip,4);
-  buf[4]= htons((unsigned short)proto);
-  buf[5]= htons(len);
+  unsigned short pseudo[6];
 
-  GetData((char*)&(buf[6]),UDP_HEADER_LENGTH,0);
+  memcpy((char*)pseudo,&srcip,4);
+  memcpy((char*)(pseudo+2),&destip,4);
+  pseudo[4]= htons((unsigned short)proto);
+  pseudo[5]= htons(len);
 
-  //YUCK
-  ((Packet&)p).GetPayload().GetData((char*)(buf+10),len-UDP_HEADER_LENGTH,0);
+  unsigned sum=ChecksumAdd(pseudo,12);
+  sum=ChecksumAdd(*this,0,UDP_HEADER_LENGTH,12,sum);
+  if (len>UDP_HEADER_LENGTH) {
+    sum=ChecksumAdd(p.GetPayload(),0,len-UDP_HEADER_LENGTH,12+UDP_HEADER_LENGTH,sum);
+  }
 
-  return ~(OnesComplementSum(buf,buflen));
+  return ntohs(ChecksumFinish(sum));
 }
 
 
@@ -130,6 +127,40 @@ void UDPHeader::RecomputeChecksum(const Packet &p)
 }
 
 
+// The setters call this: either the checksum is brought up to date now,
+// or, in deferred mode, p computes it once when it is serialized
+void UDPHeader::FieldChanged(const Packet &p)
+{
+  if (ChecksumIsDeferred()) {
+    p.MarkChecksumsPending();
+  } else {
+    RecomputeChecksum(p);
+  }
+}
+
+// Writes a port and brings the checksum up to date, by patching it for
+// the word that changed (RFC 1624) once the header has one.  A zero
+// checksum means none, so that is computed in full; so is a change of
+// length, which changes what the checksum covers.
+void UDPHeader::SetField(const char *data, const unsigned len, const unsigned offset, const Packet &p)
+{
+  unsigned short check=0, before, after;
+
+  if (GetSize()>=UDP_HEADER_LENGTH) {
+    GetData((char*)&check,2,6);
+  }
+  if (ChecksumIsDeferred() || check==0 || (offset&1) || len!=2) {
+    SetData(data,len,offset);
+    FieldChanged(p);
+    return;
+  }
+  GetData((char*)&before,2,offset);
+  SetData(data,len,offset);
+  GetData((char*)&after,2,offset);
+  check=ChecksumUpdate16(check,before,after);
+  SetData((char*)&check,2,6);
+}
+
 void UDPHeader::GetChecksum(unsigned short &checksum) const
 {
   GetData((char*)&checksum,2,6);
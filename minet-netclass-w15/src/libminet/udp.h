@@ -18,6 +18,10 @@ const unsigned int UDP_HEADER_LENGTH=8;
 const unsigned int UDP_MAX_DATA = IP_PACKET_MAX_LENGTH-IP_HEADER_BASE_LENGTH-UDP_HEADER_LENGTH;
 
 class UDPHeader : public Header {
+ private:
+  void FieldChanged(const Packet &p);
+  void SetField(const char *data, const unsigned len, const unsigned offset, const Packet &p);
+
  public:
   UDPHeader();
   UDPHeader(const UDPHeader &rhs);
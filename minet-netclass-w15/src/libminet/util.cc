@@ -1,6 +1,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include "util.h"
+#include "shmring.h"
+#include "checksum.h"
 #include <ctype.h> 
 #include <netinet/in.h>
 
@@ -10,6 +12,11 @@ int readall(const int fd, char *buf, const int len, const int oneshot, const int
 {
   int rc;
   int left;
+  ShmRing *ring;
+
+  if ((ring=ShmRingForFD(fd))) {
+    return ring->Read(buf,len);
+  }
 
   left=len;
   while (left>0) {
@@ -40,6 +47,11 @@ int writeall(const int fd, const char *buf, const int len, const int oneshot, co
 {
   int rc;
   int left;
+  ShmRing *ring;
+
+  if ((ring=ShmRingForFD(fd))) {
+    return ring->Write(buf,len);
+  }
 
   left=len;
   while (left>0) {
@@ -65,6 +77,52 @@ int writeall(const int fd, const char *buf, const int len, const int oneshot, co
   return len;
 }
 
+// Gathered write of all of iov.  The iovec array is consumed in place
+// across short writes.  Returns the number of bytes written, or <0 on error.
+int writevall(const int fd, struct iovec *iov, int iovcnt)
+{
+  int rc;
+  int done=0;
+  ShmRing *ring;
+
+  if ((ring=ShmRingForFD(fd))) {
+    for (;iovcnt>0;iov++,iovcnt--) {
+      if ((rc=ring->Write((const char*)iov->iov_base,iov->iov_len))!=(int)iov->iov_len) {
+	return done+rc;
+      }
+      done+=rc;
+    }
+    return done;
+  }
+
+  while (iovcnt>0) {
+    if (iov->iov_len==0) {
+      iov++; iovcnt--;
+      continue;
+    }
+    rc=writev(fd,iov,iovcnt);
+    if (rc<0) {
+      if (errno==EINTR || errno==EWOULDBLOCK) {
+	continue;
+      }
+      return rc;
+    }
+    if (rc==0) {
+      return done;
+    }
+    done+=rc;
+    while (iovcnt>0 && (size_t)rc>=iov->iov_len) {
+      rc-=iov->iov_len;
+      iov++; iovcnt--;
+    }
+    if (iovcnt>0) {
+      iov->iov_base=(char*)iov->iov_base+rc;
+      iov->iov_len-=rc;
+    }
+  }
+  return done;
+}
+
 
 void printhexnybble(FILE *out,const char lower)
 {
@@ -249,23 +307,8 @@ bool WaitForWrite(const int fd)
 }
 
 
+// len is in 16 bit words; the sum is returned in host order
 unsigned short OnesComplementSum(unsigned short *buf, int len)
 {
-  unsigned int sum, sum2, sum3;
-  unsigned short realsum;
-  int i;
-
-  sum=0;
-  for (i=0;i<len;i++) {
-    sum+=ntohs(buf[i]);
-  }
-  // assume there is no carry out, so now...
-
-  sum2 = (sum&0x0000ffff) + ((sum&0xffff0000)>>16);
-
-  sum3 = (sum2&0x0000ffff) +((sum2&0xffff0000)>>16);
-
-  realsum=sum3;
-
-  return realsum;
+  return ntohs(ChecksumFold(ChecksumAdd(buf,2*len)));
 }  
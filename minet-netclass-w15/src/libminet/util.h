@@ -3,6 +3,7 @@
 
 #include <cstdio>
 #include <functional>
+#include <sys/uio.h>
 
 //template <class T>
 //std::ostream & operator << (std::ostream & os, const T &obj)
@@ -12,6 +13,7 @@
 
 int readall(const int fd, char *buf, const int len, const int oneshot=0, const int awaitblock=1);
 int writeall(const int fd, const char *buf, const int len, const int oneshot=0, const int awaitblock=1);
+int writevall(const int fd, struct iovec *iov, int iovcnt);
 
 void printhexnybble(FILE *out,const char lower);
 void printhexbyte(FILE *out,const char h);
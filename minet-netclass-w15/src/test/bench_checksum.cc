@@ -0,0 +1,230 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "Minet.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks every checksum kernel against a plain 16-bit-at-a-time sum,
+// including odd lengths, odd offsets and buffers split into slices, and
+// checks RFC 1624 updates, the IP, TCP and UDP setters that use them,
+// and deferred TCP checksums against full recomputation.  Then times
+// the kernels for payloads of 64 bytes to 9 KB, and building a TCP
+// segment with its setters, with the checksum recomputed by each setter
+// and deferred to serialization.
+//
+// usage: bench_checksum [bytes-per-size]
+// (MINET_IPADDR must be set, as for any module)
+//
+
+static unsigned Random32()
+{
+  return ((unsigned)rand()<<16) ^ (unsigned)rand();
+}
+
+// The way it was always done
+static unsigned short Reference(const unsigned char *p, size_t len)
+{
+  unsigned sum=0;
+  for (size_t i=0;i<len;i+=2) {
+    sum+=(p[i]<<8) + (i+1<len ? p[i+1] : 0);
+    sum=(sum&0xffff)+(sum>>16);
+  }
+  return htons((unsigned short)sum);
+}
+
+static Packet Segment(const Buffer &data, const unsigned seq)
+{
+  Packet p(data);
+  IPHeader ih;
+  ih.SetProtocol(IP_PROTO_TCP);
+  ih.SetSourceIP(IPAddress("10.0.0.1"));
+  ih.SetDestIP(IPAddress("10.0.0.2"));
+  ih.SetTotalLength(data.GetSize()+TCP_HEADER_BASE_LENGTH+IP_HEADER_BASE_LENGTH);
+  p.PushFrontHeader(ih);
+  TCPHeader th;
+  th.SetSourcePort(5050,p);
+  th.SetDestPort(80,p);
+  th.SetHeaderLen(TCP_HEADER_BASE_LENGTH/4,p);
+  th.SetSeqNum(seq,p);
+  th.SetAckNum(seq*7,p);
+  th.SetFlags(16,p);
+  th.SetWinSize(8192,p);
+  th.SetUrgentPtr(0,p);
+  p.PushBackHeader(th);
+  return p;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t total = argc>1 ? atol(argv[1]) : 200000000;
+  const ChecksumImpl impls[] = { CHECKSUM_GENERIC, CHECKSUM_SSE2, CHECKSUM_AVX2 };
+  const size_t sizes[] = { 64, 256, 576, 1500, 4096, 9000 };
+  std::vector<unsigned char> data(9000+64);
+
+  srand(1);
+  for (size_t i=0;i<data.size();i++) {
+    data[i]=rand();
+  }
+
+  ChecksumImpl best=ChecksumGetImpl();
+  for (unsigned k=0;k<3;k++) {
+    if (!ChecksumSetImpl(impls[k])) {
+      continue;
+    }
+    for (int r=0;r<20000;r++) {
+      size_t off=rand()%64, len=rand()%(r<10000 ? 200 : 9000);
+      Check(ChecksumFold(ChecksumAdd(&data[off],len))==Reference(&data[off],len),"wrong sum");
+
+      // the same bytes in pieces, as a Buffer
+      Buffer b;
+      size_t done=0;
+      while (done<len) {
+	size_t n=1+rand()%(len-done);
+	b.AddBack(Buffer((const char *)&data[off+done],n));
+	done+=n;
+      }
+      Check(ChecksumFold(ChecksumAdd(b,0,len,0))==Reference(&data[off],len),"wrong sum over slices");
+      if (len>3) {
+	size_t skip=1+rand()%3;
+	unsigned s=ChecksumAdd(&data[off],skip);
+	Check(ChecksumFold(ChecksumAdd(b,skip,len-skip,skip,s))==Reference(&data[off],len),"wrong sum at an odd offset");
+      }
+    }
+  }
+  ChecksumSetImpl(best);
+
+  // incremental updates
+  for (int r=0;r<100000;r++) {
+    unsigned char buf[20];
+    memcpy(buf,&data[r%1000],20);
+    unsigned short check=ChecksumFinish(ChecksumAdd(buf,20));
+    unsigned at=(rand()%5)*4, neww=Random32(), oldw;
+    memcpy(&oldw,buf+at,4);
+    memcpy(buf+at,&neww,4);
+    Check(ChecksumUpdate32(check,oldw,neww)==ChecksumFinish(ChecksumAdd(buf,20)),"wrong incremental update");
+  }
+  {
+    IPHeader ih;
+    for (int r=0;r<1000;r++) {
+      ih.SetTTL(rand());
+      ih.SetID(rand());
+      ih.SetSourceIP(IPAddress(Random32()));
+      Check(ih.IsChecksumCorrect(),"IP header checksum wrong after a setter");
+    }
+  }
+
+  // TCP and UDP setters on a segment that already has its checksum
+  for (int r=0;r<1000;r++) {
+    Buffer b((const char *)&data[r%64],rand()%1460);
+    Packet p=Segment(b,r);
+    TCPHeader th=p.FindHeader(Headers::TCPHeader);
+    th.SetSeqNum(Random32(),p);
+    th.SetAckNum(Random32(),p);
+    th.SetFlags(rand(),p);
+    th.SetWinSize(rand(),p);
+    th.SetSourcePort(rand(),p);
+    th.SetUrgentPtr(rand(),p);
+    unsigned short c, full;
+    th.GetChecksum(c);
+    th.RecomputeChecksum(p);
+    th.GetChecksum(full);
+    Check(c==full,"TCP checksum wrong after a setter");
+
+    Packet u(b);
+    IPHeader ih;
+    ih.SetProtocol(IP_PROTO_UDP);
+    ih.SetSourceIP(IPAddress(Random32()));
+    ih.SetDestIP(IPAddress(Random32()));
+    ih.SetTotalLength(IP_HEADER_BASE_LENGTH+UDP_HEADER_LENGTH+b.GetSize());
+    u.PushFrontHeader(ih);
+    UDPHeader uh;
+    uh.SetLength(UDP_HEADER_LENGTH+b.GetSize(),u);
+    uh.SetSourcePort(rand(),u);
+    uh.SetDestPort(rand(),u);
+    uh.GetChecksum(c);
+    uh.RecomputeChecksum(u);
+    uh.GetChecksum(full);
+    Check(c==full,"UDP checksum wrong after a setter");
+  }
+
+  // deferred checksums come out the same as immediate ones
+  for (int r=0;r<1000;r++) {
+    Buffer b((const char *)&data[r%64],rand()%1460);
+    Packet now=Segment(b,r);
+    ChecksumSetDeferred(true);
+    Packet later=Segment(b,r);
+    ChecksumSetDeferred(false);
+    Check(later.ChecksumsPending(),"deferred packet not marked");
+    later.FinalizeChecksums();
+    TCPHeader a=now.FindHeader(Headers::TCPHeader), c=later.FindHeader(Headers::TCPHeader);
+    unsigned short ca, cc;
+    a.GetChecksum(ca);
+    c.GetChecksum(cc);
+    Check(ca==cc && a.IsCorrectChecksum(now),"deferred checksum differs");
+  }
+  cout << "bench_checksum: ok, fastest kernel is " << ChecksumImplName(best) << endl;
+
+  cout << "bytes   reference(GB/s)";
+  for (unsigned k=0;k<3;k++) {
+    cout.width(10); cout << ChecksumImplName(impls[k]) << "(GB/s)";
+  }
+  cout << endl;
+  unsigned sink=0;
+  for (unsigned s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++) {
+    size_t reps=total/sizes[s];
+    cout.width(5); cout << sizes[s];
+    double start=Now();
+    for (size_t r=0;r<reps;r++) {
+      sink+=Reference(&data[r&31],sizes[s]);
+    }
+    cout.width(18); cout << reps*sizes[s]/(Now()-start)/1e9;
+    for (unsigned k=0;k<3;k++) {
+      if (!ChecksumSetImpl(impls[k])) {
+	cout.width(16); cout << "-";
+	continue;
+      }
+      start=Now();
+      for (size_t r=0;r<reps;r++) {
+	sink+=ChecksumAdd(&data[r&31],sizes[s]);
+      }
+      cout.width(16); cout << reps*sizes[s]/(Now()-start)/1e9;
+    }
+    cout << endl;
+  }
+  ChecksumSetImpl(best);
+
+  cout << "bytes   segment, per setter(us)   segment, deferred(us)" << endl;
+  for (unsigned s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++) {
+    Buffer b((const char *)&data[0],sizes[s]);
+    size_t reps=total/100/sizes[s]+100;
+    double t[2];
+    for (int deferred=0;deferred<2;deferred++) {
+      ChecksumSetDeferred(deferred);
+      double start=Now();
+      for (size_t r=0;r<reps;r++) {
+	Packet p=Segment(b,r);
+	if (p.ChecksumsPending()) {
+	  p.FinalizeChecksums();
+	}
+	TCPHeader th=p.FindHeader(Headers::TCPHeader);
+	unsigned short c;
+	th.GetChecksum(c);
+	sink+=c;
+      }
+      t[deferred]=(Now()-start)/reps*1e6;
+    }
+    ChecksumSetDeferred(false);
+    cout.width(5); cout << sizes[s];
+    cout.width(26); cout << t[0];
+    cout.width(24); cout << t[1] << endl;
+  }
+  return sink==1 ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <stdlib.h>
+
+#include "Minet.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Demultiplexing benchmark for ConnectionList.  For each connection
+// count it fills a list with that many established connections to a
+// few server ports plus a listener on each port, then times FindMatching
+// on segments for established connections and on SYNs that only the
+// listeners match.  The same lookups are run through a linear scan of a
+// deque, the way ConnectionList used to work, as a reference (skipped
+// for the largest counts, where it takes too long).
+//
+// usage: bench_demux [max-connections] [lookups]
+// (MINET_IPADDR must be set, as for any module)
+//
+
+struct DummyState {
+  int n;
+  DummyState() : n(0) {}
+  friend std::ostream &operator<<(std::ostream &os, const DummyState &s) { return os; }
+};
+
+#define PORTS 4
+
+// Remote end of the i-th connection, the way a busy server sees them
+static Connection Remote(const unsigned i, const unsigned short port)
+{
+  return Connection(IPAddress("10.0.0.1"),
+		    IPAddress(0xc0a80000U + (i/50000)*256 + (i%250) + 1),
+		    port,
+		    1024 + (i%50000),
+		    IP_PROTO_TCP);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned maxconns = argc>1 ? atoi(argv[1]) : 100000;
+  unsigned lookups  = argc>2 ? atoi(argv[2]) : 1000000;
+  unsigned short ports[PORTS] = { 80, 443, 8080, 25 };
+
+  cout << "connections   established(ns)   listener(ns)   linear established(ns)" << endl;
+
+  for (unsigned n=10; n<=maxconns; n*=10) {
+    ConnectionList<DummyState> clist;
+    std::deque<ConnectionToStateMapping<DummyState> > linear;
+    std::vector<Connection> conns;
+
+    for (unsigned p=0;p<PORTS;p++) {
+      ConnectionToStateMapping<DummyState> m;
+      m.connection=Connection(IPAddress("10.0.0.1"),IP_ADDRESS_ANY,ports[p],PORT_ANY,IP_PROTO_TCP);
+      clist.push_back(m);
+      linear.push_back(m);
+    }
+    for (unsigned i=0;i<n;i++) {
+      ConnectionToStateMapping<DummyState> m;
+      m.connection=Remote(i,ports[i%PORTS]);
+      m.state.n=i;
+      // established connections go in front of the listeners, as a
+      // module that accepts would put them
+      clist.push_front(m);
+      linear.push_front(m);
+      conns.push_back(m.connection);
+    }
+
+    srand(n);
+    std::vector<unsigned> which(lookups);
+    for (unsigned k=0;k<lookups;k++) {
+      which[k]=rand()%n;
+    }
+
+    unsigned bad=0;
+    double start=Now();
+    for (unsigned k=0;k<lookups;k++) {
+      ConnectionList<DummyState>::iterator i=clist.FindMatching(conns[which[k]]);
+      if (i==clist.end() || (*i).state.n!=(int)which[k]) {
+	bad++;
+      }
+    }
+    double est=(Now()-start)/lookups*1e9;
+
+    start=Now();
+    for (unsigned k=0;k<lookups;k++) {
+      // a SYN from somebody new
+      Connection c=Remote(n+which[k],ports[k%PORTS]);
+      ConnectionList<DummyState>::iterator i=clist.FindMatching(c);
+      if (i==clist.end() || (*i).connection.srcport!=ports[k%PORTS] || (*i).connection.destport!=PORT_ANY) {
+	bad++;
+      }
+    }
+    double lis=(Now()-start)/lookups*1e9;
+
+    double lin=-1;
+    if (n<=10000) {
+      unsigned reps=lookups/(n/10+1)+1;
+      start=Now();
+      for (unsigned k=0;k<reps;k++) {
+	const Connection &c=conns[which[k]];
+	std::deque<ConnectionToStateMapping<DummyState> >::iterator i;
+	for (i=linear.begin(); i!=linear.end() && !(*i).Matches(c); ++i) {
+	}
+	if (i==linear.end() || (*i).state.n!=(int)which[k]) {
+	  bad++;
+	}
+      }
+      lin=(Now()-start)/reps*1e9;
+    }
+
+    if (bad) {
+      cerr << "bench_demux: " << bad << " wrong lookups with " << n << " connections" << endl;
+      exit(-1);
+    }
+    cout.width(11); cout << n;
+    cout.width(18); cout << est;
+    cout.width(15); cout << lis;
+    if (lin>=0) {
+      cout.width(25); cout << lin;
+    } else {
+      cout.width(25); cout << "-";
+    }
+    cout << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,247 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Minet.h"
+#include "route.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks ForwardingTable: next hops resolving and going away, host
+// routes for neighbors on a connected net surviving route changes, and
+// frames forwarded in place coming out with the next hop's Ethernet
+// header, one less TTL and a correct checksum, the same bytes the
+// Packet path makes of them.  Then times forwarding a pool of frames
+// through a table of random routes, in place and the way ip_module_routing
+// used to (parse into a Packet, look up the route, then the neighbor,
+// build headers and serialize), and reports packets per second.
+//
+// usage: bench_forward [routes] [packets]
+// (MINET_IPADDR must be set, as for any module)
+//
+
+static unsigned Random32()
+{
+  return ((unsigned)rand()<<16) ^ (unsigned)rand();
+}
+
+static const EthernetAddr peer("02:00:00:00:00:01");
+
+// A frame sent to us by peer, for dest
+static RawEthernetPacket Frame(const IPAddress &dest, const unsigned char ttl)
+{
+  char data[64];
+  memset(data,0x5a,sizeof(data));
+  Packet p(Buffer(data,sizeof(data)));
+  IPHeader ih;
+  ih.SetProtocol(IP_PROTO_UDP);
+  ih.SetSourceIP(IPAddress("192.168.1.1"));
+  ih.SetDestIP(dest);
+  ih.SetTotalLength(IP_HEADER_BASE_LENGTH+sizeof(data));
+  ih.SetTTL(ttl);
+  p.PushFrontHeader(ih);
+  EthernetHeader eh;
+  eh.SetSrcAddr(peer);
+  eh.SetDestAddr(MyEthernetAddr);
+  eh.SetProtocolType(PROTO_IP);
+  p.PushFrontHeader(eh);
+  return RawEthernetPacket(p);
+}
+
+static EthernetAddr Neighbor(const unsigned n)
+{
+  EthernetAddr a(peer);
+  a.addr[4]=n>>8;
+  a.addr[5]=n;
+  return a;
+}
+
+static IPAddress Gateway(const unsigned n)
+{
+  return IPAddress(ntohl(inet_addr("10.0.0.1"))+n);
+}
+
+// What ip_module_routing did with a frame for another host before it
+// had a forwarding table, less the printing
+static bool PacketForward(const RawEthernetPacket &raw, const RouteTable &table,
+			  const ARPCache &neighbors, RawEthernetPacket &out)
+{
+  Packet p(raw);
+  p.ExtractHeaderFromPayload<EthernetHeader>(ETHERNET_HEADER_LEN);
+  p.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(p));
+  IPHeader iph=p.FindHeader(Headers::IPHeader);
+  IPAddress dest;
+  unsigned char ttl;
+  iph.GetDestIP(dest);
+  iph.GetTTL(ttl);
+  if (!iph.IsChecksumCorrect() || ttl<=1) {
+    return false;
+  }
+  const RouteEntry *route=table.Lookup(dest);
+  if (!route) {
+    return false;
+  }
+  const EthernetAddr *hw=neighbors.Find(route->GetNextHop(dest));
+  if (!hw) {
+    return false;
+  }
+  iph.SetTTL(ttl-1);
+  p.PopFrontHeader();
+  p.PopFrontHeader();
+  p.PushFrontHeader(iph);
+  EthernetHeader h;
+  h.SetSrcAddr(MyEthernetAddr);
+  h.SetDestAddr(*hw);
+  h.SetProtocolType(PROTO_IP);
+  p.PushFrontHeader(h);
+  out=RawEthernetPacket(p);
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned nroutes = argc>1 ? atoi(argv[1]) : 10000;
+  unsigned npackets = argc>2 ? atoi(argv[2]) : 1000000;
+  const unsigned ngateways=8;
+  const IPAddress host("10.0.0.50");
+
+  srand(1);
+  ForwardingTable fib(MyEthernetAddr);
+  fib.Add(RouteEntry(IPAddress("10.0.0.0"),24,IP_ADDRESS_ANY,"eth0"));
+  fib.Add(RouteEntry(IP_ADDRESS_LO,8,IP_ADDRESS_ANY,"lo"));
+  fib.Add(RouteEntry(IPAddress("172.16.0.0"),12,Gateway(0),"eth0"));
+
+  const Adjacency *adj;
+  IPAddress nexthop;
+
+  // next hops
+  Check(fib.Lookup(IPAddress("192.0.2.1"),adj,nexthop)==FORWARD_NO_ROUTE,"routed with no route");
+  Check(fib.Lookup(IPAddress("127.0.0.1"),adj,nexthop)==FORWARD_LOCAL,"loopback not local");
+  Check(fib.Lookup(IPAddress("172.16.5.5"),adj,nexthop)==FORWARD_UNRESOLVED && nexthop==Gateway(0),
+	"unresolved gateway");
+  fib.SetNeighbor(IPAddress("192.0.2.1"),Neighbor(99));
+  Check(fib.NumAdjacencies()==1,"adjacency for a neighbor on no net of ours");
+  fib.SetNeighbor(Gateway(0),Neighbor(0));
+  Check(fib.Lookup(IPAddress("172.16.5.5"),adj,nexthop)==FORWARD_OK && nexthop==Gateway(0) &&
+	adj->addr==Neighbor(0),"resolved gateway");
+
+  // a host on the connected net
+  Check(fib.Lookup(host,adj,nexthop)==FORWARD_UNRESOLVED && nexthop==host,"unresolved host");
+  fib.SetNeighbor(host,Neighbor(50));
+  Check(fib.Lookup(host,adj,nexthop)==FORWARD_OK && adj->addr==Neighbor(50),"resolved host");
+  Check(fib.GetRoutes().Lookup(host)->prefixlen==32,"no host route");
+  fib.Add(RouteEntry(IPAddress("10.0.0.0"),16,Gateway(0),"eth0"));
+  fib.Delete(IPAddress("172.16.0.0"),12);
+  Check(fib.Lookup(host,adj,nexthop)==FORWARD_OK && adj->addr==Neighbor(50),"host lost by a route change");
+  Check(fib.Lookup(IPAddress("172.16.5.5"),adj,nexthop)==FORWARD_NO_ROUTE,"deleted route used");
+  fib.ClearNeighbor(host);
+  Check(fib.Lookup(host,adj,nexthop)==FORWARD_UNRESOLVED && fib.GetRoutes().Lookup(host)->prefixlen==24,
+	"host route outlived its neighbor");
+  fib.Delete(IPAddress("10.0.0.0"),16);
+  Check(fib.NumAdjacencies()==1,"adjacencies left behind");
+
+  // random routes through the gateways, and the neighbors resolved
+  std::vector<RouteEntry> routes;
+  ARPCache neighbors;
+  while (routes.size()<nroutes) {
+    unsigned len=8+rand()%17;
+    unsigned net=Random32() & ~(len==32 ? 0 : 0xffffffff>>len);
+    if ((net>>24)==10 || (net>>24)==127) {
+      continue;
+    }
+    routes.push_back(RouteEntry(IPAddress(net),len,Gateway(routes.size()%ngateways),"eth0"));
+    fib.Add(routes.back());
+  }
+  for (unsigned i=0;i<ngateways;i++) {
+    fib.SetNeighbor(Gateway(i),Neighbor(i));
+    neighbors.Update(ARPRequestResponse(Gateway(i),Neighbor(i),ARPRequestResponse::RESPONSE_OK));
+  }
+  fib.SetNeighbor(host,Neighbor(50));
+  neighbors.Update(ARPRequestResponse(host,Neighbor(50),ARPRequestResponse::RESPONSE_OK));
+  Check(fib.NumAdjacencies()==ngateways+1,"wrong number of adjacencies");
+
+  // frames forwarded in place
+  {
+    RawEthernetPacket f=Frame(host,64), before=f, out;
+    Check(fib.Forward(f,nexthop)==FORWARD_OK && nexthop==host,"frame to a host not forwarded");
+    Check(PacketForward(before,fib.GetRoutes(),neighbors,out),"Packet path did not forward");
+    Check(f.size==out.size && memcmp(f.data,out.data,f.size)==0,"frame differs from the Packet path's");
+    Packet p(f);
+    p.ExtractHeaderFromPayload<EthernetHeader>(ETHERNET_HEADER_LEN);
+    p.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(p));
+    EthernetHeader eh=p.FindHeader(Headers::EthernetHeader);
+    IPHeader ih=p.FindHeader(Headers::IPHeader);
+    EthernetAddr to, from;
+    unsigned char ttl;
+    eh.GetDestAddr(to);
+    eh.GetSrcAddr(from);
+    ih.GetTTL(ttl);
+    Check(to==Neighbor(50) && from==MyEthernetAddr,"Ethernet header not rewritten");
+    Check(ttl==63 && ih.IsChecksumCorrect(),"TTL or checksum");
+    Check(fib.Forward(f,nexthop)==FORWARD_DISCARD,"frame for another Ethernet address forwarded");
+
+    f=Frame(host,1);
+    before=f;
+    Check(fib.Forward(f,nexthop)==FORWARD_TTL_EXCEEDED,"TTL 1 forwarded");
+    Check(memcmp(f.data,before.data,f.size)==0,"frame changed when not forwarded");
+    f=Frame(host,64);
+    f.data[ETHERNET_HEADER_LEN+10]^=1;
+    Check(fib.Forward(f,nexthop)==FORWARD_DISCARD,"bad checksum forwarded");
+    f=Frame(IPAddress("10.0.0.60"),64);
+    Check(fib.Forward(f,nexthop)==FORWARD_UNRESOLVED && nexthop==IPAddress("10.0.0.60"),"unresolved host forwarded");
+    f=Frame(IPAddress("127.0.0.1"),64);
+    Check(fib.Forward(f,nexthop)==FORWARD_LOCAL,"loopback forwarded");
+  }
+
+  // a pool of frames to random routed addresses; each goes through
+  // once a round and is addressed back to us as if it came in again
+  const unsigned pool=4096;
+  unsigned rounds=MAX_MACRO(1u,MIN_MACRO(250u,npackets/pool));
+  std::vector<RawEthernetPacket> frames, copies;
+  for (unsigned i=0;i<pool;i++) {
+    const RouteEntry &r=routes[Random32()%routes.size()];
+    unsigned dest=(unsigned)r.net | (Random32() & ~(unsigned)r.GetMask());
+    frames.push_back(Frame(IPAddress(dest),255));
+  }
+  copies=frames;
+  for (unsigned i=0;i<pool;i++) {
+    RawEthernetPacket out;
+    Check(PacketForward(copies[i],fib.GetRoutes(),neighbors,out),"Packet path did not forward");
+    Check(fib.Forward(copies[i],nexthop)==FORWARD_OK,"pool frame not forwarded");
+    Check(memcmp(copies[i].data,out.data,out.size)==0,"pool frame differs from the Packet path's");
+  }
+
+  unsigned ok=0;
+  double t0=Now();
+  for (unsigned n=0;n<rounds;n++) {
+    for (unsigned i=0;i<pool;i++) {
+      ok += fib.Forward(frames[i],nexthop)==FORWARD_OK;
+      memcpy(frames[i].data,MyEthernetAddr.addr,6);
+    }
+  }
+  double t1=Now();
+  Check(ok==rounds*pool,"frames not forwarded");
+
+  ok=0;
+  for (unsigned n=0;n<rounds;n++) {
+    for (unsigned i=0;i<pool;i++) {
+      RawEthernetPacket out;
+      ok += PacketForward(copies[i],fib.GetRoutes(),neighbors,out);
+    }
+  }
+  double t2=Now();
+  Check(ok==rounds*pool,"frames not forwarded by the Packet path");
+
+  double fast=rounds*pool/(t1-t0), slow=rounds*pool/(t2-t1);
+  cout << "bench_forward: " << routes.size() << " routes, " << rounds*pool << " packets" << endl;
+  cout << "  in place:    " << fast/1e6 << " Mpps (" << 1e9/fast << " ns/packet)" << endl;
+  cout << "  Packet path: " << slow/1e6 << " Mpps (" << 1e9/slow << " ns/packet)" << endl;
+  Check(fast>slow,"forwarding in place is no faster");
+  cout << "bench_forward: ok, " << fast/slow << "x" << endl;
+  return 0;
+}
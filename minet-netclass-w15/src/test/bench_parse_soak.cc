@@ -0,0 +1,111 @@
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "packet.h"
+#include "ip.h"
+#include "tcp.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Soak benchmark for the header parsing path.  Builds one TCP/IP
+// frame and then parses it over and over the way ethernet_mux, ip_module
+// and tcp_module do, sampling the resident set size as it goes.  Reports
+// the least-squares slope of RSS against packets parsed, which should be
+// zero once warmed up.
+//
+// usage: bench_parse_soak [millions-of-packets] [payload-bytes]
+// (MINET_IPADDR must be set, as for any module)
+//
+
+static long RSSKB()
+{
+  long pages=0, rss=0;
+  FILE *f=fopen("/proc/self/statm","r");
+  if (f) {
+    if (fscanf(f,"%ld %ld",&pages,&rss)!=2) {
+      rss=0;
+    }
+    fclose(f);
+  }
+  return rss*(sysconf(_SC_PAGESIZE)/1024);
+}
+
+int main(int argc, char *argv[])
+{
+  double millions = argc>1 ? atof(argv[1]) : 10;
+  unsigned payload = argc>2 ? atoi(argv[2]) : 512;
+  unsigned long total = (unsigned long)(millions*1e6);
+  unsigned long sample = total/100 ? total/100 : 1;
+
+  // build the frame once
+  char data[ETHERNET_DATA_MAX];
+  for (unsigned i=0;i<payload;i++) {
+    data[i]=i;
+  }
+  Packet out(data,payload);
+  TCPHeader tcph;
+  tcph.SetSourcePort(5000,out);
+  tcph.SetDestPort(80,out);
+  tcph.SetSeqNum(1,out);
+  tcph.SetAckNum(1,out);
+  tcph.SetHeaderLen(TCP_HEADER_BASE_LENGTH/4,out);
+  tcph.SetWinSize(8192,out);
+  out.PushFrontHeader(tcph);
+  IPHeader iph;
+  iph.SetProtocol(IP_PROTO_TCP);
+  iph.SetSourceIP(IPAddress("10.0.0.1"));
+  iph.SetDestIP(IPAddress("10.0.0.2"));
+  iph.SetTotalLength(IP_HEADER_BASE_LENGTH+TCP_HEADER_BASE_LENGTH+payload);
+  out.PushFrontHeader(iph);
+  out.PushFrontHeader(Header(Headers::EthernetHeader,data,ETHERNET_HEADER_LEN));
+
+  size_t rawlen=out.GetRawSize();
+  char raw[ETHERNET_PACKET_LEN];
+  out.DupeRaw(raw,rawlen);
+
+  std::vector<double> xs, ys;
+  unsigned long bytes=0;
+  double start=Now();
+
+  for (unsigned long n=0;n<total;n++) {
+    Packet p(raw,rawlen);
+    p.ExtractHeaderFromPayload(Headers::EthernetHeader,ETHERNET_HEADER_LEN);
+    p.ExtractHeaderFromPayload<IPHeader>(IPHeader::EstimateIPHeaderLength(p));
+    p.ExtractHeaderFromPayload<TCPHeader>(TCPHeader::EstimateTCPHeaderLength(p));
+
+    IPHeader ipl=p.FindHeader(Headers::IPHeader);
+    TCPHeader tcpl=p.FindHeader(Headers::TCPHeader);
+    unsigned short port;
+    tcpl.GetDestPort(port);
+    unsigned char proto;
+    ipl.GetProtocol(proto);
+    bytes+=p.GetPayload().GetSize()+port+proto;
+
+    if (n%sample==0) {
+      xs.push_back(n);
+      ys.push_back(RSSKB());
+    }
+  }
+  double elapsed=Now()-start;
+
+  // least squares fit over the second half, after warmup
+  double sx=0, sy=0, sxx=0, sxy=0;
+  unsigned k=0;
+  for (unsigned i=xs.size()/2;i<xs.size();i++,k++) {
+    sx+=xs[i]; sy+=ys[i]; sxx+=xs[i]*xs[i]; sxy+=xs[i]*ys[i];
+  }
+  double slope = k>1 ? (k*sxy-sx*sy)/(k*sxx-sx*sx) : 0;
+
+  cout << "bench_parse_soak: " << total << " frames of " << rawlen << " bytes in "
+       << elapsed << " s (" << total/elapsed << " frames/s)" << endl;
+  cout << "  rss start=" << ys.front() << " KB end=" << ys.back() << " KB"
+       << " slope=" << slope*1e6 << " KB per million frames" << endl;
+  return bytes==0;
+}
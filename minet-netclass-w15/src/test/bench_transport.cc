@@ -0,0 +1,124 @@
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+#include "config.h"
+#include "packet.h"
+#include "shmring.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Measures packets per second across one module-to-module hop, first
+// over a plain fifo and then over a shared memory ring.  The receiver
+// waits for each packet the way MinetGetNextEvent does (select on the
+// fifo, or check the ring and only sleep on its doorbell) and then
+// unserializes it, so the numbers are comparable to a real hop.
+//
+// usage: bench_transport [packets] [payload-bytes]
+//
+
+static void WaitReadable(int fd)
+{
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(fd,&fds);
+  select(fd+1,&fds,0,0,0);
+}
+
+static void Receiver(const char *fifo, bool ring, unsigned long count)
+{
+  int fd=open(fifo,O_RDONLY);
+  ShmRing *r=0;
+  if (ring) {
+    if (!(r=ShmRing::Attach(fifo))) {
+      cerr << "can't attach ring" << endl;
+      exit(-1);
+    }
+    r->Bind(fd);
+  }
+  unsigned long bytes=0;
+  for (unsigned long i=0;i<count;i++) {
+    if (r) {
+      while (r->PrepareToSleep()) {
+	WaitReadable(fd);
+	r->DrainDoorbell();
+      }
+    } else {
+      WaitReadable(fd);
+    }
+    Packet p;
+    p.Unserialize(fd);
+    bytes+=p.GetPayload().GetSize();
+  }
+  delete r;
+  close(fd);
+  exit(bytes==0);
+}
+
+static double RunHop(const char *fifo, bool ring, unsigned long count, const Packet &p)
+{
+  pid_t pid=fork();
+  if (pid==0) {
+    Receiver(fifo,ring,count);
+  }
+  ShmRing *r = ring ? ShmRing::Create(fifo) : 0;
+  int fd=open(fifo,O_WRONLY);
+  if (r) {
+    r->Bind(fd);
+  }
+  double start=Now();
+  for (unsigned long i=0;i<count;i++) {
+    p.Serialize(fd);
+    if (r) {
+      r->Commit();
+    }
+  }
+  int status;
+  waitpid(pid,&status,0);
+  double elapsed=Now()-start;
+  delete r;
+  close(fd);
+  return count/elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long count = argc>1 ? atol(argv[1]) : 1000000;
+  unsigned payload = argc>2 ? atoi(argv[2]) : 512;
+  char dir[]="/tmp/minet_benchXXXXXX";
+  char data[ETHERNET_DATA_MAX];
+
+  if (!mkdtemp(dir)) {
+    cerr << "can't make temp dir" << endl;
+    return -1;
+  }
+  std::string fifo=std::string(dir)+"/hop";
+  mkfifo(fifo.c_str(),0600);
+
+  // a TCP segment as it travels between ip_mux and tcp_module
+  Packet p(data,payload);
+  p.PushFrontHeader(Header(Headers::TCPHeader,data,20));
+  p.PushFrontHeader(Header(Headers::IPHeader,data,20));
+
+  double fifopps=RunHop(fifo.c_str(),false,count,p);
+  double ringpps=RunHop(fifo.c_str(),true,count,p);
+
+  cout << "bench_transport: " << count << " packets, " << payload << " byte payload" << endl;
+  cout << "  fifo: " << fifopps << " packets/s per hop" << endl;
+  cout << "  ring: " << ringpps << " packets/s per hop" << endl;
+
+  unlink(fifo.c_str());
+  rmdir(dir);
+  return 0;
+}
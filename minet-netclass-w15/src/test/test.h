@@ -0,0 +1,30 @@
+#ifndef _test
+#define _test
+
+#include <iostream>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+//
+// What the tests and benchmarks here have in common.
+//
+
+// Ends the test, failed, with a line naming it and what went wrong
+inline void Check(const bool ok, const char *what)
+{
+  if (!ok) {
+    std::cerr << program_invocation_short_name << ": " << what << std::endl;
+    exit(-1);
+  }
+}
+
+// Wall clock time in seconds, for timing
+inline double Now()
+{
+  struct timeval tv;
+  gettimeofday(&tv,0);
+  return tv.tv_sec+tv.tv_usec/1e6;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+
+#include "Minet.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Walks ARPCache through its states on a simulated clock: a burst of
+// lookups for an unresolved address asks the network once, retries back
+// off and end in a negative entry, answers refresh entries, unused
+// entries age out unless stale entries are to be probed, in which case
+// they stay as long as they answer, and our own address never does.
+// Then times lookups in a large cache.
+//
+// usage: test_arpcache [entries] [lookups]
+//
+
+int main(int argc, char *argv[])
+{
+  unsigned entries = argc>1 ? atoi(argv[1]) : 10000;
+  unsigned lookups = argc>2 ? atoi(argv[2]) : 1000000;
+
+  ARPCache cache(30,60,1,3,20);
+  IPAddress me("10.0.0.1"), a("10.0.0.2"), b("10.0.0.3");
+  EthernetAddr hw("00:01:02:03:04:05"), ahw("00:0a:0b:0c:0d:0e");
+  std::vector<IPAddress> retry, gone;
+  double now=1000;
+
+  cache.Update(ARPRequestResponse(me,hw,ARPRequestResponse::RESPONSE_OK),now,true);
+
+  // a burst to somebody unknown asks once
+  unsigned asked=0;
+  for (int i=0;i<100;i++) {
+    ARPRequestResponse r(b,ETHERNET_BLANK_ADDR,ARPRequestResponse::REQUEST);
+    asked+=cache.Resolve(r,now);
+    Check(r.flag==ARPRequestResponse::RESPONSE_UNKNOWN,"unresolved address answered");
+  }
+  Check(asked==1,"more than one request for a burst");
+
+  // then retries after 1, 2 and 4 seconds' silence, after which it fails
+  double when[]={ 1, 3 };
+  for (int k=0;k<2;k++) {
+    retry.clear();
+    cache.Expire(now+when[k]-0.01,retry,gone);
+    Check(retry.empty(),"retried early");
+    cache.Expire(now+when[k],retry,gone);
+    Check(retry.size()==1 && retry[0]==b,"no retry");
+  }
+  retry.clear();
+  cache.Expire(now+7,retry,gone);
+  Check(retry.empty() && gone.size()==1 && gone[0]==b,"did not fail after three tries");
+  gone.clear();
+  now+=7;
+
+  // failed addresses answer from the negative entry without asking
+  ARPRequestResponse r(b,ETHERNET_BLANK_ADDR,ARPRequestResponse::REQUEST);
+  Check(!cache.Resolve(r,now) && r.flag==ARPRequestResponse::RESPONSE_UNKNOWN,"negative entry asked again");
+  cache.Expire(now+19.9,retry,gone);
+  Check(!cache.Resolve(r,now+19.9),"negative entry expired early");
+  cache.Expire(now+21,retry,gone);
+  Check(cache.Resolve(r,now+21),"negative entry did not expire");
+  cache.Delete(b);
+  now+=21;
+
+  // an answer makes it usable, and aging takes it to STALE and then away
+  cache.Update(ARPRequestResponse(a,ahw,ARPRequestResponse::RESPONSE_OK),now);
+  Check(cache.Find(a) && *cache.Find(a)==ahw,"answer not recorded");
+  cache.Expire(now+30,retry,gone);
+  Check(cache.Find(a)!=0,"stale entry unusable");
+  ARPRequestResponse s(a,ETHERNET_BLANK_ADDR,ARPRequestResponse::REQUEST);
+  Check(cache.Resolve(s,now+30) && s.flag==ARPRequestResponse::RESPONSE_OK,"stale entry not rechecked");
+  Check(!cache.Resolve(s,now+30),"stale entry rechecked twice");
+  cache.Update(ARPRequestResponse(a,ahw,ARPRequestResponse::RESPONSE_OK),now+30.5);
+  Check(!cache.Resolve(s,now+31),"confirmed entry rechecked");
+  gone.clear();
+  cache.Expire(now+60.5,retry,gone);
+  Check(gone.empty(),"entry went early");
+  cache.Expire(now+120.5,retry,gone);
+  Check(gone.size()==1 && gone[0]==a && cache.Find(a)==0,"unused stale entry kept");
+
+  // probed instead, an entry stays usable while it answers
+  cache.SetProbeStale(true);
+  now+=121;
+  cache.Update(ARPRequestResponse(a,ahw,ARPRequestResponse::RESPONSE_OK),now);
+  retry.clear();
+  gone.clear();
+  cache.Expire(now+30,retry,gone);
+  cache.Expire(now+90,retry,gone);
+  Check(retry.size()==1 && retry[0]==a && gone.empty() && cache.Find(a)!=0,"stale entry not probed");
+  cache.Update(ARPRequestResponse(a,ahw,ARPRequestResponse::RESPONSE_OK),now+90.5);
+  cache.Expire(now+120.5,retry,gone);
+  cache.Expire(now+180.5,retry,gone);
+  Check(retry.size()==2 && gone.empty() && cache.Find(a)!=0,"answered probe not kept");
+  // and goes when it stops
+  cache.Expire(now+181.5,retry,gone);
+  cache.Expire(now+183.5,retry,gone);
+  Check(retry.size()==4 && gone.empty() && cache.Find(a)!=0,"probe not retried");
+  cache.Expire(now+187.5,retry,gone);
+  Check(gone.size()==1 && gone[0]==a && cache.Find(a)==0,"unanswered probe kept");
+  cache.SetProbeStale(false);
+
+  // but we stay
+  cache.Expire(now+1e6,retry,gone);
+  Check(cache.Find(me) && *cache.Find(me)==hw,"permanent entry aged");
+  cache.Update(ARPRequestResponse(me,ahw,ARPRequestResponse::RESPONSE_OK),now);
+  Check(*cache.Find(me)==hw,"permanent entry overwritten");
+
+  const ARPCacheStats &st=cache.GetStats();
+  cout << "test_arpcache: ok, " << cache << endl;
+  Check(st.failures==2 && st.negativehits==2,"counters wrong");
+
+  // lookups with a busy segment's worth of neighbors
+  ARPCache big;
+  std::vector<IPAddress> addrs(entries);
+  for (unsigned i=0;i<entries;i++) {
+    addrs[i]=IPAddress(0x0a000000U+i*7+2);
+    big.Update(ARPRequestResponse(addrs[i],ahw,ARPRequestResponse::RESPONSE_OK),now);
+  }
+  srand(1);
+  std::vector<unsigned> which(lookups);
+  for (unsigned k=0;k<lookups;k++) {
+    which[k]=rand()%entries;
+  }
+  double start=Now();
+  for (unsigned k=0;k<lookups;k++) {
+    ARPRequestResponse q(addrs[which[k]],ETHERNET_BLANK_ADDR,ARPRequestResponse::REQUEST);
+    big.Resolve(q,now);
+  }
+  double elapsed=Now()-start;
+  Check(big.GetStats().hits==lookups,"lookups missed");
+  cout << "test_arpcache: " << entries << " entries, " << elapsed/lookups*1e9 << " ns per lookup" << endl;
+  return 0;
+}
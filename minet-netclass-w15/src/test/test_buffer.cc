@@ -0,0 +1,144 @@
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "buffer.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Applies random edits to a Buffer and to a std::string in lockstep
+// and checks that the two always hold the same bytes.  Also checks
+// that copies are not disturbed by writes to the original, that small
+// pieces added at either end are merged, and that a buffer of more
+// slices than writev takes at once serializes and reads back.
+//
+
+static std::string Contents(const Buffer &b)
+{
+  std::string s(b.GetSize(),0);
+  if (b.GetSize()>0) {
+    b.GetData(&(s[0]),b.GetSize(),0);
+  }
+  return s;
+}
+
+static std::string RandomBytes(size_t len)
+{
+  std::string s(len,0);
+  for (size_t i=0;i<len;i++) {
+    s[i]='a'+rand()%26;
+  }
+  return s;
+}
+
+int main(int argc, char *argv[])
+{
+  int iters = argc>1 ? atoi(argv[1]) : 100000;
+  Buffer b;
+  std::string ref;
+
+  srand(getpid());
+
+  for (int i=0;i<iters;i++) {
+    size_t len=rand()%64;
+    unsigned off=ref.size()>0 ? rand()%(ref.size()+1) : 0;
+    std::string r=RandomBytes(len);
+    Buffer saved(b);
+    std::string savedref(ref);
+
+    switch (rand()%7) {
+    case 0:
+      b.AddFront(Buffer(r.data(),r.size()));
+      ref.insert(0,r);
+      break;
+    case 1:
+      b.AddBack(Buffer(r.data(),r.size()));
+      ref+=r;
+      break;
+    case 2:
+      b.Insert(Buffer(r.data(),r.size()),off);
+      ref.insert(off,r);
+      break;
+    case 3:
+      b.Erase(off,len);
+      ref.erase(MIN((size_t)off,ref.size()),len);
+      break;
+    case 4: {
+      Buffer x=b.Extract(off,len);
+      std::string y=ref.substr(MIN((size_t)off,ref.size()),len);
+      ref.erase(MIN((size_t)off,ref.size()),len);
+      if (Contents(x)!=y) {
+	cerr << "Extract mismatch at iteration "<<i<<endl;
+	exit(-1);
+      }
+      break;
+    }
+    case 5:
+      b.SetData(r.data(),r.size(),off);
+      if (off+len>ref.size()) {
+	ref.resize(off+len);
+      }
+      ref.replace(off,len,r);
+      break;
+    case 6:
+      if (ref.size()>4096) {
+	b.Clear();
+	ref.clear();
+      }
+      break;
+    }
+    if (b.GetSize()!=ref.size() || Contents(b)!=ref) {
+      cerr << "Buffer mismatch at iteration "<<i<<endl;
+      exit(-1);
+    }
+    if (Contents(saved)!=savedref) {
+      cerr << "Copy disturbed at iteration "<<i<<endl;
+      exit(-1);
+    }
+    if (ref.size()>0) {
+      unsigned k=rand()%ref.size();
+      if (b[k]!=ref[k]) {
+	cerr << "operator[] mismatch at iteration "<<i<<endl;
+	exit(-1);
+      }
+    }
+  }
+  // a byte at a time from both ends, with each piece its own block
+  Buffer small;
+  for (int i=0;i<4*BUFFER_COALESCE;i++) {
+    char c='a'+i%26;
+    small.AddBack(Buffer(&c,1));
+    small.AddFront(Buffer(&c,1));
+  }
+  if (small.GetSize()!=8*BUFFER_COALESCE || small.GetNumSlices()>10) {
+    cerr << "small pieces not merged, "<<small.GetNumSlices()<<" slices"<<endl;
+    exit(-1);
+  }
+
+  // pieces too big to merge, many more than IOV_MAX of them
+  Buffer big;
+  std::string bigref;
+  for (int i=0;i<3000;i++) {
+    std::string r=RandomBytes(BUFFER_COALESCE+1);
+    big.AddBack(Buffer(r.data(),r.size()));
+    bigref+=r;
+  }
+  FILE *f=tmpfile();
+  big.Serialize(fileno(f));
+  rewind(f);
+  Buffer back;
+  back.Unserialize(fileno(f));
+  fclose(f);
+  if (big.GetNumSlices()!=3000 || Contents(back)!=bigref) {
+    cerr << "Serialize mismatch"<<endl;
+    exit(-1);
+  }
+
+  cout << "test_buffer: "<<iters<<" iterations ok, "<<b.GetNumSlices()<<" slices"<<endl;
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Minet.h"
+#include "tcpstate.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Drives TCPState::ProcessAck through slow start, congestion avoidance,
+// fast retransmit on the third duplicate ACK and recovery with Reno,
+// NewReno and CUBIC, and a retransmission timeout.  Then follows CUBIC's
+// window for a while after a loss: it should come back to where it was
+// about K seconds later and go on growing past it.  Also checks that the
+// window, and not a fixed number of segments, bounds what is in flight,
+// and that TCP_CONGESTION picks the algorithm per connection.
+//
+// usage: test_cc
+//
+
+static const unsigned mss=TCP_MAXIMUM_SEGMENT_SIZE;
+
+// A sender with segs segments outstanding from isn+1 on
+static TCPState Sender(const char *cc, unsigned isn, unsigned segs)
+{
+  TCPState s(isn,ESTABLISHED,0);
+  Check(s.SetCongestionControl(cc),"unknown algorithm");
+  s.SetLastSent(isn+segs*mss);
+  return s;
+}
+
+static void Recovery(const char *cc)
+{
+  unsigned isn=0xffffffffU-5*mss;
+  TCPState s=Sender(cc,isn,20);
+  double now=1;
+
+  Check(s.ProcessAck(isn+1+2*mss,false,now)==ACK_NEW,"new data not acked");
+  unsigned flight=18*mss;
+  Check(s.ProcessAck(isn+1+2*mss,false,now)==ACK_OLD,"ack with data counted as a duplicate");
+  Check(s.ProcessAck(isn+1+2*mss,true,now)==ACK_DUPLICATE,"first duplicate");
+  Check(s.ProcessAck(isn+1+2*mss,true,now)==ACK_DUPLICATE,"second duplicate");
+  Check(s.ProcessAck(isn+1+2*mss,true,now)==ACK_RETRANSMIT && s.InRecovery(),"no fast retransmit");
+  Check(s.GetCongestionControl().GetSsthresh()==flight/2 || !strcmp(cc,"cubic"),"ssthresh not half the flight");
+  unsigned inflated=s.GetCwnd();
+  Check(s.ProcessAck(isn+1+2*mss,true,now)==ACK_DUPLICATE && s.GetCwnd()==inflated+mss,"window not inflated");
+
+  // a partial ack
+  eAckAction a=s.ProcessAck(isn+1+8*mss,false,now);
+  if (!strcmp(cc,"reno")) {
+    Check(a==ACK_NEW && !s.InRecovery(),"reno stayed in recovery");
+    Check(s.GetCwnd()==s.GetCongestionControl().GetSsthresh(),"reno window not deflated");
+    return;
+  }
+  Check(a==ACK_RETRANSMIT && s.InRecovery(),"partial ack ended recovery");
+  Check(s.ProcessAck(isn+1+20*mss,false,now)==ACK_NEW && !s.InRecovery(),"full ack did not end recovery");
+  Check(s.GetCwnd()==s.GetCongestionControl().GetSsthresh(),"window not deflated");
+
+  // duplicates for data from before recovery ended do not start another
+  s.SetLastSent(isn+30*mss);
+  s.RetransmitTimeout(now);
+  Check(s.GetCwnd()==mss,"timeout did not collapse the window");
+  for (int i=0;i<5;i++) {
+    Check(s.ProcessAck(isn+1+20*mss,true,now)!=ACK_RETRANSMIT,"recovery again after a timeout");
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  // slow start doubles the window every round trip
+  {
+    TCPState s=Sender("newreno",1000,1000);
+    unsigned iw=s.GetCwnd(), ack=1001;
+    Check(iw==4*mss,"initial window");
+    for (int i=0;i<4;i++) {
+      ack+=mss;
+      s.ProcessAck(ack,false,1);
+    }
+    Check(s.GetCwnd()==2*iw,"slow start not doubling");
+    TCPState copy=s;
+    Check(&copy.GetCongestionControl()!=&s.GetCongestionControl() && copy.GetCwnd()==s.GetCwnd(),"copies share their algorithm");
+  }
+
+  // as much in flight as the window allows
+  {
+    static char data[64*mss];
+    TCPState s=Sender("newreno",1000,30);
+    for (unsigned ack=1001+mss;ack<=1001+30*mss;ack+=mss) {
+      s.ProcessAck(ack,false,1);
+    }
+    s.SetSendRwnd(0xffff);
+    Check(s.QueueSend(Buffer(data,sizeof(data)))==sizeof(data),"write refused");
+    unsigned seq;
+    size_t len;
+    while (s.NextSegment(seq,len)) {
+      s.SetLastSent(seq+len-1);
+    }
+    unsigned flight=s.GetLastSent()-s.GetLastAcked();
+    Check(flight==s.GetCwnd() && flight>16*mss,"flight not up to the window");
+  }
+
+  Recovery("reno");
+  Recovery("newreno");
+  Recovery("cubic");
+  Check(!TCPState(0,ESTABLISHED,0).SetCongestionControl("vegas"),"unknown algorithm accepted");
+
+  // per connection, by socket option
+  TCPState a(0,SYN_SENT,0), b(0,SYN_SENT,0);
+  SockOption opt;
+  opt.level=IPPROTO_TCP;
+  opt.name=TCP_CONGESTION;
+  strcpy(opt.text,"cubic");
+  Check(a.SetSocketOption(opt)==EOK && !strcmp(a.GetCongestionControl().Name(),"cubic")
+	&& !strcmp(b.GetCongestionControl().Name(),"newreno"),"TCP_CONGESTION not per connection");
+  strcpy(opt.text,"vegas");
+  Check(a.SetSocketOption(opt)==ENOT_SUPPORTED && !strcmp(a.GetCongestionControl().Name(),"cubic"),
+	"unknown TCP_CONGESTION taken");
+  Check(IsCongestionControl("reno") && !IsCongestionControl("vegas"),"IsCongestionControl");
+
+  setenv("MINET_CC","\"cubic\"",1);
+  Check(!strcmp(TCPState(0,ESTABLISHED,0).GetCongestionControl().Name(),"cubic"),"MINET_CC ignored");
+  unsetenv("MINET_CC");
+  Check(!strcmp(TCPState(0,ESTABLISHED,0).GetCongestionControl().Name(),"newreno"),"wrong default");
+
+  // CUBIC: grow to 100 segments, lose one, and ack a window every
+  // 100 ms after that
+  CubicCongestionControl cubic(mss);
+  double now=0;
+  while (cubic.GetCwnd()<100*mss) {
+    cubic.OnAck(mss,now);
+  }
+  cubic.OnLoss(cubic.GetCwnd(),now);
+  cubic.OnRecoveryEnd(now);
+  double wmax=100, k=cbrt(wmax*0.3/0.4);
+  Check(fabs(cubic.GetCwnd()/(double)mss-70)<1,"not backed off to 0.7");
+  cubic.OnRttSample(0.1);
+  cout << "test_cc: cubic, K=" << k << "s" << endl;
+  cout << "   t(s)   cwnd(segments)" << endl;
+  double atk=0;
+  for (int step=1; now<2*k; step++) {
+    now=step*0.1;
+    unsigned w=cubic.GetCwnd();
+    for (unsigned b=0;b<w;b+=mss) {
+      cubic.OnAck(mss,now);
+    }
+    if (step%5==0) {
+      cout.width(7); cout << now;
+      cout.width(17); cout << cubic.GetCwnd()/(double)mss << endl;
+    }
+    if (atk==0 && now>=k) {
+      atk=cubic.GetCwnd()/(double)mss;
+    }
+  }
+  Check(fabs(atk-wmax)<0.1*wmax,"not back at the old window after K");
+  Check(cubic.GetCwnd()>1.1*wmax*mss,"not probing past the old window");
+
+  cout << "test_cc: ok" << endl;
+  return 0;
+}
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+
+#include "Minet.h"
+#include "tcpstate.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks TCPState's delayed ACK rules: every second full-sized segment
+// is acked at once, a lone or small one waits for the timer, and data
+// out of order or filling a gap is acked at once.  Then moves a stream
+// through a receiver with delayed ACKs on and off, dropping a segment
+// now and then, and reports how many ACKs each sent.
+//
+// usage: test_delack [segments] [loss-percent]
+//
+
+static const unsigned mss=TCP_MAXIMUM_SEGMENT_SIZE;
+
+// Counts what the receiver would put on the wire
+struct Receiver {
+  TCPState s;
+  unsigned acks;
+
+  Receiver(double delack) : s(0,ESTABLISHED,0), acks(0) {
+    s.SetLastRecvd(1000);
+    s.TCP_BUFFER_SIZE=TCP_BUFFER_MAX;
+    s.SetDelayedAck(delack);
+  }
+
+  // a segment arrives at now, after any ACK whose timer went off first
+  void Segment(unsigned seq, size_t len, double now) {
+    Timer(now);
+    std::vector<char> data(len);
+    size_t delivered=s.ReceiveSegment(seq,Buffer(&data[0],len));
+    s.RecvBuffer.Erase(0,delivered);
+    if (s.SegmentReceived(len,delivered,now)) {
+      Ack();
+    }
+  }
+
+  void Timer(double now) {
+    if (s.AckPending() && s.GetDelayedAckDue()<=now) {
+      Ack();
+    }
+  }
+
+  void Ack() {
+    acks++;
+    s.AckSent();
+  }
+};
+
+static unsigned Stream(double delack, unsigned segments, unsigned loss)
+{
+  Receiver r(delack);
+  unsigned seq=1001;
+  double now=0;
+
+  srand(1);
+  for (unsigned i=0;i<segments;i++) {
+    // mostly full segments, with the odd short write
+    size_t len = rand()%8 ? mss : 1+rand()%(mss-1);
+    now+=0.001;
+    if ((unsigned)rand()%100>=loss) {
+      r.Segment(seq,len,now);
+    } else {
+      // resent at once, after the next one
+      i++;
+      r.Segment(seq+len,mss,now);
+      r.Segment(seq,len,now);
+      len+=mss;
+    }
+    seq+=len;
+  }
+  r.Timer(now+TCP_DELAYED_ACK_MAX);
+  Check(!r.s.AckPending(),"ACK left pending");
+  Check(r.s.GetLastRecvd()==seq-1,"stream incomplete");
+  return r.acks;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned segments = argc>1 ? atoi(argv[1]) : 100000;
+  unsigned loss = argc>2 ? atoi(argv[2]) : 1;
+
+  {
+    Receiver r(0.040);
+    r.Segment(1001,mss,1);
+    Check(r.acks==0 && r.s.AckPending() && r.s.GetDelayedAckDue()==1.040,"first full segment not delayed");
+    r.Segment(1001+mss,mss,1.01);
+    Check(r.acks==1 && !r.s.AckPending(),"second full segment not acked");
+
+    r.Segment(1001+2*mss,10,2);
+    r.Segment(1011+2*mss,10,2.01);
+    Check(r.acks==1,"small segments acked before the timer");
+    r.Timer(2.039);
+    Check(r.acks==1,"timer early");
+    r.Timer(2.040);
+    Check(r.acks==2,"timer did not ack");
+
+    // out of order, then the gap filled, then an old segment
+    r.Segment(1021+3*mss,mss,3);
+    Check(r.acks==3,"out of order segment not acked at once");
+    r.Segment(1021+2*mss,mss,3.01);
+    Check(r.acks==4 && !r.s.HasReassemblyGap(),"filled gap not acked at once");
+    r.Segment(1001,mss,3.02);
+    Check(r.acks==5,"duplicate not acked at once");
+
+    // something going the other way carries the ACK
+    r.Segment(1021+4*mss,10,4);
+    r.s.AckSent();
+    r.Timer(5);
+    Check(r.acks==5,"ACK sent twice");
+  }
+
+  {
+    Receiver r(0);
+    r.Segment(1001,10,1);
+    Check(r.acks==1,"ACK delayed while off");
+
+    setenv("MINET_DELAYED_ACK","\"200\"",1);
+    Check(TCPState::DefaultDelayedAck()==0.2,"MINET_DELAYED_ACK ignored");
+    TCPState s(0,ESTABLISHED,0);
+    Check(s.SetSocketOption(IPPROTO_TCP,TCP_QUICKACK,1)==EOK && s.delack_timeout==0,"TCP_QUICKACK ignored");
+    Check(s.SetSocketOption(IPPROTO_TCP,TCP_QUICKACK,0)==EOK && s.delack_timeout==0.2,"TCP_QUICKACK not undone");
+    setenv("MINET_DELAYED_ACK","0",1);
+    Check(TCPState(0,ESTABLISHED,0).delack_timeout==0,"MINET_DELAYED_ACK=0 ignored");
+    unsetenv("MINET_DELAYED_ACK");
+    Check(TCPState::DefaultDelayedAck()==TCP_DELAYED_ACK_DEFAULT,"wrong default");
+  }
+
+  unsigned on=Stream(TCP_DELAYED_ACK_DEFAULT,segments,loss);
+  unsigned off=Stream(0,segments,loss);
+  Check(off==segments,"an ACK per segment when off");
+  Check(on<0.6*off,"delayed ACKs saved too little");
+  cout << "test_delack: ok, " << segments << " segments, " << loss << "% lost: "
+       << off << " ACKs without delay, " << on << " with" << endl;
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#include "Minet.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks that MinetGetNextEvent/MinetGetNextEvents share out service
+// fairly.  One peer floods its connection while two others send a few
+// packets each; the quiet peers must be served within the first few
+// rounds rather than after the flood has drained.  Then checks that a
+// regular file, which epoll will not take, is still read from.
+//
+
+#define NUMPEERS 3
+#define FLOOD    2000
+#define TRICKLE  10
+
+int main(int argc, char *argv[])
+{
+  int fds[NUMPEERS][2];
+  MinetHandle h[NUMPEERS];
+  int sent[NUMPEERS] = { FLOOD, TRICKLE, TRICKLE };
+
+  MinetInit(MINET_APP);
+
+  for (int i=0;i<NUMPEERS;i++) {
+    if (pipe(fds[i])<0) {
+      cerr << "pipe failed" << endl;
+      exit(-1);
+    }
+  }
+
+  // one writer per peer, so the flood blocking on a full pipe does not
+  // hold back the others
+  pid_t pid[NUMPEERS];
+  for (int i=0;i<NUMPEERS;i++) {
+    if ((pid[i]=fork())==0) {
+      char data[64];
+      Packet p(data,sizeof(data));
+      for (int j=0;j<sent[i];j++) {
+	p.Serialize(fds[i][1]);
+      }
+      // stay around so the connection does not show end of file
+      pause();
+      exit(0);
+    }
+  }
+  for (int i=0;i<NUMPEERS;i++) {
+    close(fds[i][1]);
+    h[i]=MinetAddExternalConnection(fds[i][0],-1);
+  }
+  sleep(1);
+
+  int got[NUMPEERS] = { 0, 0, 0 };
+  int total=0;
+  int quietdone=-1;
+  MinetEvent events[4];
+
+  while (total<FLOOD+2*TRICKLE) {
+    int n;
+    if (total%2) {
+      n = MinetGetNextEvent(events[0],1.0)==0 ? 1 : -1;
+    } else {
+      n = MinetGetNextEvents(events,4,1.0);
+    }
+    if (n<=0 || events[0].eventtype!=MinetEvent::Dataflow) {
+      cerr << "test_events: unexpected timeout or error after "<<total<<" packets" << endl;
+      exit(-1);
+    }
+    for (int k=0;k<n;k++) {
+      for (int i=0;i<NUMPEERS;i++) {
+	if (events[k].handle==h[i]) {
+	  Packet p;
+	  MinetReceive(h[i],p);
+	  got[i]++;
+	  total++;
+	}
+      }
+    }
+    if (quietdone<0 && got[1]==TRICKLE && got[2]==TRICKLE) {
+      quietdone=total;
+    }
+  }
+
+  MinetEvent e;
+  if (MinetGetNextEvent(e,0.1)!=0 || e.eventtype!=MinetEvent::Timeout) {
+    cerr << "test_events: expected a timeout" << endl;
+    exit(-1);
+  }
+  for (int i=0;i<NUMPEERS;i++) {
+    kill(pid[i],SIGTERM);
+    waitpid(pid[i],0,0);
+    MinetClose(h[i]);
+  }
+
+  FILE *f=tmpfile();
+  char data[64];
+  Packet fp(data,sizeof(data));
+  for (int j=0;j<TRICKLE;j++) {
+    fp.Serialize(fileno(f));
+  }
+  rewind(f);
+  MinetHandle fh=MinetAddExternalConnection(fileno(f),-1);
+  for (int j=0;j<TRICKLE;j++) {
+    if (MinetGetNextEvent(e,1.0)!=0 || e.eventtype!=MinetEvent::Dataflow || e.handle!=fh) {
+      cerr << "test_events: regular file not read, "<<j<<" packets" << endl;
+      exit(-1);
+    }
+    MinetReceive(fh,fp);
+  }
+  MinetClose(fh);
+
+  if (quietdone<0 || quietdone>4*TRICKLE) {
+    cerr << "test_events: quiet peers starved, finished after "<<quietdone<<" packets" << endl;
+    exit(-1);
+  }
+  cout << "test_events: ok, quiet peers done after "<<quietdone<<" of "<<total<<" packets" << endl;
+  return 0;
+}
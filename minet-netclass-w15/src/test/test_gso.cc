@@ -0,0 +1,140 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Minet.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Builds a TCP super-segment the way tcp_module does, passes it through
+// a pipe as it would cross to ip_mux, and splits it as ip_module does.
+// Every segment must have its own length, ID, sequence number and
+// correct checksums, only the last may keep PSH, and together they must
+// carry exactly the original data.  Then times building a stream's
+// segments one by one against building super-segments and splitting
+// them.
+//
+// usage: test_gso [bytes]
+// (MINET_IPADDR must be set, as for any module)
+//
+
+static const unsigned mss=1448;
+
+static Packet Build(const Buffer &data, unsigned seq, unsigned short segsize)
+{
+  TCPOptions o;
+  o.AddTimestamp(12345,67890);
+
+  Packet p(data);
+  if (segsize>0) {
+    p.SetSegmentSize(segsize);
+    p.MarkChecksumsPending();
+  }
+  IPHeader ih;
+  ih.SetProtocol(IP_PROTO_TCP);
+  ih.SetSourceIP(IPAddress("10.0.0.1"));
+  ih.SetDestIP(IPAddress("10.0.0.2"));
+  ih.SetTotalLength(IP_HEADER_BASE_LENGTH+TCP_HEADER_BASE_LENGTH+o.len+data.GetSize());
+  p.PushFrontHeader(ih);
+
+  TCPHeader th;
+  unsigned char flags=0;
+  SET_ACK(flags);
+  SET_PSH(flags);
+  th.SetSourcePort(5000,p);
+  th.SetDestPort(80,p);
+  th.SetSeqNum(seq,p);
+  th.SetAckNum(1,p);
+  th.SetFlags(flags,p);
+  th.SetWinSize(0xffff,p);
+  th.SetUrgentPtr(0,p);
+  th.SetHeaderLen(TCP_HEADER_BASE_LENGTH/4,p);
+  th.SetOptions(o,p);
+  p.PushBackHeader(th);
+  return p;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t size = argc>1 ? atol(argv[1]) : 20000000;
+
+  srand(1);
+  std::vector<char> stream(10*mss+300);
+  for (unsigned i=0;i<stream.size();i++) {
+    stream[i]=rand();
+  }
+  unsigned isn=0xffffffffU-3*mss;
+  Packet super=Build(Buffer(&stream[0],stream.size()),isn,mss);
+
+  // across a fifo, as to ip_mux and ip_module
+  int fds[2];
+  Check(pipe(fds)==0,"pipe");
+  super.Serialize(fds[1]);
+  Packet p;
+  p.Unserialize(fds[0]);
+  Check(p.GetSegmentSize()==mss,"segment size lost in serialization");
+
+  std::vector<Packet> segs;
+  Check(SplitTCPSuperSegment(p,segs)==11 && segs.size()==11,"wrong number of segments");
+  IPHeader first=p.FindHeader(Headers::IPHeader);
+  unsigned short id0;
+  first.GetID(id0);
+  std::vector<char> out;
+  for (unsigned i=0;i<segs.size();i++) {
+    IPHeader ih=segs[i].FindHeader(Headers::IPHeader);
+    TCPHeader th=segs[i].FindHeader(Headers::TCPHeader);
+    unsigned short len, id;
+    unsigned int seq;
+    unsigned char flags, hlen;
+    ih.GetTotalLength(len);
+    ih.GetID(id);
+    th.GetSeqNum(seq);
+    th.GetFlags(flags);
+    th.GetHeaderLen(hlen);
+    Buffer data=segs[i].GetPayload();
+    Check(data.GetSize()==(i<10 ? mss : 300),"segment size");
+    Check(len==IP_HEADER_BASE_LENGTH+hlen*4+data.GetSize() && hlen*4==TCP_HEADER_BASE_LENGTH+12,"lengths");
+    Check(id==(unsigned short)(id0+i),"IP ID");
+    Check(seq==isn+i*mss,"sequence number");
+    Check(IS_ACK(flags) && IS_PSH(flags)==(i==10),"flags");
+    Check(ih.IsChecksumCorrect(),"IP checksum");
+    Check(th.IsCorrectChecksum(segs[i]),"TCP checksum");
+    size_t at=out.size();
+    out.resize(at+data.GetSize());
+    data.GetData(&out[at],data.GetSize(),0);
+  }
+  Check(out==stream,"data changed");
+
+  // an ordinary packet goes through as it is
+  segs.clear();
+  Packet one=Build(Buffer(&stream[0],100),isn,0);
+  Check(SplitTCPSuperSegment(one,segs)==1 && segs[0].GetPayload().GetSize()==100,"ordinary packet split");
+
+  // a stream, segment by segment and as super-segments
+  std::vector<char> big(size);
+  double t0=(double)Time();
+  unsigned n1=0;
+  for (size_t off=0; off<size; off+=mss, n1++) {
+    Packet q=Build(Buffer(&big[off],MIN_MACRO((size_t)mss,size-off)),isn+off,0);
+  }
+  double t1=(double)Time();
+  unsigned n2=0, frames=0;
+  size_t run=TCP_GSO_MAX_SIZE/mss*mss;
+  for (size_t off=0; off<size; off+=run, n2++) {
+    Packet q=Build(Buffer(&big[off],MIN_MACRO(run,size-off)),isn+off,mss);
+    segs.clear();
+    frames+=SplitTCPSuperSegment(q,segs);
+  }
+  double t2=(double)Time();
+  Check(frames==n1,"frames differ");
+  cout << "test_gso: ok, " << size << " bytes: " << n1 << " packets built in "
+       << (t1-t0)*1e3 << " ms, or " << n2 << " super-segments built and split in "
+       << (t2-t1)*1e3 << " ms" << endl;
+  return 0;
+}
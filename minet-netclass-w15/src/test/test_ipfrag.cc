@@ -0,0 +1,216 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+
+#include "Minet.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Fragments a large UDP datagram for an Ethernet MTU and checks every
+// fragment's length, offset, flags and checksum, and that together they
+// carry the datagram.  Then reassembles it from the fragments shuffled,
+// duplicated, overlapping and with link padding, and checks what comes
+// out is the datagram.  Checks that bad fragments are dropped, that
+// reassembly times out and that the memory cap holds, and times
+// fragmenting and reassembling a stream of datagrams.
+//
+// usage: test_ipfrag [datagrams]
+// (MINET_IPADDR must be set, as for any module)
+//
+
+static const unsigned short mtu=ETHERNET_DATA_MAX;
+
+static Packet Build(const std::vector<char> &data, unsigned short id, bool df)
+{
+  Packet p(Buffer(&data[0],data.size()));
+  IPHeader ih;
+  ih.SetProtocol(IP_PROTO_UDP);
+  ih.SetSourceIP(IPAddress("10.0.0.1"));
+  ih.SetDestIP(IPAddress("10.0.0.2"));
+  ih.SetTotalLength(IP_HEADER_BASE_LENGTH+UDP_HEADER_LENGTH+data.size());
+  ih.SetID(id);
+  if (!df) {
+    ih.SetFlags(0);
+  }
+  p.PushFrontHeader(ih);
+  UDPHeader uh;
+  uh.SetSourcePort(5000,p);
+  uh.SetDestPort(53,p);
+  uh.SetLength(UDP_HEADER_LENGTH+data.size(),p);
+  p.PushBackHeader(uh);
+  return p;
+}
+
+static std::vector<char> Bytes(const Buffer &b)
+{
+  std::vector<char> v(b.GetSize());
+  if (v.size()) {
+    b.GetData(&v[0],v.size(),0);
+  }
+  return v;
+}
+
+// A fragment of body at offset, as it would come off the wire
+static Packet Fragment(const IPHeader &ih, const Buffer &body, size_t offset, size_t len, bool more)
+{
+  Buffer b(body);
+  Packet f(b.Extract(offset,len));
+  IPHeader fh(ih);
+  fh.SetTotalLength(IP_HEADER_BASE_LENGTH+len);
+  fh.SetFlags(more ? IP_HEADER_FLAG_MOREFRAG : 0);
+  fh.SetFragOffset(offset/8);
+  f.PushFrontHeader(fh);
+  return f;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned count = argc>1 ? atoi(argv[1]) : 2000;
+
+  srand(1);
+  std::vector<char> data(8000);
+  for (unsigned i=0;i<data.size();i++) {
+    data[i]=rand();
+  }
+  Packet p=Build(data,1234,false);
+  Buffer body=FlattenIPPacket(p).GetPayload();
+  IPHeader ih=p.FindHeader(Headers::IPHeader);
+
+  // fragmenting
+  std::vector<Packet> frags;
+  Check(FragmentIPPacket(p,mtu,frags)==6 && frags.size()==6,"wrong number of fragments");
+  std::vector<char> out;
+  for (unsigned i=0;i<frags.size();i++) {
+    IPHeader fh=frags[i].FindHeader(Headers::IPHeader);
+    unsigned short len, off, id;
+    unsigned char flags;
+    fh.GetTotalLength(len);
+    fh.GetFragOffset(off);
+    fh.GetFlags(flags);
+    fh.GetID(id);
+    Buffer payload=frags[i].GetPayload();
+    Check(len<=mtu && len==IP_HEADER_BASE_LENGTH+payload.GetSize(),"fragment length");
+    Check(off*8==out.size(),"fragment offset");
+    Check(((flags&IP_HEADER_FLAG_MOREFRAG)!=0)==(i<5) && id==1234,"fragment flags or ID");
+    Check(i==5 || payload.GetSize()%8==0,"fragment not a multiple of 8");
+    Check(fh.IsChecksumCorrect(),"fragment checksum");
+    std::vector<char> b=Bytes(payload);
+    out.insert(out.end(),b.begin(),b.end());
+  }
+  Check(out==Bytes(body),"fragments do not carry the datagram");
+
+  std::vector<Packet> one;
+  Check(FragmentIPPacket(Build(data,1,true),mtu,one)==0 && one.empty(),"fragmented with DF set");
+  Check(FragmentIPPacket(Build(std::vector<char>(100),1,true),mtu,one)==1 && one[0].GetRawSize()==128,"small packet not left alone");
+
+  // reassembly, shuffled, with duplicates, an overlap and padding
+  {
+    IPReassembler r;
+    std::vector<Packet> in(frags);
+    in.push_back(frags[2]);
+    in.push_back(Fragment(ih,body,1000,2000,true));
+    Buffer padded(frags[5].GetPayload());
+    padded.AddBack(Buffer("padding",7));
+    Packet last(padded);
+    last.PushFrontHeader(frags[5].FindHeader(Headers::IPHeader));
+    in[5]=last;
+    std::random_shuffle(in.begin(),in.end());
+
+    Packet whole;
+    unsigned added=0;
+    while (!r.Add(in[added],1.0,whole)) {
+      added++;
+      Check(added<in.size(),"never completed");
+    }
+    Check(r.size()==0 && r.GetMemory()==0,"completed datagram kept");
+    Check(Bytes(whole.GetPayload())==Bytes(body),"reassembled data differs");
+    IPHeader wh=whole.FindHeader(Headers::IPHeader);
+    unsigned short len, off;
+    unsigned char flags;
+    wh.GetTotalLength(len);
+    wh.GetFragOffset(off);
+    wh.GetFlags(flags);
+    Check(len==IP_HEADER_BASE_LENGTH+body.GetSize() && off==0 && !(flags&IP_HEADER_FLAG_MOREFRAG),"reassembled header");
+    Check(wh.IsChecksumCorrect(),"reassembled IP checksum");
+    whole.ExtractHeaderFromPayload<UDPHeader>(UDP_HEADER_LENGTH);
+    UDPHeader uh=whole.FindHeader(Headers::UDPHeader);
+    Check(uh.IsCorrectChecksum(whole),"reassembled UDP checksum");
+  }
+
+  // bad fragments
+  {
+    IPReassembler r;
+    Packet whole;
+    Check(!r.Add(Fragment(ih,body,0,100,true),0,whole) && r.NumDropped()==1,"odd-sized fragment kept");
+    IPHeader big(ih);
+    big.SetTotalLength(IP_HEADER_BASE_LENGTH+1000);
+    big.SetFlags(0);
+    big.SetFragOffset(8100);
+    Buffer b(body);
+    Packet past(b.ExtractFront(1000));
+    past.PushFrontHeader(big);
+    Check(!r.Add(past,0,whole) && r.NumDropped()==2,"fragment past 65535 kept");
+    Check(!r.Add(Fragment(ih,body,0,1480,true),0,whole),"completed early");
+    Check(!r.Add(Fragment(ih,body,4000,400,false),0,whole),"completed early");
+    Check(!r.Add(Fragment(ih,body,4000,1000,true),0,whole) && r.NumDropped()==3,"fragment past the end kept");
+  }
+
+  // timeouts
+  {
+    IPReassembler r;
+    Packet whole;
+    std::vector<Packet> timedout;
+    r.Add(frags[0],10,whole);
+    r.Add(frags[1],10,whole);
+    Check(r.size()==1 && r.TimeUntilNext(15)==IP_REASSEMBLY_TIMEOUT-5,"timeout not scheduled");
+    r.Expire(10+IP_REASSEMBLY_TIMEOUT-1,timedout);
+    Check(r.size()==1 && timedout.empty(),"timed out early");
+    r.Expire(10+IP_REASSEMBLY_TIMEOUT,timedout);
+    Check(r.size()==0 && r.GetMemory()==0 && r.NumDropped()==2,"did not time out");
+    Check(timedout.size()==1 && timedout[0].GetPayload().GetSize()==frags[0].GetPayload().GetSize(),"first fragment not reported");
+    Check(r.TimeUntilNext(100)==-1,"timeout with nothing held");
+  }
+
+  // the memory cap
+  {
+    size_t cap=100000;
+    IPReassembler r(IP_REASSEMBLY_TIMEOUT,cap);
+    Packet whole;
+    for (unsigned id=0;id<1000;id++) {
+      Packet f(frags[0]);
+      IPHeader fh=f.PopFrontHeader();
+      fh.SetID(id);
+      f.PushFrontHeader(fh);
+      r.Add(f,id*0.001,whole);
+      Check(r.GetMemory()<=cap,"memory cap passed");
+    }
+    Check(r.size()>0 && r.size()<100 && r.NumDropped()==1000-r.size(),"oldest not evicted");
+  }
+
+  // a stream of datagrams
+  IPReassembler r;
+  double t0=(double)Time();
+  unsigned nfrags=0, done=0;
+  for (unsigned i=0;i<count;i++) {
+    Packet d=Build(data,i,false);
+    std::vector<Packet> f;
+    nfrags+=FragmentIPPacket(d,mtu,f);
+    for (unsigned j=0;j<f.size();j++) {
+      Packet whole;
+      if (r.Add(f[j],t0,whole)) {
+	done++;
+	Check(whole.GetPayload().GetSize()==body.GetSize(),"stream datagram");
+      }
+    }
+  }
+  double t1=(double)Time();
+  Check(done==count && r.size()==0,"stream not all reassembled");
+  cout << "test_ipfrag: ok, " << count << " datagrams of " << data.size() << " bytes in "
+       << nfrags << " fragments, fragmented and reassembled in " << (t1-t0)*1e3 << " ms" << endl;
+  return 0;
+}
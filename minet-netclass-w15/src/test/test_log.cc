@@ -0,0 +1,153 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MINET_LOG_LEVEL_TCP MINET_LOG_TRACE
+#define MINET_LOG_LEVEL_UDP MINET_LOG_NONE
+#include "log.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks that MINET_LOG statements below a module's compiled-in level
+// are not evaluated and those at it are, that the ring keeps the last
+// MINET_LOG_RECORDS records in order, one line each, that threads
+// logging at once lose nothing, and that with MINET_LOG_DIR set the
+// ring is a file that reads back the same.  Then times a record.
+//
+// usage: test_log [records]
+//
+
+static unsigned evaluated=0;
+
+static unsigned Evaluate()
+{
+  return ++evaluated;
+}
+
+static std::vector<std::string> Dump()
+{
+  std::ostringstream os;
+  MinetLogDump(os);
+  std::istringstream is(os.str());
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(is,line)) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+static unsigned long long Seq(const std::string &line)
+{
+  return strtoull(line.c_str(),0,10);
+}
+
+static void Writer(const unsigned id, const unsigned n)
+{
+  for (unsigned i=0;i<n;i++) {
+    MINET_LOG(TCP, TRACE, "thread " << id << " record " << i);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned count = argc>1 ? atoi(argv[1]) : 1000000;
+
+  // as start_minet.sh passes it on from minet.cfg
+  setenv("MINET_LOG_DIR","\"/tmp\"",1);
+
+  // compiled out and compiled in
+  MINET_LOG(OTHER, DEBUG, "never " << Evaluate());
+  MINET_LOG(UDP, ERROR, "never " << Evaluate());
+  Check(evaluated==0 && !MINET_LOG_ENABLED(OTHER, INFO),"statement below its level evaluated");
+  MINET_LOG(TCP, TRACE, "first " << Evaluate());
+  Check(evaluated==1 && MINET_LOG_ENABLED(TCP, TRACE),"statement at its level not evaluated");
+
+  std::vector<std::string> lines=Dump();
+  Check(lines.size()==1 && Seq(lines[0])==1,"first record");
+  Check(lines[0].find(" TRACE TCP ")!=std::string::npos &&
+	lines[0].compare(lines[0].size()-7,7,"first 1")==0,"record fields");
+
+  // records are one line each and no longer than a slot
+  MINET_LOG(TCP, DEBUG, "two\nlines");
+  MINET_LOG(TCP, DEBUG, std::string(1000,'x'));
+  lines=Dump();
+  Check(lines.size()==3 && lines[1].compare(lines[1].size()-9,9,"two lines")==0,"line break kept");
+  Check(lines[2].size()==MINET_LOG_RECORD_LEN-1,"long record not cut to a slot");
+
+  // the ring keeps the newest
+  const unsigned n=MINET_LOG_RECORDS+100;
+  for (unsigned i=0;i<n;i++) {
+    MINET_LOG(TCP, DEBUG, "record " << i);
+  }
+  lines=Dump();
+  Check(lines.size()==MINET_LOG_RECORDS,"ring not full");
+  for (unsigned i=0;i<lines.size();i++) {
+    std::ostringstream tail;
+    tail << " record " << (n-MINET_LOG_RECORDS+i);
+    Check(Seq(lines[i])==4+n-MINET_LOG_RECORDS+i &&
+	  lines[i].compare(lines[i].size()-tail.str().size(),tail.str().size(),tail.str())==0,
+	  "ring out of order");
+  }
+
+  // threads
+  const unsigned nthreads=4, each=MINET_LOG_RECORDS/nthreads;
+  std::vector<std::thread> threads;
+  for (unsigned t=0;t<nthreads;t++) {
+    threads.push_back(std::thread(Writer,t,each));
+  }
+  for (unsigned t=0;t<nthreads;t++) {
+    threads[t].join();
+  }
+  lines=Dump();
+  std::vector<unsigned> seen(nthreads,0);
+  for (unsigned i=0;i<lines.size();i++) {
+    unsigned id, rec;
+    const char *m=strstr(lines[i].c_str(),"thread ");
+    Check(Seq(lines[i])==4+n+i,"thread records not contiguous");
+    Check(m && sscanf(m,"thread %u record %u",&id,&rec)==2 && id<nthreads,"thread record garbled");
+    Check(rec==seen[id]++,"a thread's records out of order");
+  }
+  for (unsigned t=0;t<nthreads;t++) {
+    Check(seen[t]==each,"thread records lost");
+  }
+
+  // the file
+  std::string path=std::string("/tmp/")+program_invocation_short_name+".trace";
+  struct stat st;
+  Check(stat(path.c_str(),&st)==0 && st.st_size==MINET_LOG_RECORDS*MINET_LOG_RECORD_LEN,"no trace file");
+  std::ifstream file(path.c_str());
+  std::vector<std::string> fromfile;
+  std::string line;
+  while (std::getline(file,line)) {
+    size_t end=line.find_last_not_of(' ');
+    fromfile.push_back(line.substr(0,end+1));
+  }
+  std::sort(fromfile.begin(),fromfile.end());
+  Check(fromfile==lines,"trace file differs from the ring");
+
+  double t0=Now();
+  for (unsigned i=0;i<count;i++) {
+    MINET_LOG(TCP, TRACE, "timing " << i);
+  }
+  double t1=Now();
+  for (unsigned i=0;i<count;i++) {
+    MINET_LOG(OTHER, TRACE, "timing " << Evaluate());
+  }
+  Check(evaluated==1,"disabled statement evaluated");
+
+  cout << "test_log: ok, " << (t1-t0)*1e9/count << " ns per record" << endl;
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <iostream>
+#include <stdlib.h>
+
+#include "Minet.h"
+#include "tcpstate.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks the MSS option on a header and what TCPState makes of it, then
+// sends a bulk stream with the default MSS and with the one negotiated
+// over Ethernet and counts the segments.  Partway through the second,
+// an ICMP fragmentation needed message lowers the path MTU, and every
+// segment after it must fit.
+//
+// usage: test_mss [bytes]
+// (MINET_IPADDR must be set, as for any module)
+//
+
+// Sends size bytes with everything acked at once; if mtu is set, it
+// is reported for the segment in flight when half the stream is out
+static unsigned Bulk(TCPState &s, size_t size, unsigned mtu)
+{
+  unsigned segments=0;
+  size_t sent=0;
+  char chunk[4096];
+
+  s.SetSendRwnd(0xffff);
+  while (sent<size) {
+    while (s.GetSendSpace()>0 && s.SendBuffer.GetSize()<size-sent) {
+      s.QueueSend(Buffer(chunk,MIN_MACRO(sizeof(chunk),size-sent-s.SendBuffer.GetSize())));
+    }
+    unsigned int seq;
+    size_t len;
+    Check(s.NextSegment(seq,len),"nothing to send");
+    Check(len<=s.GetMss() && len+IP_HEADER_BASE_LENGTH+TCP_HEADER_BASE_LENGTH<=s.GetPathMtu(),"segment too big");
+    s.SetLastSent(seq+len-1);
+    s.SegmentSent(seq,len,false,1);
+    if (mtu && sent<size/2 && sent+len>=size/2) {
+      Check(!s.PathMtuReduced(mtu,seq+len),"took a message for a segment not sent");
+      Check(s.PathMtuReduced(mtu,seq),"path MTU not lowered");
+      Check(!s.PathMtuReduced(mtu+100,seq),"path MTU raised");
+    }
+    s.ProcessAck(seq+len,false,1);
+    sent+=len;
+    segments++;
+  }
+  return segments;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t size = argc>1 ? atol(argv[1]) : 10000000;
+
+  // the option on a SYN
+  {
+    Packet p(Buffer("",0));
+    IPHeader ih;
+    ih.SetProtocol(IP_PROTO_TCP);
+    ih.SetSourceIP(IPAddress("10.0.0.1"));
+    ih.SetDestIP(IPAddress("10.0.0.2"));
+    p.PushFrontHeader(ih);
+    TCPHeader th;
+    TCPOptions o;
+    Check(o.AddMss(TCP_MSS_OFFER) && o.AddSackPermitted() && o.AddWindowScale(7),"options did not fit");
+    th.SetOptions(o,p);
+    TCPOptions back;
+    th.GetOptions(back);
+    unsigned short mss;
+    Check(back.GetMss(mss) && mss==1460,"MSS option lost");
+    Check(!TCPOptions().GetMss(mss),"MSS option where there is none");
+  }
+
+  // what a connection makes of it
+  {
+    TCPState s(0,ESTABLISHED,0);
+    Check(s.GetMss()==TCP_MAXIMUM_SEGMENT_SIZE,"default MSS");
+    s.NegotiateMss(true,9000);
+    Check(s.GetMss()==1460,"MSS beyond the path MTU");
+    Check(s.GetCongestionControl().GetMss()==1460,"congestion control MSS");
+    s.SetTimestampsOk(true);
+    Check(s.GetMss()==1448,"timestamps not allowed for");
+    s.SetTimestampsOk(false);
+    s.NegotiateMss(true,1);
+    Check(s.GetMss()>=TCP_HEADER_OPTION_MAX_LENGTH,"tiny MSS accepted");
+    s.NegotiateMss(false,0);
+    Check(s.GetMss()==TCP_MAXIMUM_SEGMENT_SIZE,"no option, no default");
+  }
+
+  // plateaus, and the floor
+  {
+    TCPState s(1000,ESTABLISHED,0);
+    s.NegotiateMss(true,1460);
+    s.SetLastSent(2000);
+    Check(s.PathMtuReduced(0,1001) && s.GetPathMtu()==1492,"first plateau");
+    Check(s.PathMtuReduced(0,1001) && s.GetPathMtu()==1006,"second plateau");
+    Check(s.PathMtuReduced(100,1001) && s.GetPathMtu()==TCP_PMTU_MIN,"below the floor");
+    Check(!s.PathMtuReduced(0,1001),"below the floor by plateau");
+    TCPInfo info;
+    s.GetInfo(info);
+    Check(info.mss==TCP_PMTU_MIN-40 && info.pmtu==TCP_PMTU_MIN,"info");
+  }
+
+  TCPState old(0xffffffffU-size/2,ESTABLISHED,0);
+  unsigned before=Bulk(old,size,0);
+  TCPState neg(0xffffffffU-size/2,ESTABLISHED,0);
+  neg.NegotiateMss(true,TCP_MSS_OFFER);
+  unsigned after=Bulk(neg,size,1400);
+  Check(neg.GetMss()==1360,"MSS not lowered with the path MTU");
+  Check(before>2.5*after,"too many segments");
+  cout << "test_mss: ok, " << size << " bytes in " << before << " segments of "
+       << TCP_MAXIMUM_SEGMENT_SIZE << ", " << after << " with MSS " << TCP_MSS_OFFER
+       << " then a 1400 byte path MTU" << endl;
+  return 0;
+}
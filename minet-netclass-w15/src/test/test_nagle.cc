@@ -0,0 +1,113 @@
+#include <iostream>
+#include <deque>
+#include <stdlib.h>
+
+#include "Minet.h"
+#include "tcpstate.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// An application writes small pieces to a TCPState every millisecond
+// over a path with a 20 ms round trip, and the segments NextSegment
+// gives are counted with Nagle's algorithm on, with TCP_NODELAY and
+// with TCP_CORK.  Nagle and TCP_CORK must send far fewer segments,
+// mostly full ones, and all three must send the stream exactly once.
+// A window the peer has shut holds everything back for a window probe.
+//
+// usage: test_nagle [writes] [write-size]
+//
+
+static const unsigned mss=TCP_MAXIMUM_SEGMENT_SIZE;
+
+struct Result {
+  unsigned segments;
+  unsigned full;
+};
+
+static Result Run(int level, int name, unsigned writes, size_t size)
+{
+  unsigned isn=0xffffffffU-3000;
+  TCPState s(isn,ESTABLISHED,0);
+  s.SetSendRwnd(0xffff);
+  if (name) {
+    Check(s.SetSocketOption(level,name,1)==EOK,"option refused");
+  }
+  std::deque<std::pair<double,unsigned> > acks;  // when, what
+  Result r={0,0};
+  size_t queued=0;
+  unsigned expect=isn+1;
+  char piece[mss];
+
+  for (unsigned t=0; t<writes+100; t++) {
+    double now=t*0.001;
+    while (!acks.empty() && acks.front().first<=now) {
+      s.ProcessAck(acks.front().second,false,now);
+      acks.pop_front();
+    }
+    if (t<writes) {
+      Check(s.QueueSend(Buffer(piece,size))==size,"write refused");
+      queued+=size;
+    } else if (t==writes && name==TCP_CORK) {
+      s.SetSocketOption(level,name,0);
+    }
+    unsigned int seq;
+    size_t len;
+    while (s.NextSegment(seq,len)) {
+      Check(seq==expect && len>0 && len<=mss,"bad segment");
+      expect+=len;
+      s.SetLastSent(seq+len-1);
+      s.SegmentSent(seq,len,false,now);
+      acks.push_back(std::make_pair(now+0.020,seq+len));
+      r.segments++;
+      r.full+=len==mss;
+    }
+  }
+  Check(expect-(isn+1)==queued && s.SendBuffer.GetSize()==0,"stream not all sent and acked");
+  return r;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned writes = argc>1 ? atoi(argv[1]) : 10000;
+  size_t size = argc>2 ? atoi(argv[2]) : 40;
+
+  // the send buffer bounds what a write can queue
+  {
+    TCPState s(0,ESTABLISHED,0);
+    s.SetSocketOption(SOL_SOCKET,SO_SNDBUF,TCP_BUFFER_MIN);
+    char big[2*TCP_BUFFER_MIN];
+    Check(s.QueueSend(Buffer(big,sizeof(big)))==TCP_BUFFER_MIN && s.GetSendSpace()==0,"send buffer overfilled");
+    Check(s.SetSocketOption(IPPROTO_TCP,TCP_MAXSEG,100)==ENOT_SUPPORTED,"unknown option accepted");
+  }
+
+  // nothing goes into a shut window until it opens again
+  {
+    TCPState s(0,ESTABLISHED,0);
+    unsigned int seq;
+    size_t len;
+    char piece[10];
+    s.SetSendRwnd(0);
+    Check(!s.WindowShut(),"shut window with nothing to send");
+    s.QueueSend(Buffer(piece,sizeof(piece)));
+    Check(!s.NextSegment(seq,len) && s.WindowShut(),"sent into a shut window");
+    s.SetSendRwnd(100);
+    Check(s.NextSegment(seq,len) && len==sizeof(piece) && !s.WindowShut(),"window did not open");
+  }
+
+  Result nagle=Run(0,0,writes,size);
+  Result nodelay=Run(IPPROTO_TCP,TCP_NODELAY,writes,size);
+  Result cork=Run(IPPROTO_TCP,TCP_CORK,writes,size);
+
+  Check(nodelay.segments==writes,"TCP_NODELAY coalesced");
+  Check(nagle.segments*5<nodelay.segments,"Nagle coalesced too little");
+  Check(cork.segments-cork.full<=1,"TCP_CORK sent a short segment");
+  cout << "test_nagle: ok, " << writes << " writes of " << size << " bytes" << endl;
+  cout << "  nagle:   " << nagle.segments << " segments, " << nagle.full << " full" << endl;
+  cout << "  nodelay: " << nodelay.segments << " segments, " << nodelay.full << " full" << endl;
+  cout << "  cork:    " << cork.segments << " segments, " << cork.full << " full" << endl;
+  return 0;
+}
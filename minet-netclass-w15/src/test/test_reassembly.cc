@@ -0,0 +1,98 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Minet.h"
+#include "tcpstate.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Feeds TCPState::ReceiveSegment a stream cut into segments that arrive
+// shuffled, duplicated and overlapping one another, with sequence numbers
+// that wrap past 2^32, and checks that exactly the original stream comes
+// out in order, that nothing outside the window is kept, and that the
+// bytes delivered and queued always add up.
+//
+// usage: test_reassembly [rounds]
+//
+
+struct Piece {
+  unsigned offset;
+  unsigned len;
+};
+
+int main(int argc, char *argv[])
+{
+  int rounds = argc>1 ? atoi(argv[1]) : 200;
+
+  srand(1);
+  for (int round=0; round<rounds; round++) {
+    unsigned size=1+rand()%20000;
+    std::vector<char> stream(size);
+    for (unsigned i=0;i<size;i++) {
+      stream[i]=rand();
+    }
+    // start a little before the wrap, most of the time
+    unsigned isn = round%4 ? 0xffffffffU-rand()%(2*size) : rand();
+    TCPState s(isn,LISTEN,0);
+    s.SetLastRecvd(isn);
+    s.TCP_BUFFER_SIZE=size+1+rand()%1000;
+
+    // cut it up, then add some overlapping and repeated pieces
+    std::vector<Piece> pieces;
+    for (unsigned off=0; off<size;) {
+      Piece p;
+      p.offset=off;
+      p.len=std::min(size-off,1+(unsigned)rand()%1460);
+      pieces.push_back(p);
+      off+=p.len;
+    }
+    unsigned n=pieces.size();
+    for (unsigned k=0;k<n;k++) {
+      Piece p;
+      p.offset=rand()%size;
+      p.len=std::min(size-p.offset,1+(unsigned)rand()%3000);
+      pieces.push_back(p);
+      if (rand()%4==0) {
+	pieces.push_back(pieces[rand()%n]);
+      }
+    }
+    std::random_shuffle(pieces.begin(),pieces.end());
+
+    size_t delivered=0;
+    for (unsigned k=0;k<pieces.size();k++) {
+      Buffer b(&stream[pieces[k].offset],pieces[k].len);
+      delivered+=s.ReceiveSegment(isn+1+pieces[k].offset,b);
+      Check(s.RecvBuffer.GetSize()==delivered,"delivered count wrong");
+      Check(s.GetLastRecvd()==(unsigned)(isn+delivered),"last_recvd not advanced");
+      Check(delivered+s.GetReassemblyBytes()<=size,"queued more than was sent");
+    }
+    Check(delivered==size,"stream incomplete");
+    Check(!s.HasReassemblyGap() && s.GetReassemblyBytes()==0,"data left in the queue");
+
+    std::vector<char> out(size);
+    s.RecvBuffer.GetData(&out[0],size,0);
+    Check(memcmp(&out[0],&stream[0],size)==0,"stream corrupted");
+
+    // old and duplicate data gives nothing
+    Check(s.ReceiveSegment(isn+1,Buffer(&stream[0],size))==0,"old data delivered twice");
+
+    // nor does anything past the window, which is now what is left
+    // of the buffer
+    unsigned room=s.GetRwnd();
+    Buffer more(&stream[0],std::min(size,room+100));
+    Check(s.ReceiveSegment(isn+1+size+room,more)==0 && !s.HasReassemblyGap(),"kept data past the window");
+    Check(s.ReceiveSegment(isn+1+size+1,more)==0,"out of order data delivered");
+    Check(s.GetReassemblyBytes()==std::min((unsigned)more.GetSize(),room-1),"window not enforced");
+    s.SetLastRecvd(0);
+    Check(!s.HasReassemblyGap(),"queue kept across a new sequence space");
+  }
+  cout << "test_reassembly: ok, " << rounds << " streams" << endl;
+  return 0;
+}
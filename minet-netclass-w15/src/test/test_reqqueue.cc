@@ -0,0 +1,104 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Minet.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks RequestQueue, which sock_module uses to match a protocol
+// module's STATUS replies to its requests: replies by id in any order,
+// replies with id 0 in order, ids surviving a trip through a fifo and
+// the ring growing when too many are outstanding.  Then keeps a window
+// of requests outstanding, answers them in random order and reports the
+// time per request.
+//
+// usage: test_reqqueue [requests] [window]
+//
+
+int main(int argc, char *argv[])
+{
+  unsigned n = argc>1 ? atoi(argv[1]) : 10000000;
+  unsigned window = argc>2 ? atoi(argv[2]) : 32;
+
+  // out of order, in order, and unknown ids
+  {
+    RequestQueue q(4);
+    unsigned a=q.Insert(CONNECT,1), b=q.Insert(WRITE,2), c=q.Insert(CLOSE,3);
+    Check(a!=0 && b==a+1 && c==b+1,"ids not consecutive");
+    RequestRecord r;
+    Check(q.Remove(b,r) && r.type==WRITE && r.sock==2,"answered out of order");
+    Check(q.Size()==3,"hole not kept");
+    Check(!q.Remove(b,r),"answered twice");
+    Check(!q.Remove(c+10,r),"unknown id answered");
+    Check(q.Remove(0,r) && r.id==a && r.sock==1,"id 0 does not answer the oldest");
+    Check(q.Size()==1,"answered requests not dropped from the front");
+    Check(q.Remove(0,r) && r.id==c && q.Size()==0,"last request");
+    Check(!q.Remove(0,r),"empty queue answered");
+  }
+
+  // more outstanding than the ring holds
+  {
+    RequestQueue q(2);
+    std::vector<unsigned> ids;
+    for (unsigned i=0;i<100;i++) {
+      ids.push_back(q.Insert(WRITE,i));
+    }
+    Check(q.ring.size()==128 && q.Size()==100,"ring did not grow");
+    RequestRecord r;
+    for (unsigned i=0;i<100;i+=2) {
+      Check(q.Remove(ids[i],r) && r.sock==(int)i,"wrong request after growing");
+    }
+    for (unsigned i=1;i<100;i+=2) {
+      Check(q.Remove(ids[i],r) && r.sock==(int)i,"wrong request after growing");
+    }
+    Check(q.Size()==0,"requests left");
+  }
+
+  // ids wrapping past 0
+  {
+    RequestQueue q(4);
+    q.nextid=0xfffffffeU;
+    unsigned a=q.Insert(WRITE,1), b=q.Insert(WRITE,2), c=q.Insert(WRITE,3);
+    Check(b==0xffffffffU && c==1,"id 0 handed out");
+    RequestRecord r;
+    Check(q.Remove(c,r) && r.sock==3 && q.Remove(a,r) && q.Remove(b,r),"ids across the wrap");
+  }
+
+  // the id crosses a fifo
+  {
+    int fds[2];
+    Check(pipe(fds)==0,"pipe");
+    SockRequestResponse s(WRITE,Connection(),Buffer("abc",3),3,EOK);
+    s.id=12345;
+    s.Serialize(fds[1]);
+    SockRequestResponse t;
+    t.Unserialize(fds[0]);
+    Check(t.id==12345 && t.bytes==3,"id lost in serialization");
+    Check(SockRequestResponse().id==0,"default id");
+  }
+
+  RequestQueue q;
+  std::vector<unsigned> out;
+  srand(1);
+  double t0=(double)Time();
+  for (unsigned i=0;i<n;i++) {
+    out.push_back(q.Insert(WRITE,i));
+    if (out.size()>=window) {
+      unsigned j=rand()%out.size();
+      RequestRecord r;
+      Check(q.Remove(out[j],r),"request lost");
+      out[j]=out.back();
+      out.pop_back();
+    }
+  }
+  double t1=(double)Time();
+  cout << "test_reqqueue: ok, " << n << " requests, " << window << " outstanding, answered in random order: "
+       << (t1-t0)*1e9/n << " ns each, ring of " << q.ring.size() << endl;
+  return 0;
+}
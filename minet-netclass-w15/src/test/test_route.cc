@@ -0,0 +1,141 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+
+#include "route.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks RouteTable against a linear longest-prefix match while routes
+// are added and deleted at random, then times single and batched
+// lookups as the table grows.
+//
+// usage: test_route [max-routes] [lookups]
+//
+
+static unsigned Random32()
+{
+  return ((unsigned)rand()<<16) ^ (unsigned)rand();
+}
+
+static unsigned RandomPrefixLen()
+{
+  // mostly the lengths real tables have, with the odd short one
+  static const unsigned lens[] = { 0, 8, 12, 16, 19, 20, 22, 24, 24, 24, 25, 28, 30, 32 };
+  return rand()%5==0 ? rand()%33 : lens[rand()%(sizeof(lens)/sizeof(lens[0]))];
+}
+
+static int Linear(const std::vector<RouteEntry> &routes, const unsigned addr)
+{
+  int best=-1;
+  for (unsigned i=0;i<routes.size();i++) {
+    unsigned mask=(unsigned)routes[i].GetMask();
+    if ((addr&mask)==(unsigned)routes[i].net &&
+	(best<0 || routes[i].prefixlen>routes[best].prefixlen)) {
+      best=i;
+    }
+  }
+  return best;
+}
+
+static bool Same(const RouteEntry *r, const std::vector<RouteEntry> &routes, const int i)
+{
+  if (i<0 || r==0) {
+    return i<0 && r==0;
+  }
+  return r->net==routes[i].net && r->prefixlen==routes[i].prefixlen && r->metric==routes[i].metric;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned maxroutes = argc>1 ? atoi(argv[1]) : 100000;
+  unsigned lookups   = argc>2 ? atoi(argv[2]) : 1000000;
+
+  srand(1);
+
+  {
+    RouteTable table;
+    std::vector<RouteEntry> ref;
+    for (int round=0; round<20000; round++) {
+      int op=rand()%3;
+      if (op<2 || ref.empty()) {
+	RouteEntry r(Random32(),RandomPrefixLen(),IPAddress(Random32()),"eth0",round);
+	table.Add(r);
+	unsigned k;
+	for (k=0;k<ref.size();k++) {
+	  if (ref[k].net==r.net && ref[k].prefixlen==r.prefixlen) {
+	    ref[k]=r;
+	    break;
+	  }
+	}
+	if (k==ref.size()) {
+	  ref.push_back(r);
+	}
+      } else {
+	unsigned k=rand()%ref.size();
+	if (!table.Delete(ref[k].net,ref[k].prefixlen) || table.Delete(ref[k].net,ref[k].prefixlen)) {
+	  cerr << "test_route: delete failed" << endl;
+	  exit(-1);
+	}
+	ref.erase(ref.begin()+k);
+      }
+      if (table.size()!=ref.size()) {
+	cerr << "test_route: size mismatch" << endl;
+	exit(-1);
+      }
+      IPAddress addrs[16];
+      const RouteEntry *out[16];
+      for (unsigned k=0;k<16;k++) {
+	// either near a route we have or anywhere
+	addrs[k] = (k%2 && !ref.empty()) ? (unsigned)ref[rand()%ref.size()].net ^ ((Random32()>>1)>>(rand()%32)) : Random32();
+      }
+      table.Lookup(addrs,out,16);
+      for (unsigned k=0;k<16;k++) {
+	int want=Linear(ref,addrs[k]);
+	if (!Same(table.Lookup(addrs[k]),ref,want) || !Same(out[k],ref,want)) {
+	  cerr << "test_route: wrong match for " << addrs[k] << endl;
+	  exit(-1);
+	}
+      }
+    }
+    cout << "test_route: ok, " << table.size() << " routes at the end" << endl;
+  }
+
+  cout << "routes    lookup(ns)   batched(ns)" << endl;
+  RouteTable table;
+  std::vector<IPAddress> addrs(lookups);
+  std::vector<const RouteEntry *> out(lookups);
+  for (unsigned k=0;k<lookups;k++) {
+    addrs[k]=Random32();
+  }
+  table.Add(RouteEntry(IP_ADDRESS_ANY,0,IPAddress("10.0.0.254"),"eth0"));
+  for (unsigned n=1000; n<=maxroutes; n*=10) {
+    while (table.size()<n) {
+      table.Add(RouteEntry(Random32(),rand()%2 ? 24 : 16+rand()%17,IP_ADDRESS_ANY,"eth0"));
+    }
+    unsigned found=0;
+    double start=Now();
+    for (unsigned k=0;k<lookups;k++) {
+      found+=table.Lookup(addrs[k])->prefixlen;
+    }
+    double single=(Now()-start)/lookups*1e9;
+    start=Now();
+    table.Lookup(addrs.data(),out.data(),lookups);
+    double batched=(Now()-start)/lookups*1e9;
+    for (unsigned k=0;k<lookups;k++) {
+      found-=out[k]->prefixlen;
+    }
+    if (found!=0) {
+      cerr << "test_route: batched and single lookups disagree" << endl;
+      exit(-1);
+    }
+    cout.width(6); cout << n;
+    cout.width(14); cout << single;
+    cout.width(14); cout << batched << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include <iostream>
+#include <stdlib.h>
+#include <math.h>
+
+#include "Minet.h"
+#include "tcpstate.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks TCPState's retransmission timeout: the RFC 6298 estimator on
+// steady and jittery paths, Karn's rule for resent segments, RTT from
+// timestamp echoes, exponential backoff as timer tries are used up and
+// the bounds, and what GetInfo reports.  Then that after a timeout what
+// was in flight is resent a congestion window at a time, SACKed data
+// skipped.
+//
+// usage: test_rto
+//
+
+static bool Near(const double a, const double b)
+{
+  return fabs(a-b)<1e-9+1e-6*fabs(b);
+}
+
+int main(int argc, char *argv[])
+{
+  const unsigned mss=TCP_MAXIMUM_SEGMENT_SIZE;
+  double now=100;
+
+  {
+    TCPState s(1000,ESTABLISHED,NUM_SYN_TRIES);
+    Check(Near(s.GetRto(),TCP_RTO_INITIAL),"initial rto");
+
+    // the first sample sets srtt and rttvar outright
+    s.SetLastSent(1000+mss);
+    s.SegmentSent(1001,mss,false,now);
+    s.ProcessAck(1001+mss,false,now+0.5);
+    Check(Near(s.GetSrtt(),0.5) && Near(s.GetRttvar(),0.25) && Near(s.GetRto(),1.5),"first sample");
+
+    // Karn: a resent segment is not timed
+    s.SetLastSent(1000+2*mss);
+    s.SegmentSent(1001+mss,mss,false,now+1);
+    s.SegmentSent(1001+mss,mss,true,now+2);
+    s.ProcessAck(1001+2*mss,false,now+2.1);
+    Check(Near(s.GetSrtt(),0.5),"resent segment timed");
+
+    // a LAN: the estimate settles and the floor holds
+    unsigned seq=1001+2*mss;
+    for (int i=0;i<200;i++) {
+      s.SetLastSent(seq+mss-1);
+      s.SegmentSent(seq,mss,false,now);
+      seq+=mss;
+      now+=0.0005;
+      s.ProcessAck(seq,false,now);
+    }
+    Check(fabs(s.GetSrtt()-0.0005)<1e-4 && Near(s.GetRto(),TCP_RTO_MIN),"lan estimate");
+    cout << "test_rto: lan, srtt=" << s.GetSrtt()*1e3 << "ms rto=" << s.GetRto()*1e3 << "ms" << endl;
+
+    // a slow, jittery path: the timeout stays above all but 1% of samples
+    srand(1);
+    unsigned spurious=0;
+    for (int i=0;i<2000;i++) {
+      double rtt=0.8+(rand()%400)/1000.0;
+      if (i>50 && rtt>s.GetRto()) {
+	spurious++;
+      }
+      s.SetLastSent(seq+mss-1);
+      s.SegmentSent(seq,mss,false,now);
+      seq+=mss;
+      now+=rtt;
+      s.ProcessAck(seq,false,now);
+    }
+    Check(spurious<20 && s.GetRto()<2,"jittery path");
+    cout << "test_rto: wan, srtt=" << s.GetSrtt()*1e3 << "ms rttvar=" << s.GetRttvar()*1e3
+	 << "ms rto=" << s.GetRto()*1e3 << "ms" << endl;
+
+    // backoff doubles with each try used, up to the maximum
+    double base=s.GetRto();
+    s.SetTimerTries(8);
+    for (int i=1;i<=3;i++) {
+      Check(!s.ExpireTimerTries(),"ran out of tries early");
+      Check(Near(s.GetRto(),base*(1<<i)),"no backoff");
+    }
+    for (int i=0;i<5;i++) {
+      s.ExpireTimerTries();
+    }
+    Check(Near(s.GetRto(),TCP_RTO_MAX),"backoff past the maximum");
+    TCPInfo info;
+    s.GetInfo(info);
+    Check(info.backoff==8 && info.rto==(unsigned)(TCP_RTO_MAX*1e6) && info.state==ESTABLISHED,"info");
+    cout << "test_rto: " << info << endl;
+    s.SetTimerTries(8);
+    Check(Near(s.GetRto(),base),"backoff kept after the timer was reset");
+  }
+
+  // timestamps: every ack of new data is a sample, retransmission or not
+  {
+    TCPOptions o;
+    unsigned val, ecr;
+    Check(o.AddSackPermitted() && o.AddTimestamp(0x12345678,0x9abcdef0),"timestamp did not fit");
+    Check(o.GetTimestamp(val,ecr) && val==0x12345678 && ecr==0x9abcdef0,"timestamp lost");
+
+    TCPState s(1000,ESTABLISHED,NUM_SYN_TRIES);
+    s.SetTimestampsOk(true);
+    s.SetLastRecvd(5000);
+    s.TimestampReceived(5001,777,TCPState::TimestampNow(now-0.030),true,now);
+    Check(s.TimestampEcho()==777,"ts_recent not taken");
+    Check(fabs(s.GetSrtt()-0.030)<0.0011,"timestamp sample");
+    s.TimestampReceived(9000,888,0,false,now);
+    Check(s.TimestampEcho()==777,"ts_recent moved by a segment past the left edge");
+  }
+
+  // after a timeout
+  {
+    static char data[10*mss];
+    TCPState s(1000,ESTABLISHED,NUM_DATA_TRIES);
+    unsigned seq;
+    size_t len;
+    s.QueueSend(Buffer(data,sizeof(data)));
+    s.SetLastSent(1000+10*mss);
+    Check(!s.NextLostSegment(seq,len),"resent with no timeout");
+    s.RetransmitTimeout(now);
+    s.RestartRetransmission();
+    Check(s.NextLostSegment(seq,len) && seq==1001 && len==mss,"first lost segment");
+    Check(!s.NextLostSegment(seq,len),"resent past the congestion window");
+    Check(s.ProcessAck(1001+mss,false,now)==ACK_NEW && s.GetCwnd()==2*mss,"slow start after a timeout");
+    Check(s.NextLostSegment(seq,len) && seq==1001+mss && len==mss,"second lost segment");
+    TCPSackBlock b={1001+3*mss,1001+5*mss};
+    s.UpdateScoreboard(&b,1);
+    Check(s.NextLostSegment(seq,len) && seq==1001+2*mss,"third lost segment");
+    Check(s.ProcessAck(1001+3*mss,false,now)==ACK_NEW,"ack of resent segments");
+    Check(s.NextLostSegment(seq,len) && seq==1001+5*mss,"SACKed segments resent");
+    Check(s.ProcessAck(1001+10*mss,false,now)==ACK_NEW && !s.NextLostSegment(seq,len),"resent once all acked");
+  }
+
+  cout << "test_rto: ok" << endl;
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Minet.h"
+#include "tcpstate.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks that SACK options survive a trip through a TCP header, then
+// moves a stream between two TCPStates over a link that drops segments
+// at random.  Every ACK carries the receiver's SACK blocks to the
+// sender's scoreboard, and after each window the sender resends what
+// NextRetransmission gives it.  That must be exactly the bytes that were
+// lost, where go-back-N would resend the whole window.
+//
+// usage: test_sack [bytes] [loss-percent]
+// (MINET_IPADDR must be set, as for any module)
+//
+
+// What goes on the wire: the receiver's ACK and blocks, through options
+static void Ack(TCPState &rcv, TCPState &snd)
+{
+  TCPSackBlock blocks[TCP_SACK_MAX_BLOCKS];
+  unsigned n=rcv.GetSackBlocks(blocks,3);
+  TCPOptions o;
+  if (n>0) {
+    Check(o.AddSack(blocks,n),"SACK option did not fit");
+  }
+  TCPSackBlock got[TCP_SACK_MAX_BLOCKS];
+  Check(o.GetSack(got,TCP_SACK_MAX_BLOCKS)==n,"wrong number of blocks");
+  unsigned int ack=rcv.GetLastRecvd()+1;
+  if (ack!=snd.GetLastAcked()+1) {
+    Check(snd.SetLastAcked(ack),"ack refused");
+  }
+  snd.UpdateScoreboard(got,n);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t size = argc>1 ? atol(argv[1]) : 4000000;
+  unsigned loss = argc>2 ? atoi(argv[2]) : 10;
+  const size_t mss=1000, window=64*mss;
+
+  srand(1);
+
+  // options on a header
+  {
+    Packet p(Buffer("x",1));
+    IPHeader ih;
+    ih.SetProtocol(IP_PROTO_TCP);
+    ih.SetSourceIP(IPAddress("10.0.0.1"));
+    ih.SetDestIP(IPAddress("10.0.0.2"));
+    p.PushFrontHeader(ih);
+    TCPHeader th;
+    th.SetHeaderLen(TCP_HEADER_BASE_LENGTH/4,p);
+    TCPOptions o;
+    TCPSackBlock b[3]={ { 10, 20 }, { 0xfffffff0U, 5 }, { 1000, 1001 } };
+    Check(o.AddSackPermitted() && o.AddSack(b,3),"options did not fit");
+    Check(!o.AddSack(b,1),"options overflowed");
+    th.SetOptions(o,p);
+    unsigned char hlen;
+    th.GetHeaderLen(hlen);
+    Check(hlen*4U==TCP_HEADER_BASE_LENGTH+o.len,"header length not set");
+    TCPOptions back;
+    th.GetOptions(back);
+    TCPSackBlock c[4];
+    Check(back.HasSackPermitted() && back.GetSack(c,4)==3,"options lost");
+    for (unsigned i=0;i<3;i++) {
+      Check(c[i].left==b[i].left && c[i].right==b[i].right,"block changed");
+    }
+    TCPOptions bad;
+    bad.len=4;
+    bad.data[0]=TCP_HEADER_OPTION_KIND_SACK; bad.data[1]=30;
+    Check(bad.GetSack(c,4)==0,"malformed option parsed");
+  }
+
+  std::vector<char> stream(size);
+  for (size_t i=0;i<size;i++) {
+    stream[i]=rand();
+  }
+  unsigned isn=0xffffffffU-1000000;
+  TCPState snd(isn,ESTABLISHED,0), rcv(0,ESTABLISHED,0);
+  rcv.SetLastRecvd(isn);
+  rcv.TCP_BUFFER_SIZE=size+1;
+  snd.SetSackPermitted(true);
+  rcv.SetSackPermitted(true);
+
+  size_t sent=0, lost=0, resent=0, gobackn=0;
+  while (rcv.RecvBuffer.GetSize()<size) {
+    // a window of new data
+    size_t end=std::min(size,sent+window);
+    while (sent<end) {
+      size_t len=std::min(mss,end-sent);
+      snd.SetLastSent(snd.GetLastSent()+len);
+      if ((unsigned)rand()%100<loss) {
+	lost+=len;
+      } else {
+	rcv.ReceiveSegment(isn+1+sent,Buffer(&stream[sent],len));
+	Ack(rcv,snd);
+      }
+      sent+=len;
+    }
+
+    // then the timeout, and only the holes again
+    gobackn+=snd.GetLastSent()-snd.GetLastAcked();
+    size_t missing=snd.GetLastSent()-snd.GetLastAcked()-snd.GetSackedBytes();
+    Check(missing==sent-rcv.RecvBuffer.GetSize()-rcv.GetReassemblyBytes(),"scoreboard disagrees with the receiver");
+    snd.RestartRetransmission();
+    unsigned int seq;
+    size_t len, round=0;
+    while (snd.NextRetransmission(seq,len,mss)) {
+      size_t off=seq-(isn+1);
+      Check(off+len<=sent,"resent what was never sent");
+      round+=len;
+      if ((unsigned)rand()%100<loss) {
+	lost+=len;
+      } else {
+	rcv.ReceiveSegment(seq,Buffer(&stream[off],len));
+	Ack(rcv,snd);
+      }
+    }
+    Check(round==missing,"resent more than was missing");
+    resent+=round;
+  }
+
+  std::vector<char> out(size);
+  rcv.RecvBuffer.GetData(&out[0],size,0);
+  Check(memcmp(&out[0],&stream[0],size)==0,"stream corrupted");
+  Check(snd.GetSackedBytes()==0,"scoreboard not emptied by the final ack");
+  cout << "test_sack: ok, " << size << " bytes, " << lost << " lost, "
+       << resent << " resent with SACK, " << gobackn << " with go-back-N" << endl;
+  return 0;
+}
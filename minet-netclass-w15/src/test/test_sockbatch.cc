@@ -0,0 +1,91 @@
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+
+#include "Minet.h"
+#include "minet_socket.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks minet_readv, minet_writev, minet_recvmmsg and minet_sendmmsg
+// on the kernel stack, over socket pairs: buffers are filled and
+// drained in order, every message in a batch gets its own result, a
+// socket may appear more than once in a batch, and an error on one
+// message does not stop the rest.
+//
+// usage: test_sockbatch
+// (MINET_IPADDR must be set, as for any module)
+//
+
+int main(int argc, char *argv[])
+{
+  Check(minet_init(MINET_KERNEL)>=0,"minet_init");
+
+  int sv[2];
+  Check(socketpair(AF_UNIX,SOCK_STREAM,0,sv)==0,"socketpair");
+
+  // scatter and gather
+  {
+    char a[]="hello, ", b[]="minet";
+    struct iovec out[2]={{a,7},{b,5}};
+    Check(minet_writev(sv[0],out,2)==12,"writev");
+    char x[4], y[20];
+    memset(y,0,sizeof(y));
+    struct iovec in[2]={{x,4},{y,sizeof(y)}};
+    Check(minet_readv(sv[1],in,2)==12,"readv");
+    Check(!memcmp(x,"hell",4) && !strcmp(y,"o, minet"),"data scattered wrongly");
+  }
+
+  // batches over several sockets, one of them twice, one of them bad
+  {
+    const int n=8;
+    int pairs[n][2];
+    for (int i=0;i<n;i++) {
+      Check(socketpair(AF_UNIX,SOCK_STREAM,0,pairs[i])==0,"socketpair");
+    }
+    char data[n+1][16];
+    struct iovec iov[n+1];
+    struct minet_mmsghdr msgs[n+1];
+    for (int i=0;i<=n;i++) {
+      snprintf(data[i],sizeof(data[i]),"message %d",i);
+      iov[i].iov_base=data[i];
+      iov[i].iov_len=strlen(data[i]);
+      msgs[i].msg_fd=pairs[i%n][0];
+      msgs[i].msg_iov=&iov[i];
+      msgs[i].msg_iovlen=1;
+    }
+    msgs[3].msg_fd=-1;
+    Check(minet_sendmmsg(msgs,n+1)==n,"sendmmsg count");
+    Check(msgs[3].msg_len==-1 && msgs[3].msg_error!=EOK,"bad socket not reported");
+    Check(msgs[0].msg_len==9 && msgs[n].msg_len==9,"repeated socket");
+
+    char back[n][32];
+    struct iovec riov[n];
+    struct minet_mmsghdr rmsgs[n];
+    for (int i=0;i<n;i++) {
+      memset(back[i],0,sizeof(back[i]));
+      riov[i].iov_base=back[i];
+      riov[i].iov_len=sizeof(back[i])-1;
+      rmsgs[i].msg_fd=pairs[i][1];
+      rmsgs[i].msg_iov=&riov[i];
+      rmsgs[i].msg_iovlen=1;
+    }
+    for (int i=0;i<n;i++) {
+      int fl=fcntl(pairs[i][1],F_GETFL);
+      fcntl(pairs[i][1],F_SETFL,fl|O_NONBLOCK);
+    }
+    rmsgs[3].msg_fd=-1;
+    Check(minet_recvmmsg(rmsgs,n)==n-1,"recvmmsg count");
+    Check(!strcmp(back[0],"message 0message 8"),"both writes to one socket");
+    Check(!strcmp(back[5],"message 5"),"data read wrongly");
+    Check(rmsgs[3].msg_len==-1,"bad socket read");
+  }
+
+  cout << "test_sockbatch: ok" << endl;
+  return 0;
+}
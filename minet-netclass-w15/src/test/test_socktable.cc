@@ -0,0 +1,159 @@
+#include <iostream>
+#include <set>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "Minet.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Opens many sockets in a SockStatus and PortStatus the way sock_module
+// does, checks that descriptors are reused lowest first, that
+// FindConnection and FindPendingConnection find what the old linear
+// scans did, but for an accepted connection going to its own socket
+// while the listener waits in accept() again, that a socket's options
+// keep the latest value of each and go with it on close, and that
+// ephemeral ports come from the range, start at a random point and are
+// freed on close.
+// Then times lookups among all the open sockets.
+//
+// usage: test_socktable [sockets] [lookups]
+//
+
+int main(int argc, char *argv[])
+{
+  unsigned n = argc>1 ? atoi(argv[1]) : 10000;
+  unsigned lookups = argc>2 ? atoi(argv[2]) : 1000000;
+  IPAddress me("10.0.0.1"), peer("10.0.0.2");
+
+  SockStatus socks;
+  PortStatus ports;
+
+  // descriptors, lowest free first
+  {
+    Check(socks.sockArray.size()==1,"table not empty to start");
+    for (unsigned i=1;i<=3;i++) {
+      int sock=socks.FindFreeSock();
+      Check(sock==(int)i,"descriptors not handed out in order");
+      socks.SetStatus(sock,UNBOUND);
+    }
+    socks.CloseSocket(2);
+    Check(socks.FindFreeSock()==2,"closed descriptor not reused");
+    Check(socks.GetStatus(0)==FREE && socks.GetStatus(1000000)==FREE,"out of range socket in use");
+    socks.CloseSocket(1);
+    socks.CloseSocket(3);
+    Check(socks.index.empty(),"closed sockets left in the index");
+  }
+
+  // listeners, exact matches and pending connections
+  {
+    int l=socks.FindFreeSock();
+    socks.SetStatus(l,LISTENING);
+    socks.SetConnection(l,Connection(me,IP_ADDRESS_ANY,80,PORT_ANY,IP_PROTO_TCP));
+    Connection in(me,peer,80,5555,IP_PROTO_TCP);
+    Check(socks.FindConnection(in)==-1,"listener not waiting for accept matched");
+    socks.SetStatus(l,ACCEPT_PENDING);
+    Check(socks.FindConnection(in)==l && socks.FindPendingConnection(in)==l,"listener not matched");
+    int a=socks.FindFreeSock();
+    socks.SetConnection(a,in);
+    Check(socks.FindConnection(in)==l,"free socket matched");
+    socks.SetStatus(a,CONNECTED);
+    Check(socks.FindConnection(in)==a,"accepted connection matched to the listener");
+    socks.SetStatus(l,LISTENING);
+    Check(socks.FindConnection(in)==a && socks.FindPendingConnection(in)==-1,"exact match");
+    Connection moved(me,peer,80,6666,IP_PROTO_TCP);
+    socks.SetConnection(a,moved);
+    Check(socks.FindConnection(in)==-1 && socks.FindConnection(moved)==a,"index not moved with the connection");
+    socks.SetStatus(a,CONNECT_PENDING);
+    Check(socks.FindPendingConnection(moved)==a,"connecting socket not pending");
+    socks.CloseSocket(a);
+    socks.CloseSocket(l);
+    Check(socks.FindConnection(moved)==-1,"closed socket matched");
+  }
+
+  // options
+  {
+    int sock=socks.FindFreeSock();
+    SockOption opt;
+    opt.level=SOL_SOCKET;
+    opt.name=SO_RCVBUF;
+    opt.value=1000;
+    Check(socks.SetOption(sock,opt)==-1,"option set on a free socket");
+    socks.SetStatus(sock,UNBOUND);
+    socks.SetOption(sock,opt);
+    opt.name=SO_SNDBUF;
+    socks.SetOption(sock,opt);
+    opt.name=SO_RCVBUF;
+    opt.value=2000;
+    socks.SetOption(sock,opt);
+    const std::vector<SockOption> &options=*socks.GetOptions(sock);
+    Check(options.size()==2 && options[0].name==SO_RCVBUF && options[0].value==2000,"option not replaced");
+    socks.CloseSocket(sock);
+    Check(socks.GetOptions(sock)->empty(),"options outlived the socket");
+  }
+
+  // ports
+  {
+    Check(ports.AssignPort(me,80,1)==1 && ports.AssignPort(me,80,2)==-1,"port assigned twice");
+    Check(ports.Socket(me,80)==1 && ports.Socket(me,81)==0 && ports.Socket(peer,80)==0,"port owner");
+    Check(ports.ReleasePort(me,80,2)==-1 && ports.Socket(me,80)==1,"port freed by a socket not holding it");
+    Check(ports.ReleasePort(me,80,1)==0 && ports.Socket(me,80)==0,"port not freed");
+
+    std::set<int> firsts;
+    for (int i=0;i<16;i++) {
+      PortStatus p;
+      p.seed=i+1;
+      firsts.insert(p.FindFreePort(me,1));
+    }
+    Check(firsts.size()>8,"ephemeral ports do not start at random");
+
+    PortStatus p;
+    std::set<int> got;
+    const unsigned range=EPHEMERAL_PORT_MAX-EPHEMERAL_PORT_MIN+1;
+    for (unsigned i=0;i<range;i++) {
+      int port=p.FindFreePort(me,1);
+      Check(port>=EPHEMERAL_PORT_MIN && port<=EPHEMERAL_PORT_MAX,"ephemeral port out of range");
+      got.insert(port);
+    }
+    Check(got.size()==range && p.FindFreePort(me,1)==-1,"ephemeral range not used up exactly");
+    p.ReleasePort(me,50000,1);
+    Check(p.FindFreePort(me,2)==50000,"freed ephemeral port not found");
+  }
+
+  // many sockets
+  for (unsigned i=0;i<n;i++) {
+    int sock=socks.FindFreeSock();
+    Check(sock==(int)i+1,"socket table did not grow");
+    socks.SetStatus(sock,UNBOUND);
+    Connection c(me,IP_ADDRESS_ANY,PORT_NONE,PORT_ANY,IP_PROTO_TCP);
+    int port=ports.FindFreePort(me,sock);
+    Check(port>0 || i>=EPHEMERAL_PORT_MAX-EPHEMERAL_PORT_MIN+1,"out of ports early");
+    c.srcport=port>0 ? port : 1+i;
+    c.dest=peer;
+    c.destport=1024+i%50000;
+    socks.SetConnection(sock,c);
+    socks.SetStatus(sock,CONNECTED);
+  }
+  double t0=(double)Time();
+  unsigned long found=0;
+  for (unsigned i=0;i<lookups;i++) {
+    unsigned sock=1+(i*7919)%n;
+    found+=socks.FindConnection(*socks.GetConnection(sock))==(int)sock;
+  }
+  double t1=(double)Time();
+  Check(found==lookups,"lookup found the wrong socket");
+  for (unsigned sock=1;sock<=n;sock++) {
+    const Connection *c=socks.GetConnection(sock);
+    ports.ReleasePort(c->src,c->srcport,sock);
+    socks.CloseSocket(sock);
+  }
+  Check(socks.index.empty() && ports.GetInterface(me).owner.empty(),"not all freed");
+  Check(socks.FindFreeSock()==1,"lowest descriptor not reused");
+  cout << "test_socktable: ok, " << lookups << " lookups among " << n << " sockets in "
+       << (t1-t0)*1e3 << " ms, table of " << socks.sockArray.size() << endl;
+  return 0;
+}
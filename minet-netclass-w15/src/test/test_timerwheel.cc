@@ -0,0 +1,146 @@
+#include <iostream>
+#include <map>
+#include <vector>
+#include <stdlib.h>
+
+#include "Minet.h"
+#include "timerwheel.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Runs TimerWheel against a plain multimap of deadlines on a simulated
+// clock: random arms (from a tick to weeks out), cancels, and clock
+// jumps.  Every timer must fire exactly once, never early and never
+// more than a tick late, and NextDeadline must never be more than a
+// tick later than the true next deadline.  Then times arm/cancel/expire
+// with many timers.
+//
+
+#define RES 0.001
+
+struct Armed {
+  double      when;
+  TimerHandle handle;
+};
+
+int main(int argc, char *argv[])
+{
+  int rounds = argc>1 ? atoi(argv[1]) : 200000;
+  double base=(double)Time();
+  double now=base;
+  TimerWheel<unsigned> wheel(RES);
+  std::map<unsigned,Armed> live;
+  unsigned nextid=1;
+  unsigned fired=0;
+
+  srand(1);
+  for (int r=0;r<rounds;r++) {
+    int op=rand()%10;
+    if (op<5) {
+      double ahead;
+      switch (rand()%4) {
+      case 0: ahead=(rand()%100)*RES; break;
+      case 1: ahead=(rand()%100000)*RES; break;
+      case 2: ahead=(rand()%10000000)*RES; break;
+      default: ahead=-(rand()%10)*RES; break;
+      }
+      Armed a;
+      a.when=now+ahead+(rand()%1000)*RES/1000.0;
+      a.handle=wheel.Arm(a.when,nextid);
+      live[nextid++]=a;
+    } else if (op<7 && !live.empty()) {
+      std::map<unsigned,Armed>::iterator i=live.lower_bound(rand()%nextid);
+      if (i==live.end()) {
+	i=live.begin();
+      }
+      if (!wheel.Cancel(i->second.handle) || wheel.Cancel(i->second.handle)) {
+	cerr << "test_timerwheel: cancel failed" << endl;
+	exit(-1);
+      }
+      live.erase(i);
+    } else {
+      double expect=1e300;
+      for (std::map<unsigned,Armed>::iterator i=live.begin();i!=live.end();++i) {
+	if (i->second.when<expect) {
+	  expect=i->second.when;
+	}
+      }
+      // overdue timers are due at the next tick
+      if (expect<now) {
+	expect=now;
+      }
+      double next;
+      if (wheel.NextDeadline(next)!=!live.empty() || (!live.empty() && next>expect+RES+1e-9)) {
+	cerr << "test_timerwheel: bad next deadline " << next-base << " expected " << expect-base << endl;
+	exit(-1);
+      }
+      // mostly small steps, sometimes sleep right up to the deadline or
+      // far beyond it
+      switch (rand()%4) {
+      case 0: now = live.empty() ? now+1 : (next>now ? next : now); break;
+      case 1: now+=(rand()%100000)*RES; break;
+      default: now+=(rand()%20)*RES; break;
+      }
+      std::vector<unsigned> out;
+      wheel.Expire(now,out);
+      for (unsigned k=0;k<out.size();k++) {
+	std::map<unsigned,Armed>::iterator i=live.find(out[k]);
+	if (i==live.end()) {
+	  cerr << "test_timerwheel: timer fired twice or after cancel" << endl;
+	  exit(-1);
+	}
+	if (i->second.when>now+1e-9) {
+	  cerr << "test_timerwheel: timer fired early" << endl;
+	  exit(-1);
+	}
+	if (wheel.IsArmed(i->second.handle)) {
+	  cerr << "test_timerwheel: fired timer still armed" << endl;
+	  exit(-1);
+	}
+	live.erase(i);
+	fired++;
+      }
+      for (std::map<unsigned,Armed>::iterator i=live.begin();i!=live.end();++i) {
+	if (i->second.when+RES<now-1e-9) {
+	  cerr << "test_timerwheel: timer is late" << endl;
+	  exit(-1);
+	}
+      }
+    }
+    if (wheel.size()!=live.size()) {
+      cerr << "test_timerwheel: size mismatch" << endl;
+      exit(-1);
+    }
+  }
+  cout << "test_timerwheel: ok, " << fired << " fired, " << live.size() << " still armed" << endl;
+
+  // retransmit-like load: many timers, most cancelled and re-armed
+  const unsigned N=100000;
+  TimerWheel<unsigned> big(RES);
+  std::vector<TimerHandle> h(N);
+  std::vector<unsigned> out;
+  now=(double)Time();
+  Time start;
+  for (unsigned i=0;i<N;i++) {
+    h[i]=big.Arm(now+0.2+(i%1000)*RES,i);
+  }
+  unsigned ops=N;
+  for (int step=0;step<100;step++) {
+    now+=0.01;
+    for (unsigned i=step%10;i<N;i+=10) {
+      big.Cancel(h[i]);
+      h[i]=big.Arm(now+0.2+(i%1000)*RES,i);
+      ops+=2;
+    }
+    big.Expire(now,out);
+  }
+  // and let everything run out
+  big.Expire(now+2,out);
+  double elapsed=(double)Time()-(double)start;
+  cout << "test_timerwheel: " << ops << " arm/cancel and " << out.size()
+       << " expirations in " << elapsed << " s (" << (ops+out.size())/elapsed/1e6 << " M/s)" << endl;
+  return 0;
+}
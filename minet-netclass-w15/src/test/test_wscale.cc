@@ -0,0 +1,92 @@
+#include <iostream>
+#include <stdlib.h>
+
+#include "Minet.h"
+#include "tcpstate.h"
+#include "test.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//
+// Checks window scale negotiation and the windows it gives, socket
+// buffer options, SO_RCVBUF before the SYN setting the scale it offers,
+// and that autotuning grows the receive buffer to a
+// large bandwidth-delay product and the send buffer with cwnd, which
+// together let one connection have more than 64 KB in flight.
+//
+// usage: test_wscale
+//
+
+int main(int argc, char *argv[])
+{
+  const unsigned mss=TCP_MAXIMUM_SEGMENT_SIZE;
+
+  TCPOptions o;
+  unsigned char shift;
+  Check(o.AddWindowScale(7) && o.GetWindowScale(shift) && shift==7,"window scale option lost");
+  TCPOptions big;
+  Check(big.AddWindowScale(20) && big.GetWindowScale(shift) && shift==TCP_WINDOW_SCALE_MAX,"shift not capped at 14");
+
+  // both offer: the peer's fields are scaled, and so are ours
+  TCPState a(1000,SYN_SENT,NUM_SYN_TRIES), b(5000,SYN_RCVD,NUM_SYN_TRIES);
+  Check((TCP_BUFFER_MAX>>a.GetWindowScaleOffer())<=0xffff,"offer too small for the largest buffer");
+  Check(a.GetAdvertisedWindow(true)==TCP_BUFFER_DEFAULT,"SYN window scaled");
+  a.NegotiateWindowScale(true,b.GetWindowScaleOffer());
+  b.NegotiateWindowScale(true,a.GetWindowScaleOffer());
+  b.SetSendRwnd(a.GetAdvertisedWindow());
+  Check(b.rwnd<=a.GetRwnd() && b.rwnd+(1U<<a.GetWindowScaleOffer())>a.GetRwnd(),"scaled window wrong");
+
+  // one side without the option turns it off for both
+  TCPState c(1000,SYN_SENT,NUM_SYN_TRIES);
+  c.NegotiateWindowScale(false,0);
+  c.SetSendRwnd(40000);
+  Check(c.rwnd==40000 && c.GetAdvertisedWindow()==TCP_BUFFER_DEFAULT,"unscaled window wrong");
+  Check(!c.IsWindowScaleOk() && a.IsWindowScaleOk(),"whether scaling is on");
+
+  // SO_RCVBUF before the SYN offers only the scale it needs, and after
+  // it changes nothing the peer was told
+  TCPState e(1000,SYN_SENT,NUM_SYN_TRIES);
+  Check(e.SetSocketOption(SOL_SOCKET,SO_RCVBUF,32768)==EOK && e.GetWindowScaleOffer()==0,"small buffer offered a scale");
+  Check(e.SetSocketOption(SOL_SOCKET,SO_RCVBUF,200000)==EOK && e.GetWindowScaleOffer()==2,"scale offered for SO_RCVBUF");
+  e.SetLastSent(1001);
+  Check(e.SetSocketOption(SOL_SOCKET,SO_RCVBUF,1<<20)==EOK && e.GetWindowScaleOffer()==2,"scale changed after the SYN");
+
+  // options pin the buffers
+  TCPState d(1000,ESTABLISHED,NUM_SYN_TRIES);
+  Check(d.SetSocketOption(SOL_SOCKET,SO_RCVBUF,1<<20)==EOK && d.TCP_BUFFER_SIZE==1U<<20,"SO_RCVBUF");
+  Check(d.SetSocketOption(SOL_SOCKET,SO_SNDBUF,10)==EOK && d.GetSendSpace()==TCP_BUFFER_MIN,"SO_SNDBUF not clamped");
+  Check(d.SetSocketOption(SOL_SOCKET,SO_KEEPALIVE,1)==ENOT_SUPPORTED,"unknown option taken");
+  d.AutotuneReceive(1<<22,1);
+  d.AutotuneReceive(1<<22,2);
+  Check(d.TCP_BUFFER_SIZE==1U<<20,"locked buffer tuned");
+
+  // 100 Mb/s over 80 ms wants 1 MB: the receiver follows what it drains
+  double now=10, rtt=0.08, rate=100e6/8;
+  TCPState r(0,ESTABLISHED,NUM_SYN_TRIES);
+  r.NegotiateWindowScale(true,7);
+  r.RttSample(rtt);
+  for (int i=0;i<50;i++) {
+    size_t window=r.TCP_BUFFER_SIZE;
+    size_t drained=(size_t)MIN_MACRO((double)window,rate*rtt);
+    r.AutotuneReceive(drained,now);
+    now+=rtt;
+  }
+  Check(r.TCP_BUFFER_SIZE>=2*rate*rtt*0.99 && r.TCP_BUFFER_SIZE<=2*rate*rtt*1.01,"receive buffer not twice the bandwidth-delay product");
+  Check((unsigned)r.GetAdvertisedWindow()<<r.GetWindowScaleOffer()>0xffff,"advertised window stuck under 64 KB");
+
+  // and the sender's buffer follows cwnd
+  TCPState s=TCPState(1000,ESTABLISHED,NUM_SYN_TRIES);
+  s.SetLastSent(1000+2000*mss);
+  unsigned ack=1001;
+  for (int i=0;i<1000;i++) {
+    ack+=mss;
+    s.ProcessAck(ack,false,now);
+  }
+  Check(s.send_buffer_size>=2*s.GetCwnd() || s.send_buffer_size==TCP_BUFFER_MAX,"send buffer did not grow");
+
+  cout << "test_wscale: ok, receive buffer " << r.TCP_BUFFER_SIZE << " bytes, shift "
+       << (unsigned)r.GetWindowScaleOffer() << ", send buffer " << s.send_buffer_size << endl;
+  return 0;
+}